@@ -0,0 +1,181 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include "Graph.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	/*
+		Block sizes of the dynamictensor matrix products for the machine.
+
+		The best dynamictensor::GemmBlocking depends on the cache sizes and on the number of cores,
+		which differ from a machine to another. autotune_gemm() times candidate blockings on the
+		matrix products of a Graph and keeps the fastest. save_gemm_profile() writes it to a local
+		text file. A saved profile is only used after load_gemm_profile() read it, which a program
+		calls at startup. Until then, and without a profile made on the same machine, the blocking
+		is derived from the cache sizes.
+	*/
+
+	// The machine and its heuristic blocking are defined with dynamictensor::gemm_blocking, which starts from them.
+	using dynamictensor::MachineInfo;
+	using dynamictensor::machine_info;
+	using dynamictensor::heuristic_gemm_blocking;
+
+	// Shapes of the matrix products the nodes of a graph report, e.g. Linear, Conv2D, Recurrent, HalfLinear
+	// and BlockSparseLinear, each shape once. The graph has to be run forward once first.
+	inline std::vector<GemmShape> gemm_shapes(Graph const& graph)
+	{
+		std::vector<GemmShape> shapes;
+		for (NodeInterface* node : graph.nodes())
+		{
+			for (GemmShape const& shape : node->gemm_shapes())
+			{
+				if (std::find(shapes.begin(), shapes.end(), shape) == shapes.end()) shapes.push_back(shape);
+			}
+		}
+		return shapes;
+	}
+
+	struct AutotuneOptions
+	{
+		std::vector<Index> depths_ = { 64, 128, 256 };			//: Candidates of GemmBlocking::depth_.
+		std::vector<Index> cols_ = { 256, 512, 1024 };			//: Candidates of GemmBlocking::cols_.
+		std::vector<Index> threads_;							//: Candidates of GemmBlocking::threads_, powers of 2 up to the hardware threads if empty.
+		int repeats_ = 3;										//: Timed runs of every candidate, the fastest counts.
+	};
+
+	// Times every candidate blocking on the three products of a Linear layer of each shape,
+	// dot(X, W), dot_nt(G, W) and dot_tn(X, G), sets the fastest as dynamictensor::gemm_blocking and returns it.
+	// Without shapes the heuristic blocking is set.
+	inline dynamictensor::GemmBlocking autotune_gemm(std::vector<GemmShape> const& shapes, AutotuneOptions const& options = {})
+	{
+		using Matrix = dynamictensor::Tensor<Scalar, 2>;
+		using Clock = std::chrono::steady_clock;
+
+		dynamictensor::GemmBlocking best = heuristic_gemm_blocking();
+		if (shapes.empty())
+		{
+			dynamictensor::gemm_blocking = best;
+			return best;
+		}
+
+		std::vector<Index> threads = options.threads_;
+		if (threads.empty())
+		{
+			for (Index t = 1; t <= machine_info().threads_; t *= 2) threads.push_back(t);
+		}
+
+		std::mt19937 generator(0);
+		std::uniform_real_distribution<Scalar> distribution(-1., 1.);
+		auto random_matrix = [&](Index rows, Index cols)
+		{
+			Matrix m({ rows, cols });
+			for (Index i = 0; i < rows; i++)
+				for (Index j = 0; j < cols; j++) m.data_[i].data_[j] = distribution(generator);
+			return m;
+		};
+		struct Operands { Matrix X, W, G; };
+		std::vector<Operands> operands;
+		for (GemmShape const& shape : shapes)
+		{
+			operands.push_back({ random_matrix(shape.M_, shape.K_), random_matrix(shape.K_, shape.N_), random_matrix(shape.M_, shape.N_) });
+		}
+
+		double best_time = std::numeric_limits<double>::infinity();
+		for (Index depth : options.depths_)
+		{
+			for (Index cols : options.cols_)
+			{
+				for (Index thread_count : threads)
+				{
+					dynamictensor::GemmBlocking candidate = best;
+					candidate.depth_ = depth;
+					candidate.cols_ = cols;
+					candidate.threads_ = thread_count;
+					dynamictensor::gemm_blocking = candidate;
+
+					double time = 0;
+					for (Operands const& o : operands)
+					{
+						double fastest = std::numeric_limits<double>::infinity();
+						// The first run warms the caches up
+						for (int repeat = 0; repeat <= options.repeats_; repeat++)
+						{
+							Clock::time_point start = Clock::now();
+							Matrix Y = dot(o.X, o.W), dX = dot_nt(o.G, o.W), dW = dot_tn(o.X, o.G);
+							double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+							if (repeat > 0) fastest = std::min(fastest, elapsed);
+						}
+						time += fastest;
+					}
+					if (time < best_time)
+					{
+						best_time = time;
+						best = candidate;
+					}
+				}
+			}
+		}
+		dynamictensor::gemm_blocking = best;
+		return best;
+	}
+
+	// Tunes the blocking on the matrix products of the nodes of a graph, run forward once first.
+	inline dynamictensor::GemmBlocking autotune_gemm(Graph const& graph, AutotuneOptions const& options = {})
+	{
+		return autotune_gemm(gemm_shapes(graph), options);
+	}
+
+	// Writes a blocking and the machine it was tuned on to a text file.
+	inline void save_gemm_profile(std::string const& path, dynamictensor::GemmBlocking const& blocking = dynamictensor::gemm_blocking)
+	{
+		MachineInfo const info = machine_info();
+		std::ofstream file(path);
+		file << "miniflow_gemm_profile 1\n"
+			<< "machine_threads " << info.threads_ << "\n"
+			<< "machine_l1 " << info.l1_ << "\n"
+			<< "machine_l2 " << info.l2_ << "\n"
+			<< "depth " << blocking.depth_ << "\n"
+			<< "cols " << blocking.cols_ << "\n"
+			<< "pack_rows " << blocking.pack_rows_ << "\n"
+			<< "threads " << blocking.threads_ << "\n";
+		if (!file) throw std::runtime_error("Autotune: cannot write " + path);
+	}
+
+	// Sets dynamictensor::gemm_blocking from a profile saved on this machine.
+	// Returns false and sets the heuristic blocking if the file is missing, unreadable or made on another machine.
+	inline bool load_gemm_profile(std::string const& path)
+	{
+		dynamictensor::gemm_blocking = heuristic_gemm_blocking();
+
+		std::ifstream file(path);
+		std::string magic;
+		int version = 0;
+		if (!(file >> magic >> version) || magic != "miniflow_gemm_profile" || version != 1) return false;
+
+		MachineInfo info{};
+		dynamictensor::GemmBlocking blocking;
+		std::string key;
+		std::size_t value;
+		while (file >> key >> value)
+		{
+			if (key == "machine_threads") info.threads_ = value;
+			else if (key == "machine_l1") info.l1_ = value;
+			else if (key == "machine_l2") info.l2_ = value;
+			else if (key == "depth") blocking.depth_ = Index(value);
+			else if (key == "cols") blocking.cols_ = Index(value);
+			else if (key == "pack_rows") blocking.pack_rows_ = Index(value);
+			else if (key == "threads") blocking.threads_ = Index(value);
+		}
+		if (!file.eof() || !(info == machine_info())) return false;
+		if (blocking.depth_ == 0 || blocking.cols_ == 0 || blocking.threads_ == 0) return false;
+
+		dynamictensor::gemm_blocking = blocking;
+		return true;
+	}
+}
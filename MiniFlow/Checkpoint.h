@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include "Graph.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MINIFLOW_CHECKPOINT_MMAP
+#endif
+
+namespace miniflow
+{
+	/*
+		Binary checkpoint of the trainable nodes of a Graph.
+
+		Layout, version 1, native byte order:
+			header:	char magic[4] = "MFCK", u32 version, u32 number of entries, u32 blob alignment
+			index:	for each entry u32 name length, name, u32 rank, u32 shape[rank],
+					u64 blob offset from the start of the file, u64 number of values
+			blobs:	Scalar values of each entry in row-major order, every blob starts at an aligned offset
+
+		Trainables are stored under their name() or under "trainable_<k>" when they have none,
+		k being the position of the node among the trainables of the Graph in topological order.
+	*/
+
+	struct CheckpointEntry
+	{
+		std::string name_;				//: Name of the trainable node.
+		std::vector<Index> shape_;		//: Shape of the stored tensor.
+		Scalar const* values_;			//: Row-major values. Points into the loaded or mapped file.
+		std::uint64_t count_;			//: Number of values.
+	};
+
+	namespace checkpoint_format
+	{
+		constexpr char magic[4] = { 'M', 'F', 'C', 'K' };
+		constexpr std::uint32_t version = 1;
+		constexpr std::uint32_t alignment = 64;
+
+		inline std::uint64_t align(std::uint64_t offset)
+		{
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		inline std::string entry_name(NodeInterface const* node, std::size_t k)
+		{
+			return node->name().empty() ? "trainable_" + std::to_string(k) : node->name();
+		}
+
+		template<typename T>
+		void put(std::string& buffer, T value)
+		{
+			buffer.append(reinterpret_cast<char const*>(&value), sizeof(T));
+		}
+
+		template<typename T>
+		T get(char const*& it, char const* end)
+		{
+			if (end - it < std::ptrdiff_t(sizeof(T))) throw std::runtime_error("Checkpoint: unexpected end of file");
+			T value;
+			std::memcpy(&value, it, sizeof(T));
+			it += sizeof(T);
+			return value;
+		}
+
+		// Serializes named tensors into a file at path.
+		// The file is written next to path and renamed when complete, so an interrupted save never leaves a broken checkpoint.
+		inline void write(std::vector<std::pair<std::string, TensorData>> const& tensors, std::string const& path)
+		{
+			std::string index;
+			index.append(magic, sizeof(magic));
+			put(index, version);
+			put(index, std::uint32_t(tensors.size()));
+			put(index, alignment);
+
+			std::uint64_t index_size = index.size();
+			for (auto const& [name, data] : tensors)
+			{
+				index_size += 2 * sizeof(std::uint32_t) + name.size() + data.shape_.size() * sizeof(std::uint32_t) + 2 * sizeof(std::uint64_t);
+			}
+
+			std::vector<std::uint64_t> offsets;
+			std::uint64_t offset = align(index_size);
+			for (auto const& [name, data] : tensors)
+			{
+				put(index, std::uint32_t(name.size()));
+				index.append(name);
+				put(index, std::uint32_t(data.shape_.size()));
+				for (Index dim : data.shape_) put(index, std::uint32_t(dim));
+				put(index, offset);
+				put(index, std::uint64_t(data.values_.size()));
+				offsets.push_back(offset);
+				offset = align(offset + data.values_.size() * sizeof(Scalar));
+			}
+
+			std::string const temporary_path = path + ".tmp";
+			{
+				std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+				if (!file) throw std::runtime_error("Checkpoint: cannot open " + temporary_path);
+				file.write(index.data(), index.size());
+				std::uint64_t position = index.size();
+				char const padding[alignment] = {};
+				for (std::size_t i = 0; i < tensors.size(); i++)
+				{
+					file.write(padding, offsets[i] - position);
+					auto const& values = tensors[i].second.values_;
+					file.write(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(Scalar));
+					position = offsets[i] + values.size() * sizeof(Scalar);
+				}
+				if (!file) throw std::runtime_error("Checkpoint: failed to write " + temporary_path);
+			}
+#ifdef _WIN32
+			std::remove(path.c_str()); // rename does not replace existing files on Windows
+#endif
+			if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+			{
+				throw std::runtime_error("Checkpoint: cannot rename " + temporary_path + " to " + path);
+			}
+		}
+	}
+
+	class CheckpointReader
+	{
+		/*
+			Opens a checkpoint file and parses its index.
+			On POSIX systems the file is memory mapped and entry values point directly into the mapping,
+			so weights can be used in place without copying. Elsewhere the file is read with a single read call.
+		*/
+
+		std::vector<CheckpointEntry> entries_;
+		char const* bytes_ = nullptr;
+		std::size_t size_ = 0;
+		std::vector<char> buffer_;		//: File contents when the file is not mapped.
+
+		void open(std::string const& path)
+		{
+#ifdef MINIFLOW_CHECKPOINT_MMAP
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("Checkpoint: cannot open " + path);
+			struct stat status;
+			::fstat(fd, &status);
+			size_ = std::size_t(status.st_size);
+			void* mapping = size_ ? ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+			::close(fd);
+			if (mapping == MAP_FAILED) throw std::runtime_error("Checkpoint: cannot map " + path);
+			bytes_ = static_cast<char const*>(mapping);
+#else
+			std::ifstream file(path, std::ios::binary | std::ios::ate);
+			if (!file) throw std::runtime_error("Checkpoint: cannot open " + path);
+			size_ = std::size_t(file.tellg());
+			buffer_.resize(size_);
+			file.seekg(0);
+			file.read(buffer_.data(), size_);
+			bytes_ = buffer_.data();
+#endif
+		}
+
+		void close()
+		{
+#ifdef MINIFLOW_CHECKPOINT_MMAP
+			if (bytes_) ::munmap(const_cast<char*>(bytes_), size_);
+#endif
+			bytes_ = nullptr;
+		}
+
+		void parse()
+		{
+			using namespace checkpoint_format;
+			char const* it = bytes_;
+			char const* end = bytes_ + size_;
+
+			char file_magic[4];
+			for (char& c : file_magic) c = get<char>(it, end);
+			if (std::memcmp(file_magic, magic, sizeof(magic)) != 0) throw std::runtime_error("Checkpoint: not a checkpoint file");
+			if (get<std::uint32_t>(it, end) != version) throw std::runtime_error("Checkpoint: unsupported version");
+			std::uint32_t count = get<std::uint32_t>(it, end);
+			get<std::uint32_t>(it, end); // alignment
+
+			entries_.resize(count);
+			for (CheckpointEntry& entry : entries_)
+			{
+				std::uint32_t name_size = get<std::uint32_t>(it, end);
+				if (end - it < std::ptrdiff_t(name_size)) throw std::runtime_error("Checkpoint: unexpected end of file");
+				entry.name_.assign(it, name_size);
+				it += name_size;
+				entry.shape_.resize(get<std::uint32_t>(it, end));
+				for (Index& dim : entry.shape_) dim = get<std::uint32_t>(it, end);
+				std::uint64_t offset = get<std::uint64_t>(it, end);
+				entry.count_ = get<std::uint64_t>(it, end);
+				// Compared by division, so that no product can overflow
+				std::uint64_t values = 1;
+				for (Index dim : entry.shape_)
+				{
+					if (dim != 0 && values > entry.count_ / dim) throw std::runtime_error("Checkpoint: value count does not match the shape of " + entry.name_);
+					values *= dim;
+				}
+				if (values != entry.count_) throw std::runtime_error("Checkpoint: value count does not match the shape of " + entry.name_);
+				if (offset > size_ || entry.count_ > (size_ - offset) / sizeof(Scalar)) throw std::runtime_error("Checkpoint: blob out of range");
+				entry.values_ = reinterpret_cast<Scalar const*>(bytes_ + offset);
+			}
+		}
+
+	public:
+
+		explicit CheckpointReader(std::string const& path)
+		{
+			open(path);
+			try
+			{
+				parse();
+			}
+			catch (...)
+			{
+				close();
+				throw;
+			}
+		}
+
+		~CheckpointReader()
+		{
+			close();
+		}
+
+		CheckpointReader(CheckpointReader const&) = delete;
+		CheckpointReader& operator=(CheckpointReader const&) = delete;
+
+		std::vector<CheckpointEntry> const& entries() const { return entries_; }
+
+		// Returns an entry by name or nullptr if there is none.
+		CheckpointEntry const* find(std::string const& name) const
+		{
+			for (CheckpointEntry const& entry : entries_)
+			{
+				if (entry.name_ == name) return &entry;
+			}
+			return nullptr;
+		}
+
+		// Loads values of all the trainable nodes of graph.
+		void load(Graph& graph) const
+		{
+			std::vector<NodeInterface*> trainables = graph.trainables();
+			for (std::size_t k = 0; k < trainables.size(); k++)
+			{
+				std::string name = checkpoint_format::entry_name(trainables[k], k);
+				CheckpointEntry const* entry = find(name);
+				if (!entry) throw std::runtime_error("Checkpoint: no entry for " + name);
+				if (entry->shape_ != trainables[k]->data_shape()) throw std::runtime_error("Checkpoint: shape mismatch for " + name);
+				trainables[k]->set_data(TensorData{ entry->shape_, std::vector<Scalar>(entry->values_, entry->values_ + entry->count_) });
+			}
+		}
+	};
+
+	class CheckpointWriter
+	{
+		/*
+			Saves checkpoints of the trainable nodes of a Graph in the background.
+			Values are copied on the calling thread, then serialized and written by a worker,
+			so training continues while the file is being written.
+			Only one save is in flight at a time: a new save waits for the previous one.
+		*/
+
+		std::future<void> pending_;
+
+	public:
+
+		CheckpointWriter() = default;
+
+		~CheckpointWriter()
+		{
+			if (pending_.valid()) pending_.wait();
+		}
+
+		// Takes a snapshot of the trainables of graph and starts writing it to path.
+		void save(Graph const& graph, std::string const& path)
+		{
+			wait();
+			std::vector<std::pair<std::string, TensorData>> tensors;
+			std::vector<NodeInterface*> trainables = graph.trainables();
+			for (std::size_t k = 0; k < trainables.size(); k++)
+			{
+				tensors.emplace_back(checkpoint_format::entry_name(trainables[k], k), trainables[k]->data());
+			}
+			pending_ = std::async(std::launch::async, [tensors = std::move(tensors), path]()
+			{
+				checkpoint_format::write(tensors, path);
+			});
+		}
+
+		// Blocks until the last save is on disk. Rethrows its error if it failed.
+		void wait()
+		{
+			if (pending_.valid()) pending_.get();
+		}
+	};
+
+	// Writes a checkpoint of the trainables of graph to path and waits for it to complete.
+	inline void save_checkpoint(Graph const& graph, std::string const& path)
+	{
+		CheckpointWriter writer;
+		writer.save(graph, path);
+		writer.wait();
+	}
+
+	// Loads the trainables of graph from a checkpoint at path.
+	inline void load_checkpoint(Graph& graph, std::string const& path)
+	{
+		CheckpointReader(path).load(graph);
+	}
+}
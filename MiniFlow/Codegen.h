@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cctype>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include "Graph.h"
+
+namespace miniflow
+{
+	/*
+		Ahead-of-time code generation of the forward pass of a trained network.
+
+		generate_header() writes a standalone C++17 header, depending only on <cmath> and <cstddef>, that defines
+			namespace <name>
+			{
+				inline constexpr double w_<trainable>[rows][cols] = { ... };		// every Trainable, exact values
+				inline void forward(double const (&in_<input>)[rows][cols], ..., double (&output)[rows][cols]);
+			}
+		Trainables and inputs are named after name() when it is an identifier and numbered otherwise. The prefixes
+		keep them apart from the names of the generated code and from keywords, and repeated names get a suffix.
+		Every node becomes a loop nest with constant bounds, in topological order, so the compiler sees
+		all the shapes and can unroll and vectorize. Activations whose input has no other consumer are
+		computed in place. Intermediate values are local arrays: forward() neither allocates nor uses
+		virtual calls; workspace_bytes gives its stack use.
+
+		Supported nodes are Input, Trainable, Linear and the activations, on TensorScalar or matrices.
+		The shapes are those of the values of the inputs and trainables, the shapes of the other nodes follow
+		from them, so nodes whose value an in-place activation took over are generated as well.
+	*/
+
+	namespace codegen
+	{
+		struct Value
+		{
+			std::string name_;		//: Name of the array holding the value in the generated code.
+			Index rows_;
+			Index cols_;
+		};
+
+		// Node values are generated as matrices: scalars are 1 x 1 and vectors single rows.
+		inline std::pair<Index, Index> matrix_shape(NodeInterface const& node)
+		{
+			std::vector<Index> shape = node.shape();
+			if (shape.size() > 2) throw std::runtime_error(std::string("Codegen: unsupported rank of ") + node.type());
+			if (shape.size() == 2) return { shape[0], shape[1] };
+			return { 1, shape.empty() ? 1 : shape[0] };
+		}
+
+		inline bool is_identifier(std::string const& name)
+		{
+			if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) return false;
+			return std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+		}
+
+		inline bool is_keyword(std::string const& name)
+		{
+			static std::set<std::string> const keywords =
+			{
+				"alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch",
+				"char", "char16_t", "char32_t", "class", "compl", "const", "constexpr", "const_cast", "continue", "decltype",
+				"default", "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false",
+				"float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new", "noexcept",
+				"not", "not_eq", "nullptr", "operator", "or", "or_eq", "private", "protected", "public", "register",
+				"reinterpret_cast", "return", "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+				"struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid",
+				"typename", "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t", "while", "xor", "xor_eq"
+			};
+			return keywords.count(name) > 0;
+		}
+
+		// Exact literal of a value
+		inline std::string literal(Scalar value)
+		{
+			std::ostringstream out;
+			out << std::hexfloat << value;
+			return out.str();
+		}
+
+		// Statement computing y from x for an element-wise activation node, or an empty string for other nodes.
+		template<typename Tensor>
+		std::string activation(NodeInterface& node)
+		{
+			std::string const type = node.type();
+			if (type == SigmoidFunction::name) return "y = 1 / (1 + std::exp(-x));";
+			if (type == TanhFunction::name) return "y = std::tanh(x);";
+			if (type == ReLUFunction::name) return "y = x > 0 ? x : 0.;";
+			if (type == LeakyReLUFunction::name)
+			{
+				Scalar alpha = dynamic_cast<LeakyReLU<Tensor>&>(node).function().alpha_;
+				return "y = x > 0 ? x : " + literal(alpha) + " * x;";
+			}
+			if (type == GELUFunction::name)
+			{
+				return "y = 0.5 * x * (1 + std::tanh(" + literal(GELUFunction::scale) + " * (x + " + literal(GELUFunction::cubic) + " * x * x * x)));";
+			}
+			return "";
+		}
+
+		// Nodes reachable from output, every node after its inputs
+		inline void topological_order(NodeInterface* node, std::vector<NodeInterface*>& order)
+		{
+			if (std::find(order.begin(), order.end(), node) != order.end()) return;
+			for (NodeInterface* input : node->inbound_nodes()) topological_order(input, order);
+			order.push_back(node);
+		}
+	}
+
+	template<typename Tensor>
+	void generate_header(Node<Tensor>& output, std::ostream& out, std::string const& name)
+	{
+		using codegen::Value;
+
+		if (!codegen::is_identifier(name) || codegen::is_keyword(name) || name == "std")
+		{
+			throw std::runtime_error("Codegen: " + name + " is not a namespace name");
+		}
+
+		std::vector<NodeInterface*> nodes;
+		codegen::topological_order(&output, nodes);
+		for (NodeInterface* node : nodes) node->forward();
+
+		std::map<NodeInterface*, std::size_t> consumers;
+		for (NodeInterface* node : nodes)
+		{
+			for (NodeInterface* input : node->inbound_nodes()) consumers[input]++;
+		}
+
+		std::ostringstream constants, parameters, body;
+		std::map<NodeInterface*, Value> values;
+		std::size_t workspace = 0, inputs = 0, trainables = 0;
+
+		std::set<std::string> names;
+		auto node_name = [&](NodeInterface* node, std::string const& prefix, std::size_t& count)
+		{
+			std::string const base = prefix + (codegen::is_identifier(node->name()) ? node->name() : std::to_string(count++));
+			std::string name = base;
+			for (std::size_t repeat = 2; !names.insert(name).second; repeat++) name = base + "_" + std::to_string(repeat);
+			return name;
+		};
+		// Declares a local array for the value of a node, unless it is the output
+		auto local = [&](NodeInterface* node, Index rows, Index cols)
+		{
+			std::string array = node == &output ? "output" : "v" + std::to_string(values.size());
+			if (node != &output)
+			{
+				body << "\tdouble " << array << "[" << rows << "][" << cols << "];\n";
+				workspace += std::size_t(rows) * cols * sizeof(double);
+			}
+			return Value{ array, rows, cols };
+		};
+		// Separates the code of a node from the previous one and names it
+		auto comment = [&](NodeInterface* node)
+		{
+			if (body.tellp() > 0) body << "\n";
+			body << "\t// " << node->type() << (codegen::is_identifier(node->name()) ? " " + node->name() : "") << "\n";
+		};
+		auto loop = [](char const* index, Index end) { return std::string("for (std::size_t ") + index + " = 0; " + index + " < " + std::to_string(end) + "; " + index + "++)"; };
+
+		for (NodeInterface* node : nodes)
+		{
+			std::string const type = node->type();
+			std::vector<NodeInterface*> const inbound = node->inbound_nodes();
+
+			if (node->is_trainable())
+			{
+				auto const [rows, cols] = codegen::matrix_shape(*node);
+				Value value{ node_name(node, "w_", trainables), rows, cols };
+				TensorData data = node->data();
+				constants << "\t// " << type << " " << rows << " x " << cols << "\n";
+				constants << "\tinline constexpr double " << value.name_ << "[" << rows << "][" << cols << "] =\n\t{\n";
+				for (Index i = 0; i < rows; i++)
+				{
+					constants << "\t\t{ ";
+					for (Index j = 0; j < cols; j++) constants << (j ? ", " : "") << codegen::literal(data.values_[std::size_t(i) * cols + j]);
+					constants << " },\n";
+				}
+				constants << "\t};\n\n";
+				values[node] = value;
+			}
+			else if (node->is_input())
+			{
+				auto const [rows, cols] = codegen::matrix_shape(*node);
+				Value value{ node_name(node, "in_", inputs), rows, cols };
+				parameters << "double const (&" << value.name_ << ")[" << rows << "][" << cols << "], ";
+				values[node] = value;
+			}
+			else if (type == "Linear")
+			{
+				Value const& X = values[inbound[0]];
+				Value const& W = values[inbound[1]];
+				Value const& b = values[inbound[2]];
+				Index const rows = X.rows_, cols = W.cols_;
+				comment(node);
+				Value y = local(node, rows, cols);
+				body << "\t" << loop("i", rows) << "\n\t{\n"
+					<< "\t\t" << loop("j", cols) << " " << y.name_ << "[i][j] = " << b.name_ << (b.rows_ == 1 ? "[0]" : "[i]") << "[j];\n"
+					<< "\t\t" << loop("k", X.cols_) << "\n\t\t{\n"
+					<< "\t\t\tdouble const x = " << X.name_ << "[i][k];\n"
+					<< "\t\t\t" << loop("j", cols) << " " << y.name_ << "[i][j] += x * " << W.name_ << "[k][j];\n"
+					<< "\t\t}\n\t}\n";
+				values[node] = y;
+			}
+			else if (std::string statement = codegen::activation<Tensor>(*node); !statement.empty())
+			{
+				NodeInterface* input = inbound[0];
+				Value const& x = values[input];
+				Index const rows = x.rows_, cols = x.cols_;
+				comment(node);
+				// In place when nothing else reads the input, and it is not the output written by the caller
+				bool in_place = !input->is_input() && consumers[input] == 1 && node != &output;
+				Value y = in_place ? x : local(node, rows, cols);
+				body << "\t" << loop("i", rows) << "\n\t{\n"
+					<< "\t\t" << loop("j", cols) << "\n\t\t{\n"
+					<< "\t\t\tdouble const x = " << x.name_ << "[i][j];\n"
+					<< "\t\t\tdouble& y = " << y.name_ << "[i][j];\n"
+					<< "\t\t\t" << statement << "\n"
+					<< "\t\t}\n\t}\n";
+				values[node] = y;
+			}
+			else
+			{
+				throw std::runtime_error("Codegen: unsupported node type " + type);
+			}
+		}
+
+		Value const& result = values[&output];
+		if (result.name_ != "output")
+		{
+			// The output is an input or a trainable
+			if (body.tellp() > 0) body << "\n";
+			body << "\t" << loop("i", result.rows_) << "\n\t{\n\t\t" << loop("j", result.cols_) << " output[i][j] = " << result.name_ << "[i][j];\n\t}\n";
+		}
+
+		out << "// Generated by miniflow::generate_header. Forward pass of a network of " << nodes.size() << " nodes.\n"
+			<< "#pragma once\n\n#include <cmath>\n#include <cstddef>\n\n"
+			<< "namespace " << name << "\n{\n"
+			<< constants.str()
+			<< "\tinline constexpr std::size_t output_rows = " << result.rows_ << ";\n"
+			<< "\tinline constexpr std::size_t output_cols = " << result.cols_ << ";\n"
+			<< "\t// Bytes of the intermediate values forward() keeps on the stack\n"
+			<< "\tinline constexpr std::size_t workspace_bytes = " << workspace << ";\n\n"
+			<< "\tinline void forward(" << parameters.str() << "double (&output)[" << result.rows_ << "][" << result.cols_ << "])\n\t{\n";
+		std::istringstream lines(body.str());
+		for (std::string line; std::getline(lines, line);) out << (line.empty() ? "" : "\t") << line << "\n";
+		out << "\t}\n}\n";
+	}
+}
@@ -10,7 +10,7 @@
 #include <execution>
 #include <string>
 #include <boost/range/adaptor/reversed.hpp>
-//#include <algorithm>
+#include <algorithm>
 
 namespace miniflow
 {
@@ -21,6 +21,21 @@ namespace miniflow
 	// math constants
 	Scalar EXP = 2.71828182845904523536;
 
+	// Number of tensor storage allocations made by the current thread.
+	// Incremented by TrackedAllocator on every buffer allocation, accounted or not, read by the Profiler.
+	inline thread_local std::size_t allocation_count = 0;
+
+	struct TensorData
+	{
+		/*
+			Type-erased flat copy of a tensor.
+			Used wherever a node value has to be handled without knowing its Tensor type.
+		*/
+
+		std::vector<Index> shape_;		//: Dimensions of the tensor. Empty for a TensorScalar.
+		std::vector<Scalar> values_;	//: Values in row-major order.
+	};
+
 	template<typename Iter, typename F>
 	void iterateParallel(Iter begin, Iter end, F fn)
 	{
@@ -39,9 +54,27 @@ namespace miniflow
 		}
 	}
 
+	// Calls fn(i) for every index in [begin, end) in parallel.
+	// fn may allocate and must not write to memory shared between indices.
+	template<typename F>
+	void parallelFor(Index begin, Index end, F fn)
+	{
+		std::vector<Index> indices(end - begin);
+		std::iota(indices.begin(), indices.end(), begin);
+		std::for_each(std::execution::par, indices.begin(), indices.end(), fn);
+	}
+
 	template<typename Iter, typename F>
 	void iterate(Iter begin, Iter end, F fn)
 	{
 		iterateSerial(begin, end, fn);
 	}
+
+	// Products with a transposed operand, as in the gradients of Linear nodes.
+	// Tensor libraries overload them to skip the transposed copy.
+	template<typename T1, typename T2>
+	auto dot_nt(T1 const& t1, T2 const& t2) { return dot(t1, transpose(t2)); }
+
+	template<typename T1, typename T2>
+	auto dot_tn(T1 const& t1, T2 const& t2) { return dot(transpose(t1), t2); }
 }
\ No newline at end of file
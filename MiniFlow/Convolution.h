@@ -0,0 +1,256 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class Conv2D : public Node<Tensor>
+	{
+		/*
+			Represents a node that performs a 2D convolution (cross-correlation) of a batch of images.
+
+			Input is {X, W, b}, all rank 4 dynamictensor tensors:
+				X is images x channels x height x width,
+				W is filters x channels x kernel height x kernel width,
+				b is 1 x filters x 1 x 1 and is added to every output value of its filter.
+			Output is images x filters x output height x output width, where
+				output height = (height + 2 * padding - kernel height) / stride + 1 and likewise for the width.
+
+			Every image is lowered with im2col to a matrix of channels * kernel height * kernel width rows
+			by output height * output width columns, so that the convolution becomes a single matrix product
+			with W reshaped to filters x (channels * kernel height * kernel width).
+			Backward runs the transposed products and scatters the image gradient back with col2im.
+			Images are processed in parallel. Scratch matrices are kept between steps and only
+			reallocated when the input shape changes.
+		*/
+
+		static_assert(Tensor::rank_ == 4, "Conv2D requires rank 4 tensors");
+
+		using T = typename Tensor::ValueType;
+		using Matrix = dynamictensor::Tensor<T, 2>;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+
+	private:
+
+		Index stride_;
+		Index padding_;
+
+		// Geometry of the last forward pass.
+		Index images_ = 0, channels_ = 0, height_ = 0, width_ = 0;
+		Index filters_ = 0, kernel_height_ = 0, kernel_width_ = 0;
+		Index output_height_ = 0, output_width_ = 0;
+
+		// Scratch buffers reused between steps.
+		std::vector<Matrix> columns_;			//: im2col matrix of every image.
+		std::vector<Matrix> products_;			//: Per image matrix product results and gradients, filters x output pixels.
+		std::vector<Matrix> column_gradients_;	//: Per image gradient of the im2col matrix.
+		std::vector<Matrix> weight_gradients_;	//: Per image contribution to the gradient of W.
+		Matrix weights_;						//: W reshaped to filters x (channels * kernel height * kernel width).
+
+		Index rows() const { return channels_ * kernel_height_ * kernel_width_; }
+		Index pixels() const { return output_height_ * output_width_; }
+
+		static void resize(std::vector<Matrix>& matrices, Index count, Index rows, Index cols)
+		{
+			dynamictensor::Shape<2> shape{ rows, cols };
+			if (matrices.size() == count && (count == 0 || matrices[0].shape() == shape)) return;
+			matrices.assign(count, Matrix(shape));
+		}
+
+		static void reshape(Tensor& tensor, dynamictensor::Shape<4> const& shape)
+		{
+			if (tensor.shape() != shape) tensor = Tensor(shape);
+		}
+
+		// Updates the geometry and scratch buffers for the current inputs.
+		void prepare(Tensor const& X, Tensor const& W)
+		{
+			assert(X.shape()[1] == W.shape()[1]);
+			images_ = X.shape()[0], channels_ = X.shape()[1], height_ = X.shape()[2], width_ = X.shape()[3];
+			filters_ = W.shape()[0], kernel_height_ = W.shape()[2], kernel_width_ = W.shape()[3];
+			assert(height_ + 2 * padding_ >= kernel_height_ && width_ + 2 * padding_ >= kernel_width_);
+			output_height_ = (height_ + 2 * padding_ - kernel_height_) / stride_ + 1;
+			output_width_ = (width_ + 2 * padding_ - kernel_width_) / stride_ + 1;
+
+			resize(columns_, images_, rows(), pixels());
+			resize(products_, images_, filters_, pixels());
+			reshape(value_, { images_, filters_, output_height_, output_width_ });
+			if (weights_.shape() != dynamictensor::Shape<2>{ filters_, rows() }) weights_ = Matrix({ filters_, rows() });
+		}
+
+		// Calls fn(row, column, input row, input column) for every pair of im2col matrix cell and image pixel it reads.
+		// Reads of the padding are skipped.
+		template<typename F>
+		void each_patch(F fn) const
+		{
+			for (Index c = 0; c < channels_; c++)
+			for (Index kh = 0; kh < kernel_height_; kh++)
+			for (Index kw = 0; kw < kernel_width_; kw++)
+			{
+				Index row = (c * kernel_height_ + kh) * kernel_width_ + kw;
+				for (Index oh = 0; oh < output_height_; oh++)
+				{
+					Index h = oh * stride_ + kh;
+					if (h < padding_ || h >= height_ + padding_) continue;
+					for (Index ow = 0; ow < output_width_; ow++)
+					{
+						Index w = ow * stride_ + kw;
+						if (w < padding_ || w >= width_ + padding_) continue;
+						fn(row, oh * output_width_ + ow, c, h - padding_, w - padding_);
+					}
+				}
+			}
+		}
+
+		void im2col(Tensor const& X, Index n)
+		{
+			Matrix& columns = columns_[n];
+			columns.fill(0);
+			auto const& image = X.data_[n].data_;
+			each_patch([&](Index row, Index column, Index c, Index h, Index w)
+			{
+				columns.data_[row].data_[column] = image[c].data_[h].data_[w];
+			});
+		}
+
+		void col2im(Matrix const& columns, Tensor& X_gradient, Index n) const
+		{
+			auto& image = X_gradient.data_[n].data_;
+			each_patch([&](Index row, Index column, Index c, Index h, Index w)
+			{
+				image[c].data_[h].data_[w] += columns.data_[row].data_[column];
+			});
+		}
+
+	public:
+
+		Conv2D(Node& X, Node& W, Node& b, Index stride = 1, Index padding = 0) :
+			Node(std::vector<Node*>{ &X, &W, &b }),
+			stride_(stride),
+			padding_(padding)
+		{
+			assert(stride_ > 0);
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			auto const& b = inbound_nodes_[2]->getValue();
+			prepare(X, W);
+
+			for (Index f = 0; f < filters_; f++)
+			{
+				weights_.data_[f].data_.clear();
+				W.data_[f].flatten(weights_.data_[f].data_);
+			}
+
+			parallelFor(0, images_, [&](Index n)
+			{
+				im2col(X, n);
+				Matrix& product = products_[n];
+				product.fill(0);
+				dynamictensor::gemm(weights_, columns_[n], product);
+
+				for (Index f = 0; f < filters_; f++)
+				{
+					T bias = b.data_[0].data_[f].data_[0].data_[0];
+					T const* source = product.data_[f].data_.data();
+					auto& output = value_.data_[n].data_[f].data_;
+					for (Index oh = 0; oh < output_height_; oh++)
+					{
+						T* target = output[oh].data_.data();
+						for (Index ow = 0; ow < output_width_; ow++) target[ow] = source[oh * output_width_ + ow] + bias;
+					}
+				}
+			});
+		}
+
+		void backward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			auto const& b = inbound_nodes_[2]->getValue();
+
+			// Sum the partials with respect to this node over all the outputs first,
+			// so that the products below run once per step.
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				this->clear_gradient();
+				return;
+			}
+			Tensor const& grad_cost = *partial;
+
+			reshape(gradient_[0], X.shape());
+			reshape(gradient_[1], W.shape());
+			reshape(gradient_[2], b.shape());
+			gradient_[0].fill(0);
+			resize(column_gradients_, images_, rows(), pixels());
+			resize(weight_gradients_, images_, filters_, rows());
+
+			parallelFor(0, images_, [&](Index n)
+			{
+				// Gradient with respect to the convolution result, filters x output pixels.
+				Matrix& product_gradient = products_[n];
+				for (Index f = 0; f < filters_; f++)
+				{
+					product_gradient.data_[f].data_.clear();
+					grad_cost.data_[n].data_[f].flatten(product_gradient.data_[f].data_);
+				}
+
+				weight_gradients_[n].fill(0);
+				dynamictensor::gemm_nt(product_gradient, columns_[n], weight_gradients_[n]);
+
+				column_gradients_[n].fill(0);
+				dynamictensor::gemm_tn(weights_, product_gradient, column_gradients_[n]);
+				col2im(column_gradients_[n], gradient_[0], n);
+			});
+
+			// Reduce the per image partials in a fixed order, so results do not depend on scheduling.
+			Matrix weight_gradient({ filters_, rows() });
+			for (Index n = 0; n < images_; n++) weight_gradient += weight_gradients_[n];
+			for (Index f = 0; f < filters_; f++)
+			{
+				gradient_[1].data_[f].unflatten(weight_gradient.data_[f].data_.begin());
+				T bias_gradient(0);
+				for (Index n = 0; n < images_; n++) bias_gradient += sum_all(grad_cost.data_[n].data_[f]);
+				gradient_[2].data_[0].data_[f].data_[0].data_[0] = bias_gradient;
+			}
+		}
+
+		char const* type() const final { return "Conv2D"; }
+
+		// Two operations per multiply-add of the lowered matrix product and one per added bias.
+		std::size_t flops() const final
+		{
+			return 2 * std::size_t(images_) * filters_ * rows() * pixels() + size(value_);
+		}
+
+		// The product of the reshaped weights and the im2col matrix of every image
+		std::vector<GemmShape> gemm_shapes() const final
+		{
+			if (images_ == 0) return {};
+			return { { filters_, rows(), pixels() } };
+		}
+
+		// The im2col matrices and the per image products and gradients are kept between calls.
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = storage_bytes(columns_) + storage_bytes(products_) + storage_bytes(column_gradients_)
+				+ storage_bytes(weight_gradients_) + storage_bytes(weights_);
+			return usage;
+		}
+	};
+}
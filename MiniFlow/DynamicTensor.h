@@ -1,6 +1,17 @@
 #pragma once
 
+#include <array>
+#include <thread>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#define MINIFLOW_DYNAMICTENSOR_SYSCONF
+#endif
+
 #include "Common.h"
+#include "Memory.h"
 #include "TensorScalar.h"
 
 namespace dynamictensor
@@ -86,6 +97,24 @@ namespace dynamictensor
 		}
 	};
 
+	// Dot product of n values.
+	// Independent partial sums let it run several multiply-adds at once.
+	template<class T>
+	T inner(T const* a, T const* b, Index n)
+	{
+		T s0(0), s1(0), s2(0), s3(0);
+		Index k = 0;
+		for (; k + 4 <= n; k += 4)
+		{
+			s0 += a[k] * b[k];
+			s1 += a[k + 1] * b[k + 1];
+			s2 += a[k + 2] * b[k + 2];
+			s3 += a[k + 3] * b[k + 3];
+		}
+		for (; k < n; k++) s0 += a[k] * b[k];
+		return (s0 + s1) + (s2 + s3);
+	}
+
 	template<class T, unsigned rank> 
 	class Tensor
 	{
@@ -98,12 +127,16 @@ namespace dynamictensor
 	public:
 
 		// Tempalte statics
+		using ValueType = T;
 		static constexpr unsigned rank_ = rank;
 		static constexpr bool is_vector_ = rank_ == 1;
 		static constexpr bool is_matrix_ = rank_ == 2;
 		using SubTensor = typename std::conditional<is_vector_, T, Tensor<T, rank - 1>>::type;
 
-		std::vector<SubTensor> data_; // main memory structure
+		// Values are allocated through miniflow::TrackedAllocator, see Memory.h
+		using Allocator = typename std::conditional<is_vector_, miniflow::TrackedAllocator<T>, std::allocator<SubTensor>>::type;
+
+		std::vector<SubTensor, Allocator> data_; // main memory structure
 		Shape<rank> shape_; // shape of tensor
 
 		// Internal logic
@@ -165,6 +198,87 @@ namespace dynamictensor
 			return r;
 		}
 		
+		// Sets every value to fn applied to the values at the same position in sources, in a single pass.
+		// The tensor is reallocated only when its shape differs from the shape of the first source,
+		// so it may be one of the sources itself.
+		template<typename F, typename Source, typename ... Sources>
+		void transform(F fn, Source const& source, Sources const& ... sources)
+		{
+			if (shape_ != source.shape_) *this = Tensor(source.shape_);
+			transform_values(fn, source, sources...);
+		}
+
+		template<typename F, typename ... Sources>
+		void transform_values(F fn, Sources const& ... sources)
+		{
+			if constexpr(is_vector_)
+			{
+				T* values = data_.data();
+				for (Index i = 0; i < shape_[0]; i++) values[i] = fn(sources.data_[i]...);
+			}
+			else
+			{
+				for (Index i = 0; i < shape_[0]; i++) data_[i].transform_values(fn, sources.data_[i]...);
+			}
+		}
+
+		// Sets all the values to value without reallocating.
+		void fill(T value)
+		{
+			if constexpr(is_vector_)
+			{
+				std::fill(data_.begin(), data_.end(), value);
+			}
+			else
+			{
+				for (auto& subTensor : data_) subTensor.fill(value);
+			}
+		}
+
+		// Appends all the values to out in row-major order.
+		template<typename Container>
+		void flatten(Container& out) const
+		{
+			if constexpr(is_vector_)
+			{
+				out.insert(out.end(), data_.begin(), data_.end());
+			}
+			else
+			{
+				for (auto const& subTensor : data_) subTensor.flatten(out);
+			}
+		}
+
+		// Calls fn with a pointer to every row of the last axis, in row-major order.
+		template<typename F>
+		void each_row(F const& fn)
+		{
+			if constexpr(is_vector_)
+			{
+				fn(data_.data());
+			}
+			else
+			{
+				for (auto& subTensor : data_) subTensor.each_row(fn);
+			}
+		}
+
+		// Fills the tensor with values in row-major order starting from it.
+		// Returns an iterator past the last consumed value.
+		template<typename Iter>
+		Iter unflatten(Iter it)
+		{
+			if constexpr(is_vector_)
+			{
+				for (auto& x : data_) x = T(*it++);
+			}
+			else
+			{
+				for (auto& subTensor : data_) it = subTensor.unflatten(it);
+			}
+			return it;
+		}
+
 		//
 		//template<class T, typename F, unsigned rank>
 		//static Tensor<T, rank> fold(const Tensor<T, rank>& t, F fn) {}
@@ -178,21 +292,20 @@ namespace dynamictensor
 		Tensor(Shape<rank> const& shape) : Tensor(shape, 0) {}
 
 		// Initialize tensor of given shape filled with value
-		template<unsigned rank>
 		Tensor(Shape<rank> const& shape, T value) : shape_(shape)
 		{
-			data_.resize(shape[0]);
-			for (auto& subTensor : data_)
+			if constexpr(is_vector_)
 			{
-				subTensor = SubTensor(shape.subShape(), value);
+				data_.resize(shape[0], value);
+			}
+			else
+			{
+				data_.resize(shape[0]);
+				for (auto& subTensor : data_)
+				{
+					subTensor = SubTensor(shape.subShape(), value);
+				}
 			}
-		}
-
-		// Initialize vector of given shape filled with value
-		template<>
-		Tensor(Shape<1> const& shape, T value) : shape_(shape)
-		{
-			data_.resize(shape[0], value);
 		}
 
 		// Access operator const
@@ -266,9 +379,12 @@ namespace dynamictensor
 			return zip(t1, t2, [](SubTensor x1, SubTensor x2) {return x1 / x2; });
 		}
 
+		// An empty tensor, e.g. a cleared gradient, is accumulated into and added as zero.
 		void operator+=(Tensor const& t)
 		{
-			*this = *this + t;
+			if (t.data_.empty()) return;
+			if (data_.empty()) *this = t;
+			else *this = *this + t;
 		}
 
 		void operator-=(Tensor const& t)
@@ -290,7 +406,7 @@ namespace dynamictensor
 
 		friend Tensor operator+(Tensor const& t, T s)
 		{
-			return map(t, [&](SubTensor x) {return x + s; });
+			return t.map([&](SubTensor x) {return x + s; });
 		}
 
 		friend Tensor operator+(T s, Tensor const& t)
@@ -325,7 +441,7 @@ namespace dynamictensor
 
 		friend Tensor operator/(Tensor const& t, T s)
 		{
-			return t * 1 / s;
+			return t * (1 / s);
 		}
 
 		friend Tensor operator-(Tensor const& t)
@@ -347,34 +463,76 @@ namespace dynamictensor
 
 		// Special functions
 
+		// Swaps the last two axes, see transpose_into().
 		friend Tensor transpose(Tensor const& input)
 		{
-			if constexpr(input.is_vector_) return input;
-			Tensor transposed(input.shape().transpose());
-			if constexpr(input.is_matrix_)
+			if constexpr(is_vector_) return input;
+			else
 			{
-				input.each([&](int i, Tensor<T, 1> const& subtensor)
-				{
-					subtensor.each([&](int j, T const& x)
-					{
-						transposed[j][i] = x;
-					});
-				});
+				Tensor transposed(input.shape().transpose());
+				transpose_into(input, transposed);
+				return transposed;
 			}
-			else
+		}
+
+		// Permutes the axes: axis i of the result is axis axes[i] of the input, e.g. { 2, 0, 1 }.
+		// Permutations of the last two axes only run the blocked kernel. Other permutations gather
+		// the values from a flat copy of the input, one row of the result at a time.
+		friend Tensor transpose(Tensor const& input, std::array<unsigned, rank> const& axes)
+		{
+			// Stride of every input axis in a flat copy of the input
+			std::array<Index, rank> input_strides;
+			Index size = 1;
+			for (int i = int(rank) - 1; i >= 0; i--)
 			{
-				transposed.each([&](int i, SubTensor& x) 
-				{
-					x = transpose(input.data_[i]);
-				});
+				input_strides[i] = size;
+				size *= input.shape_[i];
+			}
+			Shape<rank> shape;
+			std::array<Index, rank> strides;
+			[[maybe_unused]] unsigned long long seen = 0;		// Input axes used so far, one bit each, so that axes is a permutation
+			for (unsigned i = 0; i < rank; i++)
+			{
+				assert(axes[i] < rank && !(seen >> axes[i] & 1));
+				seen |= 1ull << axes[i];
+				shape[i] = input.shape_[axes[i]];
+				strides[i] = input_strides[axes[i]];
 			}
-			return transposed;
+
+			bool identity = true, swap_last = rank >= 2;
+			for (unsigned i = 0; i < rank; i++)
+			{
+				identity = identity && axes[i] == i;
+				if (i + 2 < rank) swap_last = swap_last && axes[i] == i;
+			}
+			if (identity) return input;
+			if constexpr(rank >= 2)
+			{
+				if (swap_last && axes[rank - 2] == rank - 1 && axes[rank - 1] == rank - 2) return transpose(input);
+			}
+
+			std::vector<T> values;
+			values.reserve(size);
+			input.flatten(values);
+			Tensor result(shape);
+			std::array<Index, rank> index{};
+			Index const cols = shape[rank - 1], step = strides[rank - 1];
+			result.each_row([&](T* row)
+			{
+				Index offset = 0;
+				for (unsigned i = 0; i + 1 < rank; i++) offset += index[i] * strides[i];
+				T const* source = values.data() + offset;
+				for (Index j = 0; j < cols; j++) row[j] = source[j * step];
+				// Next row of the result
+				for (int i = int(rank) - 2; i >= 0 && ++index[i] == shape[i]; i--) index[i] = 0;
+			});
+			return result;
 		}
 
 		friend SubTensor sum(Tensor const& input)
 		{
 			SubTensor sumTensor(input.shape().foldShape());
-			if constexpr(input.is_vector_)
+			if constexpr(is_vector_)
 			{	
 				sumTensor = std::accumulate(input.data_.begin(), input.data_.end(), T(0));
 			}
@@ -390,7 +548,7 @@ namespace dynamictensor
 
 		friend SubTensor mean(Tensor const& input)
 		{			
-			if constexpr(input.is_vector_)
+			if constexpr(is_vector_)
 			{
 				return sum(input) / input.shape()[0];
 			}
@@ -405,33 +563,574 @@ namespace dynamictensor
 			}			
 		}
 
+		// Sum of all the values
+		friend T sum_all(Tensor const& input)
+		{
+			if constexpr(is_vector_)
+			{
+				return std::accumulate(input.data_.begin(), input.data_.end(), T(0));
+			}
+			else
+			{
+				T result(0);
+				for (auto const& subTensor : input.data_) result += sum_all(subTensor);
+				return result;
+			}
+		}
+
+		// Returns a tensor of the same rank holding a single value s.
+		friend Tensor scalar_like(Tensor const&, T s)
+		{
+			Shape<rank> shape;
+			std::fill(shape.idx_, shape.idx_ + rank, 1);
+			return Tensor(shape, s);
+		}
+
+		// Bias of Linear nodes
+
+		// t += b, where b has the shape of t or, for a matrix t, is a single row added to every row.
+		friend void add_bias(Tensor& t, Tensor const& b)
+		{
+			if constexpr (rank == 2)
+			{
+				assert(b.shape_[1] == t.shape_[1] && (b.shape_[0] == t.shape_[0] || b.shape_[0] == 1));
+				for (Index i = 0; i < t.shape_[0]; i++)
+				{
+					T* row = t.data_[i].data_.data();
+					T const* bias = b.data_[b.shape_[0] == 1 ? 0 : i].data_.data();
+					for (Index j = 0; j < t.shape_[1]; j++) row[j] += bias[j];
+				}
+			}
+			else
+			{
+				t += b;
+			}
+		}
+
+		// Partial of the cost with respect to b of add_bias, summed over the rows sharing a single row b.
+		friend Tensor bias_gradient(Tensor const& grad_cost, Tensor const& b)
+		{
+			if constexpr (rank == 2)
+			{
+				if (b.shape_[0] == 1 && grad_cost.shape_[0] != 1)
+				{
+					Tensor gradient(b.shape_);
+					T* g = gradient.data_[0].data_.data();
+					for (auto const& row : grad_cost.data_)
+					{
+						for (Index j = 0; j < b.shape_[1]; j++) g[j] += row.data_[j];
+					}
+					return gradient;
+				}
+			}
+			return grad_cost;
+		}
+
+		// Shape information
+
+		// Number of elements
+		friend std::size_t size(Tensor const& t)
+		{
+			std::size_t n = 1;
+			for (Index dim : t.shape_.idx_) n *= dim;
+			return n;
+		}
+
+		friend std::vector<Index> dims(Tensor const& t)
+		{
+			return std::vector<Index>(t.shape_.idx_, t.shape_.idx_ + rank);
+		}
+
+		// Conversion to and from type-erased TensorData
+
+		friend miniflow::TensorData to_data(Tensor const& t)
+		{
+			miniflow::TensorData data;
+			data.shape_.assign(t.shape_.idx_, t.shape_.idx_ + rank);
+			t.flatten(data.values_);
+			return data;
+		}
+
+		friend void from_data(miniflow::TensorData const& data, Tensor& t)
+		{
+			assert(data.shape_.size() == rank);
+			Shape<rank> shape;
+			std::copy(data.shape_.begin(), data.shape_.end(), shape.idx_);
+			t = Tensor(shape);
+			t.unflatten(data.values_.begin());
+		}
+
 		// Dot
+		// The kernel is chosen from the shapes of the operands at run time, see product().
 
 		using DotType = typename std::conditional<rank == 1, T, Tensor>::type;
 
 		friend DotType dot(const Tensor& t1, const Tensor& t2)
 		{
-			if constexpr(t1.is_vector_)
+			if constexpr(is_vector_)
 			{
 				assert(t1.shape() == t2.shape());
-				return sum(t1*t2);
+				return inner(t1.data_.data(), t2.data_.data(), t1.shape()[0]);
 			}
-			else
+			else if constexpr(is_matrix_)
 			{
 				assert(t1.shape()[1] == t2.shape()[0]);
-				Tensor<T, 2> t2transposed = transpose(t2);
-				Tensor<T, 2> result({ t1.shape()[0], t2.shape()[1] });
-				t1.each([&](int i, Tensor<T, 1> const& row) {result[i] = dot(t2transposed, row); });
+				Tensor result({ t1.shape()[0], t2.shape()[1] });
+				product(t1, t2, result);
 				return result;
-			}			
+			}
+			else
+			{
+				// Batched matrix product over the first dimension
+				static_assert(rank == 3, "dot is defined up to rank 3");
+				assert(t1.shape()[0] == t2.shape()[0] && t1.shape()[2] == t2.shape()[1]);
+				Tensor result({ t1.shape()[0], t1.shape()[1], t2.shape()[2] });
+				gemm_batched(t1, t2, result);
+				return result;
+			}
 		}
 
+		// t = dot(t1, t2) for matrices, written into the rows of t when it already has the shape of the product
+		friend void assign_dot(Tensor& t, const Tensor& t1, const Tensor& t2)
+		{
+			if constexpr(is_matrix_)
+			{
+				assert(t1.shape()[1] == t2.shape()[0]);
+				if (t.shape() == Shape<rank>{ t1.shape()[0], t2.shape()[1] })
+				{
+					t.fill(0);
+					product(t1, t2, t);
+					return;
+				}
+			}
+			t = dot(t1, t2);
+		}
+
+		// Matrix by vector
 		friend Tensor dot(const Tensor<T, rank + 1>& t1, const Tensor& t2)
 		{
+			static_assert(is_vector_, "the right operand must be a vector");
 			assert(t1.shape()[1] == t2.shape()[0]);
-			Tensor<T, 1> result({ t1.shape()[0] });
-			t1.each([&](int i, Tensor const& row) {result[i] = dot(row, t2); });
+			Tensor result({ t1.shape()[0] });
+			gemv(t1, t2.data_.data(), result.data_.data());
+			return result;
+		}
+
+		// Vector by matrix
+		friend Tensor dot(const Tensor& t1, const Tensor<T, rank + 1>& t2)
+		{
+			static_assert(is_vector_, "the left operand must be a vector");
+			assert(t1.shape()[0] == t2.shape()[0]);
+			Tensor result({ t2.shape()[1] });
+			gemv_t(t2, t1.data_.data(), result.data_.data());
+			return result;
+		}
+
+		// dot(t1, transpose(t2)) without the transposed copy
+		friend Tensor dot_nt(const Tensor& t1, const Tensor& t2)
+		{
+			static_assert(is_matrix_, "dot_nt requires matrices");
+			assert(t1.shape()[1] == t2.shape()[1]);
+			Tensor result({ t1.shape()[0], t2.shape()[0] });
+			gemm_nt(t1, t2, result);
+			return result;
+		}
+
+		// dot(transpose(t1), t2) without the transposed copy
+		friend Tensor dot_tn(const Tensor& t1, const Tensor& t2)
+		{
+			static_assert(is_matrix_, "dot_tn requires matrices");
+			assert(t1.shape()[0] == t2.shape()[0]);
+			Tensor result({ t1.shape()[1], t2.shape()[1] });
+			if (t1.shape()[0] == 1) ger(t1.data_[0].data_.data(), t2.data_[0].data_.data(), result);
+			else gemm_tn(t1, t2, result);
 			return result;
 		}
 	};
+
+	// Transpose kernels
+
+#if defined(__AVX__)
+	// Writes the 4 x 4 tile of doubles at column col of the rows src to column row of the rows dst, transposed in registers.
+	inline void transpose_4x4(double const* const* src, Index col, double* const* dst, Index row)
+	{
+		__m256d const r0 = _mm256_loadu_pd(src[0] + col), r1 = _mm256_loadu_pd(src[1] + col);
+		__m256d const r2 = _mm256_loadu_pd(src[2] + col), r3 = _mm256_loadu_pd(src[3] + col);
+		// Pairs of rows interleaved: { r0[0], r1[0], r0[2], r1[2] }, { r0[1], r1[1], r0[3], r1[3] }...
+		__m256d const t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+		__m256d const t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+		_mm256_storeu_pd(dst[0] + row, _mm256_permute2f128_pd(t0, t2, 0x20));
+		_mm256_storeu_pd(dst[1] + row, _mm256_permute2f128_pd(t1, t3, 0x20));
+		_mm256_storeu_pd(dst[2] + row, _mm256_permute2f128_pd(t0, t2, 0x31));
+		_mm256_storeu_pd(dst[3] + row, _mm256_permute2f128_pd(t1, t3, 0x31));
+	}
+#endif
+
+	// B = transpose(A), B allocated with the transposed shape.
+	// Blocks of 32 x 32 values are read and written while in cache, by tiles of 4 x 4 values,
+	// transposed in registers for doubles on AVX. Blocks of columns of large matrices run in parallel.
+	template<class T>
+	void transpose_into(Tensor<T, 2> const& A, Tensor<T, 2>& B)
+	{
+		Index const M = A.shape_[0], N = A.shape_[1];
+		assert(B.shape_[0] == N && B.shape_[1] == M);
+		constexpr Index block = 32;
+		constexpr std::size_t parallel_size = 1 << 16;
+
+		auto column_block = [&](Index j0)
+		{
+			Index const j1 = std::min(N, j0 + block);
+			for (Index i0 = 0; i0 < M; i0 += block)
+			{
+				Index const i1 = std::min(M, i0 + block);
+				Index i = i0;
+				for (; i + 4 <= i1; i += 4)
+				{
+					T const* src[4] = { A.data_[i].data_.data(), A.data_[i + 1].data_.data(), A.data_[i + 2].data_.data(), A.data_[i + 3].data_.data() };
+					Index j = j0;
+#if defined(__AVX__)
+					if constexpr (std::is_same_v<T, double>)
+					{
+						for (; j + 4 <= j1; j += 4)
+						{
+							double* dst[4] = { B.data_[j].data_.data(), B.data_[j + 1].data_.data(), B.data_[j + 2].data_.data(), B.data_[j + 3].data_.data() };
+							transpose_4x4(src, j, dst, i);
+						}
+					}
+#endif
+					for (; j < j1; j++)
+					{
+						T* dst = B.data_[j].data_.data() + i;
+						dst[0] = src[0][j];
+						dst[1] = src[1][j];
+						dst[2] = src[2][j];
+						dst[3] = src[3][j];
+					}
+				}
+				for (; i < i1; i++)
+				{
+					T const* src = A.data_[i].data_.data();
+					for (Index j = j0; j < j1; j++) B.data_[j].data_[i] = src[j];
+				}
+			}
+		};
+
+		Index const blocks = (N + block - 1) / block;
+		if (std::size_t(M) * N >= parallel_size && blocks > 1)
+		{
+			miniflow::parallelFor(0, blocks, [&](Index b) { column_block(b * block); });
+		}
+		else
+		{
+			for (Index b = 0; b < blocks; b++) column_block(b * block);
+		}
+	}
+
+	// Transposes the last two axes of every matrix of A into B.
+	template<class T, unsigned rank>
+	void transpose_into(Tensor<T, rank> const& A, Tensor<T, rank>& B)
+	{
+		for (Index i = 0; i < A.shape_[0]; i++) transpose_into(A.data_[i], B.data_[i]);
+	}
+
+	struct GemmBlocking
+	{
+		/*
+			Block sizes of the matrix product kernels.
+			A panel of depth_ rows by cols_ columns of the right operand is kept in cache
+			while it is multiplied by every row of the left operand.
+			gemm_nt copies the panels of transpose(B) into a contiguous buffer first
+			when A has pack_rows_ rows or more, so that the copy is shared by enough rows.
+			The rows of the result are split between up to threads_ threads.
+			gemm_blocking starts from heuristic_gemm_blocking(), load_gemm_profile() or autotune_gemm() of Autotune.h replace it.
+		*/
+
+		Index depth_ = 128;
+		Index cols_ = 512;
+		Index pack_rows_ = 4;
+		Index threads_ = 1;
+	};
+
+	struct MachineInfo
+	{
+		std::size_t threads_;		//: Hardware threads.
+		std::size_t l1_;			//: Bytes of level 1 data cache of a core.
+		std::size_t l2_;			//: Bytes of level 2 cache of a core.
+
+		bool operator==(MachineInfo const& info) const { return threads_ == info.threads_ && l1_ == info.l1_ && l2_ == info.l2_; }
+	};
+
+	// The machine a profile is made for. Cache sizes the system does not report are assumed 32KB and 1MB.
+	inline MachineInfo machine_info()
+	{
+		MachineInfo info{ std::max(1u, std::thread::hardware_concurrency()), 32 << 10, 1 << 20 };
+#ifdef MINIFLOW_DYNAMICTENSOR_SYSCONF
+		if (long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE); l1 > 0) info.l1_ = std::size_t(l1);
+		if (long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE); l2 > 0) info.l2_ = std::size_t(l2);
+#endif
+		return info;
+	}
+
+	// Blocking derived from the cache sizes.
+	// A row of cols_ values of the result and the four rows of the panel read with it fit in L1,
+	// a panel of depth_ x cols_ values fits in half of L2. Products run on one thread:
+	// graphs with several nodes in flight and Predictor workers are parallel already.
+	inline dynamictensor::GemmBlocking heuristic_gemm_blocking(MachineInfo const& info = machine_info())
+	{
+		auto floor_power_of_2 = [](std::size_t n, std::size_t min, std::size_t max)
+		{
+			std::size_t power = min;
+			while (power * 2 <= std::min(n, max)) power *= 2;
+			return Index(power);
+		};
+
+		dynamictensor::GemmBlocking blocking;
+		blocking.cols_ = floor_power_of_2(info.l1_ / (5 * sizeof(Scalar)), 64, 1024);
+		blocking.depth_ = floor_power_of_2(info.l2_ / 2 / (blocking.cols_ * sizeof(Scalar)), 32, 512);
+		blocking.threads_ = 1;
+		return blocking;
+	}
+
+	// Blocking of the products of the process, the heuristic one until load_gemm_profile() or autotune_gemm() sets it.
+	inline GemmBlocking gemm_blocking = heuristic_gemm_blocking();
+
+	// Calls fn(i0, i1) on ranges of the M rows of a product, in parallel on up to threads threads.
+	// Ranges have 16 rows at least, a thread is not worth fewer.
+	template<typename F>
+	void split_rows(Index M, Index threads, F fn)
+	{
+		threads = std::max(Index(1), std::min(threads, M / 16));
+		if (threads == 1)
+		{
+			fn(Index(0), M);
+			return;
+		}
+		miniflow::parallelFor(0, threads, [&](Index t) { fn(M * t / threads, M * (t + 1) / threads); });
+	}
+
+	// Matrix product kernels on row-major matrices.
+	// They accumulate into C, which must be allocated with the shape of the result.
+
+	// c[0, n) += a(k) * row(k)[0, n) for every k in [0, count).
+	// Four rows per pass over c, the inner loop of the product kernels.
+	template<class T, typename A, typename Row>
+	void accumulate_rows(T* c, Index n, Index count, A a, Row row)
+	{
+		Index k = 0;
+		for (; k + 4 <= count; k += 4)
+		{
+			T const a0 = a(k), a1 = a(k + 1), a2 = a(k + 2), a3 = a(k + 3);
+			T const* b0 = row(k);
+			T const* b1 = row(k + 1);
+			T const* b2 = row(k + 2);
+			T const* b3 = row(k + 3);
+			for (Index j = 0; j < n; j++) c[j] += a0 * b0[j] + a1 * b1[j] + a2 * b2[j] + a3 * b3[j];
+		}
+		for (; k < count; k++)
+		{
+			T const a0 = a(k);
+			T const* b0 = row(k);
+			for (Index j = 0; j < n; j++) c[j] += a0 * b0[j];
+		}
+	}
+
+	// C += A * B
+	template<class T>
+	void gemm(Tensor<T, 2> const& A, Tensor<T, 2> const& B, Tensor<T, 2>& C)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1], N = B.shape_[1];
+		assert(B.shape_[0] == K && C.shape_[0] == M && C.shape_[1] == N);
+		GemmBlocking const blocking = gemm_blocking;
+
+		split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+		{
+			for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+			{
+				Index const j1 = std::min(N, j0 + blocking.cols_);
+				for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+				{
+					Index const k1 = std::min(K, k0 + blocking.depth_);
+					for (Index i = i0; i < i1; i++)
+					{
+						T const* a = A.data_[i].data_.data() + k0;
+						accumulate_rows(C.data_[i].data_.data() + j0, j1 - j0, k1 - k0,
+							[&](Index k) { return a[k]; },
+							[&](Index k) { return B.data_[k0 + k].data_.data() + j0; });
+					}
+				}
+			}
+		});
+	}
+
+	// C += A * transpose(B)
+	template<class T>
+	void gemm_nt(Tensor<T, 2> const& A, Tensor<T, 2> const& B, Tensor<T, 2>& C)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1], N = B.shape_[0];
+		assert(B.shape_[1] == K && C.shape_[0] == M && C.shape_[1] == N);
+		GemmBlocking const blocking = gemm_blocking;
+
+		if (M < blocking.pack_rows_)
+		{
+			// Dot products of the rows of A and B
+			for (Index i = 0; i < M; i++)
+			{
+				T* c = C.data_[i].data_.data();
+				T const* a = A.data_[i].data_.data();
+				for (Index j = 0; j < N; j++) c[j] += inner(a, B.data_[j].data_.data(), K);
+			}
+			return;
+		}
+
+		// Rows of the panel are padded, rows a multiple of 4KB apart would evict each other from the cache
+		Index const stride = blocking.cols_ + 8;
+		std::vector<T> panel(std::size_t(blocking.depth_) * stride);
+		for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+		{
+			Index const j1 = std::min(N, j0 + blocking.cols_), width = j1 - j0;
+			for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+			{
+				Index const k1 = std::min(K, k0 + blocking.depth_);
+				// Row k - k0 of the panel is column k of the rows j0 to j1 of B, copied by tiles of 8 rows of B
+				for (Index jt = j0; jt < j1; jt += 8)
+				{
+					Index const rows = std::min(Index(8), j1 - jt);
+					T const* b[8];
+					for (Index l = 0; l < rows; l++) b[l] = B.data_[jt + l].data_.data();
+					for (Index k = k0; k < k1; k++)
+					{
+						T* p = panel.data() + std::size_t(k - k0) * stride + (jt - j0);
+						for (Index l = 0; l < rows; l++) p[l] = b[l][k];
+					}
+				}
+				split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+				{
+					for (Index i = i0; i < i1; i++)
+					{
+						T const* a = A.data_[i].data_.data() + k0;
+						accumulate_rows(C.data_[i].data_.data() + j0, width, k1 - k0,
+							[&](Index k) { return a[k]; },
+							[&](Index k) { return panel.data() + std::size_t(k) * stride; });
+					}
+				});
+			}
+		}
+	}
+
+	// C += transpose(A) * B
+	template<class T>
+	void gemm_tn(Tensor<T, 2> const& A, Tensor<T, 2> const& B, Tensor<T, 2>& C)
+	{
+		Index const K = A.shape_[0], M = A.shape_[1], N = B.shape_[1];
+		assert(B.shape_[0] == K && C.shape_[0] == M && C.shape_[1] == N);
+		GemmBlocking const blocking = gemm_blocking;
+
+		split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+		{
+			for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+			{
+				Index const j1 = std::min(N, j0 + blocking.cols_);
+				for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+				{
+					Index const k1 = std::min(K, k0 + blocking.depth_);
+					for (Index i = i0; i < i1; i++)
+					{
+						accumulate_rows(C.data_[i].data_.data() + j0, j1 - j0, k1 - k0,
+							[&](Index k) { return A.data_[k0 + k].data_[i]; },
+							[&](Index k) { return B.data_[k0 + k].data_.data() + j0; });
+					}
+				}
+			}
+		});
+	}
+
+	// Kernels of the products with a dimension of 1, where the blocked loops of gemm degenerate.
+
+	// y += A * x
+	template<class T>
+	void gemv(Tensor<T, 2> const& A, T const* x, T* y)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1];
+		for (Index i = 0; i < M; i++) y[i] += inner(A.data_[i].data_.data(), x, K);
+	}
+
+	// y += transpose(A) * x
+	template<class T>
+	void gemv_t(Tensor<T, 2> const& A, T const* x, T* y)
+	{
+		accumulate_rows(y, A.shape_[1], A.shape_[0],
+			[&](Index k) { return x[k]; },
+			[&](Index k) { return A.data_[k].data_.data(); });
+	}
+
+	// C += x * transpose(y), the outer product of two vectors
+	template<class T>
+	void ger(T const* x, T const* y, Tensor<T, 2>& C)
+	{
+		Index const M = C.shape_[0], N = C.shape_[1];
+		for (Index i = 0; i < M; i++)
+		{
+			T* c = C.data_[i].data_.data();
+			T const x0 = x[i];
+			for (Index j = 0; j < N; j++) c[j] += x0 * y[j];
+		}
+	}
+
+	// C[b] += A[b] * B[b] for every matrix b of the batch, in parallel
+	template<class T>
+	void gemm_batched(Tensor<T, 3> const& A, Tensor<T, 3> const& B, Tensor<T, 3>& C)
+	{
+		assert(B.shape_[0] == A.shape_[0] && C.shape_[0] == A.shape_[0]);
+		miniflow::parallelFor(0, A.shape_[0], [&](Index b) { product(A.data_[b], B.data_[b], C.data_[b]); });
+	}
+
+	enum class Product { inner, gemv, gemv_t, outer, gemm };
+
+	// Kernel of the product of an M x K by a K x N matrix
+	inline Product classify(Index M, Index K, Index N)
+	{
+		if (M == 1 && N == 1) return Product::inner;
+		if (K == 1) return Product::outer;
+		if (N == 1) return Product::gemv;
+		if (M == 1) return Product::gemv_t;
+		return Product::gemm;
+	}
+
+	// C += A * B with the kernel for the shapes.
+	// A right operand of one column is not contiguous, it is gathered into a vector first.
+	template<class T>
+	void product(Tensor<T, 2> const& A, Tensor<T, 2> const& B, Tensor<T, 2>& C)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1], N = B.shape_[1];
+		assert(B.shape_[0] == K && C.shape_[0] == M && C.shape_[1] == N);
+		auto column = [](Tensor<T, 2> const& t)
+		{
+			std::vector<T> values(t.shape_[0]);
+			for (Index i = 0; i < t.shape_[0]; i++) values[i] = t.data_[i].data_[0];
+			return values;
+		};
+
+		switch (classify(M, K, N))
+		{
+		case Product::inner:
+			C.data_[0].data_[0] += inner(A.data_[0].data_.data(), column(B).data(), K);
+			break;
+		case Product::gemv:
+		{
+			std::vector<T> y(M, T(0));
+			gemv(A, column(B).data(), y.data());
+			for (Index i = 0; i < M; i++) C.data_[i].data_[0] += y[i];
+			break;
+		}
+		case Product::gemv_t:
+			gemv_t(B, A.data_[0].data_.data(), C.data_[0].data_.data());
+			break;
+		case Product::outer:
+			ger(column(A).data(), B.data_[0].data_.data(), C);
+			break;
+		case Product::gemm:
+			gemm(A, B, C);
+			break;
+		}
+	}
 } //namespace dynamictensor
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace sparsetensor
+{
+	using miniflow::Index;
+	using miniflow::parallelFor;
+
+	template<class T>
+	struct RowGradient
+	{
+		/*
+			Gradient of a matrix that is zero outside a few rows, e.g. of an embedding table of which
+			a batch reads a few rows. Row rows_[i] of the gradient is row i of values_, rows_ is sorted
+			and has no duplicates. Memory is O(touched rows) whatever the number of rows of the matrix.
+		*/
+
+		std::vector<Index> rows_;
+		dynamictensor::Tensor<T, 2> values_;
+
+		std::size_t size() const { return rows_.size(); }
+	};
+
+	// Sums the source rows with the same index into a RowGradient of cols columns.
+	// Sources are sorted by index first, so every output row is summed by a single task, in the order of
+	// the sources: the parallel scatter has no contention and its result does not depend on the scheduling.
+	template<class T>
+	RowGradient<T> sum_rows(std::vector<Index> const& indices, std::vector<T const*> const& sources, Index cols)
+	{
+		assert(indices.size() == sources.size());
+		std::vector<Index> order(indices.size());
+		std::iota(order.begin(), order.end(), Index(0));
+		std::sort(order.begin(), order.end(), [&](Index a, Index b) { return indices[a] != indices[b] ? indices[a] < indices[b] : a < b; });
+
+		// Start of the run of every output row in order
+		RowGradient<T> result;
+		std::vector<Index> starts;
+		for (Index k = 0; k < order.size(); k++)
+		{
+			if (k > 0 && indices[order[k]] == indices[order[k - 1]]) continue;
+			starts.push_back(k);
+			result.rows_.push_back(indices[order[k]]);
+		}
+		starts.push_back(Index(order.size()));
+
+		result.values_ = dynamictensor::Tensor<T, 2>({ Index(result.rows_.size()), cols });
+		parallelFor(0, Index(result.rows_.size()), [&](Index i)
+		{
+			T* target = result.values_.data_[i].data_.data();
+			for (Index k = starts[i]; k < starts[i + 1]; k++)
+			{
+				T const* source = sources[order[k]];
+				for (Index j = 0; j < cols; j++) target[j] += source[j];
+			}
+		});
+		return result;
+	}
+}
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class EmbeddingTable : public Node<Tensor>
+	{
+		/*
+			A trainable rows x dimensions matrix read by Embedding nodes.
+
+			Unlike a Trainable, its gradient is a RowGradient holding the rows the batch read only,
+			and an SGD step only updates these rows, in parallel and without contention since the rows
+			are distinct. A step costs O(batch) rather than O(rows), so tables may have millions of rows.
+			Every outbound node must be an Embedding.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "EmbeddingTable requires dynamictensor matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::outbound_nodes_;
+
+	private:
+
+		sparsetensor::RowGradient<T> row_gradient_;
+
+	public:
+
+		explicit EmbeddingTable(Tensor const& table) :
+			Node(std::vector<Node*>(0))
+		{
+			value_ = table;
+			this->stale_ = false;
+		}
+
+		// Sums the row gradients of the Embedding nodes reading the table.
+		void backward() final;
+
+		// Performs SGD step on the rows of the last gradient
+		void update(Scalar learning_rate) final
+		{
+			Index const cols = value_.shape()[1];
+			parallelFor(0, Index(row_gradient_.size()), [&](Index i)
+			{
+				T* target = value_.data_[row_gradient_.rows_[i]].data_.data();
+				T const* gradient = row_gradient_.values_.data_[i].data_.data();
+				for (Index j = 0; j < cols; j++) target[j] -= T(learning_rate) * gradient[j];
+			});
+			this->invalidate();
+		}
+
+		sparsetensor::RowGradient<T> const& getRowGradient() const { return row_gradient_; }
+
+		bool is_input() const final { return true; }
+		bool is_trainable() const final { return true; }
+		char const* type() const final { return "EmbeddingTable"; }
+
+		// As for Input, there is nothing to compute.
+		void invalidate() final { this->invalidate_outputs(); }
+
+		std::size_t flops() const final { return 0; }
+		std::size_t bytes() const final { return 0; }
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.gradients_ += storage_bytes(row_gradient_.values_) + row_gradient_.size() * sizeof(Index);
+			return usage;
+		}
+	};
+
+	template<typename Tensor>
+	class Embedding : public Node<Tensor>
+	{
+		/*
+			Represents a node that looks up rows of an embedding table, e.g. for categorical features.
+
+			Input is {indices, table}:
+				indices is examples x fields, every value the number of a row of the table,
+				table is an EmbeddingTable of rows x dimensions.
+			Output is examples x (fields * dimensions), the rows of the fields of an example side by side.
+
+			It replaces a one-hot input of a Linear node: forward copies rows instead of multiplying by the
+			whole table, and backward returns the gradient of the rows read only, as a RowGradient,
+			in O(examples * fields * dimensions), instead of a dense partial with respect to the table.
+			No gradient flows into the indices.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "Embedding requires dynamictensor matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+
+	private:
+
+		sparsetensor::RowGradient<T> row_gradient_;
+		std::vector<Index> rows_;				//: Row of every field of every example, in row-major order.
+
+	public:
+
+		Embedding(Node& indices, EmbeddingTable<Tensor>& table) :
+			Node(std::vector<Node*>{ &indices, &table })
+		{
+		}
+
+		void forward() final
+		{
+			auto const& indices = inbound_nodes_[0]->getValue();
+			auto const& table = inbound_nodes_[1]->getValue();
+			Index const examples = indices.shape()[0], fields = indices.shape()[1], dimensions = table.shape()[1];
+
+			rows_.resize(std::size_t(examples) * fields);
+			for (Index n = 0; n < examples; n++)
+			{
+				for (Index f = 0; f < fields; f++)
+				{
+					Index const row = Index(indices.data_[n].data_[f]);
+					assert(row < table.shape()[0]);
+					rows_[std::size_t(n) * fields + f] = row;
+				}
+			}
+
+			if (value_.shape() != dynamictensor::Shape<2>{ examples, fields * dimensions }) value_ = Tensor({ examples, fields * dimensions });
+			for (Index n = 0; n < examples; n++)
+			{
+				T* target = value_.data_[n].data_.data();
+				for (Index f = 0; f < fields; f++)
+				{
+					auto const& source = table.data_[rows_[std::size_t(n) * fields + f]].data_;
+					std::copy(source.begin(), source.end(), target + f * dimensions);
+				}
+			}
+		}
+
+		void backward() final
+		{
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				row_gradient_ = {};
+				return;
+			}
+			auto const& grad_cost = *partial;
+			Index const dimensions = inbound_nodes_[1]->getValue().shape()[1];
+			Index const fields = Index(rows_.size() / grad_cost.shape()[0]);
+
+			std::vector<T const*> sources(rows_.size());
+			for (std::size_t k = 0; k < rows_.size(); k++)
+			{
+				sources[k] = grad_cost.data_[k / fields].data_.data() + (k % fields) * dimensions;
+			}
+			row_gradient_ = sparsetensor::sum_rows(rows_, sources, dimensions);
+		}
+
+		sparsetensor::RowGradient<T> const& getRowGradient() const { return row_gradient_; }
+
+		char const* type() const final { return "Embedding"; }
+
+		// Copies the rows read, one operation per output value.
+		std::size_t flops() const final { return size(value_); }
+		std::size_t bytes() const final { return 2 * size(value_) * sizeof(T); }
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.gradients_ += storage_bytes(row_gradient_.values_) + row_gradient_.size() * sizeof(Index);
+			usage.state_ = rows_.size() * sizeof(Index);
+			return usage;
+		}
+	};
+
+	template<typename Tensor>
+	void EmbeddingTable<Tensor>::backward()
+	{
+		if (outbound_nodes_.size() == 1)
+		{
+			row_gradient_ = dynamic_cast<Embedding<Tensor> const&>(*outbound_nodes_[0].node).getRowGradient();
+			return;
+		}
+
+		// Tables shared by several Embedding nodes sum the rows read by every node
+		Index const cols = value_.shape()[1];
+		std::vector<Index> rows;
+		std::vector<T const*> sources;
+		for (auto const& outbound_node : outbound_nodes_)
+		{
+			auto const& embedding = dynamic_cast<Embedding<Tensor> const&>(*outbound_node.node);
+			sparsetensor::RowGradient<T> const& gradient = embedding.getRowGradient();
+			for (std::size_t i = 0; i < gradient.size(); i++)
+			{
+				rows.push_back(gradient.rows_[i]);
+				sources.push_back(gradient.values_.data_[i].data_.data());
+			}
+		}
+		row_gradient_ = sparsetensor::sum_rows(rows, sources, cols);
+	}
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include "Graph.h"
+#include "Normalization.h"
+
+namespace miniflow
+{
+	struct FoldReport
+	{
+		std::size_t nodes_before_ = 0;		//: Nodes of the original network.
+		std::size_t nodes_after_ = 0;		//: Nodes of the folded network.
+		std::size_t constants_ = 0;			//: Computed nodes that depend on constants only, replaced by their values.
+		std::size_t affines_ = 0;			//: Affine and BatchNorm nodes merged into the W and b of a Linear node.
+		std::size_t identities_ = 0;		//: Identity nodes, and Affine nodes that scale by 1 and shift by 0, removed.
+	};
+
+	template<typename Tensor>
+	class FoldedNetwork
+	{
+		/*
+			A copy of a trained network optimized for inference.
+
+			The inputs are the nodes set at inference time; every other Input and Trainable is a constant.
+			The folded network is built in topological order:
+				computed nodes that depend on constants only are evaluated once and replaced by Input nodes
+				holding their values,
+				Affine nodes, and BatchNorm nodes in inference mode, whose input is a Linear node with constant
+				W and b and no other consumer are merged into it: W * scale and b * scale + shift,
+				Identity nodes, and Affine nodes that scale by 1 and shift by 0, are removed,
+				other BatchNorm nodes become Affine nodes,
+				Linear nodes and the activations are copied.
+			Other nodes are not supported. Every node removed is a pass over the values removed from forward().
+
+			The folded network reads the original input nodes, so their values are set on them as before,
+			and holds copies of the constants, so later changes to the trainables of the original network do not
+			affect it. As for a Predictor, the original network must not be trained while the folded network exists:
+			its inputs have the folded nodes as additional consumers.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "FoldedNetwork requires examples x features matrices");
+
+		using T = typename Tensor::ValueType;
+
+		Nodes<Tensor> nodes_;
+		Node<Tensor>& original_output_;
+		std::unique_ptr<Graph> original_;
+		std::unique_ptr<Graph> graph_;
+		Node<Tensor>* output_ = nullptr;
+		FoldReport report_;
+
+		struct Parameters
+		{
+			Input<Tensor>* W_;
+			Input<Tensor>* b_;
+			std::vector<NodeInterface*> aliases_;				//: Original nodes whose value it computes.
+		};
+
+		std::map<NodeInterface*, Node<Tensor>*> folded_;		//: Node of the folded network computing the value of an original node.
+		std::map<NodeInterface*, Input<Tensor>*> constants_;	//: Input node holding the value of a constant original node.
+		std::map<Node<Tensor>*, Parameters> linears_;			//: Linear nodes of the folded network with their own constant W and b.
+
+		static Node<Tensor>& as_node(NodeInterface* node) { return static_cast<Node<Tensor>&>(*node); }
+
+		// Records that a node of the folded network computes the value of an original node.
+		void alias(NodeInterface* node, Node<Tensor>& folded)
+		{
+			folded_[node] = &folded;
+			auto linear = linears_.find(&folded);
+			if (linear != linears_.end()) linear->second.aliases_.push_back(node);
+		}
+
+		Node<Tensor>& constant(NodeInterface* node)
+		{
+			auto it = constants_.find(node);
+			if (it != constants_.end()) return *it->second;
+			return *constants_.emplace(node, &nodes_.template add<Input<Tensor>>(as_node(node).getValue())).first->second;
+		}
+
+		Node<Tensor>& input(NodeInterface* node)
+		{
+			auto it = folded_.find(node);
+			return it != folded_.end() ? *it->second : constant(node);
+		}
+
+		template<typename Function>
+		bool copy_activation(NodeInterface* node)
+		{
+			auto* activation = dynamic_cast<Activation<Tensor, Function>*>(node);
+			if (!activation) return false;
+			folded_[node] = &nodes_.template add<Activation<Tensor, Function>>(input(node->inbound_nodes()[0]), false, activation->function());
+			return true;
+		}
+
+		// Folds y = x * scale + shift, per feature, into the node computing x.
+		void affine(NodeInterface* node, Tensor const& scale, Tensor const& shift, std::map<NodeInterface*, std::size_t> const& consumers)
+		{
+			NodeInterface* x = node->inbound_nodes()[0];
+			Node<Tensor>& folded_x = input(x);
+			T const* s = scale.data_[0].data_.data();
+			T const* t = shift.data_[0].data_.data();
+			Index const features = scale.shape()[1];
+
+			// The values of the Linear node change, so the node being folded must be their only reader:
+			// every alias but the last is read by the next one.
+			auto linear = linears_.find(&folded_x);
+			std::size_t readers = 0;
+			if (linear != linears_.end())
+			{
+				for (NodeInterface* a : linear->second.aliases_) readers += consumers.at(a);
+				readers -= linear->second.aliases_.size() - 1;
+			}
+			if (readers == 1)
+			{
+				Tensor W = linear->second.W_->getValue(), b = linear->second.b_->getValue();
+				W.each_row([&](T* row) { for (Index j = 0; j < features; j++) row[j] *= s[j]; });
+				b.each_row([&](T* row) { for (Index j = 0; j < features; j++) row[j] = row[j] * s[j] + t[j]; });
+				linear->second.W_->setValue(W);
+				linear->second.b_->setValue(b);
+				alias(node, folded_x);
+				report_.affines_++;
+				return;
+			}
+
+			bool identity = true;
+			for (Index j = 0; j < features; j++) identity = identity && s[j] == T(1) && t[j] == T(0);
+			if (identity)
+			{
+				alias(node, folded_x);
+				report_.identities_++;
+				return;
+			}
+			auto& gamma = nodes_.template add<Input<Tensor>>(scale);
+			auto& beta = nodes_.template add<Input<Tensor>>(shift);
+			folded_[node] = &nodes_.template add<Affine<Tensor>>(folded_x, gamma, beta);
+		}
+
+	public:
+
+		FoldedNetwork(Node<Tensor>& output, std::vector<Node<Tensor>*> const& inputs) :
+			original_output_(output),
+			original_(std::make_unique<Graph>(output))
+		{
+			std::set<NodeInterface*> variable(inputs.begin(), inputs.end());
+			// The output is read by the caller
+			std::map<NodeInterface*, std::size_t> consumers{ { &output, 1 } };
+			for (NodeInterface* node : original_->nodes())
+			{
+				for (NodeInterface* x : node->inbound_nodes()) consumers[x]++;
+			}
+			report_.nodes_before_ = original_->nodes().size();
+
+			for (NodeInterface* node : original_->nodes())
+			{
+				if (variable.count(node))
+				{
+					folded_[node] = &as_node(node);
+					continue;
+				}
+				std::vector<NodeInterface*> const node_inputs = node->inbound_nodes();
+				bool const depends_on_inputs = std::any_of(node_inputs.begin(), node_inputs.end(), [&](NodeInterface* x) { return variable.count(x) > 0; });
+				if (!depends_on_inputs)
+				{
+					// Evaluated now, its value becomes an Input of the folded network when another node reads it
+					if (!node->is_input())
+					{
+						node->forward();
+						report_.constants_++;
+					}
+					continue;
+				}
+				variable.insert(node);
+
+				std::string const type = node->type();
+				if (type == "Linear")
+				{
+					NodeInterface* W = node_inputs[1];
+					NodeInterface* b = node_inputs[2];
+					if (variable.count(W) || variable.count(b))
+					{
+						folded_[node] = &nodes_.template add<Linear<Tensor>>(input(node_inputs[0]), input(W), input(b));
+						continue;
+					}
+					// Own copies of W and b, which a following Affine node may change
+					auto& W_copy = nodes_.template add<Input<Tensor>>(as_node(W).getValue());
+					auto& b_copy = nodes_.template add<Input<Tensor>>(as_node(b).getValue());
+					Node<Tensor>& linear = nodes_.template add<Linear<Tensor>>(input(node_inputs[0]), W_copy, b_copy);
+					linears_[&linear] = { &W_copy, &b_copy, { node } };
+					folded_[node] = &linear;
+				}
+				else if (type == "Affine" || type == "BatchNorm")
+				{
+					if (variable.count(node_inputs[1]) || variable.count(node_inputs[2]))
+					{
+						throw std::runtime_error("Fold: " + type + " with parameters computed from the inputs");
+					}
+					if (type == "Affine")
+					{
+						affine(node, as_node(node_inputs[1]).getValue(), as_node(node_inputs[2]).getValue(), consumers);
+					}
+					else
+					{
+						auto& batch_norm = dynamic_cast<BatchNorm<Tensor>&>(*node);
+						if (batch_norm.is_training()) throw std::runtime_error("Fold: BatchNorm in training mode");
+						auto const [scale, shift] = batch_norm.inference_affine();
+						affine(node, scale, shift, consumers);
+					}
+				}
+				else if (type == "Identity")
+				{
+					alias(node, input(node_inputs[0]));
+					report_.identities_++;
+				}
+				else if (!copy_activation<SigmoidFunction>(node) && !copy_activation<TanhFunction>(node) && !copy_activation<ReLUFunction>(node)
+					&& !copy_activation<LeakyReLUFunction>(node) && !copy_activation<GELUFunction>(node))
+				{
+					throw std::runtime_error("Fold: unsupported node " + type);
+				}
+			}
+
+			output_ = &input(&output);
+			graph_ = std::make_unique<Graph>(*output_);
+			report_.nodes_after_ = graph_->nodes().size();
+		}
+
+		// Runs the folded network on the current values of the inputs.
+		Tensor const& evaluate()
+		{
+			graph_->forward();
+			return output_->getValue();
+		}
+
+		// Runs both networks on the current values of the inputs and returns the largest absolute difference
+		// of their outputs, or infinity if their shapes differ.
+		Scalar validate()
+		{
+			original_->forward();
+			Tensor const& expected = original_output_.getValue();
+			Tensor const& actual = evaluate();
+			if (expected.shape() != actual.shape()) return std::numeric_limits<Scalar>::infinity();
+
+			Scalar difference = 0;
+			for (Index i = 0; i < expected.shape()[0]; i++)
+			{
+				for (Index j = 0; j < expected.shape()[1]; j++)
+				{
+					difference = std::max(difference, Scalar(std::abs(expected.data_[i].data_[j] - actual.data_[i].data_[j])));
+				}
+			}
+			return difference;
+		}
+
+		Node<Tensor>& output() { return *output_; }
+		Graph& graph() { return *graph_; }
+		FoldReport const& report() const { return report_; }
+	};
+}
@@ -1,45 +1,140 @@
 #pragma once
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <set>
 #include "Node.h"
+#include "Profiler.h"
 
 namespace miniflow
 {
+	struct MemoryReport
+	{
+		/*
+			Bytes of tensor storage of the nodes of a Graph, see Graph::memory_report().
+		*/
+
+		struct Entry
+		{
+			NodeInterface const* node_;		//: A node of the graph.
+			MemoryUsage usage_;				//: Its bytes.
+		};
+
+		std::vector<Entry> nodes_;			//: Every node of the graph in topological order.
+		MemoryUsage total_;					//: Sums over the nodes, except temporaries_, the largest of a node.
+		std::size_t live_ = 0;				//: Live bytes of tensor storage of the process.
+		std::size_t peak_ = 0;				//: Peak of the live bytes, see MemoryTracker::reset_peak().
+
+		// Writes a table of the nodes, those holding the most bytes first.
+		void write(std::ostream& out) const
+		{
+			std::vector<Entry> entries = nodes_;
+			std::stable_sort(entries.begin(), entries.end(), [](Entry const& a, Entry const& b) { return a.usage_.held() > b.usage_.held(); });
+			auto row = [&](std::string const& label, MemoryUsage const& usage)
+			{
+				out << std::left << std::setw(32) << label << std::right
+					<< std::setw(14) << usage.values_ << std::setw(14) << usage.gradients_
+					<< std::setw(14) << usage.state_ << std::setw(14) << usage.temporaries_ << "\n";
+			};
+			out << std::left << std::setw(32) << "node" << std::right << std::setw(14) << "values" << std::setw(14) << "gradients"
+				<< std::setw(14) << "state" << std::setw(14) << "temporaries" << "\n";
+			for (Entry const& entry : entries)
+			{
+				row(entry.node_->name().empty() ? entry.node_->type() : entry.node_->name(), entry.usage_);
+			}
+			row("total", total_);
+			out << "live " << live_ << " bytes, peak " << peak_ << " bytes\n";
+		}
+	};
+
 	class Graph
 	{
 		/*
 			Stores computational graph in topological order.
 			Input nodes are calculated first.
+
+			A graph may have several outputs, e.g. a cost and the prediction or an intermediate embedding.
+			evaluate() runs only the nodes the requested targets are computed from. The pruned list of
+			nodes of every set of targets is built on its first use and cached.
 		*/
 
 		std::list<NodeInterface*> nodes_;
+		Profiler* profiler_ = nullptr;
+		std::map<std::vector<NodeInterface*>, std::vector<NodeInterface*>> plans_;		//: Nodes to evaluate, by sorted targets.
 
-		// Traverse the graph from the top to the bottom
-		template<typename F>
-		void traverse(NodeInterface* node, F fn)
+		// Visits every node once, its inputs first. Inputs are listed in the order they are found.
+		void topological_sort(NodeInterface* node, std::set<NodeInterface*>& visited, std::list<NodeInterface*>& input_nodes)
 		{
-			fn(node);
+			if (!visited.insert(node).second) return;
 			for (NodeInterface* input : node->inbound_nodes())
 			{
-				traverse(input, fn);
+				topological_sort(input, visited, input_nodes);
 			}
+			if (node->is_input()) input_nodes.push_back(node);
+			else nodes_.push_back(node);
 		}
 
-		void topological_sort(NodeInterface* output_node)
+		void topological_sort(std::vector<NodeInterface*> const& output_nodes)
 		{
 			/*
-				Sort the nodes in topological order
+				Sort the nodes in topological order.
+				Nodes shared by several paths, e.g. a Trainable used by two layers, are listed once.
 			*/
 
+			std::set<NodeInterface*> visited;
 			std::list<NodeInterface*> input_nodes;
+			for (NodeInterface* output_node : output_nodes)
+			{
+				topological_sort(output_node, visited, input_nodes);
+			}
+			nodes_.splice(nodes_.begin(), input_nodes);
+		}
+
+		// Nodes of the graph that the targets are computed from, in topological order
+		std::vector<NodeInterface*> const& plan(std::vector<NodeInterface*> targets)
+		{
+			std::sort(targets.begin(), targets.end());
+			targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+			auto it = plans_.find(targets);
+			if (it != plans_.end()) return it->second;
 
-			traverse(output_node, [&](NodeInterface* node)
+			std::set<NodeInterface*> required(targets.begin(), targets.end());
+			std::vector<NodeInterface*> plan;
+			// In reverse topological order every node is seen after the nodes computed from it
+			for (NodeInterface* node : boost::adaptors::reverse(nodes_))
 			{
-				if (node->is_input()) input_nodes.push_front(node);
-				else nodes_.push_front(node);
-			});
+				if (!required.count(node)) continue;
+				plan.push_back(node);
+				for (NodeInterface* input : node->inbound_nodes()) required.insert(input);
+			}
+			assert(std::all_of(targets.begin(), targets.end(), [&](NodeInterface* target) { return std::count(plan.begin(), plan.end(), target); }));
+			std::reverse(plan.begin(), plan.end());
+			return plans_.emplace(std::move(targets), std::move(plan)).first->second;
+		}
 
-			for (NodeInterface* node : input_nodes)
+		// Runs a pass of a node, through the profiler when one is attached,
+		// and records the bytes the call allocated and released while memory accounting is enabled.
+		template<typename F>
+		void run(NodeInterface* node, Phase phase, F fn)
+		{
+			bool const accounted = memory_tracker.enabled();
+			std::size_t const before = accounted ? memory_tracker.begin_scope() : 0;
+			if (profiler_) profiler_->record(node, phase, fn);
+			else fn();
+			if (!accounted) return;
+			std::size_t const held = std::max(before, memory_tracker.live()), peak = memory_tracker.scope_peak();
+			node->record_temporaries(peak > held ? peak - held : 0);
+		}
+
+		// Recomputes the stale nodes of a list in topological order.
+		template<typename NodeList>
+		void forward(NodeList const& nodes)
+		{
+			for (NodeInterface* node : nodes)
 			{
-				nodes_.push_front(node);
+				if (!node->is_stale()) continue;
+				run(node, Phase::forward, [&] { node->forward(); });
+				node->mark_fresh();
 			}
 		}
 
@@ -47,15 +142,73 @@ namespace miniflow
 
 		explicit Graph(NodeInterface& output_node)
 		{
-			topological_sort(&output_node);
+			topological_sort({ &output_node });
+		}
+
+		// A graph computing all the output nodes
+		explicit Graph(std::vector<NodeInterface*> const& output_nodes)
+		{
+			topological_sort(output_nodes);
+		}
+
+		// Access functions.
+		std::list<NodeInterface*> const& nodes() const { return nodes_; }
+
+		// Attaches a profiler that records every node call. Pass nullptr to detach.
+		void set_profiler(Profiler* profiler) { profiler_ = profiler; }
+
+		// Returns the trainable nodes in topological order.
+		std::vector<NodeInterface*> trainables() const
+		{
+			std::vector<NodeInterface*> trainable_nodes;
+			for (NodeInterface* node : nodes_)
+			{
+				if (node->is_trainable()) trainable_nodes.push_back(node);
+			}
+			return trainable_nodes;
 		}
 
 		// Performs a forward pass through a list of Nodes.
+		// Only stale nodes are recomputed: after an Input or a Trainable changed, the nodes computed from it.
+		// Nodes that depend on unchanged values only, e.g. on constant inputs, keep the value of a previous pass.
 		void forward()
 		{
+			forward(nodes_);
+		}
+
+		// Performs a forward pass through the nodes the targets are computed from only,
+		// e.g. to predict without the cost node or to read an intermediate value.
+		void evaluate(std::vector<NodeInterface*> const& targets)
+		{
+			forward(plan(targets));
+		}
+
+		// Bytes held by every node, and the largest temporary bytes of a call of every node over the passes run so far
+		// with memory_tracker enabled.
+		MemoryReport memory_report() const
+		{
+			MemoryReport report;
 			for (NodeInterface* node : nodes_)
 			{
-				node->forward();
+				MemoryUsage const usage = node->memory();
+				report.nodes_.push_back({ node, usage });
+				report.total_.values_ += usage.values_;
+				report.total_.gradients_ += usage.gradients_;
+				report.total_.state_ += usage.state_;
+				report.total_.temporaries_ = std::max(report.total_.temporaries_, usage.temporaries_);
+			}
+			report.live_ = memory_tracker.live();
+			report.peak_ = memory_tracker.peak();
+			return report;
+		}
+
+		// Marks every node stale, so that the next forward() recomputes the whole graph,
+		// e.g. after node values were changed in place.
+		void invalidate()
+		{
+			for (NodeInterface* node : nodes_)
+			{
+				node->invalidate();
 			}
 		}
 
@@ -64,7 +217,7 @@ namespace miniflow
 		{
 			for (NodeInterface* node : boost::adaptors::reverse(nodes_))
 			{
-				node->backward();
+				run(node, Phase::backward, [&] { node->backward(); });
 			}
 		}
 
@@ -73,7 +226,7 @@ namespace miniflow
 		{
 			for (NodeInterface* node : nodes_)
 			{
-				node->update(learning_rate);
+				run(node, Phase::update, [&] { node->update(learning_rate); });
 			}
 		}
 
@@ -92,4 +245,24 @@ namespace miniflow
 			}
 		}
 	};
+
+	template<typename Tensor>
+	class Nodes
+	{
+		/*
+			Owns the nodes of a network built at run time, e.g. by the builder of a Predictor.
+			Nodes keep pointers to each other, so they are allocated individually and never move.
+		*/
+
+		std::vector<std::unique_ptr<Node<Tensor>>> nodes_;
+
+	public:
+
+		template<typename N, typename ... Args>
+		N& add(Args&& ... args)
+		{
+			nodes_.push_back(std::make_unique<N>(std::forward<Args>(args)...));
+			return static_cast<N&>(*nodes_.back());
+		}
+	};
 }
\ No newline at end of file
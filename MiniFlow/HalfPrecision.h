@@ -0,0 +1,669 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Graph.h"
+#include "DynamicTensor.h"
+
+namespace halfprecision
+{
+	/*
+		16-bit floating point storage for dynamictensor, with kernels computing in float.
+
+		bfloat16 keeps the 8-bit exponent of float and 7 bits of mantissa: it has the range of float,
+		so gradients neither overflow nor underflow, with about 3 significant digits.
+		float16 has a 5-bit exponent and 10 bits of mantissa: more precise, but limited to [6e-8, 65504],
+		so gradients converted to it are scaled first, see LossScale.
+
+		Both are storage types: dynamictensor::Tensor<bfloat16, rank> holds a quarter of the bytes of
+		a Tensor<Scalar, rank>. Kernels convert rows to float, compute and accumulate in float, and convert
+		the result back. Conversions use F16C and AVX-512 BF16 instructions when the compiler targets them,
+		AVX2 for bfloat16 otherwise, and bit manipulation on other targets. All of them round to nearest even.
+	*/
+
+	using miniflow::Scalar;
+	using miniflow::Index;
+	template<class T> using Matrix = dynamictensor::Tensor<T, 2>;
+
+#if defined(__F16C__)
+	inline constexpr char const* float16_kernel = "f16c";
+#else
+	inline constexpr char const* float16_kernel = "scalar";
+#endif
+
+#if defined(__AVX512BF16__) && defined(__AVX512VL__)
+	inline constexpr char const* bfloat16_kernel = "avx512_bf16";
+#elif defined(__AVX2__)
+	inline constexpr char const* bfloat16_kernel = "avx2";
+#else
+	inline constexpr char const* bfloat16_kernel = "scalar";
+#endif
+
+	inline std::uint32_t float_bits(float x)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		return bits;
+	}
+
+	inline float bits_float(std::uint32_t bits)
+	{
+		float x;
+		std::memcpy(&x, &bits, sizeof(x));
+		return x;
+	}
+
+	inline std::uint16_t float_to_bfloat16_bits(float x)
+	{
+		std::uint32_t const bits = float_bits(x);
+		// NaNs stay quiet NaNs, rounding could carry their payload into infinity
+		if ((bits & 0x7fffffff) > 0x7f800000) return std::uint16_t((bits >> 16) | 0x40);
+		return std::uint16_t((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+	}
+
+	inline float bfloat16_bits_to_float(std::uint16_t bits)
+	{
+		return bits_float(std::uint32_t(bits) << 16);
+	}
+
+	inline std::uint16_t float_to_float16_bits(float x)
+	{
+		std::uint32_t bits = float_bits(x);
+		std::uint32_t const sign = (bits >> 16) & 0x8000;
+		bits &= 0x7fffffff;
+
+		// Infinities and NaNs, then values that round above 65504
+		if (bits >= 0x7f800000) return std::uint16_t(sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0));
+		if (bits >= 0x477ff000) return std::uint16_t(sign | 0x7c00);
+		if (bits < 0x38800000)
+		{
+			// Below 2^-14 the result is subnormal: adding 0.5 aligns its last bit with the last bit of
+			// the mantissa of 0.5, and the float addition rounds to nearest even.
+			return std::uint16_t(sign | (float_bits(bits_float(bits) + 0.5f) - 0x3f000000));
+		}
+		// Rebias the exponent from 127 to 15 and round the 13 bits dropped
+		bits += 0xc8000fff + ((bits >> 13) & 1);
+		return std::uint16_t(sign | (bits >> 13));
+	}
+
+	inline float float16_bits_to_float(std::uint16_t bits)
+	{
+		std::uint32_t const sign = std::uint32_t(bits & 0x8000) << 16;
+		std::uint32_t const exponent = (bits >> 10) & 0x1f, mantissa = bits & 0x3ff;
+		if (exponent == 0)
+		{
+			float const value = float(mantissa) * 5.9604644775390625e-8f;	// mantissa * 2^-24
+			return bits_float(sign | float_bits(value));
+		}
+		if (exponent == 31) return bits_float(sign | 0x7f800000 | (mantissa << 13));
+		return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+	}
+
+	struct bfloat16
+	{
+		/*
+			Brain floating point: the upper half of a float.
+		*/
+
+		std::uint16_t bits_ = 0;
+
+		bfloat16() = default;
+		bfloat16(float x) : bits_(float_to_bfloat16_bits(x)) {}
+		operator float() const { return bfloat16_bits_to_float(bits_); }
+
+		bool finite() const { return (bits_ & 0x7f80) != 0x7f80; }
+	};
+
+	struct float16
+	{
+		/*
+			IEEE 754 half precision.
+		*/
+
+		std::uint16_t bits_ = 0;
+
+		float16() = default;
+		float16(float x) : bits_(float_to_float16_bits(x)) {}
+		operator float() const { return float16_bits_to_float(bits_); }
+
+		bool finite() const { return (bits_ & 0x7c00) != 0x7c00; }
+	};
+
+	static_assert(sizeof(bfloat16) == 2 && sizeof(float16) == 2, "Half precision values must be 2 bytes");
+
+	// Conversions of n values.
+
+	inline void convert(float const* source, bfloat16* target, Index n)
+	{
+		Index i = 0;
+#if defined(__AVX512BF16__) && defined(__AVX512VL__)
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128bh const half = _mm256_cvtneps_pbh(_mm256_loadu_ps(source + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), (__m128i)half);
+		}
+#elif defined(__AVX2__)
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256 const x = _mm256_loadu_ps(source + i);
+			__m256i const bits = _mm256_castps_si256(x);
+			__m256i const odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+			__m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), odd)), 16);
+			__m256i const nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+			rounded = _mm256_blendv_epi8(rounded, nan, _mm256_castps_si256(_mm256_cmp_ps(x, x, _CMP_UNORD_Q)));
+			// Packs the 16-bit halves of both 128-bit lanes, then moves them together
+			__m256i const packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm256_castsi256_si128(packed));
+		}
+#endif
+		for (; i < n; i++) target[i] = bfloat16(source[i]);
+	}
+
+	inline void convert(bfloat16 const* source, float* target, Index n)
+	{
+		Index i = 0;
+#if defined(__AVX2__)
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i const bits = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i)));
+			_mm256_storeu_ps(target + i, _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16)));
+		}
+#endif
+		for (; i < n; i++) target[i] = float(source[i]);
+	}
+
+	inline void convert(float const* source, float16* target, Index n)
+	{
+		Index i = 0;
+#if defined(__F16C__)
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i const half = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), half);
+		}
+#endif
+		for (; i < n; i++) target[i] = float16(source[i]);
+	}
+
+	inline void convert(float16 const* source, float* target, Index n)
+	{
+		Index i = 0;
+#if defined(__F16C__)
+		for (; i + 8 <= n; i += 8)
+		{
+			_mm256_storeu_ps(target + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i))));
+		}
+#endif
+		for (; i < n; i++) target[i] = float(source[i]);
+	}
+
+	// Other pairs of types convert value by value, or through float in chunks for half precision.
+	template<class Source, class Target>
+	void convert(Source const* source, Target* target, Index n)
+	{
+		constexpr bool half_source = std::is_same<Source, bfloat16>::value || std::is_same<Source, float16>::value;
+		constexpr bool half_target = std::is_same<Target, bfloat16>::value || std::is_same<Target, float16>::value;
+		if constexpr (half_source || half_target)
+		{
+			static_assert(!(half_source && half_target), "Conversion between half precision types");
+			constexpr Index chunk = 256;
+			float buffer[chunk];
+			for (Index i = 0; i < n; i += chunk)
+			{
+				Index const m = std::min(chunk, n - i);
+				convert(source + i, buffer, m);
+				convert(buffer, target + i, m);
+			}
+		}
+		else
+		{
+			for (Index i = 0; i < n; i++) target[i] = Target(source[i]);
+		}
+	}
+
+	template<class T>
+	void convert(T const* source, T* target, Index n)
+	{
+		std::copy(source, source + n, target);
+	}
+
+	template<class Target, class Source, unsigned rank>
+	void convert_into(dynamictensor::Tensor<Source, rank> const& source, dynamictensor::Tensor<Target, rank>& target)
+	{
+		if (target.shape_ != source.shape_) target = dynamictensor::Tensor<Target, rank>(source.shape_);
+		if constexpr (rank == 1)
+		{
+			convert(source.data_.data(), target.data_.data(), source.shape_[0]);
+		}
+		else
+		{
+			for (Index i = 0; i < source.shape_[0]; i++) convert_into(source.data_[i], target.data_[i]);
+		}
+	}
+
+	// Copy of a tensor with values of another type, e.g. convert<bfloat16>(W).
+	template<class Target, class Source, unsigned rank>
+	dynamictensor::Tensor<Target, rank> convert(dynamictensor::Tensor<Source, rank> const& source)
+	{
+		dynamictensor::Tensor<Target, rank> target(source.shape_);
+		convert_into(source, target);
+		return target;
+	}
+
+	template<class T, unsigned rank>
+	bool all_finite(dynamictensor::Tensor<T, rank> const& t)
+	{
+		if constexpr (rank == 1)
+		{
+			for (T const& x : t.data_)
+			{
+				if constexpr (std::is_floating_point<T>::value) { if (!std::isfinite(x)) return false; }
+				else if (!x.finite()) return false;
+			}
+			return true;
+		}
+		else
+		{
+			for (auto const& subTensor : t.data_)
+			{
+				if (!all_finite(subTensor)) return false;
+			}
+			return true;
+		}
+	}
+
+	template<class Target, typename F, class ... Sources, std::size_t ... I>
+	void apply_chunk(Target* target, Index m, F const& fn, float (&in)[sizeof...(Sources)][256], std::index_sequence<I...>)
+	{
+		float out[256];
+		for (Index i = 0; i < m; i++) out[i] = fn(in[I][i]...);
+		convert(out, target, m);
+	}
+
+	// Element-wise kernel on rows: target[i] = fn(sources[i]...), computed in float.
+	// Sources and target may be of any mix of half, float and double values, converted by chunks.
+	template<class Target, typename F, class ... Sources>
+	void transform_row(Target* target, Index n, F const& fn, Sources const* ... sources)
+	{
+		constexpr Index chunk = 256;
+		float in[sizeof...(Sources)][chunk];
+		for (Index i0 = 0; i0 < n; i0 += chunk)
+		{
+			Index const m = std::min(chunk, n - i0);
+			std::size_t s = 0;
+			(convert(sources + i0, in[s++], m), ...);
+			apply_chunk<Target, F, Sources...>(target + i0, m, fn, in, std::index_sequence_for<Sources...>{});
+		}
+	}
+
+	// Sets every value of target to fn applied in float to the values at the same position in sources.
+	// target is reallocated only when its shape differs from the shape of the first source.
+	template<class Target, unsigned rank, typename F, class Source, class ... Sources>
+	void transform(dynamictensor::Tensor<Target, rank>& target, F fn, dynamictensor::Tensor<Source, rank> const& source, dynamictensor::Tensor<Sources, rank> const& ... sources)
+	{
+		if (target.shape_ != source.shape_) target = dynamictensor::Tensor<Target, rank>(source.shape_);
+		if constexpr (rank == 1)
+		{
+			transform_row(target.data_.data(), source.shape_[0], fn, source.data_.data(), sources.data_.data()...);
+		}
+		else
+		{
+			for (Index i = 0; i < source.shape_[0]; i++) transform(target.data_[i], fn, source.data_[i], sources.data_[i]...);
+		}
+	}
+
+	// Matrix products of half precision matrices, accumulated in float.
+	// Panels of the right operand are converted to float once per call, then multiplied by every row
+	// of the left operand with the float kernels of dynamictensor, blocked by dynamictensor::gemm_blocking.
+	// They accumulate into C, which must be allocated with the shape of the result.
+
+	// Converts the block [r0, r1) x [c0, c1) of A to float, rows stride apart.
+	template<class H>
+	void convert_block(Matrix<H> const& A, Index r0, Index r1, Index c0, Index c1, float* target, Index stride)
+	{
+		for (Index r = r0; r < r1; r++) convert(A.data_[r].data_.data() + c0, target + std::size_t(r - r0) * stride, c1 - c0);
+	}
+
+	// C += A * B
+	template<class H>
+	void gemm(Matrix<H> const& A, Matrix<H> const& B, Matrix<float>& C)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1], N = B.shape_[1];
+		assert(B.shape_[0] == K && C.shape_[0] == M && C.shape_[1] == N);
+		dynamictensor::GemmBlocking const blocking = dynamictensor::gemm_blocking;
+
+		// Rows of the panel are padded, rows a multiple of 4KB apart would evict each other from the cache
+		Index const stride = blocking.cols_ + 8;
+		std::vector<float> panel(std::size_t(blocking.depth_) * stride);
+		for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+		{
+			Index const j1 = std::min(N, j0 + blocking.cols_);
+			for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+			{
+				Index const k1 = std::min(K, k0 + blocking.depth_);
+				convert_block(B, k0, k1, j0, j1, panel.data(), stride);
+				dynamictensor::split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+				{
+					std::vector<float> a(k1 - k0);
+					for (Index i = i0; i < i1; i++)
+					{
+						convert(A.data_[i].data_.data() + k0, a.data(), k1 - k0);
+						dynamictensor::accumulate_rows(C.data_[i].data_.data() + j0, j1 - j0, k1 - k0,
+							[&](Index k) { return a[k]; },
+							[&](Index k) { return panel.data() + std::size_t(k) * stride; });
+					}
+				});
+			}
+		}
+	}
+
+	// C += A * transpose(B)
+	template<class H>
+	void gemm_nt(Matrix<H> const& A, Matrix<H> const& B, Matrix<float>& C)
+	{
+		Index const M = A.shape_[0], K = A.shape_[1], N = B.shape_[0];
+		assert(B.shape_[1] == K && C.shape_[0] == M && C.shape_[1] == N);
+		dynamictensor::GemmBlocking const blocking = dynamictensor::gemm_blocking;
+
+		Index const stride = blocking.cols_ + 8;
+		std::vector<float> panel(std::size_t(blocking.depth_) * stride), row(blocking.depth_);
+		for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+		{
+			Index const j1 = std::min(N, j0 + blocking.cols_);
+			for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+			{
+				Index const k1 = std::min(K, k0 + blocking.depth_);
+				// Row k - k0 of the panel is column k of the rows j0 to j1 of B
+				for (Index j = j0; j < j1; j++)
+				{
+					convert(B.data_[j].data_.data() + k0, row.data(), k1 - k0);
+					for (Index k = 0; k < k1 - k0; k++) panel[std::size_t(k) * stride + (j - j0)] = row[k];
+				}
+				dynamictensor::split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+				{
+					std::vector<float> a(k1 - k0);
+					for (Index i = i0; i < i1; i++)
+					{
+						convert(A.data_[i].data_.data() + k0, a.data(), k1 - k0);
+						dynamictensor::accumulate_rows(C.data_[i].data_.data() + j0, j1 - j0, k1 - k0,
+							[&](Index k) { return a[k]; },
+							[&](Index k) { return panel.data() + std::size_t(k) * stride; });
+					}
+				});
+			}
+		}
+	}
+
+	// C += transpose(A) * B
+	template<class H>
+	void gemm_tn(Matrix<H> const& A, Matrix<H> const& B, Matrix<float>& C)
+	{
+		Index const K = A.shape_[0], M = A.shape_[1], N = B.shape_[1];
+		assert(B.shape_[0] == K && C.shape_[0] == M && C.shape_[1] == N);
+		dynamictensor::GemmBlocking const blocking = dynamictensor::gemm_blocking;
+
+		Index const stride = blocking.cols_ + 8;
+		std::vector<float> panel(std::size_t(blocking.depth_) * stride), a(std::size_t(blocking.depth_) * M);
+		for (Index k0 = 0; k0 < K; k0 += blocking.depth_)
+		{
+			Index const k1 = std::min(K, k0 + blocking.depth_);
+			convert_block(A, k0, k1, 0, M, a.data(), M);
+			for (Index j0 = 0; j0 < N; j0 += blocking.cols_)
+			{
+				Index const j1 = std::min(N, j0 + blocking.cols_);
+				convert_block(B, k0, k1, j0, j1, panel.data(), stride);
+				dynamictensor::split_rows(M, blocking.threads_, [&](Index i0, Index i1)
+				{
+					for (Index i = i0; i < i1; i++)
+					{
+						dynamictensor::accumulate_rows(C.data_[i].data_.data() + j0, j1 - j0, k1 - k0,
+							[&](Index k) { return a[std::size_t(k) * M + i]; },
+							[&](Index k) { return panel.data() + std::size_t(k) * stride; });
+					}
+				});
+			}
+		}
+	}
+
+	// Product of half precision matrices as a float matrix
+	template<class H>
+	Matrix<float> dot(Matrix<H> const& A, Matrix<H> const& B)
+	{
+		Matrix<float> C({ A.shape_[0], B.shape_[1] });
+		gemm(A, B, C);
+		return C;
+	}
+
+	struct LossScale
+	{
+		/*
+			Dynamic scale of the gradients converted to float16.
+
+			Gradients much smaller than 1 underflow to 0 in float16. HalfLinear multiplies the gradient of its
+			output by scale_ before converting it, and divides the products by scale_ in float. When a scaled
+			gradient overflows, overflow_ is set and the step must be skipped: the scale is divided by factor_.
+			After growth_interval_ steps without overflow it is multiplied by factor_, so it stays near the
+			largest scale that does not overflow. Factors are powers of 2, so scaling is exact.
+		*/
+
+		Scalar scale_ = 65536;				//: Factor of the gradients converted to half precision.
+		Scalar factor_ = 2;					//: Growth and backoff factor of the scale.
+		int growth_interval_ = 1000;		//: Steps without overflow before the scale grows.
+		int good_steps_ = 0;				//: Steps without overflow since the scale changed.
+		bool overflow_ = false;				//: Whether a scaled gradient overflowed in the current step.
+
+		// Ends a step: adjusts the scale and returns whether the gradients of the step were finite.
+		bool end_step()
+		{
+			bool const finite = !overflow_;
+			overflow_ = false;
+			if (!finite)
+			{
+				scale_ = std::max(Scalar(1), scale_ / factor_);
+				good_steps_ = 0;
+			}
+			else if (++good_steps_ >= growth_interval_)
+			{
+				scale_ *= factor_;
+				good_steps_ = 0;
+			}
+			return finite;
+		}
+	};
+}
+
+namespace miniflow
+{
+	template<typename Tensor, class Half>
+	class MixedTrainable : public Input<Tensor>
+	{
+		/*
+			A trainable parameter for mixed precision training.
+
+			The value is the master copy in full precision, which SGD steps update: steps much smaller than
+			the weights would be rounded away in half precision. HalfLinear nodes read the half precision copy,
+			converted after every change of the value.
+		*/
+
+	protected:
+
+		// Names of the dependent base class.
+		using Input = miniflow::Input<Tensor>;
+		using Input::value_;
+		using Input::gradient_;
+
+	private:
+
+		dynamictensor::Tensor<Half, Tensor::rank_> half_;
+
+		void refresh() { halfprecision::convert_into(value_, half_); }
+
+	public:
+
+		explicit MixedTrainable(Tensor const& input) :
+			Input(input)
+		{
+			refresh();
+		}
+
+		// Performs SGD step on the master copy
+		void update(Scalar learning_rate) final
+		{
+			if (size(gradient_[0]) == 0) return;
+			value_ -= learning_rate * gradient_[0];
+			refresh();
+			this->invalidate();
+		}
+
+		void setValue(Tensor const& value)
+		{
+			Input::setValue(value);
+			refresh();
+		}
+
+		void set_data(TensorData const& data) final
+		{
+			Input::set_data(data);
+			refresh();
+		}
+
+		dynamictensor::Tensor<Half, Tensor::rank_> const& getHalfValue() const { return half_; }
+
+		bool is_trainable() const final { return true; }
+		char const* type() const final { return "MixedTrainable"; }
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Input::memory();
+			usage.state_ += size(half_) * sizeof(Half);
+			return usage;
+		}
+	};
+
+	template<typename Tensor, class Half>
+	class HalfLinear : public Node<Tensor>
+	{
+		/*
+			Represents a Linear node computed in half precision, for mixed precision training.
+
+			Input is {X, W, b}, as for Linear, with W a MixedTrainable.
+			Output is dot(X, W) + b.
+
+			X is converted to Half, kept for backward(), and multiplied by the half precision copy of W,
+			accumulating in float. backward() converts the gradient of the output to Half, scaled by the
+			LossScale when one is given, which float16 requires, and returns the partials in full precision.
+			b and its gradient stay in full precision.
+		*/
+
+		static_assert(std::is_same<Tensor, dynamictensor::Tensor<Scalar, 2>>::value, "HalfLinear requires dynamictensor matrices");
+
+		using HalfMatrix = halfprecision::Matrix<Half>;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
+	private:
+
+		MixedTrainable<Tensor, Half> const& weights_;
+		halfprecision::LossScale* loss_scale_;
+		HalfMatrix input_;					//: X in half precision, saved by forward() for backward().
+		HalfMatrix grad_output_;
+
+	public:
+
+		HalfLinear(Node& X, MixedTrainable<Tensor, Half>& W, Node& b, halfprecision::LossScale* loss_scale = nullptr) :
+			Node(std::vector<Node*>{ &X, &W, &b }),
+			weights_(W),
+			loss_scale_(loss_scale)
+		{
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			halfprecision::convert_into(X, input_);
+			halfprecision::Matrix<float> const product = halfprecision::dot(input_, weights_.getHalfValue());
+			halfprecision::convert_into(product, value_);
+			add_bias(value_, inbound_nodes_[2]->getValue());
+		}
+
+		void backward() final
+		{
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				clear_gradient();
+				return;
+			}
+			auto const& grad_cost = *partial;
+			float const scale = loss_scale_ ? float(loss_scale_->scale_) : 1.f, inverse = 1 / scale;
+			halfprecision::transform(grad_output_, [scale](float g) { return g * scale; }, grad_cost);
+			if (loss_scale_ && !halfprecision::all_finite(grad_output_)) loss_scale_->overflow_ = true;
+
+			HalfMatrix const& W = weights_.getHalfValue();
+			auto unscale = [inverse](float x) { return x * inverse; };
+			halfprecision::Matrix<float> grad_input({ input_.shape_[0], input_.shape_[1] });
+			halfprecision::gemm_nt(grad_output_, W, grad_input);
+			halfprecision::transform(gradient_[0], unscale, grad_input);
+
+			halfprecision::Matrix<float> grad_weights({ W.shape_[0], W.shape_[1] });
+			halfprecision::gemm_tn(input_, grad_output_, grad_weights);
+			halfprecision::transform(gradient_[1], unscale, grad_weights);
+
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+		}
+
+		char const* type() const final { return "HalfLinear"; }
+
+		// Each multiply-add of dot(X, W) is two operations, adding b is one per output value.
+		std::size_t flops() const final
+		{
+			return 2 * std::size_t(input_.shape_[0]) * input_.shape_[1] * weights_.getHalfValue().shape_[1] + size(value_);
+		}
+
+		// The half precision product runs the float kernels with the same blocking
+		std::vector<GemmShape> gemm_shapes() const final
+		{
+			if (input_.shape_[0] == 0) return {};
+			return { { input_.shape_[0], input_.shape_[1], weights_.getHalfValue().shape_[1] } };
+		}
+
+		// X is read once in full precision and once in half precision, W in half precision.
+		std::size_t bytes() const final
+		{
+			std::size_t const inputs = size(input_);
+			return (inputs + 2 * size(value_)) * sizeof(Scalar) + (2 * inputs + size(weights_.getHalfValue())) * sizeof(Half);
+		}
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = size(input_) * sizeof(Half);
+			usage.gradients_ += size(grad_output_) * sizeof(Half);
+			return usage;
+		}
+	};
+
+	// A mixed precision SGD step: forward, backward, then the update of the trainables unless
+	// a scaled gradient overflowed. Adjusts the scale and returns whether the step was applied.
+	inline bool mixed_SGD_step(Graph& graph, Scalar learning_rate, halfprecision::LossScale& loss_scale)
+	{
+		graph.forward();
+		graph.backward();
+		bool const finite = loss_scale.end_step();
+		if (finite) graph.update(learning_rate);
+		return finite;
+	}
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include "Common.h"
+
+namespace miniflow
+{
+	/*
+		Accounting of the bytes of tensor storage.
+
+		dynamictensor values are allocated through TrackedAllocator, which reports every buffer to
+		memory_tracker: the live bytes of the process, their peak and the peak within a scope, e.g. a node
+		call of a Graph. Graph::memory_report() attributes the bytes to the nodes, see MemoryUsage.
+		Counters are atomic, so allocations of parallel kernels are counted, but the scope peak is shared:
+		with several graphs running at once, e.g. Predictor workers, per node temporaries are approximate.
+
+		Accounting is off until memory_tracker.set_enabled(true): the atomics of every allocation and the
+		scope of every node call cost 10 to 15% of a training step of small layers. Disabled, an allocation
+		only tests the flag and increments the thread local allocation_count of the Profiler. Buffers
+		allocated while it is off are not in the live bytes, and those freed while it is off stay in them,
+		so enable it before building the tensors to measure.
+	*/
+
+	struct MemoryUsage
+	{
+		std::size_t values_ = 0;			//: Bytes of the node value.
+		std::size_t gradients_ = 0;			//: Bytes of the partials with respect to the inputs and of their sums.
+		std::size_t state_ = 0;				//: Bytes kept between calls: optimizer state, buffers saved by forward() for backward().
+		std::size_t temporaries_ = 0;		//: Peak bytes allocated and released within a single call.
+
+		// Bytes held between calls
+		std::size_t held() const { return values_ + gradients_ + state_; }
+	};
+
+	class MemoryTracker
+	{
+		/*
+			Live and peak bytes of tensor storage, with callbacks on the peak.
+			A high-water callback runs once when the peak reaches its threshold, on the allocating thread,
+			after the allocation. reset_peak() sets the peak to the live bytes and re-arms the callbacks above them.
+		*/
+
+		struct Callback
+		{
+			std::size_t threshold_;						//: Peak bytes that trigger the callback.
+			std::function<void(std::size_t)> fn_;		//: Called with the live bytes.
+			bool armed_;								//: Whether it has not run since it was set or re-armed.
+		};
+
+		static constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+
+		std::atomic<bool> enabled_{ false };
+		std::atomic<std::size_t> live_{ 0 };
+		std::atomic<std::size_t> peak_{ 0 };
+		std::atomic<std::size_t> scope_peak_{ 0 };
+		std::atomic<std::size_t> next_threshold_{ none };	//: Lowest threshold of the armed callbacks.
+		std::mutex mutex_;
+		std::vector<Callback> callbacks_;
+
+		static void raise(std::atomic<std::size_t>& peak, std::size_t value)
+		{
+			std::size_t current = peak.load(std::memory_order_relaxed);
+			while (current < value && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+		}
+
+		// Lowest threshold of the armed callbacks, under the lock
+		void update_next_threshold()
+		{
+			std::size_t next = none;
+			for (Callback const& callback : callbacks_)
+			{
+				if (callback.armed_) next = std::min(next, callback.threshold_);
+			}
+			next_threshold_ = next;
+		}
+
+		void notify(std::size_t live)
+		{
+			std::vector<std::function<void(std::size_t)>> due;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				for (Callback& callback : callbacks_)
+				{
+					if (!callback.armed_ || live < callback.threshold_) continue;
+					callback.armed_ = false;
+					due.push_back(callback.fn_);
+				}
+				update_next_threshold();
+			}
+			// Outside the lock, callbacks may allocate
+			for (auto const& fn : due) fn(live);
+		}
+
+	public:
+
+		// Whether allocations and node calls are accounted
+		bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+		void set_enabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+		void allocate(std::size_t bytes)
+		{
+			std::size_t const live = live_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+			raise(peak_, live);
+			raise(scope_peak_, live);
+			if (live >= next_threshold_.load(std::memory_order_relaxed)) notify(live);
+		}
+
+		// Buffers allocated while accounting was off are not in the live bytes, which stop at 0.
+		void deallocate(std::size_t bytes)
+		{
+			std::size_t live = live_.load(std::memory_order_relaxed);
+			while (!live_.compare_exchange_weak(live, live - std::min(live, bytes), std::memory_order_relaxed)) {}
+		}
+
+		std::size_t live() const { return live_.load(std::memory_order_relaxed); }
+		std::size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+		// Starts a scope: returns the live bytes, the scope peak starts from them.
+		std::size_t begin_scope()
+		{
+			std::size_t const live = live_.load(std::memory_order_relaxed);
+			scope_peak_.store(live, std::memory_order_relaxed);
+			return live;
+		}
+
+		// Highest live bytes since begin_scope()
+		std::size_t scope_peak() const { return scope_peak_.load(std::memory_order_relaxed); }
+
+		void reset_peak()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			peak_ = live_.load();
+			for (Callback& callback : callbacks_) callback.armed_ = callback.threshold_ > peak_;
+			update_next_threshold();
+		}
+
+		// Calls fn(live bytes) when the peak reaches threshold bytes.
+		void on_high_water(std::size_t threshold, std::function<void(std::size_t)> fn)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			callbacks_.push_back({ threshold, std::move(fn), threshold > peak_ });
+			update_next_threshold();
+		}
+
+		void clear_callbacks()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			callbacks_.clear();
+			update_next_threshold();
+		}
+	};
+
+	inline MemoryTracker memory_tracker;
+
+	// Allocator of tensor storage that reports to memory_tracker while it is enabled.
+	template<class T>
+	struct TrackedAllocator
+	{
+		using value_type = T;
+
+		TrackedAllocator() = default;
+		template<class U> TrackedAllocator(TrackedAllocator<U> const&) {}
+
+		T* allocate(std::size_t n)
+		{
+			T* p = std::allocator<T>().allocate(n);
+			++allocation_count;
+			if (memory_tracker.enabled()) memory_tracker.allocate(n * sizeof(T));
+			return p;
+		}
+
+		void deallocate(T* p, std::size_t n)
+		{
+			if (memory_tracker.enabled()) memory_tracker.deallocate(n * sizeof(T));
+			std::allocator<T>().deallocate(p, n);
+		}
+
+		template<class U> bool operator==(TrackedAllocator<U> const&) const { return true; }
+		template<class U> bool operator!=(TrackedAllocator<U> const&) const { return false; }
+	};
+}
@@ -1,12 +1,26 @@
 #pragma once
 
 #include "Common.h"
+#include "Memory.h"
 #include "TensorScalar.h"
 
 namespace miniflow
 {
 	//using placeholder::Tensor;
 
+	struct GemmShape
+	{
+		/*
+			Shape of a matrix product run by a node, M x K by K x N, see NodeInterface::gemm_shapes().
+		*/
+
+		Index M_;		//: Rows of the left operand and of the result.
+		Index K_;		//: Columns of the left operand, rows of the right operand.
+		Index N_;		//: Columns of the right operand and of the result.
+
+		bool operator==(GemmShape const& shape) const { return M_ == shape.M_ && K_ == shape.K_ && N_ == shape.N_; }
+	};
+
 	class NodeInterface
 	{
 
@@ -18,9 +32,63 @@ namespace miniflow
 		virtual void update(Scalar /*learning_rate*/) = 0;			// Updates trainables
 		virtual void print_info(std::string const& /*print*/) = 0;	//
 		virtual bool is_input() const = 0;							//
+		virtual bool is_trainable() const = 0;						//
 		virtual std::vector<NodeInterface*> inbound_nodes() = 0;	//
+		virtual char const* type() const = 0;						// Name of the node class
+		virtual std::string const& name() const = 0;				// An optional name used to identify the node, e.g. in checkpoints
+		virtual void set_name(std::string const& name) = 0;			//
+		virtual TensorData data() const = 0;						// Returns a type-erased copy of value_
+		virtual void set_data(TensorData const& data) = 0;			// Sets value_ from a type-erased copy
+		virtual std::vector<Index> shape() const = 0;				// Shape of value_
+		virtual std::vector<Index> data_shape() const = 0;			// Shape of data(), without copying the values
+		virtual std::size_t flops() const = 0;						// Estimated floating point operations of forward()
+		virtual std::size_t bytes() const = 0;						// Estimated bytes read and written by forward()
+		virtual void invalidate() = 0;								// Marks the node and the nodes computed from it as stale
+		virtual MemoryUsage memory() const = 0;						// Bytes of tensor storage held by the node, and its temporaries
+		virtual std::vector<GemmShape> gemm_shapes() const = 0;		// Shapes of the blocked matrix products of forward(), as of the last pass
+
+		// Whether value_ is out of date, i.e. forward() has to run. Inputs are never stale.
+		bool is_stale() const { return stale_; }
+		// Records that forward() has run
+		void mark_fresh() { stale_ = false; }
+		// Records the bytes a call allocated and released, measured by the Graph
+		void record_temporaries(std::size_t bytes) { temporaries_ = std::max(temporaries_, bytes); }
+
+	protected:
+
+		bool stale_ = true;				//: Whether an input changed since the last forward().
+		std::size_t temporaries_ = 0;	//: Largest temporary bytes of a call.
 	};
 
+	// Shape of the type-erased copy of a tensor, see to_data(). Tensors whose TensorData is not shaped as dims() overload it.
+	template<typename Tensor>
+	std::vector<Index> data_dims(Tensor const& t)
+	{
+		return dims(t);
+	}
+
+	// Sets t to dot(t1, t2). Tensors that can write the product into the storage of t overload it.
+	template<typename Tensor, typename Left, typename Right>
+	void assign_dot(Tensor& t, Left const& t1, Right const& t2)
+	{
+		t = dot(t1, t2);
+	}
+
+	// Bytes of the values of a tensor. Tensors holding several values per element, e.g. TensorLanes, overload it.
+	template<typename Tensor>
+	std::size_t storage_bytes(Tensor const& t)
+	{
+		return size(t) * sizeof(typename Tensor::ValueType);
+	}
+
+	template<typename Tensor>
+	std::size_t storage_bytes(std::vector<Tensor> const& tensors)
+	{
+		std::size_t bytes = 0;
+		for (Tensor const& t : tensors) bytes += storage_bytes(t);
+		return bytes;
+	}
+
 	template<typename Tensor>
 	class Node : public NodeInterface
 	{
@@ -32,10 +100,10 @@ namespace miniflow
 
 		struct OutboundNode
 		{
-			const Node* node;							//: A pointer to outbound node itself.
+			Node* node;									//: A pointer to outbound node itself.
 			std::size_t index;							//: An index of the host node in the outbound node's list of the inputs.
 
-			Tensor getGradient() const
+			Tensor const& getGradient() const
 			{
 				return node->getGradient()[index];		// An index is used for getting the outbound node gradient with respect to host node.
 			}
@@ -47,10 +115,89 @@ namespace miniflow
 		std::vector<Tensor> gradient_;					//: Partial derivatives of this node with respect to the input nodes.
 														//  Set by running the forward() method.
 														//  Has the same size as a list of the input nodes.
+		std::string name_;								//: An optional name of the node.
+		std::vector<Tensor> partial_sums_;				//: Slots of the sums of outbound gradients, one per pair added.
+
+		// Values per pair above which a level of outbound_gradient() is added in parallel.
+		static constexpr std::size_t parallel_sum_size = 1 << 14;
+
 		void clear_gradient()
 		{
 			for (auto& value : gradient_) value = Tensor();
 		}
+
+		// Marks the nodes computed from this node as stale. Only computed nodes have inputs,
+		// so the recursion needs no virtual calls. It stops at stale nodes, whose outputs are stale as well.
+		void invalidate_outputs()
+		{
+			for (OutboundNode const& output : outbound_nodes_)
+			{
+				Node& node = *output.node;
+				if (node.stale_) continue;
+				node.stale_ = true;
+				node.invalidate_outputs();
+			}
+		}
+
+		// Sum of the partials of the cost with respect to this node over all the outbound nodes.
+		// The partials are added in a fixed pairwise tree, ((g0 + g1) + (g2 + g3)) + ..., every pair into
+		// its own slot, so the sum does not depend on the order the consumers are run in and the pairs of
+		// a level are added in parallel without sharing memory, e.g. for weights shared by many layers.
+		// Consumers the cost does not depend on, e.g. a side output of the graph, leave an empty partial,
+		// which is left out of the sum. With a single partial it is returned without a copy, with none an empty tensor.
+		Tensor const& outbound_gradient()
+		{
+			assert(!outbound_nodes_.empty());
+			if (outbound_nodes_.size() == 1) return outbound_nodes_[0].getGradient();
+
+			std::vector<Tensor const*> level;
+			level.reserve(outbound_nodes_.size());
+			for (OutboundNode const& output : outbound_nodes_)
+			{
+				Tensor const& partial = output.getGradient();
+				if (size(partial) > 0) level.push_back(&partial);
+			}
+			if (level.empty())
+			{
+				partial_sums_.assign(1, Tensor());
+				return partial_sums_[0];
+			}
+			partial_sums_.resize(level.size() - 1);
+			std::size_t slot = 0;
+			while (level.size() > 1)
+			{
+				std::size_t const pairs = level.size() / 2;
+				auto add = [&, first = slot](Index pair)
+				{
+					partial_sums_[first + pair] = *level[2 * pair] + *level[2 * pair + 1];
+				};
+				if (pairs > 1 && size(*level[0]) >= parallel_sum_size) parallelFor(0, Index(pairs), add);
+				else for (Index pair = 0; pair < pairs; pair++) add(pair);
+
+				// The sums of the pairs, and the last partial of an odd level, form the next level.
+				for (std::size_t pair = 0; pair < pairs; pair++) level[pair] = &partial_sums_[slot + pair];
+				if (level.size() % 2) level[pairs] = level.back();
+				level.resize(pairs + level.size() % 2);
+				slot += pairs;
+			}
+			return *level[0];
+		}
+
+		// The sum of the partials of the outbound nodes, see outbound_gradient(), or nullptr when the cost does
+		// not depend on this node: it has no outbound nodes, e.g. an output of the graph, or none left a partial.
+		// Nodes clear their gradients and skip backward() then.
+		Tensor const* cost_gradient()
+		{
+			if (outbound_nodes_.empty()) return nullptr;
+			Tensor const& gradient = outbound_gradient();
+			return size(gradient) > 0 ? &gradient : nullptr;
+		}
+
+		// Gives nodes that work in place access to the value of another node.
+		static Tensor& mutableValue(Node& node)
+		{
+			return node.value_;
+		}
 	
 	public:
 
@@ -66,12 +213,33 @@ namespace miniflow
 			}
 		}
 
+		// Unlinks the node from the nodes it is connected to, in whichever order they are destroyed,
+		// e.g. a prediction network built around weights it shares with a training graph.
+		~Node() override
+		{
+			for (Node* input : inbound_nodes_)
+			{
+				if (!input) continue;
+				auto& outbound = input->outbound_nodes_;
+				outbound.erase(std::remove_if(outbound.begin(), outbound.end(), [&](OutboundNode const& o) { return o.node == this; }), outbound.end());
+			}
+			for (OutboundNode const& output : outbound_nodes_)
+			{
+				output.node->inbound_nodes_[output.index] = nullptr;
+			}
+		}
+
+		Node(Node const&) = delete;
+		Node& operator=(Node const&) = delete;
+
 		// Node Interface virtual functions. General implementations.
 		// Note that different functions are further overridden in Node specializations.
 		void forward() override {}
 		void backward() override {}
 		void update(Scalar /*learning_rate*/) override {}
 		bool is_input() const override { return false; }
+		bool is_trainable() const override { return false; }
+		char const* type() const override { return "Node"; }
 		void print_info(std::string const& print) override 
 		{
 			//std::cout << print << value_.value_ << "\n"; //FIX PRINT INFO
@@ -85,10 +253,50 @@ namespace miniflow
 			}
 			return inbound_nodes_interface;
 		}
+		std::string const& name() const final { return name_; }
+		void set_name(std::string const& name) final { name_ = name; }
+		TensorData data() const final { return to_data(value_); }
+		void set_data(TensorData const& data) override
+		{
+			from_data(data, value_);
+			invalidate();
+		}
+		std::vector<Index> shape() const final { return dims(value_); }
+		std::vector<Index> data_shape() const final { return data_dims(value_); }
+
+		void invalidate() override
+		{
+			if (stale_) return;
+			stale_ = true;
+			invalidate_outputs();
+		}
+
+		// By default a node is assumed to be element-wise: one operation per output value,
+		// reading all the input values and writing its own value once.
+		std::size_t flops() const override { return size(value_); }
+		std::size_t bytes() const override
+		{
+			std::size_t count = size(value_);
+			for (Node const* node : inbound_nodes_) count += size(node->value_);
+			return count * sizeof(Scalar);
+		}
+
+		// Nodes running the blocked dynamictensor products, e.g. Linear or Conv2D, report them for autotune_gemm().
+		std::vector<GemmShape> gemm_shapes() const override { return {}; }
+
+		// Nodes that keep other tensors add them to the state.
+		MemoryUsage memory() const override
+		{
+			MemoryUsage usage;
+			usage.values_ = storage_bytes(value_);
+			usage.gradients_ = storage_bytes(gradient_) + storage_bytes(partial_sums_);
+			usage.temporaries_ = temporaries_;
+			return usage;
+		}
 
 		// Access functions.
-		auto getValue() const { return value_; }
-		auto getGradient() const { return gradient_; }
+		Tensor const& getValue() const { return value_; }
+		std::vector<Tensor> const& getGradient() const { return gradient_; }
 	};
 
 	template<typename Tensor>
@@ -100,6 +308,15 @@ namespace miniflow
 			gradient_ size is 1 and a partial derivative is stored in gradient_[0].
 		*/
 
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
 	public:
 
 		explicit Input(Tensor const& input) :
@@ -107,20 +324,31 @@ namespace miniflow
 		{
 			gradient_.resize(1, Tensor());
 			value_ = input;
+			this->stale_ = false;
 		}
 
 		void backward() final
 		{
-			clear_gradient();
-			// Cycle through the outputs. Sum the partial with respect to the input over all the outputs.
-			for (OutboundNode outbound_node : outbound_nodes_)
-			{
-				// Get the partial of the cost with respect to this node.				
-				gradient_[0] += outbound_node.getGradient();
-			}
+			// Sum the partial with respect to the input over all the outputs.
+			if (outbound_nodes_.empty()) clear_gradient();
+			else gradient_[0] = this->outbound_gradient();
+		}
+
+		void setValue(Tensor const& value)
+		{
+			value_ = value;
+			this->invalidate();
 		}
 
 		bool is_input() const final { return true; }
+		char const* type() const override { return "Input"; }
+
+		// Inputs are never stale, their value is set rather than computed. A new value makes their outputs stale.
+		void invalidate() final { this->invalidate_outputs(); }
+
+		// Inputs only hold values, their forward() does nothing.
+		std::size_t flops() const final { return 0; }
+		std::size_t bytes() const final { return 0; }
 	};
 
 	template<typename Tensor>
@@ -130,6 +358,13 @@ namespace miniflow
 			A trainable parameter of the network.
 		*/
 
+	protected:
+
+		// Names of the dependent base class.
+		using Input = miniflow::Input<Tensor>;
+		using Input::value_;
+		using Input::gradient_;
+
 	public:
 
 		explicit Trainable(Tensor const& input) :
@@ -137,11 +372,25 @@ namespace miniflow
 		{
 		}
 
-		// Performs SGD step
+		// Performs SGD step.
+		// The gradient is empty when no cost depends on the node, e.g. the weights of a side output, which are kept.
 		void update(Scalar learning_rate) final
 		{
+			if (size(gradient_[0]) == 0) return;
 			value_ -= learning_rate * gradient_[0];
+			this->invalidate();
 		}
+
+		// Performs SGD step with a learning rate per value, e.g. per model of TensorLanes
+		void update(Tensor const& learning_rates)
+		{
+			if (size(gradient_[0]) == 0) return;
+			value_ -= learning_rates * gradient_[0];
+			this->invalidate();
+		}
+
+		bool is_trainable() const final { return true; }
+		char const* type() const final { return "Trainable"; }
 	};
 
 	template<typename Tensor>
@@ -152,8 +401,20 @@ namespace miniflow
 
 			Input is {X, W, b}.
 			Output is dot(X, W) + b.
+			b has the shape of the output or, for matrices, is a single row shared by every example,
+			which lets the node run on batches of any size.
 		*/
 
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
 	public:
 
 		Linear(Node& X, Node& W, Node& b) :
@@ -167,70 +428,261 @@ namespace miniflow
 			auto const& X = inbound_nodes_[0]->getValue();
 			auto const& W = inbound_nodes_[1]->getValue();
 			auto const& b = inbound_nodes_[2]->getValue();
-			value_ = dot(X, W) + b;
+			assign_dot(value_, X, W);
+			add_bias(value_, b);
 		}
 
 		void backward() final
 		{
-			clear_gradient();
-			// Cycle through the outputs. Sum the partial with respect to the input over all the outputs.
-			for (OutboundNode outbound_node : outbound_nodes_)
+			// Sum the partial with respect to this node over all the outputs first,
+			// so that the products below run once per step whatever the number of outputs.
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
 			{
-				// Get the partial of the cost with respect to this node.
-				auto const& grad_cost = outbound_node.getGradient();
-				// Set the partial of the loss with respect to this node's inputs.
-				gradient_[0] += dot(grad_cost, transpose(inbound_nodes_[1]->getValue()));
-				// Set the partial of the loss with respect to this node's weights.
-				gradient_[1] += dot(transpose(inbound_nodes_[0]->getValue()), grad_cost);
-				// Set the partial of the loss with respect to this node's bias.
-				gradient_[2] += sum(grad_cost); //TODO
+				clear_gradient();
+				return;
 			}
+			auto const& grad_cost = *partial;
+			// Set the partial of the loss with respect to this node's inputs.
+			gradient_[0] = dot_nt(grad_cost, inbound_nodes_[1]->getValue());
+			// Set the partial of the loss with respect to this node's weights.
+			gradient_[1] = dot_tn(inbound_nodes_[0]->getValue(), grad_cost);
+			// Set the partial of the loss with respect to this node's bias.
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+		}
+
+		char const* type() const final { return "Linear"; }
+
+		// Each multiply-add of dot(X, W) is two operations, adding b is one per output value.
+		std::size_t flops() const final
+		{
+			auto const& W = inbound_nodes_[1]->getValue();
+			std::vector<Index> W_dims = dims(W);
+			std::size_t inner = W_dims.empty() ? 1 : W_dims[0];
+			return 2 * size(inbound_nodes_[0]->getValue()) * size(W) / inner + size(value_);
+		}
+
+		// dot(X, W) of matrices
+		std::vector<GemmShape> gemm_shapes() const final
+		{
+			std::vector<Index> X = dims(inbound_nodes_[0]->getValue()), W = dims(inbound_nodes_[1]->getValue());
+			if (X.size() != 2 || W.size() != 2) return {};
+			return { { X[0], X[1], W[1] } };
 		}
 	};
 
 	template<typename Tensor>
-	class Sigmoid : public Node<Tensor>
+	class Identity : public Node<Tensor>
 	{
 		/*
-			 Represents a node that performs the sigmoid activation function.
+			Represents a node that passes its input through, e.g. to name an intermediate value.
+
+			Input is {X}.
+			Output is X.
+
+			FoldedNetwork removes it.
+		*/
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
+	public:
+
+		explicit Identity(Node& X) :
+			Node(std::vector<Node*>{ &X })
+		{
+		}
+
+		void forward() final { value_ = inbound_nodes_[0]->getValue(); }
+
+		void backward() final
+		{
+			if (outbound_nodes_.empty()) clear_gradient();
+			else gradient_[0] = this->outbound_gradient();
+		}
+
+		char const* type() const final { return "Identity"; }
+
+		// A copy of the input.
+		std::size_t flops() const final { return 0; }
+	};
+
+	/*
+		Element-wise activation functions for the Activation node.
+
+		Each function provides:
+			value(x)				the activation of a single value,
+			derivative(z)			its derivative, where z is the output of the activation when
+									from_output is set and the input otherwise,
+			name, flops				the node type name and operations per value of forward().
+		Functions whose derivative is expressed through the output can run in place.
+	*/
+
+	struct SigmoidFunction
+	{
+		static constexpr char const* name = "Sigmoid";
+		static constexpr std::size_t flops = 4;			// Negation, exponent, addition and division.
+		static constexpr bool from_output = true;
+
+		template<typename T> T value(T x) const { return T(1) / (1 + std::exp(-x)); }
+		template<typename T> T derivative(T y) const { return y * (1 - y); }
+	};
+
+	struct TanhFunction
+	{
+		static constexpr char const* name = "Tanh";
+		static constexpr std::size_t flops = 4;
+		static constexpr bool from_output = true;
+
+		template<typename T> T value(T x) const { return std::tanh(x); }
+		template<typename T> T derivative(T y) const { return 1 - y * y; }
+	};
+
+	struct ReLUFunction
+	{
+		static constexpr char const* name = "ReLU";
+		static constexpr std::size_t flops = 1;
+		static constexpr bool from_output = true;
+
+		template<typename T> T value(T x) const { return x > 0 ? x : T(0); }
+		template<typename T> T derivative(T y) const { return y > 0 ? T(1) : T(0); }
+	};
+
+	struct LeakyReLUFunction
+	{
+		static constexpr char const* name = "LeakyReLU";
+		static constexpr std::size_t flops = 2;
+		static constexpr bool from_output = true;	// Holds for a positive alpha_: the output keeps the sign of the input.
+
+		Scalar alpha_ = 0.01;						//: Slope for negative inputs.
+
+		template<typename T> T value(T x) const { return x > 0 ? x : T(alpha_) * x; }
+		template<typename T> T derivative(T y) const { return y > 0 ? T(1) : T(alpha_); }
+	};
+
+	struct GELUFunction
+	{
+		// The tanh approximation: 0.5 * x * (1 + tanh(sqrt(2 / pi) * (x + 0.044715 * x^3)))
+		static constexpr char const* name = "GELU";
+		static constexpr std::size_t flops = 10;
+		static constexpr bool from_output = false;
+		static constexpr Scalar scale = 0.7978845608028654;
+		static constexpr Scalar cubic = 0.044715;
+
+		template<typename T> T value(T x) const
+		{
+			return T(0.5) * x * (1 + std::tanh(T(scale) * (x + T(cubic) * x * x * x)));
+		}
+
+		template<typename T> T derivative(T x) const
+		{
+			T t = std::tanh(T(scale) * (x + T(cubic) * x * x * x));
+			return T(0.5) * (1 + t) + T(0.5) * x * (1 - t * t) * T(scale) * (1 + 3 * T(cubic) * x * x);
+		}
+	};
 
-			 Input is {X}.
-			 Output is sigmoid(X) = 1 / (1 + exp(-X));
+	template<typename Tensor, typename Function>
+	class Activation : public Node<Tensor>
+	{
+		/*
+			Represents a node that performs an element-wise activation function.
+
+			Input is {X}.
+			Output is Function(X).
+
+			Forward is a single pass over X. Backward multiplies the sum of the partials of the outbound
+			nodes by the derivative in one pass; with a single outbound node the sum is skipped.
+			In place, forward takes over the value of the input node instead of writing a separate
+			value. The input node is then left holding stale values, so it may only be used when this
+			node is its only consumer and its own backward() does not read its value (e.g. Linear, Conv2D).
+			Nothing else may read the value of the input node after this node ran, e.g. a target of
+			Graph::evaluate() or generate_header(). The buffers of the two nodes swap every pass and
+			Linear writes the product into the buffer it gets back, so no value is allocated per step.
 		*/
 
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::mutableValue;
+
+	private:
+
+		Function function_;
+		bool in_place_;
+
 	public:
 
-		explicit Sigmoid(Node& input) :
-			Node(std::vector<Node*>{ &input })
+		explicit Activation(Node& input, bool in_place = false, Function function = Function()) :
+			Node(std::vector<Node*>{ &input }),
+			function_(function),
+			in_place_(in_place)
 		{
+			assert(!in_place_ || Function::from_output);
 		}
 
 		void forward() final
 		{
-			// The math behind a sigmoid.
-			auto const& input = inbound_nodes_[0]->getValue();
-			value_ = 1. / (1 + exp(-input));
+			if (in_place_)
+			{
+				std::swap(value_, mutableValue(*inbound_nodes_[0]));
+				value_.transform([&](auto x) { return function_.value(x); }, value_);
+			}
+			else
+			{
+				value_.transform([&](auto x) { return function_.value(x); }, inbound_nodes_[0]->getValue());
+			}
 		}
 
 		void backward() final
 		{
-			/*
-				The derivative of sigmoid(X):
-				d/dx[sigmoid(x)] = sigmoid(X) * (1 - sigmoid(X))
-			*/
+			Tensor& gradient = gradient_[0];
+			Tensor const& z = Function::from_output ? value_ : inbound_nodes_[0]->getValue();
+			auto chain = [&](auto x, auto grad_cost) { return function_.derivative(x) * grad_cost; };
 
-			clear_gradient();
-			// Cycle through the outputs. Sum the partial with respect to the input over all the outputs.
-			for (OutboundNode outbound_node : outbound_nodes_)
+			// Sum the partial with respect to this node over all the outputs, then apply the derivative.
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
 			{
-				// Get the partial of the cost with respect to this node.
-				auto const& sigmoid = value_;
-				auto const& grad_cost = outbound_node.getGradient();
-				gradient_[0] += sigmoid * (1 - sigmoid) * grad_cost;
+				gradient = Tensor();
+				return;
 			}
-		};
+			gradient.transform(chain, z, *partial);
+		}
+
+		Function const& function() const { return function_; }
+
+		char const* type() const final { return Function::name; }
+
+		std::size_t flops() const final { return Function::flops * size(value_); }
 	};
 
+	template<typename Tensor>
+	using Sigmoid = Activation<Tensor, SigmoidFunction>;
+
+	template<typename Tensor>
+	using Tanh = Activation<Tensor, TanhFunction>;
+
+	template<typename Tensor>
+	using ReLU = Activation<Tensor, ReLUFunction>;
+
+	template<typename Tensor>
+	using LeakyReLU = Activation<Tensor, LeakyReLUFunction>;
+
+	template<typename Tensor>
+	using GELU = Activation<Tensor, GELUFunction>;
+
 	template<typename Tensor>
 	class MSE : public Node<Tensor>
 	{
@@ -242,6 +694,17 @@ namespace miniflow
 			Output is mean squared error;
 		*/
 
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::print_info;
+
+	private:
+
 		//Cached values calculated during forward() computation for backward.
 		std::size_t m_;
 		Tensor diff_;
@@ -260,9 +723,9 @@ namespace miniflow
 			auto const& labels = inbound_nodes_[0]->getValue();
 			auto const& predictions = inbound_nodes_[1]->getValue();
 
-			m_ = 1;// inbound_nodes[0]->getValue().shape[0]; //TODO
 			diff_ = labels - predictions;
-			value_ = mean(sqr(diff_));
+			m_ = size(diff_);
+			value_ = scalar_like(diff_, sum_all(sqr(diff_)) / m_);
 
 			print_info("Cost: ");
 		}
@@ -276,6 +739,19 @@ namespace miniflow
 			gradient_[0] = 2. / m_ * diff_; //gradient with respect to labels
 			gradient_[1] = -gradient_[0];   //gradient with respect to predictions
 		}
+
+		char const* type() const final { return "MSE"; }
+
+		// Subtraction, square and accumulation per value.
+		std::size_t flops() const final { return 3 * size(diff_); }
+
+		// diff_ is kept for backward()
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = storage_bytes(diff_);
+			return usage;
+		}
 	};
 
 	
@@ -294,5 +770,7 @@ namespace miniflow
 		{
 			gradient_[0] = 1;
 		}
+
+		char const* type() const final { return "DebugNode"; }
 	};
 }
\ No newline at end of file
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class Affine : public Node<Tensor>
+	{
+		/*
+			Represents a node that scales and shifts every feature.
+
+			Input is {X, gamma, beta}: X is examples x features, gamma and beta single rows of features.
+			Output is X * gamma + beta, gamma and beta broadcast over the rows.
+
+			FoldedNetwork merges it into a preceding Linear node.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "Affine requires examples x features matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
+	public:
+
+		Affine(Node& X, Node& gamma, Node& beta) :
+			Node(std::vector<Node*>{ &X, &gamma, &beta })
+		{
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			T const* gamma = inbound_nodes_[1]->getValue().data_[0].data_.data();
+			T const* beta = inbound_nodes_[2]->getValue().data_[0].data_.data();
+			Index const features = X.shape()[1];
+			assert(inbound_nodes_[1]->getValue().shape()[1] == features && inbound_nodes_[2]->getValue().shape()[1] == features);
+
+			if (value_.shape() != X.shape()) value_ = Tensor(X.shape());
+			for (Index i = 0; i < X.shape()[0]; i++)
+			{
+				T const* x = X.data_[i].data_.data();
+				T* y = value_.data_[i].data_.data();
+				for (Index j = 0; j < features; j++) y[j] = x[j] * gamma[j] + beta[j];
+			}
+		}
+
+		void backward() final
+		{
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				clear_gradient();
+				return;
+			}
+			auto const& grad_cost = *partial;
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& gamma = inbound_nodes_[1]->getValue();
+			Index const features = X.shape()[1];
+
+			gradient_[0] = Tensor(X.shape());
+			gradient_[1] = Tensor(gamma.shape());
+			T* grad_gamma = gradient_[1].data_[0].data_.data();
+			for (Index i = 0; i < X.shape()[0]; i++)
+			{
+				T const* x = X.data_[i].data_.data();
+				T const* g = grad_cost.data_[i].data_.data();
+				T* grad_x = gradient_[0].data_[i].data_.data();
+				for (Index j = 0; j < features; j++)
+				{
+					grad_x[j] = g[j] * gamma.data_[0].data_[j];
+					grad_gamma[j] += g[j] * x[j];
+				}
+			}
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+		}
+
+		char const* type() const final { return "Affine"; }
+
+		// A multiplication and an addition per value.
+		std::size_t flops() const final { return 2 * size(value_); }
+	};
+
+	template<typename Tensor>
+	class BatchNorm : public Node<Tensor>
+	{
+		/*
+			Represents a node that normalizes every feature over the examples of a batch.
+
+			Input is {X, gamma, beta}: X is examples x features, gamma and beta single rows of features.
+			Output is (X - mean) / sqrt(variance + epsilon_) * gamma + beta.
+
+			In training mode mean and variance are those of the batch, and the running averages used in inference
+			mode are updated on every forward pass. In inference mode the node is an Affine node with
+			scale = gamma / sqrt(running variance + epsilon_), shift = beta - running mean * scale,
+			which FoldedNetwork merges into a preceding Linear node.
+			The running averages are not trainable, so checkpoints do not save them.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "BatchNorm requires examples x features matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
+	private:
+
+		Scalar momentum_;					//: Weight of the batch statistics in the running averages.
+		Scalar epsilon_;					//: Added to the variances.
+		bool training_ = true;
+		Tensor running_mean_;
+		Tensor running_variance_;
+		Tensor normalized_;					//: (X - mean) / sqrt(variance + epsilon_), kept for backward().
+		std::vector<T> inverse_std_;		//: 1 / sqrt(variance + epsilon_) of every feature.
+
+	public:
+
+		BatchNorm(Node& X, Node& gamma, Node& beta, Scalar momentum = 0.1, Scalar epsilon = 1e-5) :
+			Node(std::vector<Node*>{ &X, &gamma, &beta }),
+			momentum_(momentum),
+			epsilon_(epsilon)
+		{
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			Index const examples = X.shape()[0], features = X.shape()[1];
+			if (running_mean_.shape()[1] != features)
+			{
+				running_mean_ = Tensor({ 1, features });
+				running_variance_ = Tensor({ 1, features }, T(1));
+			}
+			T* running_mean = running_mean_.data_[0].data_.data();
+			T* running_variance = running_variance_.data_[0].data_.data();
+
+			std::vector<T> mean(features, T(0));
+			inverse_std_.resize(features);
+			if (training_)
+			{
+				std::vector<T> variance(features, T(0));
+				for (auto const& row : X.data_)
+				{
+					for (Index j = 0; j < features; j++) mean[j] += row.data_[j];
+				}
+				for (Index j = 0; j < features; j++) mean[j] /= examples;
+				for (auto const& row : X.data_)
+				{
+					for (Index j = 0; j < features; j++) variance[j] += (row.data_[j] - mean[j]) * (row.data_[j] - mean[j]);
+				}
+				for (Index j = 0; j < features; j++)
+				{
+					variance[j] /= examples;
+					inverse_std_[j] = T(1) / std::sqrt(variance[j] + T(epsilon_));
+					// The running variance is unbiased
+					T const unbiased = examples > 1 ? variance[j] * examples / (examples - 1) : variance[j];
+					running_mean[j] += T(momentum_) * (mean[j] - running_mean[j]);
+					running_variance[j] += T(momentum_) * (unbiased - running_variance[j]);
+				}
+			}
+			else
+			{
+				for (Index j = 0; j < features; j++)
+				{
+					mean[j] = running_mean[j];
+					inverse_std_[j] = T(1) / std::sqrt(running_variance[j] + T(epsilon_));
+				}
+			}
+
+			T const* gamma = inbound_nodes_[1]->getValue().data_[0].data_.data();
+			T const* beta = inbound_nodes_[2]->getValue().data_[0].data_.data();
+			if (value_.shape() != X.shape()) value_ = Tensor(X.shape());
+			if (normalized_.shape() != X.shape()) normalized_ = Tensor(X.shape());
+			for (Index i = 0; i < examples; i++)
+			{
+				T const* x = X.data_[i].data_.data();
+				T* n = normalized_.data_[i].data_.data();
+				T* y = value_.data_[i].data_.data();
+				for (Index j = 0; j < features; j++)
+				{
+					n[j] = (x[j] - mean[j]) * inverse_std_[j];
+					y[j] = n[j] * gamma[j] + beta[j];
+				}
+			}
+		}
+
+		void backward() final
+		{
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				clear_gradient();
+				return;
+			}
+			auto const& grad_cost = *partial;
+			auto const& gamma = inbound_nodes_[1]->getValue();
+			Index const examples = grad_cost.shape()[0], features = grad_cost.shape()[1];
+
+			// Partials with respect to gamma and beta, summed over the examples
+			gradient_[1] = Tensor(gamma.shape());
+			T* grad_gamma = gradient_[1].data_[0].data_.data();
+			for (Index i = 0; i < examples; i++)
+			{
+				T const* g = grad_cost.data_[i].data_.data();
+				T const* n = normalized_.data_[i].data_.data();
+				for (Index j = 0; j < features; j++) grad_gamma[j] += g[j] * n[j];
+			}
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+			T const* grad_beta = gradient_[2].data_[0].data_.data();
+
+			// In training mode the batch statistics depend on X:
+			// dX = gamma * inverse_std / examples * (examples * dY - sum(dY) - normalized * sum(dY * normalized))
+			gradient_[0] = Tensor(grad_cost.shape());
+			for (Index i = 0; i < examples; i++)
+			{
+				T const* g = grad_cost.data_[i].data_.data();
+				T const* n = normalized_.data_[i].data_.data();
+				T* grad_x = gradient_[0].data_[i].data_.data();
+				for (Index j = 0; j < features; j++)
+				{
+					T const scale = gamma.data_[0].data_[j] * inverse_std_[j];
+					grad_x[j] = training_ ? scale / examples * (examples * g[j] - grad_beta[j] - n[j] * grad_gamma[j]) : scale * g[j];
+				}
+			}
+		}
+
+		// Selects the statistics of the batch, in training mode, or the running averages.
+		void set_training(bool training)
+		{
+			training_ = training;
+			this->invalidate();
+		}
+
+		bool is_training() const { return training_; }
+		Tensor const& running_mean() const { return running_mean_; }
+		Tensor const& running_variance() const { return running_variance_; }
+
+		// Scale and shift of every feature in inference mode, rows of gamma / sqrt(running variance + epsilon_)
+		// and beta - running mean * scale.
+		std::pair<Tensor, Tensor> inference_affine() const
+		{
+			Tensor scale = inbound_nodes_[1]->getValue(), shift = inbound_nodes_[2]->getValue();
+			Index const features = scale.shape()[1];
+			for (Index j = 0; j < features; j++)
+			{
+				T const mean = running_mean_.shape()[1] == features ? running_mean_.data_[0].data_[j] : T(0);
+				T const variance = running_variance_.shape()[1] == features ? running_variance_.data_[0].data_[j] : T(1);
+				scale.data_[0].data_[j] /= std::sqrt(variance + T(epsilon_));
+				shift.data_[0].data_[j] -= mean * scale.data_[0].data_[j];
+			}
+			return { scale, shift };
+		}
+
+		char const* type() const final { return "BatchNorm"; }
+
+		// Statistics in training mode, then a subtraction, two multiplications and an addition per value.
+		std::size_t flops() const final { return (training_ ? 8 : 4) * size(value_); }
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = storage_bytes(normalized_) + storage_bytes(running_mean_) + storage_bytes(running_variance_) + inverse_std_.size() * sizeof(T);
+			return usage;
+		}
+	};
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "Graph.h"
+#include "DynamicTensor.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#define MINIFLOW_PIPELINE_AFFINITY
+#endif
+
+namespace miniflow
+{
+	struct PipelineOptions
+	{
+		std::size_t stages_ = 2;					//: Stages the computed nodes are partitioned into, each run by its own thread.
+		std::size_t micro_batches_ = 4;				//: Micro-batches a mini-batch is split into.
+		bool pin_threads_ = false;					//: Pins the thread of every stage to its own group of CPUs, on Linux.
+	};
+
+	struct PipelineReport
+	{
+		std::size_t steps_ = 0;						//: Steps run since the last reset.
+		double wall_seconds_ = 0;					//: Time from the start to the end of the passes of the steps.
+		std::vector<double> busy_seconds_;			//: Time every stage ran forward and backward passes.
+		std::vector<std::size_t> stage_nodes_;		//: Computed nodes of every stage.
+		std::vector<std::size_t> stage_flops_;		//: flops() of the forward pass of every stage on a micro-batch.
+
+		// Time a stage waited for the stages before or after it.
+		double idle_seconds(std::size_t stage) const { return wall_seconds_ - busy_seconds_[stage]; }
+
+		// Bubble time: the fraction of the time of the stage threads spent waiting.
+		double bubble() const
+		{
+			if (busy_seconds_.empty() || wall_seconds_ <= 0) return 0;
+			double busy = 0;
+			for (double seconds : busy_seconds_) busy += seconds;
+			return 1 - busy / (wall_seconds_ * busy_seconds_.size());
+		}
+	};
+
+	// Bubble of a GPipe schedule of equal stages: every stage waits for stages - 1 passes of a micro-batch
+	// before its first forward pass and after its last backward pass.
+	inline double gpipe_bubble(std::size_t stages, std::size_t micro_batches)
+	{
+		return double(stages - 1) / double(micro_batches + stages - 1);
+	}
+
+	template<typename Tensor>
+	class Pipeline
+	{
+		/*
+			Pipeline-parallel training of a network on the rows of mini-batches.
+
+			The network is built once per micro-batch around shared Trainable nodes, as the worker networks of
+			a Predictor. The computed nodes of its topological order are partitioned into options.stages_
+			contiguous stages of about equal flops(), measured on the first mini-batch. Every stage has its own
+			thread, which runs the forward passes of its nodes on every micro-batch in order, then their backward
+			passes in reverse order (GPipe schedule): while stage s runs micro-batch m, stage s + 1 runs m - 1.
+
+			A Trainable sums the partials of its outbound nodes, which are the nodes of every micro-batch, so the
+			gradients of the micro-batches are accumulated by the backward pass of the trainables after the last
+			micro-batch, followed by a single update with the learning rate divided by the number of micro-batches.
+			With costs averaged over the rows, e.g. MSE, and micro-batches of equal rows, a step is a step of
+			SGD on the whole mini-batch.
+
+			Rows split into micro-batches lower the products of every node to smaller matrices, so pipelining
+			pays off when stages have several cores between them, see PipelineOptions::pin_threads_.
+			The parallel loops of the nodes run on the shared pool of parallelFor. report() gives the time every
+			stage ran and waited. The trainables must only be read by the networks of the pipeline while it trains.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "Pipeline requires examples x features matrices");
+
+		using Clock = std::chrono::steady_clock;
+
+	public:
+
+		using Nodes = miniflow::Nodes<Tensor>;
+
+		// Builds the network of a micro-batch on its input and labels nodes and returns its cost node.
+		using Builder = std::function<Node<Tensor>&(Node<Tensor>& input, Node<Tensor>& labels, Nodes& nodes)>;
+
+	private:
+
+		// Input node of a micro-batch network, filled with its rows of a mini-batch.
+		class BatchInput : public Input<Tensor>
+		{
+		public:
+
+			BatchInput() : Input<Tensor>(Tensor()) {}
+
+			Tensor& value() { return this->value_; }
+		};
+
+		struct MicroBatch
+		{
+			Nodes nodes_;
+			BatchInput* input_ = nullptr;
+			BatchInput* labels_ = nullptr;
+			Node<Tensor>* cost_ = nullptr;
+			std::unique_ptr<Graph> graph_;
+			std::vector<std::vector<NodeInterface*>> stages_;		//: Computed nodes of every stage, in topological order.
+		};
+
+		PipelineOptions options_;
+		std::vector<std::unique_ptr<MicroBatch>> micro_batches_;
+		std::vector<NodeInterface*> trainables_;
+		std::vector<std::thread> threads_;
+		PipelineReport report_;
+
+		std::mutex mutex_;
+		std::condition_variable progress_;
+		std::size_t generation_ = 0;				//: Steps started, a stage thread runs a step when it changes.
+		std::vector<std::size_t> forwarded_;		//: Stages that ran the forward pass of every micro-batch.
+		std::vector<std::size_t> backwarded_;		//: Stages that ran the backward pass of every micro-batch.
+		std::size_t finished_ = 0;					//: Stage threads done with the current step.
+		std::exception_ptr error_;
+		bool stopping_ = false;
+
+		// Restricts the calling thread to its group of CPUs, CPUs divided evenly between the stages.
+		void pin(std::size_t stage) const
+		{
+#ifdef MINIFLOW_PIPELINE_AFFINITY
+			if (!options_.pin_threads_) return;
+			std::size_t const cpus = std::max(1u, std::thread::hardware_concurrency()), stages = options_.stages_;
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			if (cpus < stages) CPU_SET(stage % cpus, &set);
+			for (std::size_t cpu = cpus * stage / stages; cpu < cpus * (stage + 1) / stages; cpu++) CPU_SET(cpu, &set);
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+			(void)stage;
+#endif
+		}
+
+		// Splits the computed nodes into stages of about equal forward flops, on the values of the first micro-batch.
+		void partition()
+		{
+			std::size_t const stages = options_.stages_;
+			MicroBatch& first = *micro_batches_.front();
+			std::vector<NodeInterface*> computed;
+			for (NodeInterface* node : first.graph_->nodes())
+			{
+				if (!node->is_input()) computed.push_back(node);
+			}
+			if (computed.size() < stages) throw std::runtime_error("Pipeline: fewer computed nodes than stages");
+
+			std::vector<std::size_t> flops;
+			std::size_t total = 0;
+			for (NodeInterface* node : computed)
+			{
+				node->forward();
+				node->mark_fresh();
+				flops.push_back(node->flops());
+				total += flops.back();
+			}
+
+			// A stage ends when the flops so far reach its share of the total, leaving a node for every later stage
+			std::vector<std::size_t> ends;
+			std::size_t sum = 0;
+			for (std::size_t i = 0; i < computed.size(); i++)
+			{
+				sum += flops[i];
+				std::size_t const stage = ends.size();
+				if (stage + 1 == stages) break;
+				bool const share = double(sum) >= double(total) * (stage + 1) / stages;
+				if (share || computed.size() - (i + 1) == stages - (stage + 1)) ends.push_back(i + 1);
+			}
+			ends.push_back(computed.size());
+
+			report_.stage_nodes_.assign(stages, 0);
+			report_.stage_flops_.assign(stages, 0);
+			for (std::size_t s = 0, begin = 0; s < stages; begin = ends[s++])
+			{
+				report_.stage_nodes_[s] = ends[s] - begin;
+				for (std::size_t i = begin; i < ends[s]; i++) report_.stage_flops_[s] += flops[i];
+			}
+
+			// Every network is built by the same builder, so its nodes have the same topological order
+			trainables_ = trainables(first);
+			for (auto& micro_batch : micro_batches_)
+			{
+				std::vector<NodeInterface*> nodes;
+				for (NodeInterface* node : micro_batch->graph_->nodes())
+				{
+					if (!node->is_input()) nodes.push_back(node);
+				}
+				if (nodes.size() != computed.size()) throw std::runtime_error("Pipeline: micro-batch networks differ");
+				if (trainables(*micro_batch) != trainables_) throw std::runtime_error("Pipeline: trainables not shared by the micro-batch networks");
+
+				micro_batch->stages_.assign(stages, {});
+				for (std::size_t s = 0, begin = 0; s < stages; begin = ends[s++])
+				{
+					micro_batch->stages_[s].assign(nodes.begin() + begin, nodes.begin() + ends[s]);
+				}
+			}
+		}
+
+		static std::vector<NodeInterface*> trainables(MicroBatch const& micro_batch)
+		{
+			std::vector<NodeInterface*> trainables;
+			for (NodeInterface* node : micro_batch.graph_->nodes())
+			{
+				if (node->is_trainable()) trainables.push_back(node);
+			}
+			return trainables;
+		}
+
+		// Waits until ready() or a stage failed, returns false if a stage failed.
+		template<typename F>
+		bool wait(std::unique_lock<std::mutex>& lock, F ready)
+		{
+			progress_.wait(lock, [&] { return error_ || ready(); });
+			return !error_;
+		}
+
+		void run(std::size_t stage)
+		{
+			pin(stage);
+			std::size_t const stages = options_.stages_, micro_batches = micro_batches_.size();
+			std::size_t seen = 0;
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					progress_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+					if (stopping_) return;
+					seen = generation_;
+				}
+
+				double busy = 0;
+				auto pass = [&](std::vector<std::size_t>& done, std::size_t m, std::size_t position, bool forward)
+				{
+					{
+						std::unique_lock<std::mutex> lock(mutex_);
+						if (!wait(lock, [&] { return done[m] == position; })) return false;
+					}
+					Clock::time_point const start = Clock::now();
+					auto const& nodes = micro_batches_[m]->stages_[stage];
+					if (forward)
+					{
+						for (NodeInterface* node : nodes)
+						{
+							node->forward();
+							node->mark_fresh();
+						}
+					}
+					else
+					{
+						for (auto node = nodes.rbegin(); node != nodes.rend(); ++node) (*node)->backward();
+					}
+					busy += std::chrono::duration<double>(Clock::now() - start).count();
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						done[m]++;
+					}
+					progress_.notify_all();
+					return true;
+				};
+
+				try
+				{
+					// Forward passes in order, then backward passes from the last micro-batch, which the last stage has just run
+					bool running = true;
+					for (std::size_t m = 0; running && m < micro_batches; m++) running = pass(forwarded_, m, stage, true);
+					for (std::size_t m = micro_batches; running && m-- > 0;) running = pass(backwarded_, m, stages - 1 - stage, false);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (!error_) error_ = std::current_exception();
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					report_.busy_seconds_[stage] += busy;
+					finished_++;
+				}
+				progress_.notify_all();
+			}
+		}
+
+	public:
+
+		// Builds options.micro_batches_ copies of the network. Nodes shared by build() must outlive the Pipeline.
+		Pipeline(Builder const& build, PipelineOptions const& options = PipelineOptions()) :
+			options_(options)
+		{
+			assert(options_.stages_ > 0 && options_.micro_batches_ > 0);
+			for (std::size_t m = 0; m < options_.micro_batches_; m++)
+			{
+				auto micro_batch = std::make_unique<MicroBatch>();
+				micro_batch->input_ = &micro_batch->nodes_.template add<BatchInput>();
+				micro_batch->labels_ = &micro_batch->nodes_.template add<BatchInput>();
+				micro_batch->cost_ = &build(*micro_batch->input_, *micro_batch->labels_, micro_batch->nodes_);
+				micro_batch->graph_ = std::make_unique<Graph>(*micro_batch->cost_);
+				micro_batches_.push_back(std::move(micro_batch));
+			}
+			report_.busy_seconds_.assign(options_.stages_, 0);
+			forwarded_.assign(options_.micro_batches_, 0);
+			backwarded_.assign(options_.micro_batches_, 0);
+			for (std::size_t s = 0; s < options_.stages_; s++) threads_.emplace_back([this, s] { run(s); });
+		}
+
+		Pipeline(Pipeline const&) = delete;
+		Pipeline& operator=(Pipeline const&) = delete;
+
+		~Pipeline()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			progress_.notify_all();
+			for (std::thread& thread : threads_) thread.join();
+		}
+
+		// Performs an SGD step on a mini-batch of rows x features inputs and their labels, split into micro-batches
+		// of as equal rows as possible. Returns the cost of the mini-batch before the update, the average of the costs
+		// of the micro-batches weighted by their rows.
+		Scalar step(Tensor const& X, Tensor const& labels, Scalar learning_rate)
+		{
+			Index const rows = X.shape()[0];
+			std::size_t const micro_batches = micro_batches_.size();
+			assert(labels.shape()[0] == rows);
+			if (rows < micro_batches) throw std::runtime_error("Pipeline: fewer rows than micro-batches");
+
+			for (std::size_t m = 0; m < micro_batches; m++)
+			{
+				Index const begin = Index(rows * m / micro_batches), end = Index(rows * (m + 1) / micro_batches);
+				auto fill = [&](BatchInput& input, Tensor const& values)
+				{
+					Tensor& value = input.value();
+					dynamictensor::Shape<2> shape{ end - begin, values.shape()[1] };
+					if (value.shape() != shape) value = Tensor(shape);
+					for (Index i = begin; i < end; i++) value.data_[i - begin].data_ = values.data_[i].data_;
+					input.invalidate();
+				};
+				fill(*micro_batches_[m]->input_, X);
+				fill(*micro_batches_[m]->labels_, labels);
+			}
+			if (micro_batches_.front()->stages_.empty()) partition();
+
+			Clock::time_point const start = Clock::now();
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				std::fill(forwarded_.begin(), forwarded_.end(), 0);
+				std::fill(backwarded_.begin(), backwarded_.end(), 0);
+				finished_ = 0;
+				generation_++;
+				progress_.notify_all();
+				progress_.wait(lock, [&] { return finished_ == threads_.size(); });
+				if (error_)
+				{
+					std::exception_ptr error = error_;
+					error_ = nullptr;
+					std::rethrow_exception(error);
+				}
+			}
+			report_.wall_seconds_ += std::chrono::duration<double>(Clock::now() - start).count();
+			report_.steps_++;
+
+			// The partials of the micro-batches are summed by every trainable
+			for (NodeInterface* trainable : trainables_)
+			{
+				trainable->backward();
+				trainable->update(learning_rate / micro_batches);
+			}
+
+			Scalar cost = 0;
+			for (auto const& micro_batch : micro_batches_)
+			{
+				cost += micro_batch->cost_->getValue().data_[0].data_[0] * micro_batch->input_->getValue().shape()[0] / rows;
+			}
+			return cost;
+		}
+
+		// Time every stage ran and waited since the last reset, and the partition of the nodes into stages.
+		PipelineReport const& report() const { return report_; }
+
+		void reset_report()
+		{
+			report_.steps_ = 0;
+			report_.wall_seconds_ = 0;
+			std::fill(report_.busy_seconds_.begin(), report_.busy_seconds_.end(), 0.);
+		}
+
+		// Computed nodes of every stage of the network of a micro-batch, after the first step.
+		std::vector<std::vector<NodeInterface*>> const& stages(std::size_t micro_batch = 0) const { return micro_batches_[micro_batch]->stages_; }
+	};
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Graph.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	struct PredictorOptions
+	{
+		std::size_t workers_ = 1;									//: Number of worker threads, each with its own network.
+		Index max_batch_ = 64;										//: Largest number of rows a worker runs at once.
+		std::chrono::microseconds max_latency_{ 1000 };				//: Longest time a request waits for a batch to fill.
+	};
+
+	template<typename Tensor>
+	class Predictor
+	{
+		/*
+			Thread-safe batched inference of a trained network.
+
+			Graph is not thread-safe, because node values are members of the nodes. Every worker of a Predictor
+			therefore builds its own copy of the network around the trained weights: the Trainable nodes are shared
+			and only read, while the worker nodes hold the activations of its batches and keep their buffers between
+			them. The weights must not be trained while the Predictor exists.
+
+			predict() may be called from any thread. Requests are queued and the first idle worker takes as many of
+			them as fit into max_batch_ rows, runs them as a single batch and answers each request with its own rows.
+			Batches adapt to the load: while a worker has fewer rows than its previous batch and every other worker
+			is busy, it waits for more requests, but no longer than until the oldest one has waited max_latency_.
+			Under low load requests run as soon as they arrive, under high load batches grow up to max_batch_.
+
+			The network must accept batches of any number of rows, e.g. Linear nodes with a single row b.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "Predictor requires examples x features matrices");
+
+		using Clock = std::chrono::steady_clock;
+
+	public:
+
+		using Nodes = miniflow::Nodes<Tensor>;
+
+		// Builds the network of a worker on the given input node and returns its output node.
+		using Builder = std::function<Node<Tensor>&(Node<Tensor>& input, Nodes& nodes)>;
+
+	private:
+
+		// Input node of a worker network, filled with the rows of a batch.
+		class BatchInput : public Input<Tensor>
+		{
+		public:
+
+			BatchInput() : Input<Tensor>(Tensor()) {}
+
+			Tensor& value() { return this->value_; }
+		};
+
+		struct Request
+		{
+			Tensor input_;
+			std::promise<Tensor> result_;
+			Clock::time_point arrival_;
+		};
+
+		struct Worker
+		{
+			Nodes nodes_;
+			BatchInput* input_ = nullptr;
+			Node<Tensor>* output_ = nullptr;
+			std::unique_ptr<Graph> graph_;
+			std::thread thread_;
+		};
+
+		PredictorOptions options_;
+		Index features_;
+		std::vector<std::unique_ptr<Worker>> workers_;
+
+		std::mutex mutex_;
+		std::condition_variable queued_;
+		std::deque<Request> queue_;
+		std::size_t idle_ = 0;			//: Number of workers waiting for requests.
+		bool stopping_ = false;
+
+		// Waits for the next batch of requests, trying to fill target rows.
+		// Returns false when the predictor stops and the queue is empty.
+		bool take(std::vector<Request>& batch, Index target)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			idle_++;
+			queued_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+			idle_--;
+			if (queue_.empty()) return false;
+
+			Clock::time_point const deadline = queue_.front().arrival_ + options_.max_latency_;
+			Index rows = 0;
+			while (true)
+			{
+				while (!queue_.empty() && (rows == 0 || rows + queue_.front().input_.shape_[0] <= options_.max_batch_))
+				{
+					rows += queue_.front().input_.shape_[0];
+					batch.push_back(std::move(queue_.front()));
+					queue_.pop_front();
+				}
+				// Full, or an idle worker would run the next requests anyway
+				if (!queue_.empty() || rows >= std::min(target, options_.max_batch_) || stopping_ || idle_ > 0) break;
+				if (!queued_.wait_until(lock, deadline, [&] { return stopping_ || !queue_.empty(); })) break;
+			}
+			if (!queue_.empty()) queued_.notify_one();
+			return true;
+		}
+
+		void run(Worker& worker)
+		{
+			std::vector<Request> batch;
+			Index rows = 0;
+			while (take(batch, rows))
+			{
+				try
+				{
+					// Gather the rows of the requests into the input of the network
+					rows = 0;
+					for (Request const& request : batch) rows += request.input_.shape_[0];
+					Tensor& input = worker.input_->value();
+					dynamictensor::Shape<2> shape{ rows, features_ };
+					if (input.shape() != shape) input = Tensor(shape);
+					Index row = 0;
+					for (Request const& request : batch)
+					{
+						for (auto const& values : request.input_.data_) input.data_[row++].data_ = values.data_;
+					}
+					worker.input_->invalidate();
+
+					worker.graph_->forward();
+
+					// Answer every request with its rows of the output
+					Tensor const& output = worker.output_->getValue();
+					row = 0;
+					for (Request& request : batch)
+					{
+						Tensor result(dynamictensor::Shape<2>{ request.input_.shape_[0], output.shape_[1] });
+						for (auto& values : result.data_) values.data_ = output.data_[row++].data_;
+						request.result_.set_value(std::move(result));
+					}
+				}
+				catch (...)
+				{
+					for (Request& request : batch) request.result_.set_exception(std::current_exception());
+				}
+				batch.clear();
+			}
+		}
+
+	public:
+
+		// Builds options.workers_ copies of the network. Nodes shared by build() must outlive the Predictor.
+		Predictor(Builder const& build, Index features, PredictorOptions const& options = PredictorOptions()) :
+			options_(options),
+			features_(features)
+		{
+			assert(options_.workers_ > 0 && options_.max_batch_ > 0);
+			// Networks are built before any worker starts, since building connects them to the shared nodes.
+			for (std::size_t i = 0; i < options_.workers_; i++)
+			{
+				auto worker = std::make_unique<Worker>();
+				worker->input_ = &worker->nodes_.template add<BatchInput>();
+				worker->output_ = &build(*worker->input_, worker->nodes_);
+				worker->graph_ = std::make_unique<Graph>(*worker->output_);
+				workers_.push_back(std::move(worker));
+			}
+			for (auto& worker : workers_)
+			{
+				worker->thread_ = std::thread([this, &worker = *worker] { run(worker); });
+			}
+		}
+
+		Predictor(Predictor const&) = delete;
+		Predictor& operator=(Predictor const&) = delete;
+
+		// Answers the queued requests and stops the workers.
+		~Predictor()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stopping_ = true;
+			}
+			queued_.notify_all();
+			for (auto& worker : workers_) worker->thread_.join();
+		}
+
+		// Queues rows x features inputs and returns the future rows x outputs result.
+		std::future<Tensor> predict(Tensor input)
+		{
+			assert(input.shape_[1] == features_ && input.shape_[0] > 0);
+			Request request{ std::move(input), std::promise<Tensor>(), Clock::now() };
+			std::future<Tensor> result = request.result_.get_future();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queue_.push_back(std::move(request));
+			}
+			queued_.notify_one();
+			return result;
+		}
+	};
+}
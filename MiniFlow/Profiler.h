@@ -0,0 +1,214 @@
+#pragma once
+
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include "Node.h"
+
+namespace miniflow
+{
+	enum class Phase { forward, backward, update };
+
+	inline char const* phase_name(Phase phase)
+	{
+		switch (phase)
+		{
+		case Phase::forward: return "forward";
+		case Phase::backward: return "backward";
+		default: return "update";
+		}
+	}
+
+	struct ProfileEvent
+	{
+		NodeInterface const* node_;		//: Profiled node.
+		Phase phase_;					//: Profiled pass.
+		double start_;					//: Start time in microseconds since the profiler was created.
+		double duration_;				//: Wall time in microseconds.
+		std::size_t flops_;				//: Estimated floating point operations.
+		std::size_t bytes_;				//: Estimated bytes moved.
+		std::size_t allocations_;		//: Tensor allocations made during the call.
+		std::vector<Index> shape_;		//: Shape of the node value after the call.
+	};
+
+	class Profiler
+	{
+		/*
+			Records per node statistics of Graph passes.
+			Attach it to a Graph with Graph::set_profiler(). A Graph without a profiler only pays a pointer check per node call.
+			FLOPs and bytes are estimates reported by the nodes for forward(). Backward is estimated as twice the forward cost,
+			update as one multiply-add per value of a trainable node.
+		*/
+
+		using Clock = std::chrono::steady_clock;
+
+		Clock::time_point origin_;
+		std::vector<ProfileEvent> events_;
+		std::map<NodeInterface const*, std::string> labels_;
+
+		static std::size_t count(std::vector<Index> const& shape)
+		{
+			std::size_t n = 1;
+			for (Index dim : shape) n *= dim;
+			return n;
+		}
+
+		static std::string shape_string(std::vector<Index> const& shape)
+		{
+			std::string result;
+			for (std::size_t i = 0; i < shape.size(); i++)
+			{
+				result += (i ? "x" : "") + std::to_string(shape[i]);
+			}
+			return result.empty() ? "scalar" : result;
+		}
+
+		static std::string escape(std::string const& text)
+		{
+			std::string result;
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\') result += '\\';
+				result += c;
+			}
+			return result;
+		}
+
+	public:
+
+		Profiler() : origin_(Clock::now()) {}
+
+		// Calls fn and records it as the phase of node.
+		template<typename F>
+		void record(NodeInterface* node, Phase phase, F fn)
+		{
+			std::size_t allocations = allocation_count;
+			Clock::time_point start = Clock::now();
+			fn();
+			Clock::time_point end = Clock::now();
+
+			ProfileEvent event;
+			event.node_ = node;
+			event.phase_ = phase;
+			event.start_ = std::chrono::duration<double, std::micro>(start - origin_).count();
+			event.duration_ = std::chrono::duration<double, std::micro>(end - start).count();
+			event.allocations_ = allocation_count - allocations;
+			event.shape_ = node->shape();
+			switch (phase)
+			{
+			case Phase::forward:
+				event.flops_ = node->flops();
+				event.bytes_ = node->bytes();
+				break;
+			case Phase::backward:
+				event.flops_ = 2 * node->flops();
+				event.bytes_ = 2 * node->bytes();
+				break;
+			default:
+				event.flops_ = node->is_trainable() ? 2 * count(event.shape_) : 0;
+				event.bytes_ = node->is_trainable() ? 3 * count(event.shape_) * sizeof(Scalar) : 0;
+			}
+			events_.push_back(std::move(event));
+		}
+
+		std::vector<ProfileEvent> const& events() const { return events_; }
+
+		void clear()
+		{
+			events_.clear();
+			origin_ = Clock::now();
+		}
+
+		// Returns the node name, or its type followed by the order in which the profiler first saw it.
+		std::string const& label(NodeInterface const* node)
+		{
+			auto it = labels_.find(node);
+			if (it == labels_.end())
+			{
+				std::string text = node->name().empty() ? node->type() + ("#" + std::to_string(labels_.size())) : node->name();
+				it = labels_.emplace(node, text).first;
+			}
+			return it->second;
+		}
+
+		// Writes the events in Chrome trace event format, viewable in chrome://tracing or Perfetto.
+		void write_chrome_trace(std::ostream& out)
+		{
+			std::ios_base::fmtflags flags = out.flags();
+			std::streamsize precision = out.precision();
+			out << "{\"traceEvents\":[";
+			for (std::size_t i = 0; i < events_.size(); i++)
+			{
+				ProfileEvent const& event = events_[i];
+				out << (i ? ",\n" : "\n")
+					<< "{\"name\":\"" << escape(label(event.node_)) << "\",\"cat\":\"" << phase_name(event.phase_)
+					<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":" << std::fixed << std::setprecision(3) << event.start_
+					<< ",\"dur\":" << event.duration_
+					<< ",\"args\":{\"type\":\"" << event.node_->type() << "\",\"flops\":" << event.flops_
+					<< ",\"bytes\":" << event.bytes_ << ",\"allocations\":" << event.allocations_
+					<< ",\"shape\":\"" << shape_string(event.shape_) << "\"}}";
+			}
+			out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+			out.flags(flags);
+			out.precision(precision);
+		}
+
+		// Writes a table of the time spent per node and pass, the most expensive first.
+		void write_summary(std::ostream& out)
+		{
+			std::ios_base::fmtflags flags = out.flags();
+			std::streamsize precision = out.precision();
+			struct Row
+			{
+				std::string label_;
+				Phase phase_;
+				std::size_t calls_ = 0;
+				double time_ = 0;
+				std::size_t flops_ = 0;
+				std::size_t bytes_ = 0;
+				std::size_t allocations_ = 0;
+				std::vector<Index> shape_;
+			};
+
+			std::map<std::pair<NodeInterface const*, Phase>, Row> rows;
+			double total_time = 0;
+			for (ProfileEvent const& event : events_)
+			{
+				Row& row = rows[{ event.node_, event.phase_ }];
+				row.label_ = label(event.node_);
+				row.phase_ = event.phase_;
+				row.calls_++;
+				row.time_ += event.duration_;
+				row.flops_ += event.flops_;
+				row.bytes_ += event.bytes_;
+				row.allocations_ += event.allocations_;
+				row.shape_ = event.shape_;
+				total_time += event.duration_;
+			}
+
+			std::vector<Row> sorted;
+			for (auto const& item : rows) sorted.push_back(item.second);
+			std::sort(sorted.begin(), sorted.end(), [](Row const& r1, Row const& r2) { return r1.time_ > r2.time_; });
+
+			out << std::left << std::setw(24) << "node" << std::setw(10) << "pass" << std::right
+				<< std::setw(8) << "calls" << std::setw(12) << "total ms" << std::setw(8) << "%"
+				<< std::setw(12) << "mean us" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s"
+				<< std::setw(8) << "allocs" << "  shape\n";
+			for (Row const& row : sorted)
+			{
+				double seconds = row.time_ * 1e-6;
+				out << std::left << std::setw(24) << row.label_ << std::setw(10) << phase_name(row.phase_) << std::right
+					<< std::fixed << std::setw(8) << row.calls_
+					<< std::setprecision(3) << std::setw(12) << row.time_ * 1e-3
+					<< std::setprecision(1) << std::setw(8) << (total_time > 0 ? 100 * row.time_ / total_time : 0.)
+					<< std::setprecision(2) << std::setw(12) << row.time_ / row.calls_
+					<< std::setw(10) << (seconds > 0 ? row.flops_ * 1e-9 / seconds : 0.)
+					<< std::setw(10) << (seconds > 0 ? row.bytes_ * 1e-9 / seconds : 0.)
+					<< std::setw(8) << row.allocations_ << "  " << shape_string(row.shape_) << "\n";
+			}
+			out.flags(flags);
+			out.precision(precision);
+		}
+	};
+}
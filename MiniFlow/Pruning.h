@@ -0,0 +1,348 @@
+#pragma once
+
+#include <numeric>
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	/*
+		Structured magnitude pruning of the weights of Linear nodes.
+
+		W is divided into blocks of block_rows_ x block_cols_ values: a block of 1 x cols prunes a whole input
+		feature, rows x 1 a whole output, and small tiles, e.g. 32 x 32, anything in between. prune() zeroes
+		the blocks of lowest root mean square value and returns the BlockMask of the blocks kept.
+		BlockSparseLinear then multiplies by the kept blocks only, in forward and in both products of backward,
+		so its cost is proportional to the values kept. Its gradient is zero on the pruned blocks, so SGD steps
+		keep them zero and training can go on with the pruned model.
+	*/
+
+	struct PruningOptions
+	{
+		Index block_rows_ = 32;				//: Rows of W in a block, inputs of the Linear node.
+		Index block_cols_ = 32;				//: Columns of W in a block, outputs of the Linear node.
+		Scalar sparsity_ = 0.5;				//: Fraction of the blocks pruned.
+	};
+
+	class BlockMask
+	{
+		/*
+			Blocks of a rows x cols matrix kept by pruning. Blocks of the last block row and column may be smaller.
+		*/
+
+		Index rows_ = 0;
+		Index cols_ = 0;
+		Index block_rows_ = 1;
+		Index block_cols_ = 1;
+		std::vector<char> kept_;					//: Whether every block is kept, block rows by block columns.
+		std::vector<std::vector<Index>> columns_;	//: Kept block rows of every block column, in order.
+		std::vector<std::vector<Index>> rows_kept_;	//: Kept block columns of every block row, in order.
+
+	public:
+
+		BlockMask() = default;
+
+		// A mask keeping every block
+		BlockMask(Index rows, Index cols, Index block_rows, Index block_cols) :
+			rows_(rows),
+			cols_(cols),
+			block_rows_(block_rows),
+			block_cols_(block_cols)
+		{
+			// The block counts divide by the block sizes
+			if (block_rows <= 0 || block_cols <= 0) throw std::runtime_error("Pruning: block sizes must be positive");
+			kept_.assign(std::size_t(block_row_count()) * block_col_count(), 1);
+			update();
+		}
+
+		// Rebuilds the lists of kept blocks after kept_ changed
+		void update()
+		{
+			columns_.assign(block_col_count(), {});
+			rows_kept_.assign(block_row_count(), {});
+			for (Index kb = 0; kb < block_row_count(); kb++)
+			{
+				for (Index jb = 0; jb < block_col_count(); jb++)
+				{
+					if (!kept(kb, jb)) continue;
+					columns_[jb].push_back(kb);
+					rows_kept_[kb].push_back(jb);
+				}
+			}
+		}
+
+		Index rows() const { return rows_; }
+		Index cols() const { return cols_; }
+		Index block_rows() const { return block_rows_; }
+		Index block_cols() const { return block_cols_; }
+		Index block_row_count() const { return (rows_ + block_rows_ - 1) / block_rows_; }
+		Index block_col_count() const { return (cols_ + block_cols_ - 1) / block_cols_; }
+
+		bool kept(Index kb, Index jb) const { return kept_[std::size_t(kb) * block_col_count() + jb] != 0; }
+		void set_kept(Index kb, Index jb, bool kept) { kept_[std::size_t(kb) * block_col_count() + jb] = kept; }
+		std::vector<Index> const& kept_rows(Index jb) const { return columns_[jb]; }
+		std::vector<Index> const& kept_cols(Index kb) const { return rows_kept_[kb]; }
+
+		// Rows [k0, k1) and columns [j0, j1) of W in a block
+		Index row_begin(Index kb) const { return kb * block_rows_; }
+		Index row_end(Index kb) const { return std::min(rows_, (kb + 1) * block_rows_); }
+		Index col_begin(Index jb) const { return jb * block_cols_; }
+		Index col_end(Index jb) const { return std::min(cols_, (jb + 1) * block_cols_); }
+
+		// Values of W in the kept blocks
+		std::size_t kept_values() const
+		{
+			std::size_t count = 0;
+			for (Index jb = 0; jb < block_col_count(); jb++)
+			{
+				for (Index kb : columns_[jb]) count += std::size_t(row_end(kb) - row_begin(kb)) * (col_end(jb) - col_begin(jb));
+			}
+			return count;
+		}
+
+		// Fraction of the values of W pruned
+		Scalar sparsity() const
+		{
+			return rows_ > 0 && cols_ > 0 ? 1 - Scalar(kept_values()) / (Scalar(rows_) * cols_) : 0;
+		}
+
+		// Zeroes the pruned blocks of a matrix
+		template<class T>
+		void apply(dynamictensor::Tensor<T, 2>& W) const
+		{
+			assert(W.shape()[0] == rows_ && W.shape()[1] == cols_);
+			for (Index kb = 0; kb < block_row_count(); kb++)
+			{
+				for (Index jb = 0; jb < block_col_count(); jb++)
+				{
+					if (kept(kb, jb)) continue;
+					for (Index k = row_begin(kb); k < row_end(kb); k++)
+					{
+						std::fill(W.data_[k].data_.begin() + col_begin(jb), W.data_[k].data_.begin() + col_end(jb), T(0));
+					}
+				}
+			}
+		}
+	};
+
+	// Mask of the blocks of W kept when the fraction options.sparsity_ of them, of lowest root mean square value, is pruned.
+	template<class T>
+	BlockMask magnitude_mask(dynamictensor::Tensor<T, 2> const& W, PruningOptions const& options)
+	{
+		BlockMask mask(W.shape()[0], W.shape()[1], options.block_rows_, options.block_cols_);
+		Index const block_cols = mask.block_col_count();
+		std::vector<T> magnitudes(std::size_t(mask.block_row_count()) * block_cols);
+		for (Index kb = 0; kb < mask.block_row_count(); kb++)
+		{
+			for (Index jb = 0; jb < block_cols; jb++)
+			{
+				T squares(0);
+				for (Index k = mask.row_begin(kb); k < mask.row_end(kb); k++)
+				{
+					for (Index j = mask.col_begin(jb); j < mask.col_end(jb); j++) squares += W.data_[k].data_[j] * W.data_[k].data_[j];
+				}
+				Index const count = (mask.row_end(kb) - mask.row_begin(kb)) * (mask.col_end(jb) - mask.col_begin(jb));
+				magnitudes[std::size_t(kb) * block_cols + jb] = std::sqrt(squares / count);
+			}
+		}
+
+		std::vector<std::size_t> order(magnitudes.size());
+		std::iota(order.begin(), order.end(), std::size_t(0));
+		std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return magnitudes[a] < magnitudes[b]; });
+		std::size_t const pruned = std::min(order.size(), std::size_t(std::llround(options.sparsity_ * Scalar(order.size()))));
+		for (std::size_t i = 0; i < pruned; i++) mask.set_kept(Index(order[i] / block_cols), Index(order[i] % block_cols), false);
+		mask.update();
+		return mask;
+	}
+
+	// Prunes the weights of a Trainable: zeroes the blocks of lowest magnitude and returns the mask of the kept ones.
+	template<typename Tensor>
+	BlockMask prune(Trainable<Tensor>& W, PruningOptions const& options = {})
+	{
+		Tensor value = W.getValue();
+		BlockMask mask = magnitude_mask(value, options);
+		mask.apply(value);
+		W.setValue(value);
+		return mask;
+	}
+
+	template<typename Tensor>
+	class BlockSparseLinear : public Node<Tensor>
+	{
+		/*
+			Represents a Linear node whose W is zero outside the kept blocks of a BlockMask.
+
+			Input is {X, W, b}, as for Linear.
+			Output is dot(X, W) + b.
+
+			The products of forward() and backward() run over the kept blocks only: the pruned blocks are
+			neither read nor written, and the partial with respect to W is zero on them. Rows of X are
+			split between threads as for the dense products, see dynamictensor::GemmBlocking.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "BlockSparseLinear requires dynamictensor matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+		using Node::clear_gradient;
+
+	private:
+
+		BlockMask mask_;
+		Tensor transposed_;					//: transpose(W) on the kept blocks, zero elsewhere, for backward().
+
+		void transpose_kept(Tensor const& W)
+		{
+			if (transposed_.shape()[0] != mask_.cols() || transposed_.shape()[1] != mask_.rows()) transposed_ = Tensor({ mask_.cols(), mask_.rows() });
+			for (Index kb = 0; kb < mask_.block_row_count(); kb++)
+			{
+				for (Index jb : mask_.kept_cols(kb))
+				{
+					for (Index k = mask_.row_begin(kb); k < mask_.row_end(kb); k++)
+					{
+						for (Index j = mask_.col_begin(jb); j < mask_.col_end(jb); j++) transposed_.data_[j].data_[k] = W.data_[k].data_[j];
+					}
+				}
+			}
+		}
+
+	public:
+
+		BlockSparseLinear(Node& X, Node& W, Node& b, BlockMask const& mask) :
+			Node(std::vector<Node*>{ &X, &W, &b }),
+			mask_(mask)
+		{
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			Index const M = X.shape()[0];
+			assert(X.shape()[1] == mask_.rows() && W.shape()[0] == mask_.rows() && W.shape()[1] == mask_.cols());
+
+			// Starts from b, the products are added to it
+			value_ = Tensor({ M, mask_.cols() });
+			add_bias(value_, inbound_nodes_[2]->getValue());
+			dynamictensor::split_rows(M, dynamictensor::gemm_blocking.threads_, [&](Index i0, Index i1)
+			{
+				for (Index jb = 0; jb < mask_.block_col_count(); jb++)
+				{
+					Index const j0 = mask_.col_begin(jb), width = mask_.col_end(jb) - j0;
+					for (Index i = i0; i < i1; i++)
+					{
+						T const* x = X.data_[i].data_.data();
+						T* y = value_.data_[i].data_.data() + j0;
+						for (Index kb : mask_.kept_rows(jb))
+						{
+							Index const k0 = mask_.row_begin(kb);
+							dynamictensor::accumulate_rows(y, width, mask_.row_end(kb) - k0,
+								[&](Index k) { return x[k0 + k]; },
+								[&](Index k) { return W.data_[k0 + k].data_.data() + j0; });
+						}
+					}
+				}
+			});
+		}
+
+		void backward() final
+		{
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				clear_gradient();
+				return;
+			}
+			auto const& grad_cost = *partial;
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			Index const M = X.shape()[0];
+
+			// dX = dot_nt(grad_cost, W) over the kept blocks, as rows of transpose(W):
+			// dX[i][k0..k1) += grad_cost[i][j] * transposed_[j][k0..k1) for j in [j0, j1)
+			transpose_kept(W);
+			gradient_[0] = Tensor(X.shape());
+			dynamictensor::split_rows(M, dynamictensor::gemm_blocking.threads_, [&](Index i0, Index i1)
+			{
+				for (Index jb = 0; jb < mask_.block_col_count(); jb++)
+				{
+					Index const j0 = mask_.col_begin(jb);
+					for (Index i = i0; i < i1; i++)
+					{
+						T const* g = grad_cost.data_[i].data_.data() + j0;
+						T* dx = gradient_[0].data_[i].data_.data();
+						for (Index kb : mask_.kept_rows(jb))
+						{
+							Index const k0 = mask_.row_begin(kb);
+							dynamictensor::accumulate_rows(dx + k0, mask_.row_end(kb) - k0, mask_.col_end(jb) - j0,
+								[&](Index j) { return g[j]; },
+								[&](Index j) { return transposed_.data_[j0 + j].data_.data() + k0; });
+						}
+					}
+				}
+			});
+
+			// dW = dot_tn(X, grad_cost) on the kept blocks, rows of W split between threads.
+			// Rows of transpose(X) make the multipliers of a row of dW contiguous.
+			Tensor const XT = transpose(X);
+			gradient_[1] = Tensor(W.shape());
+			dynamictensor::split_rows(mask_.rows(), dynamictensor::gemm_blocking.threads_, [&](Index k0, Index k1)
+			{
+				for (Index k = k0; k < k1; k++)
+				{
+					T const* x = XT.data_[k].data_.data();
+					T* dw = gradient_[1].data_[k].data_.data();
+					for (Index jb : mask_.kept_cols(k / mask_.block_rows()))
+					{
+						Index const j0 = mask_.col_begin(jb);
+						dynamictensor::accumulate_rows(dw + j0, mask_.col_end(jb) - j0, M,
+							[&](Index i) { return x[i]; },
+							[&](Index i) { return grad_cost.data_[i].data_.data() + j0; });
+					}
+				}
+			});
+
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+		}
+
+		BlockMask const& mask() const { return mask_; }
+
+		// Replaces the mask, e.g. after pruning W further
+		void set_mask(BlockMask const& mask)
+		{
+			mask_ = mask;
+			transposed_ = Tensor();
+			this->invalidate();
+		}
+
+		char const* type() const final { return "BlockSparseLinear"; }
+
+		// Each multiply-add of a kept value of W is two operations per row of X, adding b is one per output value.
+		std::size_t flops() const final
+		{
+			return 2 * std::size_t(inbound_nodes_[0]->getValue().shape()[0]) * mask_.kept_values() + size(value_);
+		}
+
+		// The kept blocks of dot(X, W), split between gemm_blocking.threads_ threads
+		std::vector<GemmShape> gemm_shapes() const final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			return { { X.shape()[0], mask_.rows(), mask_.cols() } };
+		}
+
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = storage_bytes(transposed_);
+			return usage;
+		}
+	};
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Graph.h"
+#include "DynamicTensor.h"
+
+namespace quantization
+{
+	/*
+		Int8 inference kernels for Linear.
+
+		Weights are quantized symmetrically per output channel (column of W): w = scale_j * q, q in [-127, 127].
+		Activations are quantized per tensor with a zero point over a calibrated range: x = scale * (q - zero_point),
+		q in [0, 255]. The product of a row of X and a column of W is then
+			scale * scale_j * (sum(qx * qw) - zero_point * sum(qw)),
+		where sum(qx * qw) is an unsigned by signed int8 dot product accumulated in int32. That is the operation of
+		the VNNI vpdpbusd instruction, which is used when the compiler targets it, AVX2 otherwise, and plain loops
+		on other targets.
+	*/
+
+	using miniflow::Scalar;
+	using miniflow::Index;
+	using miniflow::parallelFor;
+	using Matrix = dynamictensor::Tensor<Scalar, 2>;
+
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+	inline constexpr char const* kernel_name = "avx512_vnni";
+#elif defined(__AVXVNNI__)
+	inline constexpr char const* kernel_name = "avx_vnni";
+#elif defined(__AVX2__)
+	inline constexpr char const* kernel_name = "avx2";
+#else
+	inline constexpr char const* kernel_name = "scalar";
+#endif
+
+	// Rows of quantized matrices are padded with zero weights to a multiple of one 256-bit vector.
+	inline constexpr Index block_ = 32;
+
+	inline Index padded(Index depth) { return (depth + block_ - 1) / block_ * block_; }
+
+	struct Range
+	{
+		/*
+			Range of values of a tensor, always including 0 so that 0 is represented exactly.
+		*/
+
+		Scalar min_ = 0;
+		Scalar max_ = 0;
+
+		void add(Scalar x)
+		{
+			min_ = std::min(min_, x);
+			max_ = std::max(max_, x);
+		}
+	};
+
+	struct QuantizedWeights
+	{
+		/*
+			W of a depth x outputs Linear, stored transposed so that every output channel is a contiguous row.
+		*/
+
+		Index outputs_ = 0;
+		Index depth_ = 0;
+		Index stride_ = 0;						//: Padded length of a row.
+		std::vector<std::int8_t> values_;		//: outputs_ x stride_ quantized weights.
+		std::vector<Scalar> scales_;			//: Scale of every output channel.
+		std::vector<std::int32_t> sums_;		//: Sum of the quantized weights of every output channel.
+
+		QuantizedWeights() = default;
+
+		explicit QuantizedWeights(Matrix const& W) :
+			outputs_(W.shape_[1]),
+			depth_(W.shape_[0]),
+			stride_(padded(W.shape_[0])),
+			values_(std::size_t(outputs_) * stride_, 0),
+			scales_(outputs_, 0),
+			sums_(outputs_, 0)
+		{
+			for (Index j = 0; j < outputs_; j++)
+			{
+				Scalar max_abs = 0;
+				for (Index k = 0; k < depth_; k++) max_abs = std::max(max_abs, std::abs(W.data_[k].data_[j]));
+				scales_[j] = max_abs > 0 ? max_abs / 127 : 1;
+
+				std::int8_t* q = values_.data() + std::size_t(j) * stride_;
+				for (Index k = 0; k < depth_; k++)
+				{
+					q[k] = std::int8_t(std::lround(W.data_[k].data_[j] / scales_[j]));
+					sums_[j] += q[k];
+				}
+			}
+		}
+	};
+
+	struct QuantizedActivations
+	{
+		/*
+			Rows of X quantized with one scale and zero point.
+		*/
+
+		Index rows_ = 0;
+		Index stride_ = 0;
+		std::vector<std::uint8_t> values_;		//: rows_ x stride_ quantized values.
+		Scalar scale_ = 1;
+		std::int32_t zero_point_ = 0;
+
+		void quantize(Matrix const& X, Range const& range)
+		{
+			Index const depth = X.shape_[1];
+			rows_ = X.shape_[0];
+			stride_ = padded(depth);
+			values_.resize(std::size_t(rows_) * stride_);
+			scale_ = range.max_ > range.min_ ? (range.max_ - range.min_) / 255 : 1;
+			zero_point_ = std::int32_t(std::lround(-range.min_ / scale_));
+			Scalar const inverse = 1 / scale_;
+
+			parallelFor(0, rows_, [&](Index i)
+			{
+				Scalar const* x = X.data_[i].data_.data();
+				std::uint8_t* q = values_.data() + std::size_t(i) * stride_;
+				for (Index k = 0; k < depth; k++)
+				{
+					Scalar const value = std::nearbyint(x[k] * inverse) + zero_point_;
+					q[k] = std::uint8_t(std::min<Scalar>(255, std::max<Scalar>(0, value)));
+				}
+				// Padding meets zero weights, any value will do.
+				std::memset(q + depth, 0, stride_ - depth);
+			});
+		}
+	};
+
+#if defined(__AVX2__)
+	// acc += sum of four adjacent products of unsigned a and signed b bytes, in every int32 lane.
+	inline __m256i multiply_add(__m256i acc, __m256i a, __m256i b)
+	{
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+		return _mm256_dpbusd_epi32(acc, a, b);
+#elif defined(__AVXVNNI__)
+		return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+		// Widened to 16 bits first: _mm256_maddubs_epi16 would saturate on large products.
+		__m256i const a_low = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a));
+		__m256i const a_high = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1));
+		__m256i const b_low = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b));
+		__m256i const b_high = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(b, 1));
+		return _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_madd_epi16(a_low, b_low), _mm256_madd_epi16(a_high, b_high)));
+#endif
+	}
+
+	inline std::int32_t horizontal_sum(__m256i v)
+	{
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		s = _mm_hadd_epi32(s, s);
+		s = _mm_hadd_epi32(s, s);
+		return _mm_cvtsi128_si32(s);
+	}
+#endif
+
+	// sums[c] = dot product of a with the row b[c] for c < columns <= 4, length is a multiple of block_.
+	inline void dot_u8s8(std::uint8_t const* a, std::int8_t const* const* b, Index columns, Index length, std::int32_t* sums)
+	{
+#if defined(__AVX2__)
+		if (columns == 4)
+		{
+			// A vector of a is loaded once for four output channels.
+			__m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+			for (Index k = 0; k < length; k += block_)
+			{
+				__m256i const x = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + k));
+				acc0 = multiply_add(acc0, x, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b[0] + k)));
+				acc1 = multiply_add(acc1, x, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b[1] + k)));
+				acc2 = multiply_add(acc2, x, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b[2] + k)));
+				acc3 = multiply_add(acc3, x, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b[3] + k)));
+			}
+			sums[0] = horizontal_sum(acc0);
+			sums[1] = horizontal_sum(acc1);
+			sums[2] = horizontal_sum(acc2);
+			sums[3] = horizontal_sum(acc3);
+			return;
+		}
+		for (Index c = 0; c < columns; c++)
+		{
+			__m256i acc = _mm256_setzero_si256();
+			for (Index k = 0; k < length; k += block_)
+			{
+				acc = multiply_add(acc, _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + k)), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b[c] + k)));
+			}
+			sums[c] = horizontal_sum(acc);
+		}
+#else
+		for (Index c = 0; c < columns; c++)
+		{
+			std::int32_t sum = 0;
+			for (Index k = 0; k < length; k++) sum += std::int32_t(a[k]) * std::int32_t(b[c][k]);
+			sums[c] = sum;
+		}
+#endif
+	}
+
+	// C = b + dequantized product of X and W, where b is a matrix or a single row as for Linear.
+	// C must be allocated with the shape of the result.
+	// Rows of X are independent and run in parallel.
+	inline void gemm_int8(QuantizedActivations const& X, QuantizedWeights const& W, Matrix const& b, Matrix& C)
+	{
+		assert(X.stride_ == W.stride_ && C.shape_[0] == X.rows_ && C.shape_[1] == W.outputs_);
+		assert(b.shape_[1] == C.shape_[1] && (b.shape_[0] == C.shape_[0] || b.shape_[0] == 1));
+
+		parallelFor(0, X.rows_, [&](Index i)
+		{
+			std::uint8_t const* a = X.values_.data() + std::size_t(i) * X.stride_;
+			Scalar const* bias = b.data_[b.shape_[0] == 1 ? 0 : i].data_.data();
+			Scalar* output = C.data_[i].data_.data();
+			for (Index j0 = 0; j0 < W.outputs_; j0 += 4)
+			{
+				Index const columns = std::min<Index>(4, W.outputs_ - j0);
+				std::int8_t const* rows[4];
+				std::int32_t sums[4];
+				for (Index c = 0; c < columns; c++) rows[c] = W.values_.data() + std::size_t(j0 + c) * W.stride_;
+				dot_u8s8(a, rows, columns, X.stride_, sums);
+				for (Index c = 0; c < columns; c++)
+				{
+					Index const j = j0 + c;
+					output[j] = bias[j] + X.scale_ * W.scales_[j] * Scalar(sums[c] - X.zero_point_ * W.sums_[j]);
+				}
+			}
+		});
+	}
+
+	class Calibration
+	{
+		/*
+			Records the range of the input of every Linear node of a graph over representative batches.
+			Set the inputs of the graph to a batch, then call observe(); repeat for every batch.
+		*/
+
+		std::map<miniflow::NodeInterface const*, Range> ranges_;
+
+	public:
+
+		// Runs a forward pass and widens the recorded input ranges.
+		void observe(miniflow::Graph& graph)
+		{
+			graph.forward();
+			for (miniflow::NodeInterface* node : graph.nodes())
+			{
+				if (!dynamic_cast<miniflow::Linear<Matrix>*>(node)) continue;
+				Range& range = ranges_[node];
+				Matrix const& X = static_cast<miniflow::Node<Matrix>&>(*node->inbound_nodes()[0]).getValue();
+				for (auto const& row : X.data_)
+				{
+					for (Scalar x : row.data_) range.add(x);
+				}
+			}
+		}
+
+		// The range of the input of a Linear node observed so far.
+		Range range(miniflow::NodeInterface const& linear) const
+		{
+			auto it = ranges_.find(&linear);
+			assert(it != ranges_.end());
+			return it->second;
+		}
+	};
+}
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class QuantizedLinear : public Node<Tensor>
+	{
+		/*
+			Represents a Linear node evaluated in int8, for inference.
+
+			Input is {X, W, b}, as for Linear.
+			Output is dot(X, W) + b, with X and W quantized.
+
+			W is quantized per output channel on construction and by quantize_weights(), X on every forward pass
+			over the range calibrated for the Linear node this one replaces. Has no backward pass.
+		*/
+
+		static_assert(std::is_same<Tensor, quantization::Matrix>::value, "QuantizedLinear requires double matrices");
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::inbound_nodes_;
+
+	private:
+
+		quantization::Range range_;
+		quantization::QuantizedWeights weights_;
+		quantization::QuantizedActivations input_;
+
+	public:
+
+		QuantizedLinear(Node& X, Node& W, Node& b, quantization::Range const& range) :
+			Node(std::vector<Node*>{ &X, &W, &b }),
+			range_(range)
+		{
+			quantize_weights();
+		}
+
+		// Quantizes the current value of W.
+		void quantize_weights()
+		{
+			weights_ = quantization::QuantizedWeights(inbound_nodes_[1]->getValue());
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& b = inbound_nodes_[2]->getValue();
+			assert(X.shape_[1] == weights_.depth_);
+
+			input_.quantize(X, range_);
+			dynamictensor::Shape<2> shape{ X.shape_[0], weights_.outputs_ };
+			if (value_.shape() != shape) value_ = Tensor(shape);
+			quantization::gemm_int8(input_, weights_, b, value_);
+		}
+
+		char const* type() const final { return "QuantizedLinear"; }
+
+		// Each multiply-add of dot(X, W) is two operations, adding b is one per output value.
+		std::size_t flops() const final
+		{
+			return 2 * std::size_t(input_.rows_) * weights_.depth_ * weights_.outputs_ + size(value_);
+		}
+
+		// X and b are read as doubles, the int8 W once.
+		std::size_t bytes() const final
+		{
+			return (size(inbound_nodes_[0]->getValue()) + 2 * size(value_)) * sizeof(Scalar) + weights_.values_.size();
+		}
+	};
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	/*
+		Cells of the Recurrent node.
+
+		A cell computes one time step of one example from the pre-activations of its gates,
+		split into an input part p = x W + b and a recurrent part r = h_prev U, each gates * hidden values.
+		Each cell provides:
+			forward(hidden, p, r, h_prev, c_prev, gates, h, c)
+									computes the state h, and c for cells with a cell state, and keeps
+									the activations of the gates for backward,
+			backward(hidden, gates, r, h_prev, c_prev, c, dh, dc, dp, dr)
+									computes the partials dp and dr of the pre-activations from the partials
+									dh and dc of the state, and replaces dh and dc by the element-wise part
+									of the partials of h_prev and c_prev,
+			name, gates, has_cell_state, flops
+									the node type name, the number of gates, whether the cell has a cell state c
+									and the operations per hidden value of forward().
+	*/
+
+	namespace recurrent
+	{
+		template<typename T> T sigmoid(T x) { return 1 / (1 + std::exp(-x)); }
+	}
+
+	struct RNNCell
+	{
+		// h = tanh(x W + h_prev U + b)
+		static constexpr char const* name = "RNN";
+		static constexpr Index gates = 1;
+		static constexpr bool has_cell_state = false;
+		static constexpr std::size_t flops = 3;
+
+		template<typename T>
+		static void forward(Index hidden, T const* p, T const* r, T const*, T const*, T* gates, T* h, T*)
+		{
+			for (Index j = 0; j < hidden; j++) h[j] = gates[j] = std::tanh(p[j] + r[j]);
+		}
+
+		template<typename T>
+		static void backward(Index hidden, T const* gates, T const*, T const*, T const*, T const*, T* dh, T*, T* dp, T* dr)
+		{
+			for (Index j = 0; j < hidden; j++)
+			{
+				dp[j] = dr[j] = dh[j] * (1 - gates[j] * gates[j]);
+				dh[j] = 0;
+			}
+		}
+	};
+
+	struct GRUCell
+	{
+		/*
+			Gates are {z, r, n}:
+				z = sigmoid(p_z + r_z), r = sigmoid(p_r + r_r),
+				n = tanh(p_n + r * r_n),
+				h = (1 - z) * n + z * h_prev.
+		*/
+
+		static constexpr char const* name = "GRU";
+		static constexpr Index gates = 3;
+		static constexpr bool has_cell_state = false;
+		static constexpr std::size_t flops = 16;
+
+		template<typename T>
+		static void forward(Index hidden, T const* p, T const* r, T const* h_prev, T const*, T* gates, T* h, T*)
+		{
+			T* z = gates;
+			T* reset = gates + hidden;
+			T* n = gates + 2 * hidden;
+			for (Index j = 0; j < hidden; j++)
+			{
+				z[j] = recurrent::sigmoid(p[j] + r[j]);
+				reset[j] = recurrent::sigmoid(p[hidden + j] + r[hidden + j]);
+				n[j] = std::tanh(p[2 * hidden + j] + reset[j] * r[2 * hidden + j]);
+				h[j] = (1 - z[j]) * n[j] + z[j] * h_prev[j];
+			}
+		}
+
+		template<typename T>
+		static void backward(Index hidden, T const* gates, T const* r, T const* h_prev, T const*, T const*, T* dh, T*, T* dp, T* dr)
+		{
+			T const* z = gates;
+			T const* reset = gates + hidden;
+			T const* n = gates + 2 * hidden;
+			for (Index j = 0; j < hidden; j++)
+			{
+				T const dn = dh[j] * (1 - z[j]) * (1 - n[j] * n[j]);
+				T const dz = dh[j] * (h_prev[j] - n[j]) * z[j] * (1 - z[j]);
+				T const dreset = dn * r[2 * hidden + j] * reset[j] * (1 - reset[j]);
+				dp[j] = dr[j] = dz;
+				dp[hidden + j] = dr[hidden + j] = dreset;
+				dp[2 * hidden + j] = dn;
+				dr[2 * hidden + j] = dn * reset[j];
+				dh[j] *= z[j];
+			}
+		}
+	};
+
+	struct LSTMCell
+	{
+		/*
+			Gates are {i, f, g, o}:
+				i = sigmoid(a_i), f = sigmoid(a_f), g = tanh(a_g), o = sigmoid(a_o), where a = p + r,
+				c = f * c_prev + i * g,
+				h = o * tanh(c).
+		*/
+
+		static constexpr char const* name = "LSTM";
+		static constexpr Index gates = 4;
+		static constexpr bool has_cell_state = true;
+		static constexpr std::size_t flops = 24;
+
+		template<typename T>
+		static void forward(Index hidden, T const* p, T const* r, T const*, T const* c_prev, T* gates, T* h, T* c)
+		{
+			T* i = gates;
+			T* f = gates + hidden;
+			T* g = gates + 2 * hidden;
+			T* o = gates + 3 * hidden;
+			for (Index j = 0; j < hidden; j++)
+			{
+				i[j] = recurrent::sigmoid(p[j] + r[j]);
+				f[j] = recurrent::sigmoid(p[hidden + j] + r[hidden + j]);
+				g[j] = std::tanh(p[2 * hidden + j] + r[2 * hidden + j]);
+				o[j] = recurrent::sigmoid(p[3 * hidden + j] + r[3 * hidden + j]);
+				c[j] = f[j] * c_prev[j] + i[j] * g[j];
+				h[j] = o[j] * std::tanh(c[j]);
+			}
+		}
+
+		template<typename T>
+		static void backward(Index hidden, T const* gates, T const*, T const*, T const* c_prev, T const* c, T* dh, T* dc, T* dp, T* dr)
+		{
+			T const* i = gates;
+			T const* f = gates + hidden;
+			T const* g = gates + 2 * hidden;
+			T const* o = gates + 3 * hidden;
+			for (Index j = 0; j < hidden; j++)
+			{
+				T const tanh_c = std::tanh(c[j]);
+				T const dcell = dc[j] + dh[j] * o[j] * (1 - tanh_c * tanh_c);
+				dp[j] = dr[j] = dcell * g[j] * i[j] * (1 - i[j]);
+				dp[hidden + j] = dr[hidden + j] = dcell * c_prev[j] * f[j] * (1 - f[j]);
+				dp[2 * hidden + j] = dr[2 * hidden + j] = dcell * i[j] * (1 - g[j] * g[j]);
+				dp[3 * hidden + j] = dr[3 * hidden + j] = dh[j] * tanh_c * o[j] * (1 - o[j]);
+				dh[j] = 0;
+				dc[j] = dcell * f[j];
+			}
+		}
+	};
+
+	struct RecurrentOptions
+	{
+		bool all_steps_ = true;		//: Whether the output holds the state of every step or of the last step only.
+		Index truncation_ = 0;		//: Steps after which backward stops following the state back in time, 0 for none.
+	};
+
+	template<typename Tensor, typename Cell>
+	class Recurrent : public Node<Tensor>
+	{
+		/*
+			Represents a recurrent layer that loops over the time steps of a batch of sequences itself,
+			so that a sequence model is a single node rather than a copy of its layers per step.
+
+			Input is {X, W, U, b}, all dynamictensor matrices:
+				X is (steps * examples) x features, the examples of step t in rows [t * examples, (t + 1) * examples),
+				W is features x (gates * hidden), U is hidden x (gates * hidden), b is 1 x (gates * hidden).
+			Output is (steps * examples) x hidden, the state of every step in the row order of X,
+			or examples x hidden, the state after the last step, without all_steps_.
+			The initial state is zero.
+
+			Forward computes the input part X W + b of all the steps as one matrix product, then runs one product
+			h_prev U over all the gates per step, followed by the element-wise Cell. Backward propagates through
+			time in reverse with the states and gate activations kept by forward and again gathers the products
+			of W over all the steps. With truncation_ set to k, the partials of the state are not carried back
+			past every k-th step, i.e. gradients are computed on windows of k steps (truncated BPTT),
+			while forward still carries the state through the whole sequence.
+			The per step buffers are kept between passes and only reallocated when the shapes change.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "Recurrent requires dynamictensor matrices");
+
+		using T = typename Tensor::ValueType;
+		using Matrix = Tensor;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+
+	private:
+
+		Index steps_;
+		RecurrentOptions options_;
+
+		// Geometry of the last forward pass.
+		Index examples_ = 0, features_ = 0, hidden_ = 0;
+
+		// Buffers reused between passes.
+		Matrix inputs_;							//: X W + b of every step, (steps * examples) x (gates * hidden).
+		Matrix gates_;							//: Gate activations of every step, as inputs_.
+		std::vector<Matrix> recurrent_;			//: h_prev U of every step, examples x (gates * hidden).
+		std::vector<Matrix> states_;			//: h before and after every step, examples x hidden.
+		std::vector<Matrix> cells_;				//: c before and after every step, for cells with a cell state.
+		Matrix input_gradient_;					//: Partials of inputs_.
+		Matrix recurrent_gradient_;				//: Partials of the recurrent part of the current step.
+		Matrix state_gradient_;					//: Partials of the state, and of the cell state, of the current step.
+		Matrix cell_gradient_;
+
+		Index width() const { return Cell::gates * hidden_; }
+
+		static void reshape(Matrix& matrix, Index rows, Index cols)
+		{
+			if (matrix.shape() != dynamictensor::Shape<2>{ rows, cols }) matrix = Matrix({ rows, cols });
+		}
+
+		static void resize(std::vector<Matrix>& matrices, Index count, Index rows, Index cols)
+		{
+			dynamictensor::Shape<2> shape{ rows, cols };
+			if (matrices.size() == count && (count == 0 || matrices[0].shape() == shape)) return;
+			matrices.assign(count, Matrix(shape));
+		}
+
+		// Updates the geometry and buffers for the current inputs.
+		void prepare(Matrix const& X, [[maybe_unused]] Matrix const& W, Matrix const& U)
+		{
+			assert(X.shape()[0] % steps_ == 0);
+			examples_ = X.shape()[0] / steps_, features_ = X.shape()[1], hidden_ = U.shape()[0];
+			assert(W.shape() == (dynamictensor::Shape<2>{ features_, width() }) && U.shape()[1] == width());
+
+			reshape(inputs_, steps_ * examples_, width());
+			reshape(gates_, steps_ * examples_, width());
+			resize(recurrent_, steps_, examples_, width());
+			resize(states_, steps_ + 1, examples_, hidden_);
+			if constexpr (Cell::has_cell_state) resize(cells_, steps_ + 1, examples_, hidden_);
+			reshape(value_, options_.all_steps_ ? steps_ * examples_ : examples_, hidden_);
+		}
+
+		T* cell_row(Index step, Index example)
+		{
+			if constexpr (Cell::has_cell_state) return cells_[step].data_[example].data_.data();
+			else return nullptr;
+		}
+
+	public:
+
+		Recurrent(Node& X, Node& W, Node& U, Node& b, Index steps, RecurrentOptions const& options = {}) :
+			Node(std::vector<Node*>{ &X, &W, &U, &b }),
+			steps_(steps),
+			options_(options)
+		{
+			assert(steps_ > 0);
+		}
+
+		void forward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			auto const& U = inbound_nodes_[2]->getValue();
+			auto const& b = inbound_nodes_[3]->getValue();
+			prepare(X, W, U);
+
+			// Input part of all the steps at once
+			for (Index i = 0; i < inputs_.shape()[0]; i++) std::copy(b.data_[0].data_.begin(), b.data_[0].data_.end(), inputs_.data_[i].data_.begin());
+			dynamictensor::gemm(X, W, inputs_);
+
+			states_[0].fill(0);
+			if constexpr (Cell::has_cell_state) cells_[0].fill(0);
+			for (Index t = 0; t < steps_; t++)
+			{
+				Matrix& recurrent = recurrent_[t];
+				recurrent.fill(0);
+				if (t > 0) dynamictensor::gemm(states_[t], U, recurrent);
+				for (Index n = 0; n < examples_; n++)
+				{
+					Index const row = t * examples_ + n;
+					Cell::forward(hidden_, inputs_.data_[row].data_.data(), recurrent.data_[n].data_.data(),
+						states_[t].data_[n].data_.data(), cell_row(t, n),
+						gates_.data_[row].data_.data(), states_[t + 1].data_[n].data_.data(), cell_row(t + 1, n));
+				}
+				if (options_.all_steps_)
+				{
+					for (Index n = 0; n < examples_; n++) value_.data_[t * examples_ + n] = states_[t + 1].data_[n];
+				}
+			}
+			if (!options_.all_steps_) value_ = states_[steps_];
+		}
+
+		void backward() final
+		{
+			auto const& X = inbound_nodes_[0]->getValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			auto const& U = inbound_nodes_[2]->getValue();
+			Matrix const* const partial = this->cost_gradient();
+			if (!partial)
+			{
+				this->clear_gradient();
+				return;
+			}
+			Matrix const& grad_cost = *partial;
+
+			reshape(input_gradient_, steps_ * examples_, width());
+			reshape(recurrent_gradient_, examples_, width());
+			reshape(state_gradient_, examples_, hidden_);
+			reshape(cell_gradient_, examples_, hidden_);
+			state_gradient_.fill(0);
+			cell_gradient_.fill(0);
+
+			Matrix& grad_U = gradient_[2];
+			reshape(grad_U, hidden_, width());
+			grad_U.fill(0);
+
+			for (Index t = steps_; t-- > 0;)
+			{
+				// Partial of the state after step t: from the output and from step t + 1
+				for (Index n = 0; n < examples_; n++)
+				{
+					T* dh = state_gradient_.data_[n].data_.data();
+					if (options_.all_steps_)
+					{
+						T const* output = grad_cost.data_[t * examples_ + n].data_.data();
+						for (Index j = 0; j < hidden_; j++) dh[j] += output[j];
+					}
+					else if (t == steps_ - 1)
+					{
+						T const* output = grad_cost.data_[n].data_.data();
+						for (Index j = 0; j < hidden_; j++) dh[j] += output[j];
+					}
+					Index const row = t * examples_ + n;
+					Cell::backward(hidden_, gates_.data_[row].data_.data(), recurrent_[t].data_[n].data_.data(),
+						states_[t].data_[n].data_.data(), cell_row(t, n), cell_row(t + 1, n),
+						dh, cell_gradient_.data_[n].data_.data(),
+						input_gradient_.data_[row].data_.data(), recurrent_gradient_.data_[n].data_.data());
+				}
+
+				// The initial state is zero, so the first step adds nothing to the partial of U.
+				if (t == 0) break;
+				dynamictensor::gemm_tn(states_[t], recurrent_gradient_, grad_U);
+
+				// Truncation cuts the partials of the state at the start of every window.
+				if (options_.truncation_ > 0 && t % options_.truncation_ == 0)
+				{
+					state_gradient_.fill(0);
+					cell_gradient_.fill(0);
+				}
+				else
+				{
+					// Adds the path through U to the element-wise part of the partial of the previous state
+					dynamictensor::gemm_nt(recurrent_gradient_, U, state_gradient_);
+				}
+			}
+
+			// Products with X and W of all the steps at once
+			Matrix& grad_X = gradient_[0];
+			Matrix& grad_W = gradient_[1];
+			Matrix& grad_b = gradient_[3];
+			reshape(grad_X, steps_ * examples_, features_);
+			reshape(grad_W, features_, width());
+			reshape(grad_b, 1, width());
+			grad_X.fill(0);
+			grad_W.fill(0);
+			grad_b.fill(0);
+			dynamictensor::gemm_nt(input_gradient_, W, grad_X);
+			dynamictensor::gemm_tn(X, input_gradient_, grad_W);
+			T* db = grad_b.data_[0].data_.data();
+			for (Index i = 0; i < input_gradient_.shape()[0]; i++)
+			{
+				T const* dp = input_gradient_.data_[i].data_.data();
+				for (Index j = 0; j < width(); j++) db[j] += dp[j];
+			}
+		}
+
+		char const* type() const final { return Cell::name; }
+
+		// Two operations per multiply-add of the products with W and U, and the cell per state value.
+		std::size_t flops() const final
+		{
+			std::size_t const rows = std::size_t(steps_) * examples_;
+			return 2 * rows * (features_ + hidden_) * width() + Cell::flops * rows * hidden_;
+		}
+
+		// X W for all the steps at once, then h_prev U at every step
+		std::vector<GemmShape> gemm_shapes() const final
+		{
+			if (examples_ == 0) return {};
+			return { { steps_ * examples_, features_, width() }, { examples_, hidden_, width() } };
+		}
+
+		// The inputs, gates and states of every step are kept for backpropagation through time.
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = storage_bytes(inputs_) + storage_bytes(gates_) + storage_bytes(recurrent_) + storage_bytes(states_) + storage_bytes(cells_);
+			usage.gradients_ += storage_bytes(input_gradient_) + storage_bytes(recurrent_gradient_) + storage_bytes(state_gradient_) + storage_bytes(cell_gradient_);
+			return usage;
+		}
+	};
+
+	template<typename Tensor>
+	using RNN = Recurrent<Tensor, RNNCell>;
+
+	template<typename Tensor>
+	using GRU = Recurrent<Tensor, GRUCell>;
+
+	template<typename Tensor>
+	using LSTM = Recurrent<Tensor, LSTMCell>;
+}
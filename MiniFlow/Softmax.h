@@ -0,0 +1,155 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class SoftmaxCrossEntropy : public Node<Tensor>
+	{
+		/*
+			Represents a node that calculates the cross entropy of the softmax of logits with labels.
+			Should be used as the last node for a classification network.
+
+			Input is {labels, logits}, both examples x classes.
+			Output is the mean over examples of -sum(labels * log(softmax(logits))).
+
+			Softmax is never materialized: forward makes a single pass over every row, keeping a running
+			maximum and a rescaled running sum of exponents, and stores only the log-sum-exp of each row.
+			Backward recomputes softmax from it in the same pass that writes the gradients:
+				d/d(logits) = (sum(labels) * softmax(logits) - labels) / examples, i.e. softmax - labels for one-hot labels,
+				d/d(labels) = (log-sum-exp - logits) / examples.
+			Rows are processed in parallel.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "SoftmaxCrossEntropy requires examples x classes matrices");
+
+		using T = typename Tensor::ValueType;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+
+	private:
+
+		bool keep_probabilities_;		//: Whether forward() stores softmax(logits).
+		std::vector<T> log_sum_exp_;	//: Log-sum-exp of every row of logits.
+		std::vector<T> row_loss_;		//: Cross entropy of every row.
+		Tensor probabilities_;			//: softmax(logits), only when keep_probabilities_ is set.
+
+		static void reshape(Tensor& tensor, dynamictensor::Shape<2> const& shape)
+		{
+			if (tensor.shape() != shape) tensor = Tensor(shape);
+		}
+
+	public:
+
+		SoftmaxCrossEntropy(Node& labels, Node& logits, bool keep_probabilities = false) :
+			Node(std::vector<Node*>{ &labels, &logits }),
+			keep_probabilities_(keep_probabilities)
+		{
+		}
+
+		void forward() final
+		{
+			auto const& labels = inbound_nodes_[0]->getValue();
+			auto const& logits = inbound_nodes_[1]->getValue();
+			assert(labels.shape() == logits.shape());
+
+			Index const examples = logits.shape()[0], classes = logits.shape()[1];
+			log_sum_exp_.resize(examples);
+			row_loss_.resize(examples);
+			if (keep_probabilities_) reshape(probabilities_, logits.shape());
+
+			parallelFor(0, examples, [&](Index i)
+			{
+				T const* x = logits.data_[i].data_.data();
+				T const* l = labels.data_[i].data_.data();
+
+				// Online log-sum-exp: the running sum is rescaled whenever the maximum grows.
+				T maximum = classes ? x[0] : T(0), exponents(0), label_sum(0), label_logits(0);
+				for (Index j = 0; j < classes; j++)
+				{
+					if (x[j] > maximum)
+					{
+						exponents = exponents * std::exp(maximum - x[j]) + 1;
+						maximum = x[j];
+					}
+					else
+					{
+						exponents += std::exp(x[j] - maximum);
+					}
+					label_sum += l[j];
+					label_logits += l[j] * x[j];
+				}
+
+				T const lse = maximum + std::log(exponents);
+				log_sum_exp_[i] = lse;
+				row_loss_[i] = label_sum * lse - label_logits;
+
+				if (keep_probabilities_)
+				{
+					T* p = probabilities_.data_[i].data_.data();
+					for (Index j = 0; j < classes; j++) p[j] = std::exp(x[j] - lse);
+				}
+			});
+
+			T loss(0);
+			for (T row : row_loss_) loss += row;
+			value_ = scalar_like(logits, examples ? loss / examples : loss);
+		}
+
+		void backward() final
+		{
+			auto const& labels = inbound_nodes_[0]->getValue();
+			auto const& logits = inbound_nodes_[1]->getValue();
+
+			Index const examples = logits.shape()[0], classes = logits.shape()[1];
+			reshape(gradient_[0], labels.shape());
+			reshape(gradient_[1], logits.shape());
+			T const scale = T(1) / examples;
+
+			parallelFor(0, examples, [&](Index i)
+			{
+				T const* x = logits.data_[i].data_.data();
+				T const* l = labels.data_[i].data_.data();
+				T* labels_gradient = gradient_[0].data_[i].data_.data();
+				T* logits_gradient = gradient_[1].data_[i].data_.data();
+				T const lse = log_sum_exp_[i];
+
+				T label_sum(0);
+				for (Index j = 0; j < classes; j++) label_sum += l[j];
+				for (Index j = 0; j < classes; j++)
+				{
+					logits_gradient[j] = (label_sum * std::exp(x[j] - lse) - l[j]) * scale;
+					labels_gradient[j] = (lse - x[j]) * scale;
+				}
+			});
+		}
+
+		// softmax(logits) of the last forward pass. Requires keep_probabilities.
+		Tensor const& probabilities() const
+		{
+			assert(keep_probabilities_);
+			return probabilities_;
+		}
+
+		char const* type() const final { return "SoftmaxCrossEntropy"; }
+
+		// Exponent, logarithm share and the label products per value.
+		std::size_t flops() const final { return 6 * size(inbound_nodes_[1]->getValue()); }
+
+		// Per row results and the optional probabilities are kept for backward()
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.state_ = (log_sum_exp_.size() + row_loss_.size()) * sizeof(T) + storage_bytes(probabilities_);
+			return usage;
+		}
+	};
+}
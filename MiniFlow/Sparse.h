@@ -0,0 +1,311 @@
+#pragma once
+
+#include "Node.h"
+#include "DynamicTensor.h"
+
+namespace sparsetensor
+{
+	using miniflow::Index;
+	using miniflow::parallelFor;
+
+	template<class T> struct Triplet
+	{
+		/*
+			A single non-zero value of a sparse matrix in coordinate (COO) form.
+		*/
+
+		Index row_;
+		Index col_;
+		T value_;
+	};
+
+	template<class T>
+	class CsrMatrix
+	{
+		/*
+			Represents a sparse matrix in compressed sparse row (CSR) form.
+
+			The non-zeros of row i are columns_[k], values_[k] for k in [row_offsets_[i], row_offsets_[i + 1]),
+			sorted by column. Only the non-zero values are stored, so memory is O(rows + non-zeros).
+		*/
+
+	public:
+
+		using ValueType = T;
+
+		Index rows_ = 0;
+		Index cols_ = 0;
+		std::vector<Index> row_offsets_ = { 0 };	//: rows_ + 1 offsets into columns_ and values_.
+		std::vector<Index> columns_;				//: Column of every non-zero.
+		std::vector<T> values_;						//: Value of every non-zero.
+
+		CsrMatrix() = default;
+
+		// Initialize a matrix of given shape with no non-zeros
+		CsrMatrix(Index rows, Index cols) : rows_(rows), cols_(cols), row_offsets_(rows + 1, 0) {}
+
+		// Builds a matrix from its non-zeros in any order. Values at the same position are summed.
+		static CsrMatrix from_triplets(Index rows, Index cols, std::vector<Triplet<T>> triplets)
+		{
+			std::sort(triplets.begin(), triplets.end(), [](Triplet<T> const& a, Triplet<T> const& b)
+			{
+				return a.row_ != b.row_ ? a.row_ < b.row_ : a.col_ < b.col_;
+			});
+
+			CsrMatrix matrix(rows, cols);
+			matrix.columns_.reserve(triplets.size());
+			matrix.values_.reserve(triplets.size());
+			for (std::size_t k = 0; k < triplets.size(); k++)
+			{
+				Triplet<T> const& triplet = triplets[k];
+				assert(triplet.row_ < rows && triplet.col_ < cols);
+				if (k > 0 && triplet.row_ == triplets[k - 1].row_ && triplet.col_ == triplets[k - 1].col_)
+				{
+					matrix.values_.back() += triplet.value_;
+					continue;
+				}
+				matrix.columns_.push_back(triplet.col_);
+				matrix.values_.push_back(triplet.value_);
+				matrix.row_offsets_[triplet.row_ + 1]++;
+			}
+			std::partial_sum(matrix.row_offsets_.begin(), matrix.row_offsets_.end(), matrix.row_offsets_.begin());
+			return matrix;
+		}
+
+		// Keeps the non-zero values of a dense matrix
+		static CsrMatrix from_dense(dynamictensor::Tensor<T, 2> const& dense)
+		{
+			CsrMatrix matrix(dense.shape_[0], dense.shape_[1]);
+			for (Index i = 0; i < matrix.rows_; i++)
+			{
+				T const* row = dense.data_[i].data_.data();
+				for (Index j = 0; j < matrix.cols_; j++)
+				{
+					if (row[j] == T(0)) continue;
+					matrix.columns_.push_back(j);
+					matrix.values_.push_back(row[j]);
+				}
+				matrix.row_offsets_[i + 1] = Index(matrix.columns_.size());
+			}
+			return matrix;
+		}
+
+		dynamictensor::Tensor<T, 2> to_dense() const
+		{
+			dynamictensor::Tensor<T, 2> dense({ rows_, cols_ });
+			for (Index i = 0; i < rows_; i++)
+			{
+				for (Index k = row_offsets_[i]; k < row_offsets_[i + 1]; k++) dense.data_[i].data_[columns_[k]] = values_[k];
+			}
+			return dense;
+		}
+
+		std::size_t nonzeros() const { return values_.size(); }
+
+		// Compressed sparse column form of the matrix, built with a counting sort over columns.
+		// Rows of the result stay sorted because the input rows are visited in order.
+		friend CsrMatrix transpose(CsrMatrix const& input)
+		{
+			CsrMatrix result(input.cols_, input.rows_);
+			result.columns_.resize(input.nonzeros());
+			result.values_.resize(input.nonzeros());
+			for (Index col : input.columns_) result.row_offsets_[col + 1]++;
+			std::partial_sum(result.row_offsets_.begin(), result.row_offsets_.end(), result.row_offsets_.begin());
+
+			std::vector<Index> next(result.row_offsets_.begin(), result.row_offsets_.end() - 1);
+			for (Index i = 0; i < input.rows_; i++)
+			{
+				for (Index k = input.row_offsets_[i]; k < input.row_offsets_[i + 1]; k++)
+				{
+					Index const position = next[input.columns_[k]]++;
+					result.columns_[position] = i;
+					result.values_[position] = input.values_[k];
+				}
+			}
+			return result;
+		}
+
+		friend dynamictensor::Tensor<T, 2> dot(CsrMatrix const& A, dynamictensor::Tensor<T, 2> const& B)
+		{
+			dynamictensor::Tensor<T, 2> result({ A.rows_, B.shape_[1] });
+			spmm(A, B, result);
+			return result;
+		}
+
+		friend std::size_t size(CsrMatrix const& t) { return std::size_t(t.rows_) * t.cols_; }
+		friend std::vector<Index> dims(CsrMatrix const& t) { return { t.rows_, t.cols_ }; }
+	};
+
+	// C += A * B for a sparse A and dense B, C.
+	// Every row of C is the sum of the rows of B selected by the non-zeros of the same row of A,
+	// so rows are independent and run in parallel.
+	template<class T>
+	void spmm(CsrMatrix<T> const& A, dynamictensor::Tensor<T, 2> const& B, dynamictensor::Tensor<T, 2>& C)
+	{
+		Index const N = B.shape_[1];
+		assert(B.shape_[0] == A.cols_ && C.shape_[0] == A.rows_ && C.shape_[1] == N);
+
+		parallelFor(0, A.rows_, [&](Index i)
+		{
+			T* c = C.data_[i].data_.data();
+			for (Index k = A.row_offsets_[i]; k < A.row_offsets_[i + 1]; k++)
+			{
+				T const a = A.values_[k];
+				T const* b = B.data_[A.columns_[k]].data_.data();
+				for (Index j = 0; j < N; j++) c[j] += a * b[j];
+			}
+		});
+	}
+}
+
+namespace miniflow
+{
+	template<typename Tensor>
+	class SparseInput : public Node<Tensor>
+	{
+		/*
+			An input into the network holding a sparse examples x features matrix.
+			Only SparseLinear reads it: value_ stays empty, the dense matrix is never materialized.
+			The transposed (column) form used for the weight gradient is built once per new value.
+			Inputs are not trained, so no gradient flows into this node.
+		*/
+
+		using T = typename Tensor::ValueType;
+
+	public:
+
+		using SparseTensor = sparsetensor::CsrMatrix<T>;
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+
+	private:
+
+		SparseTensor sparse_value_;
+		SparseTensor transposed_;
+
+	public:
+
+		explicit SparseInput(SparseTensor const& input) :
+			Node(std::vector<Node*>(0))
+		{
+			this->stale_ = false;
+			setSparseValue(input);
+		}
+
+		void setSparseValue(SparseTensor const& input)
+		{
+			sparse_value_ = input;
+			transposed_ = transpose(sparse_value_);
+			this->invalidate();
+		}
+
+		SparseTensor const& getSparseValue() const { return sparse_value_; }
+		SparseTensor const& getTransposedValue() const { return transposed_; }
+
+		bool is_input() const final { return true; }
+		char const* type() const final { return "SparseInput"; }
+
+		// As for Input, there is nothing to compute.
+		void invalidate() final { this->invalidate_outputs(); }
+
+		std::size_t flops() const final { return 0; }
+		std::size_t bytes() const final { return sparse_value_.nonzeros() * (sizeof(T) + sizeof(Index)); }
+
+		// The CSR matrix and its transpose
+		MemoryUsage memory() const final
+		{
+			MemoryUsage usage = Node::memory();
+			usage.values_ += 2 * bytes();
+			return usage;
+		}
+	};
+
+	template<typename Tensor>
+	class SparseLinear : public Node<Tensor>
+	{
+		/*
+			Represents a node that performs a linear transform of a sparse input.
+
+			Input is {X, W, b}, X is a SparseInput.
+			Output is dot(X, W) + b.
+			b has the shape of the output or is a single row, as for Linear.
+
+			Forward and the weight gradient only touch the non-zeros of X:
+				value = b + X * W,			rows of X in parallel,
+				d/dW = transpose(X) * grad,	rows of transpose(X), i.e. rows of W, in parallel.
+			Both are race free and deterministic, since every row of the result is written by one task.
+		*/
+
+		static_assert(Tensor::rank_ == 2, "SparseLinear requires examples x features matrices");
+
+	protected:
+
+		// Names of the dependent base class.
+		using Node = miniflow::Node<Tensor>;
+		using Node::value_;
+		using Node::gradient_;
+		using Node::inbound_nodes_;
+		using Node::outbound_nodes_;
+
+	private:
+
+		SparseInput<Tensor>& X_;
+
+	public:
+
+		SparseLinear(SparseInput<Tensor>& X, Node& W, Node& b) :
+			Node(std::vector<Node*>{ &X, &W, &b }),
+			X_(X)
+		{
+		}
+
+		void forward() final
+		{
+			auto const& X = X_.getSparseValue();
+			auto const& W = inbound_nodes_[1]->getValue();
+			auto const& b = inbound_nodes_[2]->getValue();
+			dynamictensor::Shape<2> shape{ X.rows_, W.shape_[1] };
+			if (value_.shape() != shape) value_ = Tensor(shape);
+			else value_.fill(0);
+			add_bias(value_, b);
+			spmm(X, W, value_);
+		}
+
+		void backward() final
+		{
+			auto const& W = inbound_nodes_[1]->getValue();
+			Tensor& grad_W = gradient_[1];
+			if (grad_W.shape() != W.shape()) grad_W = Tensor(W.shape());
+			else grad_W.fill(0);
+			gradient_[2] = Tensor();
+
+			// Sum the partial with respect to this node over all the outputs first,
+			// so that the products below run once per step.
+			Tensor const* const partial = this->cost_gradient();
+			if (!partial) return;
+			auto const& grad_cost = *partial;
+			// Set the partial of the loss with respect to this node's weights.
+			spmm(X_.getTransposedValue(), grad_cost, grad_W);
+			// Set the partial of the loss with respect to this node's bias.
+			gradient_[2] = bias_gradient(grad_cost, inbound_nodes_[2]->getValue());
+		}
+
+		char const* type() const final { return "SparseLinear"; }
+
+		// Each multiply-add over a non-zero of X is two operations, adding b is one per output value.
+		std::size_t flops() const final
+		{
+			Index const outputs = inbound_nodes_[1]->getValue().shape_[1];
+			return 2 * X_.getSparseValue().nonzeros() * outputs + size(value_);
+		}
+
+		std::size_t bytes() const final
+		{
+			Index const outputs = inbound_nodes_[1]->getValue().shape_[1];
+			return (X_.getSparseValue().nonzeros() * (outputs + 1) + 2 * size(value_)) * sizeof(Scalar);
+		}
+	};
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <tuple>
+#include <type_traits>
+#include "Node.h"
+#include "StaticTensor.h"
+
+namespace miniflow
+{
+	namespace staticgraph
+	{
+		/*
+			A computational graph whose topology is a type.
+
+			Nodes take their inputs as template parameters, so a whole network is a single type, e.g.
+				using X = Input<Tensor, struct XTag>;
+				using W = Trainable<Tensor, struct WTag>;
+				using b = Trainable<Tensor, struct bTag>;
+				using Y = Input<Tensor, struct YTag>;
+				StaticGraph<MSE<Y, Sigmoid<Linear<X, W, b>>>> network;
+			and every node holds its inputs as members. Forward and backward are plain recursive member calls
+			that the compiler inlines into straight-line code: there is no node list, no virtual dispatch and
+			no heap allocation beyond what the tensor type itself does. Gradients are only computed for the
+			subtrees that contain Trainables, which is decided at compile time.
+
+			Nodes compute the same functions as their runtime counterparts in Node.h, with the same
+			Tensor functions, so they work on TensorScalar, StaticTensor and DynamicTensor values.
+			Since the network is a tree, every leaf type may appear only once; networks sharing
+			nodes or weights are built with Graph.
+		*/
+
+		// Number of nodes of type Leaf in the subtrees of a tuple of nodes
+		template<typename Leaf, typename Nodes>
+		struct Occurrences;
+
+		template<typename Leaf, typename ... Nodes>
+		struct Occurrences<Leaf, std::tuple<Nodes...>>
+		{
+			static constexpr std::size_t value = ((std::size_t(std::is_same_v<Leaf, Nodes>) + Occurrences<Leaf, typename Nodes::Inputs>::value) + ... + 0);
+		};
+
+		// Whether every leaf in the subtrees of a tuple of nodes appears once in the tree of Root
+		template<typename Root, typename Nodes>
+		struct UniqueLeaves;
+
+		template<typename Root, typename ... Nodes>
+		struct UniqueLeaves<Root, std::tuple<Nodes...>>
+		{
+			static constexpr bool value = (((std::tuple_size_v<typename Nodes::Inputs> > 0 || Occurrences<Nodes, std::tuple<Root>>::value == 1)
+				&& UniqueLeaves<Root, typename Nodes::Inputs>::value) && ... && true);
+		};
+
+		// Base class of the nodes, holding their inputs
+		template<typename ... InputNodes>
+		class Operation
+		{
+		public:
+
+			using Inputs = std::tuple<InputNodes...>;
+			static constexpr bool is_trainable = false;
+			static constexpr bool has_trainables = (InputNodes::has_trainables || ... || false);
+
+			Inputs inputs_;
+
+		protected:
+
+			template<std::size_t i>
+			auto& input() { return std::get<i>(inputs_); }
+
+			void forward_inputs()
+			{
+				std::apply([](auto& ... inputs) { (inputs.forward(), ...); }, inputs_);
+			}
+		};
+
+		template<typename Tensor, typename Id>
+		class Input : public Operation<>
+		{
+			/*
+				An input into the network, identified by the type Id.
+				Inputs are not trained, so no gradient flows into them.
+			*/
+
+		protected:
+
+			Tensor value_;
+
+		public:
+
+			using Value = Tensor;
+
+			void forward() {}
+
+			Tensor const& getValue() const { return value_; }
+			void setValue(Tensor const& value) { value_ = value; }
+		};
+
+		template<typename Tensor, typename Id>
+		class Trainable : public Input<Tensor, Id>
+		{
+			/*
+				A trainable parameter of the network, identified by the type Id.
+			*/
+
+		protected:
+
+			// Names of the dependent base class.
+			using Input = staticgraph::Input<Tensor, Id>;
+			using Input::value_;
+
+		private:
+
+			Tensor gradient_;
+
+		public:
+
+			static constexpr bool is_trainable = true;
+			static constexpr bool has_trainables = true;
+
+			void backward(Tensor const& grad_cost) { gradient_ = grad_cost; }
+
+			// Performs SGD step
+			void update(Scalar learning_rate) { value_ -= learning_rate * gradient_; }
+
+			Tensor const& getGradient() const { return gradient_; }
+		};
+
+		template<typename XNode, typename WNode, typename bNode>
+		class Linear : public Operation<XNode, WNode, bNode>
+		{
+			/*
+				Represents a node that performs a linear transform.
+
+				Input is {X, W, b}.
+				Output is dot(X, W) + b, b has the shape of the output or is a single row.
+			*/
+
+		public:
+
+			using Value = std::decay_t<decltype(dot(std::declval<typename XNode::Value>(), std::declval<typename WNode::Value>()))>;
+
+		private:
+
+			Value value_;
+
+		public:
+
+			void forward()
+			{
+				this->forward_inputs();
+				auto const& X = std::get<0>(this->inputs_).getValue();
+				auto const& W = std::get<1>(this->inputs_).getValue();
+				auto const& b = std::get<2>(this->inputs_).getValue();
+				value_ = dot(X, W);
+				add_bias(value_, b);
+			}
+
+			void backward(Value const& grad_cost)
+			{
+				auto& X = std::get<0>(this->inputs_);
+				auto& W = std::get<1>(this->inputs_);
+				auto& b = std::get<2>(this->inputs_);
+				if constexpr (XNode::has_trainables) X.backward(dot_nt(grad_cost, W.getValue()));
+				if constexpr (WNode::has_trainables) W.backward(dot_tn(X.getValue(), grad_cost));
+				if constexpr (bNode::has_trainables) b.backward(bias_gradient(grad_cost, b.getValue()));
+			}
+
+			Value const& getValue() const { return value_; }
+		};
+
+		template<typename Function, typename XNode>
+		class Activation : public Operation<XNode>
+		{
+			/*
+				Represents a node that performs an element-wise activation function of Node.h.
+
+				Input is {X}.
+				Output is Function(X).
+			*/
+
+		public:
+
+			using Value = typename XNode::Value;
+
+		private:
+
+			Function function_;
+			Value value_;
+			Value gradient_;
+
+		public:
+
+			void forward()
+			{
+				this->forward_inputs();
+				value_.transform([&](auto x) { return function_.value(x); }, std::get<0>(this->inputs_).getValue());
+			}
+
+			void backward(Value const& grad_cost)
+			{
+				if constexpr (XNode::has_trainables)
+				{
+					Value const& z = Function::from_output ? value_ : std::get<0>(this->inputs_).getValue();
+					gradient_.transform([&](auto x, auto grad) { return function_.derivative(x) * grad; }, z, grad_cost);
+					std::get<0>(this->inputs_).backward(gradient_);
+				}
+			}
+
+			Value const& getValue() const { return value_; }
+		};
+
+		template<typename XNode>
+		using Sigmoid = Activation<SigmoidFunction, XNode>;
+
+		template<typename XNode>
+		using Tanh = Activation<TanhFunction, XNode>;
+
+		template<typename XNode>
+		using ReLU = Activation<ReLUFunction, XNode>;
+
+		template<typename XNode>
+		using LeakyReLU = Activation<LeakyReLUFunction, XNode>;
+
+		template<typename XNode>
+		using GELU = Activation<GELUFunction, XNode>;
+
+		template<typename LabelsNode, typename PredictionsNode>
+		class MSE : public Operation<LabelsNode, PredictionsNode>
+		{
+			/*
+				Represents a node that calculates mean squared error cost function.
+				Should be used as the last node for a network.
+
+				Input is {labels, predictions}.
+				Output is mean squared error.
+			*/
+
+		public:
+
+			using Value = typename PredictionsNode::Value;
+
+		private:
+
+			Scalar value_ = 0;
+			Value diff_;
+			Value gradient_;
+
+		public:
+
+			void forward()
+			{
+				this->forward_inputs();
+				diff_ = std::get<0>(this->inputs_).getValue() - std::get<1>(this->inputs_).getValue();
+				value_ = sum_all(diff_ * diff_) / size(diff_);
+			}
+
+			void backward()
+			{
+				// Gradient with respect to the labels, the one with respect to the predictions is its negation.
+				gradient_ = Scalar(2) / size(diff_) * diff_;
+				if constexpr (LabelsNode::has_trainables) std::get<0>(this->inputs_).backward(gradient_);
+				if constexpr (PredictionsNode::has_trainables) std::get<1>(this->inputs_).backward(-gradient_);
+			}
+
+			Scalar getValue() const { return value_; }
+		};
+
+		// Applies fn to every node of the tree in the order of a forward pass
+		template<typename Node, typename F>
+		void for_each_node(Node& node, F&& fn)
+		{
+			std::apply([&](auto& ... inputs) { (for_each_node(inputs, fn), ...); }, node.inputs_);
+			fn(node);
+		}
+	}
+
+	template<typename Cost>
+	class StaticGraph
+	{
+		/*
+			Owns a network whose topology is the type Cost, see staticgraph.
+			Has the training interface of Graph, with every call fully inlined.
+		*/
+
+		static_assert(staticgraph::UniqueLeaves<Cost, std::tuple<Cost>>::value, "Every leaf may appear once in a StaticGraph");
+
+		Cost cost_;
+
+	public:
+
+		// Returns the node of type N, e.g. to set an Input or to read a Trainable.
+		template<typename N>
+		N& get()
+		{
+			static_assert(staticgraph::Occurrences<N, std::tuple<Cost>>::value == 1, "N must be a node of the graph");
+			N* result = nullptr;
+			staticgraph::for_each_node(cost_, [&](auto& node)
+			{
+				if constexpr (std::is_same_v<std::decay_t<decltype(node)>, N>) result = &node;
+			});
+			return *result;
+		}
+
+		Cost const& cost() const { return cost_; }
+
+		// Performs a forward pass and returns the cost.
+		Scalar forward()
+		{
+			cost_.forward();
+			return cost_.getValue();
+		}
+
+		void backward()
+		{
+			cost_.backward();
+		}
+
+		// Performs an update of all the trainable nodes.
+		void update(Scalar learning_rate)
+		{
+			staticgraph::for_each_node(cost_, [&](auto& node)
+			{
+				if constexpr (std::decay_t<decltype(node)>::is_trainable) node.update(learning_rate);
+			});
+		}
+
+		void SGD_step(Scalar learning_rate)
+		{
+			forward();
+			backward();
+			update(learning_rate);
+		}
+
+		void SGD(Scalar learning_rate, int repeats)
+		{
+			for (int i = 0; i < repeats; i++)
+			{
+				SGD_step(learning_rate);
+			}
+		}
+	};
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <array>
 #include <initializer_list>
+#include <type_traits>
 
 namespace statictensor
 {
@@ -19,8 +20,10 @@ namespace statictensor
 		*/
 
 		using SubTensor = typename TensorContainer::SubTensor;
+		using ValueType = typename TensorContainer::ValueType;
 		static constexpr unsigned dim_ = TensorContainer::dim_;
 		static constexpr unsigned rank_ = TensorContainer::rank_;
+		static constexpr std::size_t size_ = TensorContainer::size_;
 		//static constexpr Shape<rank_> shape_ = get_shape_static();
 
 		SubTensor data_[dim_];
@@ -58,7 +61,7 @@ namespace statictensor
 			return data_[i];
 		}
 
-		SubTensor operator[](unsigned i) const
+		SubTensor const& operator[](unsigned i) const
 		{
 			return data_[i];
 		}
@@ -67,6 +70,95 @@ namespace statictensor
 		{
 			return TensorImp::get_shape_static();
 		}		
+
+		// Sets every value to fn applied to the values at the same position of sources.
+		// The loops have constant bounds, so the compiler unrolls and vectorizes them.
+		template<typename F, typename ... Sources>
+		void transform(F fn, Sources const& ... sources)
+		{
+			for (unsigned i = 0; i < dim_; i++)
+			{
+				if constexpr (rank_ == 1) data_[i] = fn(sources.data_[i]...);
+				else data_[i].transform(fn, sources.data_[i]...);
+			}
+		}
+
+		void fill(ValueType value)
+		{
+			transform([=](ValueType) { return value; }, *this);
+		}
+
+		// Element-wise tensor operations
+
+		friend TensorImp operator+(TensorImp const& t1, TensorImp const& t2)
+		{
+			TensorImp result;
+			result.transform([](ValueType a, ValueType b) { return a + b; }, t1, t2);
+			return result;
+		}
+
+		friend TensorImp operator-(TensorImp const& t1, TensorImp const& t2)
+		{
+			TensorImp result;
+			result.transform([](ValueType a, ValueType b) { return a - b; }, t1, t2);
+			return result;
+		}
+
+		friend TensorImp operator*(TensorImp const& t1, TensorImp const& t2)
+		{
+			TensorImp result;
+			result.transform([](ValueType a, ValueType b) { return a * b; }, t1, t2);
+			return result;
+		}
+
+		void operator+=(TensorImp const& t)
+		{
+			transform([](ValueType a, ValueType b) { return a + b; }, *this, t);
+		}
+
+		void operator-=(TensorImp const& t)
+		{
+			transform([](ValueType a, ValueType b) { return a - b; }, *this, t);
+		}
+
+		// Element-wise operations with scalars
+
+		friend TensorImp operator*(ValueType s, TensorImp const& t)
+		{
+			TensorImp result;
+			result.transform([=](ValueType a) { return s * a; }, t);
+			return result;
+		}
+
+		friend TensorImp operator*(TensorImp const& t, ValueType s)
+		{
+			return s * t;
+		}
+
+		friend TensorImp operator-(TensorImp const& t)
+		{
+			return ValueType(-1) * t;
+		}
+
+		// Special functions
+
+		friend ValueType sum_all(TensorImp const& t)
+		{
+			ValueType result = 0;
+			for (unsigned i = 0; i < dim_; i++)
+			{
+				if constexpr (rank_ == 1) result += t.data_[i];
+				else result += sum_all(t.data_[i]);
+			}
+			return result;
+		}
+
+		// Shape information
+
+		friend std::size_t size(TensorImp const&)
+		{
+			return TensorImp::size_;
+		}
 	};
 
 	template<typename T, unsigned ... dims>
@@ -79,15 +171,80 @@ namespace statictensor
 	struct TensorContainer<T, dim, dims...>
 	{
 		using SubTensor = Tensor<T, dims...>;
+		using ValueType = T;
 		static constexpr unsigned dim_ = dim;
 		static constexpr unsigned rank_ = sizeof...(dims) + 1;
+		static constexpr std::size_t size_ = (std::size_t(dim) * ... * dims);
 	};
 
 	template<typename T, unsigned dim>
 	struct TensorContainer<T, dim>
 	{		
 		using SubTensor = T;
+		using ValueType = T;
 		static constexpr unsigned dim_ = dim;
 		static constexpr unsigned rank_ = 1;
+		static constexpr std::size_t size_ = dim;
 	};
+
+	// Matrix functions
+
+	template<typename T, unsigned M, unsigned K, unsigned N>
+	Tensor<T, M, N> dot(Tensor<T, M, K> const& t1, Tensor<T, K, N> const& t2)
+	{
+		Tensor<T, M, N> result;
+		for (unsigned i = 0; i < M; i++)
+		{
+			// Rows of the result are sums of the rows of t2, which keeps the inner loop contiguous.
+			T* row = &result[i][0];
+			for (unsigned j = 0; j < N; j++) row[j] = 0;
+			for (unsigned k = 0; k < K; k++)
+			{
+				T const a = t1[i][k];
+				T const* b = &t2[k][0];
+				for (unsigned j = 0; j < N; j++) row[j] += a * b[j];
+			}
+		}
+		return result;
+	}
+
+	template<typename T, unsigned M, unsigned N>
+	Tensor<T, N, M> transpose(Tensor<T, M, N> const& input)
+	{
+		Tensor<T, N, M> result;
+		for (unsigned i = 0; i < M; i++)
+		{
+			for (unsigned j = 0; j < N; j++) result[j][i] = input[i][j];
+		}
+		return result;
+	}
+
+	// Bias of Linear nodes: b has the shape of the output or is a single row shared by every row.
+
+	template<typename T, unsigned ... dims>
+	void add_bias(Tensor<T, dims...>& t, Tensor<T, dims...> const& b)
+	{
+		t += b;
+	}
+
+	template<typename T, unsigned M, unsigned N, typename = std::enable_if_t<(M > 1)>>
+	void add_bias(Tensor<T, M, N>& t, Tensor<T, 1, N> const& b)
+	{
+		for (unsigned i = 0; i < M; i++) t[i] += b[0];
+	}
+
+	template<typename T, unsigned ... dims>
+	Tensor<T, dims...> const& bias_gradient(Tensor<T, dims...> const& grad_cost, Tensor<T, dims...> const&)
+	{
+		return grad_cost;
+	}
+
+	template<typename T, unsigned M, unsigned N, typename = std::enable_if_t<(M > 1)>>
+	Tensor<T, 1, N> bias_gradient(Tensor<T, M, N> const& grad_cost, Tensor<T, 1, N> const&)
+	{
+		Tensor<T, 1, N> result;
+		result[0] = grad_cost[0];
+		for (unsigned i = 1; i < M; i++) result[0] += grad_cost[i];
+		return result;
+	}
 } //namespace statictensor
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <functional>
+#include "Graph.h"
+#include "TensorLanes.h"
+
+namespace miniflow
+{
+	template<std::size_t lanes>
+	class Sweep
+	{
+		/*
+			Trains many independent small models, e.g. a hyperparameter sweep or a model per customer.
+
+			Models are trained lanes at a time by a Graph on TensorLanes: the network of a group holds
+			models [first, first + lanes) in its lanes and every model has its own learning rate.
+			Groups are independent and are trained in parallel, so a sweep keeps all the SIMD lanes
+			and all the cores busy instead of running one tiny scalar graph after another.
+
+			The last group is filled up with the lanes of models past the end, which are trained with
+			a zero learning rate and whose results are dropped.
+		*/
+
+	public:
+
+		using Tensor = TensorLanes<lanes>;
+
+		// Builds the network of models [first, first + lanes) and returns its cost node.
+		using Builder = std::function<Node<Tensor>&(std::size_t first, Nodes<Tensor>& nodes)>;
+
+		// Returns the learning rate of a model.
+		using LearningRate = std::function<Scalar(std::size_t model)>;
+
+	private:
+
+		struct Group
+		{
+			Nodes<Tensor> nodes_;
+			Node<Tensor>* cost_ = nullptr;
+			std::unique_ptr<Graph> graph_;
+			std::vector<Trainable<Tensor>*> trainables_;
+			Tensor learning_rates_;
+		};
+
+		std::size_t models_;
+		std::vector<std::unique_ptr<Group>> groups_;
+
+	public:
+
+		// Builds the networks of all the groups. build() is called from this thread only.
+		Sweep(std::size_t models, Builder const& build, LearningRate const& learning_rate) :
+			models_(models)
+		{
+			for (std::size_t first = 0; first < models_; first += lanes)
+			{
+				auto group = std::make_unique<Group>();
+				group->cost_ = &build(first, group->nodes_);
+				group->graph_ = std::make_unique<Graph>(*group->cost_);
+				for (NodeInterface* node : group->graph_->trainables())
+				{
+					auto trainable = dynamic_cast<Trainable<Tensor>*>(node);
+					assert(trainable);
+					group->trainables_.push_back(trainable);
+				}
+				for (std::size_t lane = 0; lane < lanes; lane++)
+				{
+					group->learning_rates_[int(lane)] = first + lane < models_ ? learning_rate(first + lane) : 0;
+				}
+				groups_.push_back(std::move(group));
+			}
+		}
+
+		Sweep(Sweep const&) = delete;
+		Sweep& operator=(Sweep const&) = delete;
+
+		std::size_t models() const { return models_; }
+
+		// Performs repeats SGD steps on every model, groups in parallel.
+		void train(int repeats)
+		{
+			parallelFor(0, Index(groups_.size()), [&](Index g)
+			{
+				Group& group = *groups_[g];
+				for (int i = 0; i < repeats; i++)
+				{
+					group.graph_->forward();
+					group.graph_->backward();
+					for (Trainable<Tensor>* trainable : group.trainables_) trainable->update(group.learning_rates_);
+				}
+			});
+		}
+
+		// Returns the cost of every model after the last forward pass.
+		std::vector<Scalar> costs() const
+		{
+			std::vector<Scalar> result(models_);
+			for (std::size_t model = 0; model < models_; model++)
+			{
+				result[model] = groups_[model / lanes]->cost_->getValue()[int(model % lanes)];
+			}
+			return result;
+		}
+
+		// Returns the values of the trainables of a model, in the order of Graph::trainables().
+		std::vector<Scalar> parameters(std::size_t model) const
+		{
+			assert(model < models_);
+			Group const& group = *groups_[model / lanes];
+			std::vector<Scalar> result;
+			for (Trainable<Tensor> const* trainable : group.trainables_)
+			{
+				result.push_back(trainable->getValue()[int(model % lanes)]);
+			}
+			return result;
+		}
+	};
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <array>
+#include "Common.h"
+
+namespace miniflow
+{
+	template<std::size_t lanes>
+	class TensorLanes
+	{
+		/*
+			The scalars of lanes independent models, a drop-in for TensorScalar.
+
+			A network built on TensorLanes is lanes copies of the same scalar network, one per lane:
+			every operation is applied lane by lane, so a single Graph trains lanes models at once.
+			The loops over the lanes have a constant trip count and no dependencies between lanes,
+			so the compiler turns them into SIMD instructions.
+
+			Reductions such as sum_all() stay within a lane, and size() is the number of values of a single
+			model, so cost nodes compute the cost of every model separately. Trainable::update() with
+			a TensorLanes of learning rates trains every model with its own learning rate.
+		*/
+
+	public:
+
+		using ValueType = Scalar;
+		static constexpr std::size_t lanes_ = lanes;
+
+		alignas(64) std::array<Scalar, lanes> value_;
+
+		TensorLanes()
+		{
+			value_.fill(0);
+		}
+
+		// Every model has the same value
+		TensorLanes(Scalar value)
+		{
+			value_.fill(value);
+		}
+
+		TensorLanes(std::array<Scalar, lanes> const& values) :
+			value_(values)
+		{}
+
+		// Value of a lane
+		Scalar operator[](int lane) const
+		{
+			return value_[lane];
+		}
+
+		Scalar& operator[](int lane)
+		{
+			return value_[lane];
+		}
+
+		// Sets the value of every lane to fn applied to the values of the same lane of sources.
+		template<typename F, typename ... Sources>
+		void transform(F fn, Sources const& ... sources)
+		{
+			for (std::size_t i = 0; i < lanes; i++) value_[i] = fn(sources.value_[i]...);
+		}
+
+		// Element-wise tensor operations
+
+		friend TensorLanes operator+(TensorLanes const& t1, TensorLanes const& t2)
+		{
+			TensorLanes result;
+			result.transform([](Scalar a, Scalar b) { return a + b; }, t1, t2);
+			return result;
+		}
+
+		friend TensorLanes operator-(TensorLanes const& t1, TensorLanes const& t2)
+		{
+			TensorLanes result;
+			result.transform([](Scalar a, Scalar b) { return a - b; }, t1, t2);
+			return result;
+		}
+
+		friend TensorLanes operator*(TensorLanes const& t1, TensorLanes const& t2)
+		{
+			TensorLanes result;
+			result.transform([](Scalar a, Scalar b) { return a * b; }, t1, t2);
+			return result;
+		}
+
+		friend TensorLanes operator/(TensorLanes const& t1, TensorLanes const& t2)
+		{
+			TensorLanes result;
+			result.transform([](Scalar a, Scalar b) { return a / b; }, t1, t2);
+			return result;
+		}
+
+		void operator+=(const TensorLanes& t)
+		{
+			transform([](Scalar a, Scalar b) { return a + b; }, *this, t);
+		}
+
+		void operator-=(const TensorLanes& t)
+		{
+			transform([](Scalar a, Scalar b) { return a - b; }, *this, t);
+		}
+
+		void operator*=(const TensorLanes& t)
+		{
+			transform([](Scalar a, Scalar b) { return a * b; }, *this, t);
+		}
+
+		void operator/=(const TensorLanes& t)
+		{
+			transform([](Scalar a, Scalar b) { return a / b; }, *this, t);
+		}
+
+		// Element-wise operations with scalars, which are shared by all the lanes
+
+		friend TensorLanes operator+(TensorLanes const& t, Scalar s)
+		{
+			return t + TensorLanes(s);
+		}
+
+		friend TensorLanes operator+(Scalar s, TensorLanes const& t)
+		{
+			return t + s;
+		}
+
+		friend TensorLanes operator-(TensorLanes const& t, Scalar s)
+		{
+			return t - TensorLanes(s);
+		}
+
+		friend TensorLanes operator-(Scalar s, TensorLanes const& t)
+		{
+			return TensorLanes(s) - t;
+		}
+
+		friend TensorLanes operator*(TensorLanes const& t, Scalar s)
+		{
+			return t * TensorLanes(s);
+		}
+
+		friend TensorLanes operator*(Scalar s, TensorLanes const& t)
+		{
+			return t * s;
+		}
+
+		friend TensorLanes operator/(Scalar s, TensorLanes const& t)
+		{
+			return TensorLanes(s) / t;
+		}
+
+		friend TensorLanes operator/(TensorLanes const& t, Scalar s)
+		{
+			return t * (1 / s);
+		}
+
+		friend TensorLanes operator-(TensorLanes const& t)
+		{
+			return t * -1;
+		}
+
+		// Special functions, each lane is a scalar
+
+		friend TensorLanes sum(TensorLanes const& t)
+		{
+			return t;
+		}
+
+		friend TensorLanes mean(TensorLanes const& t)
+		{
+			return t;
+		}
+
+		// The sum of every lane. Unlike the Scalar of other tensors, lanes are not added together.
+		friend TensorLanes sum_all(TensorLanes const& t)
+		{
+			return t;
+		}
+
+		friend TensorLanes scalar_like(TensorLanes const&, TensorLanes const& s)
+		{
+			return s;
+		}
+
+		friend TensorLanes exp(const TensorLanes& t)
+		{
+			TensorLanes result;
+			result.transform([](Scalar a) { return std::exp(a); }, t);
+			return result;
+		}
+
+		friend TensorLanes sqr(const TensorLanes& t)
+		{
+			return t * t;
+		}
+
+		friend TensorLanes dot(const TensorLanes& t1, const TensorLanes& t2)
+		{
+			return t1 * t2;
+		}
+
+		friend TensorLanes transpose(TensorLanes const& input)
+		{
+			return input;
+		}
+
+		// Bias of Linear nodes
+
+		friend void add_bias(TensorLanes& t, TensorLanes const& b)
+		{
+			t += b;
+		}
+
+		friend TensorLanes bias_gradient(TensorLanes const& grad_cost, TensorLanes const&)
+		{
+			return grad_cost;
+		}
+
+		// Shape information of a single model
+
+		friend std::size_t size(TensorLanes const&)
+		{
+			return 1;
+		}
+
+		friend std::vector<Index> dims(TensorLanes const&)
+		{
+			return {};
+		}
+
+		// Conversion to and from type-erased TensorData, which holds all the lanes as a vector
+
+		friend std::vector<Index> data_dims(TensorLanes const&)
+		{
+			return { Index(lanes) };
+		}
+
+		friend TensorData to_data(TensorLanes const& t)
+		{
+			return TensorData{ { Index(lanes) }, std::vector<Scalar>(t.value_.begin(), t.value_.end()) };
+		}
+
+		friend void from_data(TensorData const& data, TensorLanes& t)
+		{
+			assert(data.values_.size() == lanes);
+			std::copy(data.values_.begin(), data.values_.end(), t.value_.begin());
+		}
+	};
+
+	// Bytes of the values of all the models, while size() counts those of a single model
+	template<std::size_t lanes>
+	std::size_t storage_bytes(TensorLanes<lanes> const&)
+	{
+		return lanes * sizeof(Scalar);
+	}
+}
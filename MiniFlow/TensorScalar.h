@@ -13,6 +13,8 @@ namespace miniflow
 
 	public:
 
+		using ValueType = Scalar;
+
 		Scalar value_;			
 
 		TensorScalar() :
@@ -33,6 +35,13 @@ namespace miniflow
 			return value_;
 		}
 
+		// Sets the value to fn applied to the values of sources.
+		template<typename F, typename ... Sources>
+		void transform(F fn, Sources const& ... sources)
+		{
+			value_ = fn(sources.value_...);
+		}
+
 		// Element-wise tensor operations
 
 		friend TensorScalar operator+(TensorScalar const& t1, TensorScalar const& t2)
@@ -114,7 +123,7 @@ namespace miniflow
 
 		friend TensorScalar operator/(TensorScalar const& t, Scalar s)
 		{
-			return t * 1 / s;
+			return t * (1 / s);
 		}
 
 		friend TensorScalar operator-(TensorScalar const& t)
@@ -134,6 +143,17 @@ namespace miniflow
 			return TensorScalar(t.value_);
 		}
 
+		friend Scalar sum_all(TensorScalar const& t)
+		{
+			return t.value_;
+		}
+
+		// Returns a tensor holding a single value s.
+		friend TensorScalar scalar_like(TensorScalar const&, Scalar s)
+		{
+			return TensorScalar(s);
+		}
+
 		friend TensorScalar exp(const TensorScalar& t)
 		{
 			return pow(EXP, t.value_);
@@ -153,5 +173,42 @@ namespace miniflow
 		{
 			return TensorScalar(input.value_);
 		}
+
+		// Bias of Linear nodes
+
+		friend void add_bias(TensorScalar& t, TensorScalar const& b)
+		{
+			t.value_ += b.value_;
+		}
+
+		friend TensorScalar bias_gradient(TensorScalar const& grad_cost, TensorScalar const&)
+		{
+			return grad_cost;
+		}
+
+		// Shape information
+
+		friend std::size_t size(TensorScalar const&)
+		{
+			return 1;
+		}
+
+		friend std::vector<Index> dims(TensorScalar const&)
+		{
+			return {};
+		}
+
+		// Conversion to and from type-erased TensorData
+
+		friend TensorData to_data(TensorScalar const& t)
+		{
+			return TensorData{ {}, { t.value_ } };
+		}
+
+		friend void from_data(TensorData const& data, TensorScalar& t)
+		{
+			assert(data.shape_.empty() && data.values_.size() == 1);
+			t.value_ = data.values_[0];
+		}
 	};
 }
\ No newline at end of file
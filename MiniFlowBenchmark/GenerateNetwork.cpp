@@ -0,0 +1,48 @@
+// GenerateNetwork.cpp : Writes the generated forward pass of the network benchmarked by the codegen benchmarks.
+//
+// Usage: GenerateNetwork <header>
+//
+
+#include <fstream>
+#include <random>
+
+#include "../MiniFlow/DynamicTensor.h"
+#include "../MiniFlow/Codegen.h"
+
+int main(int argc, char* argv[])
+{
+	using Matrix = dynamictensor::Tensor<miniflow::Scalar, 2>;
+
+	if (argc != 2)
+	{
+		std::cerr << "Usage: GenerateNetwork <header>\n";
+		return 1;
+	}
+
+	// A single example through a 64-64-10 network, the size of a small embedded classifier
+	std::mt19937 random_engine(7);
+	auto random_matrix = [&](miniflow::Index rows, miniflow::Index cols, miniflow::Scalar scale)
+	{
+		std::uniform_real_distribution<miniflow::Scalar> distribution(-scale, scale);
+		Matrix m(dynamictensor::Shape<2>{ rows, cols });
+		for (auto& row : m.data_) for (auto& x : row.data_) x = distribution(random_engine);
+		return m;
+	};
+
+	miniflow::Input<Matrix> X(random_matrix(1, 64, 1.));
+	miniflow::Trainable<Matrix> W1(random_matrix(64, 64, 0.125)), b1(random_matrix(1, 64, 0.1));
+	miniflow::Trainable<Matrix> W2(random_matrix(64, 10, 0.125)), b2(random_matrix(1, 10, 0.1));
+	miniflow::Linear<Matrix> L1(X, W1, b1);
+	miniflow::ReLU<Matrix> R1(L1);
+	miniflow::Linear<Matrix> L2(R1, W2, b2);
+	miniflow::Sigmoid<Matrix> S2(L2);
+	X.set_name("X");
+	W1.set_name("W1");
+	b1.set_name("b1");
+	W2.set_name("W2");
+	b2.set_name("b2");
+
+	std::ofstream file(argv[1]);
+	miniflow::generate_header(S2, file, "generated_network");
+	return file ? 0 : 1;
+}
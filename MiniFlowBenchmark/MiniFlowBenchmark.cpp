@@ -0,0 +1,1195 @@
+// MiniFlowBenchmark.cpp : Performance benchmarks of the tensor libraries and of graph training.
+//
+// Usage: MiniFlowBenchmark [--filter <text>] [--min-time <seconds>] [--out <file>] [--compare <file>] [--gemm-profile <file>]
+//	--filter		runs only the benchmarks whose name contains text
+//	--min-time		minimal time spent measuring each benchmark, 0 runs every benchmark once
+//	--out			writes results as JSON to a file instead of the standard output
+//	--compare		prints the change of every benchmark against results of a previous run
+//	--gemm-profile	loads the matrix product blocking of the machine from a profile saved by save_gemm_profile()
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#include "../MiniFlow/DynamicTensor.h"
+#include "../MiniFlow/StaticTensor.h"
+#include "../MiniFlow/Convolution.h"
+#include "../MiniFlow/Softmax.h"
+#include "../MiniFlow/Sparse.h"
+#include "../MiniFlow/Recurrent.h"
+#include "../MiniFlow/Embedding.h"
+#include "../MiniFlow/Autotune.h"
+#include "../MiniFlow/Quantization.h"
+#include "../MiniFlow/HalfPrecision.h"
+#include "../MiniFlow/Fold.h"
+#include "../MiniFlow/Pruning.h"
+#include "../MiniFlow/Pipeline.h"
+#include "../MiniFlow/Predictor.h"
+#include "../MiniFlow/Graph.h"
+#include "../MiniFlow/StaticGraph.h"
+#include "../MiniFlow/Sweep.h"
+
+#ifndef MINIFLOW_REVISION
+#define MINIFLOW_REVISION "unknown"
+#endif
+
+// Written by GenerateNetwork during the CMake build
+#ifdef MINIFLOW_GENERATED_NETWORK
+#include "generated_network.h"
+#endif
+
+namespace
+{
+	using miniflow::Scalar;
+	using Matrix = dynamictensor::Tensor<Scalar, 2>;
+	using Vector = dynamictensor::Tensor<Scalar, 1>;
+
+	// Keeps the compiler from optimizing away a computed value.
+	template<typename T>
+	void keep(T const& value)
+	{
+		static volatile char sink;
+		sink = *reinterpret_cast<char const volatile*>(&value);
+	}
+
+	struct Result
+	{
+		std::string name_;
+		std::size_t iterations_;	//: Number of measured calls.
+		double ns_median_;			//: Median time of a call over the samples.
+		double ns_min_;				//: Fastest sample time of a call.
+		double items_;				//: Work per call: values, multiply-adds or training examples.
+	};
+
+	class Benchmark
+	{
+		/*
+			Measures a function by calling it in batches large enough to last min_time / samples,
+			and reports the median and the minimum time per call over the samples.
+		*/
+
+		using Clock = std::chrono::steady_clock;
+		static constexpr int samples_ = 5;
+
+		std::string filter_;
+		double min_time_;
+		std::vector<Result> results_;
+
+		template<typename F>
+		static double time(std::size_t batch, F& fn)
+		{
+			Clock::time_point start = Clock::now();
+			for (std::size_t i = 0; i < batch; i++) fn();
+			return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		}
+
+	public:
+
+		Benchmark(std::string const& filter, double min_time) :
+			filter_(filter),
+			min_time_(min_time)
+		{
+		}
+
+		std::vector<Result> const& results() const { return results_; }
+
+		// Whether a benchmark of the given name passes the filter.
+		bool selected(std::string const& name) const { return name.find(filter_) != std::string::npos; }
+
+		template<typename F>
+		void run(std::string const& name, double items, F fn)
+		{
+			if (!selected(name)) return;
+
+			double sample_time = min_time_ * 1e9 / samples_;
+			std::size_t batch = 1;
+			double elapsed = time(batch, fn); // warm up
+			while (elapsed < sample_time && batch < (std::size_t(1) << 30))
+			{
+				batch *= elapsed > 0 ? std::max<std::size_t>(2, std::min<std::size_t>(100, std::size_t(sample_time / elapsed))) : 100;
+				elapsed = time(batch, fn);
+			}
+
+			int samples = min_time_ > 0 ? samples_ : 1;
+			std::vector<double> times(samples);
+			for (double& t : times) t = time(batch, fn) / batch;
+			std::sort(times.begin(), times.end());
+
+			results_.push_back({ name, batch * samples, times[samples / 2], times[0], items });
+			std::cerr << std::left << std::setw(48) << name << std::right << std::setw(16) << std::fixed << std::setprecision(1)
+				<< times[samples / 2] << " ns" << std::setw(14) << std::setprecision(3) << items * 1e3 / times[samples / 2] << " Mitems/s\n";
+		}
+
+		// Prints a measurement that is not a time, such as accuracy, along with the results of name.
+		void note(std::string const& name, std::string const& text) const
+		{
+			if (!selected(name)) return;
+			std::cerr << std::left << std::setw(48) << name << "  " << text << "\n";
+		}
+
+		void write_json(std::ostream& out) const
+		{
+			out << "{\n\t\"revision\": \"" << MINIFLOW_REVISION << "\",\n\t\"benchmarks\": [\n";
+			for (std::size_t i = 0; i < results_.size(); i++)
+			{
+				Result const& r = results_[i];
+				out << "\t\t{\"name\": \"" << r.name_ << "\", \"iterations\": " << r.iterations_ << std::setprecision(6) << std::defaultfloat
+					<< ", \"ns_per_op\": " << r.ns_median_ << ", \"ns_min\": " << r.ns_min_
+					<< ", \"items_per_second\": " << r.items_ * 1e9 / r.ns_median_ << "}" << (i + 1 < results_.size() ? "," : "") << "\n";
+			}
+			out << "\t]\n}\n";
+		}
+	};
+
+	// Reads name and ns_per_op of every benchmark from a file written by Benchmark::write_json.
+	std::map<std::string, double> read_json(std::string const& path)
+	{
+		std::map<std::string, double> baseline;
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::size_t name = line.find("\"name\": \"");
+			std::size_t time = line.find("\"ns_per_op\": ");
+			if (name == std::string::npos || time == std::string::npos) continue;
+			name += 9;
+			baseline[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(time + 13));
+		}
+		return baseline;
+	}
+
+	void compare(std::vector<Result> const& results, std::map<std::string, double> const& baseline)
+	{
+		std::cerr << "\n" << std::left << std::setw(48) << "benchmark" << std::right << std::setw(16) << "baseline ns"
+			<< std::setw(16) << "current ns" << std::setw(10) << "change\n";
+		for (Result const& r : results)
+		{
+			auto it = baseline.find(r.name_);
+			if (it == baseline.end()) continue;
+			double change = r.ns_median_ / it->second - 1;
+			std::cerr << std::left << std::setw(48) << r.name_ << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(16) << it->second << std::setw(16) << r.ns_median_ << std::setw(9) << std::showpos << 100 * change
+				<< "%" << std::noshowpos << (change > 0.1 ? "  slower" : change < -0.1 ? "  faster" : "") << "\n";
+		}
+	}
+
+	std::mt19937 random_engine(42);
+
+	Matrix random_matrix(miniflow::Index rows, miniflow::Index cols, Scalar scale = 1.)
+	{
+		std::uniform_real_distribution<Scalar> distribution(-scale, scale);
+		Matrix m(dynamictensor::Shape<2>{ rows, cols });
+		m.each([&](int, Vector& row) { row.each([&](int, Scalar& x) { x = distribution(random_engine); }); });
+		return m;
+	}
+
+	std::string shape_name(std::vector<miniflow::Index> const& dims)
+	{
+		std::string name;
+		for (std::size_t i = 0; i < dims.size(); i++) name += (i ? "x" : "") + std::to_string(dims[i]);
+		return name;
+	}
+
+	template<typename Tensor>
+	class Network
+	{
+		/*
+			Owns the nodes of a chain of Linear and Sigmoid layers trained with an MSE cost.
+			Nodes keep pointers to each other, so they are allocated individually and never move.
+		*/
+
+		std::vector<std::unique_ptr<miniflow::NodeInterface>> nodes_;
+
+		template<typename N, typename ... Args>
+		N& add(Args&& ... args)
+		{
+			nodes_.push_back(std::make_unique<N>(std::forward<Args>(args)...));
+			return static_cast<N&>(*nodes_.back());
+		}
+
+	public:
+
+		std::unique_ptr<miniflow::Graph> graph_;
+
+		// layers holds the initial {W, b} of every layer.
+		Network(Tensor const& X, Tensor const& Y, std::vector<std::pair<Tensor, Tensor>> const& layers)
+		{
+			miniflow::Node<Tensor>* output = &add<miniflow::Input<Tensor>>(X);
+			auto& labels = add<miniflow::Input<Tensor>>(Y);
+			for (auto const& [W, b] : layers)
+			{
+				auto& L = add<miniflow::Linear<Tensor>>(*output, add<miniflow::Trainable<Tensor>>(W), add<miniflow::Trainable<Tensor>>(b));
+				output = &add<miniflow::Sigmoid<Tensor>>(L);
+			}
+			graph_ = std::make_unique<miniflow::Graph>(add<miniflow::MSE<Tensor>>(labels, *output));
+		}
+	};
+
+	// Fully connected network on batch x widths[0] inputs with layers of the given widths.
+	Network<Matrix> matrix_network(miniflow::Index batch, std::vector<miniflow::Index> const& widths)
+	{
+		std::vector<std::pair<Matrix, Matrix>> layers;
+		for (std::size_t i = 1; i < widths.size(); i++)
+		{
+			layers.emplace_back(random_matrix(widths[i - 1], widths[i], 1. / std::sqrt(Scalar(widths[i - 1]))), Matrix(dynamictensor::Shape<2>{ batch, widths[i] }));
+		}
+		return Network<Matrix>(random_matrix(batch, widths.front()), random_matrix(batch, widths.back()), layers);
+	}
+
+	void elementwise_benchmarks(Benchmark& benchmark)
+	{
+		for (miniflow::Index n : { 64u, 256u, 1024u })
+		{
+			Matrix t1 = random_matrix(n, n), t2 = random_matrix(n, n);
+			std::string shape = shape_name({ n, n });
+			benchmark.run("dynamictensor/add/" + shape, n * n, [&] { keep(t1 + t2); });
+			benchmark.run("dynamictensor/mul/" + shape, n * n, [&] { keep(t1 * t2); });
+			benchmark.run("dynamictensor/scale/" + shape, n * n, [&] { keep(t1 * 0.5); });
+			benchmark.run("dynamictensor/accumulate/" + shape, n * n, [&] { t1 += t2; });
+		}
+		for (miniflow::Index n : { 64u, 256u })
+		{
+			Matrix t = random_matrix(n, n);
+			benchmark.run("dynamictensor/exp/" + shape_name({ n, n }), n * n, [&] { keep(exp(t)); });
+		}
+	}
+
+	void transpose_benchmarks(Benchmark& benchmark)
+	{
+		for (miniflow::Index n : { 64u, 256u, 1024u })
+		{
+			Matrix t = random_matrix(n, n), transposed(dynamictensor::Shape<2>{ n, n });
+			benchmark.run("dynamictensor/transpose/" + shape_name({ n, n }), n * n, [&] { keep(transpose(t)); });
+			// Without the allocation of the result
+			benchmark.run("dynamictensor/transpose_into/" + shape_name({ n, n }), n * n, [&] { transpose_into(t, transposed); keep(transposed); });
+		}
+		Matrix tall = random_matrix(2048, 64);
+		benchmark.run("dynamictensor/transpose/2048x64", 2048 * 64, [&] { keep(transpose(tall)); });
+
+		// Rank 3: the last two axes of every matrix, and a permutation moving the last axis first
+		dynamictensor::Tensor<Scalar, 3> batch({ 16, 128, 128 });
+		for (miniflow::Index i = 0; i < 16; i++) batch[i] = random_matrix(128, 128);
+		benchmark.run("dynamictensor/transpose/16x128x128", 16 * 128 * 128, [&] { keep(transpose(batch)); });
+		benchmark.run("dynamictensor/transpose/permute_201/16x128x128", 16 * 128 * 128, [&] { keep(transpose(batch, { 2, 0, 1 })); });
+	}
+
+	void dot_benchmarks(Benchmark& benchmark)
+	{
+		// {M, K, N}: dot of M x K and K x N matrices, items are multiply-adds.
+		std::vector<std::array<miniflow::Index, 3>> shapes =
+		{
+			{ 32, 32, 32 }, { 64, 64, 64 }, { 128, 128, 128 }, { 256, 256, 256 },
+			{ 1, 256, 256 }, { 256, 256, 1 }, { 512, 32, 512 }, { 32, 512, 32 }, { 64, 784, 128 }, { 64, 128, 784 },
+		};
+		for (auto const& [m, k, n] : shapes)
+		{
+			Matrix t1 = random_matrix(m, k), t2 = random_matrix(k, n);
+			benchmark.run("dynamictensor/dot/" + shape_name({ m, k, n }), double(m) * k * n, [&] { keep(dot(t1, t2)); });
+		}
+
+		Matrix matrix = random_matrix(256, 256);
+		Vector vector = matrix[0];
+		benchmark.run("dynamictensor/dot/vector/4096", 4096, [&, v = random_matrix(1, 4096)[0]] { keep(dot(v, v)); });
+		benchmark.run("dynamictensor/dot/matrix_vector/256x256", 256 * 256, [&] { keep(dot(matrix, vector)); });
+		benchmark.run("dynamictensor/dot/vector_matrix/256x256", 256 * 256, [&] { keep(dot(vector, matrix)); });
+
+		// The three products of the gradients of a Linear node of 784 inputs and 128 outputs, for batches of 64 and 1
+		for (miniflow::Index batch : { 64u, 1u })
+		{
+			Matrix X = random_matrix(batch, 784), W = random_matrix(784, 128), G = random_matrix(batch, 128);
+			std::string shape = shape_name({ batch, 784, 128 });
+			double items = double(batch) * 784 * 128;
+			benchmark.run("dynamictensor/dot/linear_forward/" + shape, items, [&] { keep(dot(X, W)); });
+			benchmark.run("dynamictensor/dot/transposed_copy_nt/" + shape, items, [&] { keep(dot(G, transpose(W))); });
+			benchmark.run("dynamictensor/dot/nt/" + shape, items, [&] { keep(dot_nt(G, W)); });
+			benchmark.run("dynamictensor/dot/transposed_copy_tn/" + shape, items, [&] { keep(dot(transpose(X), G)); });
+			benchmark.run("dynamictensor/dot/tn/" + shape, items, [&] { keep(dot_tn(X, G)); });
+		}
+
+		// 16 products of 64 x 64 matrices
+		dynamictensor::Tensor<miniflow::Scalar, 3> batch_a({ 16, 64, 64 }), batch_b({ 16, 64, 64 });
+		for (miniflow::Index i = 0; i < 16; i++)
+		{
+			batch_a[i] = random_matrix(64, 64);
+			batch_b[i] = random_matrix(64, 64);
+		}
+		benchmark.run("dynamictensor/dot/batched/16x64x64x64", 16. * 64 * 64 * 64, [&] { keep(dot(batch_a, batch_b)); });
+	}
+
+	// Products of a Linear layer with the blocking derived from the cache sizes and with the tuned one.
+	void autotune_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::GemmShape const shape{ 64, 784, 128 };
+		std::string const name = shape_name({ shape.M_, shape.K_, shape.N_ });
+		if (!benchmark.selected("dynamictensor/gemm_blocking/")) return;
+
+		dynamictensor::GemmBlocking const saved = dynamictensor::gemm_blocking;
+		Matrix X = random_matrix(shape.M_, shape.K_), W = random_matrix(shape.K_, shape.N_), G = random_matrix(shape.M_, shape.N_);
+		auto products = [&] { keep(dot(X, W)); keep(dot_nt(G, W)); keep(dot_tn(X, G)); };
+		double items = 3. * shape.M_ * shape.K_ * shape.N_;
+
+		dynamictensor::gemm_blocking = miniflow::heuristic_gemm_blocking();
+		benchmark.run("dynamictensor/gemm_blocking/heuristic/" + name, items, products);
+		miniflow::autotune_gemm({ shape });
+		benchmark.run("dynamictensor/gemm_blocking/tuned/" + name, items, products);
+		dynamictensor::gemm_blocking = saved;
+	}
+
+	void reduction_benchmarks(Benchmark& benchmark)
+	{
+		for (miniflow::Index n : { 256u, 1024u })
+		{
+			Matrix t = random_matrix(n, n);
+			std::string shape = shape_name({ n, n });
+			benchmark.run("dynamictensor/sum/" + shape, n * n, [&] { keep(sum(t)); });
+			benchmark.run("dynamictensor/mean/" + shape, n * n, [&] { keep(mean(t)); });
+			benchmark.run("dynamictensor/sum_all/" + shape, n * n, [&] { keep(sum_all(t)); });
+		}
+	}
+
+	// Element-wise addition of 16 values stored in each of the tensor types.
+	void tensor_type_benchmarks(Benchmark& benchmark)
+	{
+		constexpr unsigned n = 16;
+
+		std::array<miniflow::TensorScalar, n> scalars1, scalars2, scalars_result;
+		for (unsigned i = 0; i < n; i++) scalars1[i] = scalars2[i] = Scalar(i);
+		benchmark.run("tensor_types/add16/TensorScalar", n, [&]
+		{
+			for (unsigned i = 0; i < n; i++) scalars_result[i] = scalars1[i] + scalars2[i];
+			keep(scalars_result);
+		});
+
+		statictensor::Tensor<Scalar, n> static1, static2, static_result;
+		for (unsigned i = 0; i < n; i++) static1[i] = static2[i] = Scalar(i);
+		benchmark.run("tensor_types/add16/StaticTensor", n, [&]
+		{
+			for (unsigned i = 0; i < n; i++) static_result[i] = static1[i] + static2[i];
+			keep(static_result);
+		});
+
+		Vector dynamic1(dynamictensor::Shape<1>{ n }, 1.), dynamic2(dynamictensor::Shape<1>{ n }, 2.);
+		benchmark.run("tensor_types/add16/DynamicTensor", n, [&] { keep(dynamic1 + dynamic2); });
+
+		statictensor::Tensor<Scalar, 4, 4> static_matrix1, static_matrix2, static_matrix_result;
+		for (unsigned i = 0; i < 4; i++) for (unsigned j = 0; j < 4; j++) static_matrix1[i][j] = static_matrix2[i][j] = Scalar(i + j);
+		benchmark.run("tensor_types/add4x4/StaticTensor", n, [&]
+		{
+			for (unsigned i = 0; i < 4; i++) for (unsigned j = 0; j < 4; j++) static_matrix_result[i][j] = static_matrix1[i][j] + static_matrix2[i][j];
+			keep(static_matrix_result);
+		});
+
+		Matrix dynamic_matrix1 = random_matrix(4, 4), dynamic_matrix2 = random_matrix(4, 4);
+		benchmark.run("tensor_types/add4x4/DynamicTensor", n, [&] { keep(dynamic_matrix1 + dynamic_matrix2); });
+	}
+
+	void convolution_benchmarks(Benchmark& benchmark)
+	{
+		using Tensor = dynamictensor::Tensor<Scalar, 4>;
+		using Shape = dynamictensor::Shape<4>;
+
+		// {images, channels, image size, filters, kernel, stride, padding}, items are multiply-adds.
+		std::vector<std::array<miniflow::Index, 7>> configurations =
+		{
+			{ 16, 1, 28, 8, 5, 1, 0 }, { 8, 16, 32, 32, 3, 1, 1 }, { 8, 32, 32, 64, 3, 2, 1 },
+		};
+		for (auto const& [images, channels, extent, filters, kernel, stride, padding] : configurations)
+		{
+			Matrix values = random_matrix(images * channels * extent, extent);
+			Tensor image(Shape{ images, channels, extent, extent });
+			std::vector<Scalar> flat;
+			values.flatten(flat);
+			image.unflatten(flat.begin());
+
+			miniflow::Input<Tensor> X(image);
+			miniflow::Trainable<Tensor> W(Tensor(Shape{ filters, channels, kernel, kernel }, 0.01)), b(Tensor(Shape{ 1, filters, 1, 1 }));
+			miniflow::Conv2D<Tensor> C(X, W, b, stride, padding);
+			miniflow::Input<Tensor> Y(Tensor(Shape{ images, filters, (extent + 2 * padding - kernel) / stride + 1, (extent + 2 * padding - kernel) / stride + 1 }));
+			miniflow::MSE<Tensor> cost(Y, C);
+			miniflow::Graph network(cost);
+
+			double multiply_adds = double(size(Y.getValue())) * channels * kernel * kernel;
+			std::string name = shape_name({ images, channels, extent, extent }) + "/" + shape_name({ filters, kernel, kernel }) + "/s" + std::to_string(stride) + "p" + std::to_string(padding);
+			benchmark.run("conv2d/forward/" + name, multiply_adds, [&] { network.invalidate(); network.forward(); });
+			benchmark.run("conv2d/SGD_step/" + name, 3 * multiply_adds, [&] { network.SGD_step(0.01); });
+		}
+	}
+
+	// Activation node forward and backward with a single outbound node.
+	template<template<typename> class Activation>
+	void activation_benchmark(Benchmark& benchmark, std::string const& name, Matrix const& input)
+	{
+		miniflow::Input<Matrix> X(input);
+		Activation<Matrix> A(X);
+		miniflow::Input<Matrix> Y(Matrix(input.shape()));
+		miniflow::MSE<Matrix> cost(Y, A);
+		miniflow::Graph(cost).forward();
+		cost.backward();
+		benchmark.run("activation/" + name + "/" + shape_name(dims(input)), size(input), [&] { A.forward(); A.backward(); });
+	}
+
+	// Linear followed by ReLU, so an in place activation always finds a fresh producer value.
+	void linear_relu_benchmark(Benchmark& benchmark, bool in_place)
+	{
+		miniflow::Input<Matrix> X(random_matrix(256, 256));
+		miniflow::Trainable<Matrix> W(random_matrix(256, 1024)), b(random_matrix(256, 1024));
+		miniflow::Linear<Matrix> L(X, W, b);
+		miniflow::ReLU<Matrix> A(L, in_place);
+		miniflow::Input<Matrix> Y(random_matrix(256, 1024));
+		miniflow::MSE<Matrix> cost(Y, A);
+		miniflow::Graph(cost).forward();
+		cost.backward();
+		std::string name = in_place ? "linear_relu_in_place" : "linear_relu";
+		benchmark.run("activation/" + name + "/256x256x1024", 256 * 1024, [&] { L.forward(); A.forward(); A.backward(); });
+	}
+
+	void activation_benchmarks(Benchmark& benchmark)
+	{
+		Matrix input = random_matrix(256, 1024, 4.);
+		activation_benchmark<miniflow::Sigmoid>(benchmark, "sigmoid", input);
+		activation_benchmark<miniflow::Tanh>(benchmark, "tanh", input);
+		activation_benchmark<miniflow::ReLU>(benchmark, "relu", input);
+		activation_benchmark<miniflow::LeakyReLU>(benchmark, "leaky_relu", input);
+		activation_benchmark<miniflow::GELU>(benchmark, "gelu", input);
+		linear_relu_benchmark(benchmark, false);
+		linear_relu_benchmark(benchmark, true);
+
+		// Sigmoid written with tensor expressions, as the node was implemented before the activation kernels.
+		Matrix grad_cost = random_matrix(256, 1024);
+		benchmark.run("activation/sigmoid_expression/" + shape_name(dims(input)), size(input), [&]
+		{
+			Matrix sigmoid = 1. / (1 + exp(-input));
+			keep(sigmoid * (1 - sigmoid) * grad_cost);
+		});
+	}
+
+	// Cost nodes on examples x classes predictions with one-hot labels, forward and backward.
+	void cost_benchmarks(Benchmark& benchmark)
+	{
+		for (auto [examples, classes] : { std::pair<miniflow::Index, miniflow::Index>{ 64, 10 }, { 256, 1000 } })
+		{
+			Matrix labels(dynamictensor::Shape<2>{ examples, classes });
+			for (miniflow::Index i = 0; i < examples; i++) labels[i][i % classes] = 1;
+			std::string shape = shape_name({ examples, classes });
+
+			miniflow::Input<Matrix> softmax_labels(labels), softmax_logits(random_matrix(examples, classes));
+			miniflow::SoftmaxCrossEntropy<Matrix> softmax_cost(softmax_labels, softmax_logits);
+			benchmark.run("cost/softmax_cross_entropy/" + shape, examples * classes, [&] { softmax_cost.forward(); softmax_cost.backward(); });
+
+			miniflow::Input<Matrix> mse_labels(labels), mse_predictions(random_matrix(examples, classes));
+			miniflow::MSE<Matrix> mse_cost(mse_labels, mse_predictions);
+			benchmark.run("cost/mse/" + shape, examples * classes, [&] { mse_cost.forward(); mse_cost.backward(); });
+		}
+	}
+
+	// Linear on a wide input with 1% non-zeros, stored sparse and dense, forward and backward.
+	// Items are the non-zero multiply-adds, the work both nodes have to do at least.
+	void sparse_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const examples = 128, features = 20000, outputs = 64;
+		std::uniform_real_distribution<Scalar> distribution(0, 1);
+		Matrix dense(dynamictensor::Shape<2>{ examples, features });
+		dense.each([&](int, Vector& row) { row.each([&](int, Scalar& x) { if (distribution(random_engine) < 0.01) x = distribution(random_engine); }); });
+		sparsetensor::CsrMatrix<Scalar> sparse = sparsetensor::CsrMatrix<Scalar>::from_dense(dense);
+		std::size_t items = sparse.nonzeros() * outputs;
+		std::string shape = shape_name({ examples, features, outputs });
+
+		Matrix W = random_matrix(features, outputs, 0.01), b = random_matrix(examples, outputs);
+		miniflow::Input<Matrix> Y(random_matrix(examples, outputs));
+
+		miniflow::SparseInput<Matrix> sparse_X(sparse);
+		miniflow::Trainable<Matrix> sparse_W(W), sparse_b(b);
+		miniflow::SparseLinear<Matrix> sparse_linear(sparse_X, sparse_W, sparse_b);
+		miniflow::MSE<Matrix> sparse_cost(Y, sparse_linear);
+		sparse_linear.forward();
+		sparse_cost.forward();
+		sparse_cost.backward();
+		benchmark.run("sparse/linear/sparse/" + shape, items, [&] { sparse_linear.forward(); sparse_linear.backward(); });
+
+		miniflow::Input<Matrix> dense_X(dense);
+		miniflow::Trainable<Matrix> dense_W(W), dense_b(b);
+		miniflow::Linear<Matrix> dense_linear(dense_X, dense_W, dense_b);
+		miniflow::MSE<Matrix> dense_cost(Y, dense_linear);
+		dense_linear.forward();
+		dense_cost.forward();
+		dense_cost.backward();
+		benchmark.run("sparse/linear/dense/" + shape, items, [&] { dense_linear.forward(); dense_linear.backward(); });
+	}
+
+	// Training steps of a categorical feature of a million values mapped to 16 dimensions followed by a Linear layer,
+	// as an Embedding and as a one-hot SparseLinear input, whose dense weight gradient costs O(vocabulary).
+	// Items are examples.
+	void embedding_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const examples = 256, vocabulary = 1000000, dimensions = 16;
+		std::string const shape = shape_name({ examples, vocabulary, dimensions });
+		std::uniform_int_distribution<miniflow::Index> category(0, vocabulary - 1);
+		Matrix indices(dynamictensor::Shape<2>{ examples, 1 });
+		std::vector<sparsetensor::Triplet<Scalar>> triplets;
+		for (miniflow::Index n = 0; n < examples; n++)
+		{
+			miniflow::Index const row = category(random_engine);
+			indices[n][0] = row;
+			triplets.push_back({ n, row, 1. });
+		}
+		Matrix table = random_matrix(vocabulary, dimensions, 0.1);
+		miniflow::Input<Matrix> Y(random_matrix(examples, 1));
+		{
+			miniflow::Input<Matrix> I(indices);
+			miniflow::EmbeddingTable<Matrix> E(table);
+			miniflow::Trainable<Matrix> W(random_matrix(dimensions, 1, 0.25)), b(random_matrix(1, 1));
+			miniflow::Embedding<Matrix> lookup(I, E);
+			miniflow::Linear<Matrix> L(lookup, W, b);
+			miniflow::MSE<Matrix> cost(Y, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("embedding/SGD_step/embedding/" + shape, examples, [&] { graph.SGD_step(0.01); });
+		}
+		{
+			miniflow::SparseInput<Matrix> X(sparsetensor::CsrMatrix<Scalar>::from_triplets(examples, vocabulary, triplets));
+			miniflow::Trainable<Matrix> E(table), b_E(Matrix(dynamictensor::Shape<2>{ 1, dimensions }));
+			miniflow::Trainable<Matrix> W(random_matrix(dimensions, 1, 0.25)), b(random_matrix(1, 1));
+			miniflow::SparseLinear<Matrix> lookup(X, E, b_E);
+			miniflow::Linear<Matrix> L(lookup, W, b);
+			miniflow::MSE<Matrix> cost(Y, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("embedding/SGD_step/one_hot/" + shape, examples, [&] { graph.SGD_step(0.01); });
+		}
+	}
+
+	// Training steps of a sequence model with an MSE cost on the last state: an RNN unrolled into
+	// a Linear and a Tanh node per step, and the RNN, GRU and LSTM nodes. Items are sequences.
+	void recurrent_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const steps = 32, examples = 16, features = 32, hidden = 64;
+		std::string const shape = shape_name({ steps, examples, features, hidden });
+		Matrix X = random_matrix(steps * examples, features);
+		miniflow::Input<Matrix> Y(random_matrix(examples, hidden, 0.5));
+		{
+			miniflow::Trainable<Matrix> W(random_matrix(features, hidden, 0.1)), U(random_matrix(hidden, hidden, 0.1)), b(random_matrix(1, hidden, 0.1));
+			miniflow::Nodes<Matrix> nodes;
+			miniflow::Node<Matrix>* state = nullptr;
+			for (miniflow::Index t = 0; t < steps; t++)
+			{
+				Matrix x(dynamictensor::Shape<2>{ examples, features });
+				for (miniflow::Index n = 0; n < examples; n++) x[n] = X[t * examples + n];
+				miniflow::Node<Matrix>* a = &nodes.add<miniflow::Linear<Matrix>>(nodes.add<miniflow::Input<Matrix>>(x), W, b);
+				if (state) a = &nodes.add<miniflow::Linear<Matrix>>(*state, U, *a);
+				state = &nodes.add<miniflow::Tanh<Matrix>>(*a);
+			}
+			miniflow::MSE<Matrix> cost(Y, *state);
+			miniflow::Graph graph(cost);
+			benchmark.run("recurrent/SGD_step/unrolled_rnn/" + shape, examples, [&] { graph.SGD_step(0.01); });
+		}
+		auto run = [&](std::string const& name, auto* cell)
+		{
+			using Cell = std::remove_pointer_t<decltype(cell)>;
+			miniflow::Index const width = Cell::gates * hidden;
+			miniflow::Input<Matrix> X_node(X);
+			miniflow::Trainable<Matrix> W(random_matrix(features, width, 0.1)), U(random_matrix(hidden, width, 0.1)), b(random_matrix(1, width, 0.1));
+			miniflow::Recurrent<Matrix, Cell> R(X_node, W, U, b, steps, { false });
+			miniflow::MSE<Matrix> cost(Y, R);
+			miniflow::Graph graph(cost);
+			benchmark.run("recurrent/SGD_step/" + name + "/" + shape, examples, [&] { graph.SGD_step(0.01); });
+		};
+		run("rnn", static_cast<miniflow::RNNCell*>(nullptr));
+		run("gru", static_cast<miniflow::GRUCell*>(nullptr));
+		run("lstm", static_cast<miniflow::LSTMCell*>(nullptr));
+	}
+
+	// Inference of a 784-512-512-10 Sigmoid network in double and with int8 QuantizedLinear layers,
+	// calibrated on four batches and evaluated on a fifth one.
+	void quantization_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const batch = 256;
+		std::vector<miniflow::Index> const widths = { 784, 512, 512, 10 };
+		std::string const shape = shape_name({ batch, 784, 512, 512, 10 });
+		std::string const double_name = "quantization/forward/double/" + shape;
+		std::string const int8_name = "quantization/forward/int8/" + shape;
+		std::string const accuracy_name = "quantization/accuracy/" + shape;
+		if (!benchmark.selected(double_name) && !benchmark.selected(int8_name) && !benchmark.selected(accuracy_name)) return;
+
+		auto input = [&] { return random_matrix(batch, widths.front(), 1.) + 1.; };
+
+		std::vector<std::unique_ptr<miniflow::NodeInterface>> nodes;
+		auto add = [&](auto node) -> auto& { nodes.push_back(std::move(node)); return static_cast<typename decltype(node)::element_type&>(*nodes.back()); };
+
+		auto& X = add(std::make_unique<miniflow::Input<Matrix>>(input()));
+		miniflow::Node<Matrix>* output = &X;
+		miniflow::Node<Matrix>* quantized_output = &X;
+		std::vector<miniflow::Linear<Matrix>*> linears;
+		std::vector<std::pair<miniflow::Node<Matrix>*, miniflow::Node<Matrix>*>> parameters;
+		std::size_t items = 0;
+		for (std::size_t i = 1; i < widths.size(); i++)
+		{
+			auto& W = add(std::make_unique<miniflow::Trainable<Matrix>>(random_matrix(widths[i - 1], widths[i], 4. / std::sqrt(Scalar(widths[i - 1])))));
+			auto& b = add(std::make_unique<miniflow::Trainable<Matrix>>(random_matrix(batch, widths[i], 0.1)));
+			linears.push_back(&add(std::make_unique<miniflow::Linear<Matrix>>(*output, W, b)));
+			output = &add(std::make_unique<miniflow::Sigmoid<Matrix>>(*linears.back()));
+			parameters.emplace_back(&W, &b);
+			items += batch * widths[i - 1] * widths[i];
+		}
+		miniflow::Graph graph(*output);
+
+		quantization::Calibration calibration;
+		for (int i = 0; i < 4; i++)
+		{
+			X.set_data(to_data(input()));
+			calibration.observe(graph);
+		}
+		for (std::size_t i = 0; i < linears.size(); i++)
+		{
+			auto& L = add(std::make_unique<miniflow::QuantizedLinear<Matrix>>(*quantized_output, *parameters[i].first, *parameters[i].second, calibration.range(*linears[i])));
+			quantized_output = &add(std::make_unique<miniflow::Sigmoid<Matrix>>(L));
+		}
+		miniflow::Graph quantized_graph(*quantized_output);
+
+		X.set_data(to_data(input()));
+		benchmark.run(double_name, items, [&] { graph.invalidate(); graph.forward(); });
+		benchmark.run(int8_name, items, [&] { quantized_graph.invalidate(); quantized_graph.forward(); });
+
+		// Accuracy of the int8 outputs against the double ones
+		graph.forward();
+		quantized_graph.forward();
+		Matrix const& expected = output->getValue();
+		Matrix const& actual = quantized_output->getValue();
+		Scalar max_error = 0;
+		miniflow::Index agreements = 0;
+		for (miniflow::Index i = 0; i < batch; i++)
+		{
+			auto const& e = expected.data_[i].data_;
+			auto const& a = actual.data_[i].data_;
+			for (std::size_t j = 0; j < e.size(); j++) max_error = std::max(max_error, std::abs(e[j] - a[j]));
+			agreements += std::max_element(e.begin(), e.end()) - e.begin() == std::max_element(a.begin(), a.end()) - a.begin();
+		}
+		std::ostringstream accuracy;
+		accuracy << quantization::kernel_name << " kernel, max abs error " << std::setprecision(3) << std::defaultfloat << max_error
+			<< ", top-1 agreement " << std::fixed << std::setprecision(1) << 100. * agreements / batch << "%";
+		benchmark.note(accuracy_name, accuracy.str());
+	}
+
+	// Half precision storage: conversions, products accumulated in float, and mixed precision SGD steps
+	// of a Linear layer against the same layer in double. Items are values converted or multiply-adds.
+	void half_precision_benchmarks(Benchmark& benchmark)
+	{
+		using halfprecision::bfloat16;
+		using halfprecision::float16;
+
+		miniflow::Index const count = 1 << 20;
+		std::vector<float> values(count);
+		for (miniflow::Index i = 0; i < count; i++) values[i] = std::sin(float(i));
+		std::vector<float16> halves(count);
+		std::vector<bfloat16> brains(count);
+		benchmark.run(std::string("half_precision/convert/float16/") + halfprecision::float16_kernel, count, [&] { halfprecision::convert(values.data(), halves.data(), count); keep(halves[count - 1]); });
+		benchmark.run(std::string("half_precision/convert/bfloat16/") + halfprecision::bfloat16_kernel, count, [&] { halfprecision::convert(values.data(), brains.data(), count); keep(brains[count - 1]); });
+
+		miniflow::Index const M = 256, K = 1024, N = 1024;
+		std::string const shape = shape_name({ M, K, N });
+		std::size_t const items = std::size_t(M) * K * N;
+		Matrix const A = random_matrix(M, K), B = random_matrix(K, N);
+
+		benchmark.run("half_precision/gemm/double/" + shape, items, [&] { keep(dot(A, B)); });
+		auto gemm = [&](auto half, std::string const& name)
+		{
+			using H = decltype(half);
+			auto const A_half = halfprecision::convert<H>(A), B_half = halfprecision::convert<H>(B);
+			benchmark.run("half_precision/gemm/" + name + "/" + shape, items, [&] { keep(halfprecision::dot(A_half, B_half)); });
+		};
+		gemm(bfloat16(), "bfloat16");
+		gemm(float16(), "float16");
+
+		// Forward, backward and update: three products per step
+		Matrix const Y = random_matrix(M, N);
+		{
+			miniflow::Input<Matrix> X(A), labels(Y);
+			miniflow::Trainable<Matrix> W(random_matrix(K, N, 1. / 32)), b(random_matrix(1, N, 0.1));
+			miniflow::Linear<Matrix> L(X, W, b);
+			miniflow::MSE<Matrix> cost(labels, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("half_precision/SGD_step/double/" + shape, 3 * items, [&] { graph.SGD_step(1e-3); });
+		}
+		auto step = [&](auto half, std::string const& name)
+		{
+			using H = decltype(half);
+			miniflow::Input<Matrix> X(A), labels(Y);
+			miniflow::MixedTrainable<Matrix, H> W(random_matrix(K, N, 1. / 32));
+			miniflow::Trainable<Matrix> b(random_matrix(1, N, 0.1));
+			halfprecision::LossScale loss_scale;
+			miniflow::HalfLinear<Matrix, H> L(X, W, b, std::is_same<H, float16>::value ? &loss_scale : nullptr);
+			miniflow::MSE<Matrix> cost(labels, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("half_precision/SGD_step/" + name + "/" + shape, 3 * items, [&] { miniflow::mixed_SGD_step(graph, 1e-3, loss_scale); });
+		};
+		step(bfloat16(), "bfloat16");
+		step(float16(), "float16");
+	}
+
+	// Forward pass of a 784-512-512-10 network with BatchNorm after the hidden Linear nodes and an Identity
+	// naming its output, as built for training, against the network folded for inference.
+	void fold_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const batch = 64;
+		std::vector<miniflow::Index> const widths = { 784, 512, 512, 10 };
+		std::string const shape = shape_name({ batch, 784, 512, 512, 10 });
+		std::string const original_name = "fold/forward/original/" + shape;
+		std::string const folded_name = "fold/forward/folded/" + shape;
+		if (!benchmark.selected(original_name) && !benchmark.selected(folded_name)) return;
+
+		miniflow::Nodes<Matrix> nodes;
+		auto& X = nodes.add<miniflow::Input<Matrix>>(random_matrix(batch, widths.front()));
+		miniflow::Node<Matrix>* output = &X;
+		std::vector<miniflow::BatchNorm<Matrix>*> batch_norms;
+		for (std::size_t i = 1; i < widths.size(); i++)
+		{
+			auto& W = nodes.add<miniflow::Trainable<Matrix>>(random_matrix(widths[i - 1], widths[i], 1. / std::sqrt(Scalar(widths[i - 1]))));
+			auto& b = nodes.add<miniflow::Trainable<Matrix>>(random_matrix(1, widths[i], 0.1));
+			output = &nodes.add<miniflow::Linear<Matrix>>(*output, W, b);
+			if (i + 1 == widths.size()) break;
+			auto& gamma = nodes.add<miniflow::Trainable<Matrix>>(random_matrix(1, widths[i], 0.1) + 1.);
+			auto& beta = nodes.add<miniflow::Trainable<Matrix>>(random_matrix(1, widths[i], 0.1));
+			batch_norms.push_back(&nodes.add<miniflow::BatchNorm<Matrix>>(*output, gamma, beta));
+			output = &nodes.add<miniflow::ReLU<Matrix>>(*batch_norms.back());
+		}
+		output = &nodes.add<miniflow::Identity<Matrix>>(*output);
+		miniflow::Graph graph(*output);
+		graph.forward();
+		for (auto* batch_norm : batch_norms) batch_norm->set_training(false);
+
+		miniflow::FoldedNetwork<Matrix> folded(*output, { &X });
+		miniflow::Graph& folded_graph = folded.graph();
+		benchmark.run(original_name, batch, [&] { graph.invalidate(); graph.forward(); });
+		benchmark.run(folded_name, batch, [&] { folded_graph.invalidate(); folded_graph.forward(); });
+
+		std::ostringstream note;
+		note << folded.report().nodes_before_ << " nodes folded into " << folded.report().nodes_after_
+			<< ", max abs difference " << std::setprecision(3) << folded.validate();
+		benchmark.note(folded_name, note.str());
+	}
+
+	// Forward passes and SGD steps of a Linear layer against the BlockSparseLinear node of its W pruned to
+	// 32 x 32 blocks at several sparsities. Items are the multiply-adds of the dense layer, three products per step.
+	void pruning_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const M = 256, K = 1024, N = 1024;
+		std::string const shape = shape_name({ M, K, N });
+		std::size_t const items = std::size_t(M) * K * N;
+		Matrix const A = random_matrix(M, K), Y = random_matrix(M, N), W0 = random_matrix(K, N, 1. / 32), b0 = random_matrix(1, N, 0.1);
+
+		{
+			miniflow::Input<Matrix> X(A), labels(Y);
+			miniflow::Trainable<Matrix> W(W0), b(b0);
+			miniflow::Linear<Matrix> L(X, W, b);
+			miniflow::MSE<Matrix> cost(labels, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("pruning/forward/dense/" + shape, items, [&] { L.forward(); keep(L.getValue().data_[0].data_[0]); });
+			benchmark.run("pruning/SGD_step/dense/" + shape, 3 * items, [&] { graph.SGD_step(1e-3); });
+		}
+		for (int percent : { 50, 75, 90 })
+		{
+			std::string const sparsity = "sparse_" + std::to_string(percent) + "/";
+			miniflow::Input<Matrix> X(A), labels(Y);
+			miniflow::Trainable<Matrix> W(W0), b(b0);
+			miniflow::BlockMask const mask = miniflow::prune(W, { 32, 32, percent / 100. });
+			miniflow::BlockSparseLinear<Matrix> L(X, W, b, mask);
+			miniflow::MSE<Matrix> cost(labels, L);
+			miniflow::Graph graph(cost);
+			benchmark.run("pruning/forward/" + sparsity + shape, items, [&] { L.forward(); keep(L.getValue().data_[0].data_[0]); });
+			benchmark.run("pruning/SGD_step/" + sparsity + shape, 3 * items, [&] { graph.SGD_step(1e-3); });
+		}
+	}
+
+	// SGD steps of a 784-512-512-512-10 Sigmoid network on a Graph against a Pipeline of 4 stages, with the bubble
+	// measured and that of equal stages. Items are examples.
+	void pipeline_benchmarks(Benchmark& benchmark)
+	{
+		miniflow::Index const batch = 256;
+		std::vector<miniflow::Index> const widths = { 784, 512, 512, 512, 10 };
+		std::string const shape = shape_name({ batch, 784, 512, 512, 512, 10 });
+		std::string const graph_name = "pipeline/SGD_step/graph/" + shape;
+		Matrix const X = random_matrix(batch, widths.front()), Y = random_matrix(batch, widths.back());
+
+		// Every network has its own trainables, the pipeline must be their only reader
+		auto parameters = [&]
+		{
+			std::vector<std::unique_ptr<miniflow::Trainable<Matrix>>> trainables;
+			for (std::size_t i = 1; i < widths.size(); i++)
+			{
+				trainables.push_back(std::make_unique<miniflow::Trainable<Matrix>>(random_matrix(widths[i - 1], widths[i], 1. / std::sqrt(Scalar(widths[i - 1])))));
+				trainables.push_back(std::make_unique<miniflow::Trainable<Matrix>>(random_matrix(1, widths[i], 0.1)));
+			}
+			return trainables;
+		};
+		auto network = [&](miniflow::Node<Matrix>& input, miniflow::Node<Matrix>& labels, miniflow::Nodes<Matrix>& nodes,
+			std::vector<std::unique_ptr<miniflow::Trainable<Matrix>>> const& trainables) -> miniflow::Node<Matrix>&
+		{
+			miniflow::Node<Matrix>* output = &input;
+			for (std::size_t i = 0; i < trainables.size(); i += 2)
+			{
+				output = &nodes.add<miniflow::Linear<Matrix>>(*output, *trainables[i], *trainables[i + 1]);
+				if (i + 2 < trainables.size()) output = &nodes.add<miniflow::Sigmoid<Matrix>>(*output);
+			}
+			return nodes.add<miniflow::MSE<Matrix>>(labels, *output);
+		};
+
+		if (benchmark.selected(graph_name))
+		{
+			auto trainables = parameters();
+			miniflow::Nodes<Matrix> nodes;
+			auto& input = nodes.add<miniflow::Input<Matrix>>(X);
+			auto& labels = nodes.add<miniflow::Input<Matrix>>(Y);
+			miniflow::Graph graph(network(input, labels, nodes, trainables));
+			benchmark.run(graph_name, batch, [&] { graph.SGD_step(1e-3); });
+		}
+
+		for (std::size_t micro_batches : { 4, 16 })
+		{
+			std::string const name = "pipeline/SGD_step/stages_4_micro_batches_" + std::to_string(micro_batches) + "/" + shape;
+			if (!benchmark.selected(name)) continue;
+
+			auto trainables = parameters();
+			miniflow::PipelineOptions options;
+			options.stages_ = 4;
+			options.micro_batches_ = micro_batches;
+			options.pin_threads_ = true;
+			miniflow::Pipeline<Matrix> pipeline([&](miniflow::Node<Matrix>& input, miniflow::Node<Matrix>& labels, miniflow::Nodes<Matrix>& nodes)
+				-> miniflow::Node<Matrix>& { return network(input, labels, nodes, trainables); }, options);
+			pipeline.step(X, Y, 1e-3);
+			pipeline.reset_report();
+			benchmark.run(name, batch, [&] { keep(pipeline.step(X, Y, 1e-3)); });
+
+			std::ostringstream note;
+			note << "bubble " << std::fixed << std::setprecision(1) << 100 * pipeline.report().bubble() << "%, "
+				<< 100 * miniflow::gpipe_bubble(options.stages_, micro_batches) << "% for equal stages, " << std::thread::hardware_concurrency() << " hardware threads";
+			benchmark.note(name, note.str());
+		}
+	}
+
+	// Closed loop load generator: client threads send single example requests to a Predictor of a 784-256-10
+	// network and wait for every answer. Items are requests; latencies are reported for the last run.
+	void predictor_benchmarks(Benchmark& benchmark)
+	{
+		using Predictor = miniflow::Predictor<Matrix>;
+		miniflow::Trainable<Matrix> W1(random_matrix(784, 256, 1. / 28)), b1(random_matrix(1, 256, 0.1));
+		miniflow::Trainable<Matrix> W2(random_matrix(256, 10, 1. / 16)), b2(random_matrix(1, 10, 0.1));
+		Predictor::Builder build = [&](miniflow::Node<Matrix>& input, Predictor::Nodes& nodes) -> miniflow::Node<Matrix>&
+		{
+			auto& L1 = nodes.add<miniflow::Linear<Matrix>>(input, W1, b1);
+			auto& S1 = nodes.add<miniflow::Sigmoid<Matrix>>(L1);
+			return nodes.add<miniflow::Linear<Matrix>>(S1, W2, b2);
+		};
+
+		std::size_t const clients = 16, requests = 64;
+		std::vector<Matrix> examples;
+		for (std::size_t i = 0; i < clients; i++) examples.push_back(random_matrix(1, 784));
+
+		for (miniflow::Index max_batch : { 1, 32 })
+		{
+			std::string name = "predictor/784x256x10/max_batch_" + std::to_string(max_batch);
+			if (!benchmark.selected(name)) continue;
+
+			miniflow::PredictorOptions options;
+			options.workers_ = std::max(1u, std::thread::hardware_concurrency());
+			options.max_batch_ = max_batch;
+			options.max_latency_ = std::chrono::microseconds(2000);
+			Predictor predictor(build, 784, options);
+
+			std::vector<double> latencies(clients * requests);
+			double elapsed = 0;
+			benchmark.run(name, clients * requests, [&]
+			{
+				auto start = std::chrono::steady_clock::now();
+				std::vector<std::thread> threads;
+				for (std::size_t c = 0; c < clients; c++)
+				{
+					threads.emplace_back([&, c]
+					{
+						for (std::size_t r = 0; r < requests; r++)
+						{
+							auto sent = std::chrono::steady_clock::now();
+							keep(predictor.predict(examples[c]).get());
+							latencies[c * requests + r] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count();
+						}
+					});
+				}
+				for (std::thread& thread : threads) thread.join();
+				elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			});
+
+			std::sort(latencies.begin(), latencies.end());
+			std::ostringstream report;
+			report << std::fixed << std::setprecision(1) << "p50 " << latencies[latencies.size() / 2] << " us, p99 "
+				<< latencies[latencies.size() * 99 / 100] << " us, " << std::setprecision(0) << latencies.size() / elapsed << " requests/s";
+			benchmark.note(name, report.str());
+		}
+	}
+
+#ifdef MINIFLOW_GENERATED_NETWORK
+	// Forward pass of the network of GenerateNetwork.cpp through a Graph and through its generated code.
+	void codegen_benchmarks(Benchmark& benchmark)
+	{
+		namespace generated = generated_network;
+		auto matrix = [](auto const& values)
+		{
+			Matrix m(dynamictensor::Shape<2>{ miniflow::Index(std::size(values)), miniflow::Index(std::size(values[0])) });
+			for (std::size_t i = 0; i < std::size(values); i++) m[i].data_.assign(std::begin(values[i]), std::end(values[i]));
+			return m;
+		};
+
+		double input[1][64];
+		std::uniform_real_distribution<Scalar> distribution(-1, 1);
+		for (double& x : input[0]) x = distribution(random_engine);
+
+		miniflow::Input<Matrix> X(matrix(input));
+		miniflow::Trainable<Matrix> W1(matrix(generated::w_W1)), b1(matrix(generated::w_b1)), W2(matrix(generated::w_W2)), b2(matrix(generated::w_b2));
+		miniflow::Linear<Matrix> L1(X, W1, b1);
+		miniflow::ReLU<Matrix> R1(L1);
+		miniflow::Linear<Matrix> L2(R1, W2, b2);
+		miniflow::Sigmoid<Matrix> S2(L2);
+		miniflow::Graph graph(S2);
+
+		double output[generated::output_rows][generated::output_cols];
+		std::size_t items = 64 * 64 + 64 * 10;
+		benchmark.run("codegen/forward/graph/1x64x64x10", items, [&] { graph.invalidate(); graph.forward(); });
+		benchmark.run("codegen/forward/generated/1x64x64x10", items, [&] { generated::forward(input, output); keep(output); });
+
+		graph.forward();
+		generated::forward(input, output);
+		Scalar max_error = 0;
+		for (std::size_t j = 0; j < generated::output_cols; j++) max_error = std::max(max_error, std::abs(output[0][j] - S2.getValue()[0][j]));
+		std::ostringstream report;
+		report << "max abs difference " << std::setprecision(3) << max_error;
+		benchmark.note("codegen/accuracy/1x64x64x10", report.str());
+	}
+#endif
+
+	void graph_benchmarks(Benchmark& benchmark)
+	{
+		// The network of nn.cpp
+		{
+			using Tensor = miniflow::TensorScalar;
+			Network<Tensor> network(0.2, 0.5, { { 1., 0.3 } });
+			benchmark.run("graph/SGD_step/nn", 1, [&] { network.graph_->SGD_step(0.1); });
+		}
+		// The same network as a StaticGraph
+		{
+			namespace sg = miniflow::staticgraph;
+			using Tensor = miniflow::TensorScalar;
+			using X = sg::Input<Tensor, struct XTag>;
+			using Y = sg::Input<Tensor, struct YTag>;
+			using W = sg::Trainable<Tensor, struct WTag>;
+			using b = sg::Trainable<Tensor, struct bTag>;
+			miniflow::StaticGraph<sg::MSE<Y, sg::Sigmoid<sg::Linear<X, W, b>>>> network;
+			network.get<X>().setValue(0.2);
+			network.get<Y>().setValue(0.5);
+			network.get<W>().setValue(1.);
+			network.get<b>().setValue(0.3);
+			benchmark.run("graph/SGD_step/nn/static", 1, [&] { network.SGD_step(0.1); keep(network.get<W>().getValue()); });
+		}
+		// A small per-entity model, 8 x 4-8-1, as a Graph on DynamicTensor and as a StaticGraph on StaticTensor
+		{
+			Matrix X = random_matrix(8, 4), Y = random_matrix(8, 1), W1 = random_matrix(4, 8, 0.5), W2 = random_matrix(8, 1, 0.35);
+			Matrix b1(dynamictensor::Shape<2>{ 8, 8 }), b2(dynamictensor::Shape<2>{ 8, 1 });
+			Network<Matrix> network(X, Y, { { W1, b1 }, { W2, b2 } });
+			benchmark.run("graph/SGD_step/small/8x4-8-1", 8, [&] { network.graph_->SGD_step(0.1); });
+
+			namespace sg = miniflow::staticgraph;
+			using XNode = sg::Input<statictensor::Tensor<Scalar, 8, 4>, struct XTag>;
+			using YNode = sg::Input<statictensor::Tensor<Scalar, 8, 1>, struct YTag>;
+			using W1Node = sg::Trainable<statictensor::Tensor<Scalar, 4, 8>, struct W1Tag>;
+			using b1Node = sg::Trainable<statictensor::Tensor<Scalar, 8, 8>, struct b1Tag>;
+			using W2Node = sg::Trainable<statictensor::Tensor<Scalar, 8, 1>, struct W2Tag>;
+			using b2Node = sg::Trainable<statictensor::Tensor<Scalar, 8, 1>, struct b2Tag>;
+			miniflow::StaticGraph<sg::MSE<YNode, sg::Sigmoid<sg::Linear<sg::Sigmoid<sg::Linear<XNode, W1Node, b1Node>>, W2Node, b2Node>>>> static_network;
+			auto set = [](auto& node, Matrix const& m)
+			{
+				auto value = node.getValue();
+				for (unsigned i = 0; i < m.shape_[0]; i++) for (unsigned j = 0; j < m.shape_[1]; j++) value[i][j] = m[i][j];
+				node.setValue(value);
+			};
+			set(static_network.get<XNode>(), X);
+			set(static_network.get<YNode>(), Y);
+			set(static_network.get<W1Node>(), W1);
+			set(static_network.get<b1Node>(), b1);
+			set(static_network.get<W2Node>(), W2);
+			set(static_network.get<b2Node>(), b2);
+			benchmark.run("graph/SGD_step/small/8x4-8-1/static", 8, [&] { static_network.SGD_step(0.1); keep(static_network.get<W2Node>().getValue()); });
+		}
+		// A sweep of 256 models of nn.cpp with their own inputs and learning rates, 100 SGD steps each:
+		// one scalar Graph after another, and in the lanes of a Sweep.
+		{
+			std::size_t const models = 256;
+			int const repeats = 100;
+			auto input = [](std::size_t model) { return 0.1 + 0.001 * Scalar(model); };
+			auto learning_rate = [](std::size_t model) { return 0.05 + 0.001 * Scalar(model % 100); };
+
+			benchmark.run("graph/sweep/nn/256x100/serial", models * repeats, [&]
+			{
+				using Tensor = miniflow::TensorScalar;
+				for (std::size_t model = 0; model < models; model++)
+				{
+					Network<Tensor> network(input(model), 0.5, { { 1., 0.3 } });
+					network.graph_->SGD(learning_rate(model), repeats);
+				}
+			});
+
+			constexpr std::size_t lanes = 8;
+			using Tensor = miniflow::TensorLanes<lanes>;
+			miniflow::Sweep<lanes>::Builder build = [&](std::size_t first, miniflow::Nodes<Tensor>& nodes) -> miniflow::Node<Tensor>&
+			{
+				Tensor X;
+				for (std::size_t lane = 0; lane < lanes; lane++) X[int(lane)] = input(first + lane);
+				auto& L = nodes.add<miniflow::Linear<Tensor>>(nodes.add<miniflow::Input<Tensor>>(X), nodes.add<miniflow::Trainable<Tensor>>(1.), nodes.add<miniflow::Trainable<Tensor>>(0.3));
+				return nodes.add<miniflow::MSE<Tensor>>(nodes.add<miniflow::Input<Tensor>>(0.5), nodes.add<miniflow::Sigmoid<Tensor>>(L));
+			};
+			benchmark.run("graph/sweep/nn/256x100/lanes8", models * repeats, [&]
+			{
+				miniflow::Sweep<lanes> sweep(models, build, learning_rate);
+				sweep.train(repeats);
+				keep(sweep.costs());
+			});
+		}
+		// What-if analysis: single feature perturbations of a network whose context branch is constant.
+		// The 1x1024-1024-10 context branch computes the bias of the layer on the 1x16 features.
+		{
+			Matrix features = random_matrix(1, 16);
+			miniflow::Input<Matrix> X(features), context(random_matrix(1, 1024));
+			miniflow::Trainable<Matrix> W1(random_matrix(1024, 1024, 1. / 32)), b1(random_matrix(1, 1024, 0.1));
+			miniflow::Trainable<Matrix> W2(random_matrix(1024, 10, 1. / 32)), b2(random_matrix(1, 10, 0.1));
+			miniflow::Trainable<Matrix> W(random_matrix(16, 10, 0.25));
+			miniflow::Linear<Matrix> L1(context, W1, b1);
+			miniflow::Sigmoid<Matrix> S1(L1);
+			miniflow::Linear<Matrix> L2(S1, W2, b2);
+			miniflow::Linear<Matrix> L(X, W, L2);
+			miniflow::Sigmoid<Matrix> S(L);
+			miniflow::Graph graph(S);
+
+			std::size_t feature = 0;
+			auto perturb = [&]
+			{
+				Matrix perturbed = features;
+				perturbed[0][feature] += 0.1;
+				feature = (feature + 1) % 16;
+				X.setValue(perturbed);
+			};
+			benchmark.run("graph/forward/what_if/full", 1, [&] { perturb(); graph.invalidate(); graph.forward(); keep(S.getValue()); });
+			benchmark.run("graph/forward/what_if/incremental", 1, [&] { perturb(); graph.forward(); keep(S.getValue()); });
+		}
+		// A 64-wide embedding as a second output of a network with a wide head, evaluated alone and with the whole graph
+		{
+			miniflow::Input<Matrix> X(random_matrix(64, 256)), Y(random_matrix(64, 2048));
+			miniflow::Trainable<Matrix> W1(random_matrix(256, 64, 1. / 16)), b1(random_matrix(1, 64, 0.1));
+			miniflow::Trainable<Matrix> W2(random_matrix(64, 2048, 1. / 8)), b2(random_matrix(1, 2048, 0.1));
+			miniflow::Linear<Matrix> L1(X, W1, b1);
+			miniflow::Sigmoid<Matrix> embedding(L1);
+			miniflow::Linear<Matrix> L2(embedding, W2, b2);
+			miniflow::Sigmoid<Matrix> S2(L2);
+			miniflow::MSE<Matrix> cost(Y, S2);
+			miniflow::Graph graph({ &cost, &embedding });
+			benchmark.run("graph/evaluate/all/64x256-64-2048", 64, [&] { graph.invalidate(); graph.forward(); });
+			benchmark.run("graph/evaluate/embedding/64x256-64-2048", 64, [&] { graph.invalidate(); graph.evaluate({ &embedding }); });
+		}
+		// A shared trunk read by eight heads, each with its own cost: the gradients of the trunk have a fan-out of eight
+		{
+			miniflow::Input<Matrix> X(random_matrix(64, 256)), Y(random_matrix(64, 32));
+			miniflow::Trainable<Matrix> W(random_matrix(256, 256, 1. / 16)), b(random_matrix(1, 256, 0.1));
+			miniflow::Linear<Matrix> trunk(X, W, b);
+			miniflow::Nodes<Matrix> heads;
+			std::vector<miniflow::NodeInterface*> costs;
+			for (int i = 0; i < 8; i++)
+			{
+				auto& W_head = heads.add<miniflow::Trainable<Matrix>>(random_matrix(256, 32, 1. / 16));
+				auto& b_head = heads.add<miniflow::Trainable<Matrix>>(random_matrix(1, 32, 0.1));
+				auto& head = heads.add<miniflow::Linear<Matrix>>(trunk, W_head, b_head);
+				costs.push_back(&heads.add<miniflow::MSE<Matrix>>(Y, head));
+			}
+			miniflow::Graph graph(costs);
+			graph.forward();
+			benchmark.run("graph/backward/fan_out/64x256-256-8x32", 64, [&] { graph.backward(); });
+		}
+		// Deep networks
+		{
+			using Tensor = miniflow::TensorScalar;
+			Network<Tensor> network(0.2, 0.5, std::vector<std::pair<Tensor, Tensor>>(32, { 1., 0.1 }));
+			benchmark.run("graph/SGD_step/deep_scalar/32", 1, [&] { network.graph_->SGD_step(0.1); });
+		}
+		{
+			Network<Matrix> network = matrix_network(32, std::vector<miniflow::Index>(9, 32));
+			benchmark.run("graph/SGD_step/deep/32x8x32", 32, [&] { network.graph_->SGD_step(0.1); });
+		}
+		// Wide networks
+		{
+			Network<Matrix> network = matrix_network(64, { 256, 1024, 10 });
+			benchmark.run("graph/SGD_step/wide/64x256-1024-10", 64, [&] { network.graph_->SGD_step(0.1); });
+		}
+		{
+			Network<Matrix> network = matrix_network(16, { 784, 128, 10 });
+			benchmark.run("graph/SGD_step/wide/16x784-128-10", 16, [&] { network.graph_->SGD_step(0.1); });
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string filter, out_path, compare_path, gemm_profile_path;
+	double min_time = 0.5;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string option = argv[i];
+		if (option == "--filter") filter = argv[i + 1];
+		else if (option == "--min-time") min_time = std::stod(argv[i + 1]);
+		else if (option == "--out") out_path = argv[i + 1];
+		else if (option == "--compare") compare_path = argv[i + 1];
+		else if (option == "--gemm-profile") gemm_profile_path = argv[i + 1];
+		else
+		{
+			std::cerr << "Unknown option " << option << "\n";
+			return 1;
+		}
+	}
+
+	if (!gemm_profile_path.empty() && !miniflow::load_gemm_profile(gemm_profile_path))
+	{
+		std::cerr << "No profile of this machine in " << gemm_profile_path << ", using the heuristic matrix product blocking\n";
+	}
+
+	Benchmark benchmark(filter, min_time);
+	elementwise_benchmarks(benchmark);
+	transpose_benchmarks(benchmark);
+	dot_benchmarks(benchmark);
+	autotune_benchmarks(benchmark);
+	reduction_benchmarks(benchmark);
+	tensor_type_benchmarks(benchmark);
+	convolution_benchmarks(benchmark);
+	activation_benchmarks(benchmark);
+	cost_benchmarks(benchmark);
+	sparse_benchmarks(benchmark);
+	embedding_benchmarks(benchmark);
+	recurrent_benchmarks(benchmark);
+	quantization_benchmarks(benchmark);
+	half_precision_benchmarks(benchmark);
+	fold_benchmarks(benchmark);
+	pruning_benchmarks(benchmark);
+	pipeline_benchmarks(benchmark);
+	predictor_benchmarks(benchmark);
+#ifdef MINIFLOW_GENERATED_NETWORK
+	codegen_benchmarks(benchmark);
+#endif
+	graph_benchmarks(benchmark);
+
+	if (out_path.empty())
+	{
+		benchmark.write_json(std::cout);
+	}
+	else
+	{
+		std::ofstream file(out_path);
+		benchmark.write_json(file);
+	}
+	if (!compare_path.empty()) compare(benchmark.results(), read_json(compare_path));
+
+	return 0;
+}
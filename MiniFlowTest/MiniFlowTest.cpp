@@ -5,10 +5,66 @@
 #include "../MiniFlow/DynamicTensor.h"
 #include "../MiniFlow/StaticTensor.h"
 #include "../MiniFlow/Graph.h"
+#include "../MiniFlow/Checkpoint.h"
+#include "../MiniFlow/Convolution.h"
+#include "../MiniFlow/Softmax.h"
+#include "../MiniFlow/Sparse.h"
+#include "../MiniFlow/Quantization.h"
+#include "../MiniFlow/Predictor.h"
+#include "../MiniFlow/Codegen.h"
+#include "../MiniFlow/StaticGraph.h"
+#include "../MiniFlow/Sweep.h"
+#include "../MiniFlow/Recurrent.h"
+#include "../MiniFlow/Embedding.h"
+#include "../MiniFlow/Autotune.h"
+#include "../MiniFlow/Memory.h"
+#include "../MiniFlow/HalfPrecision.h"
+#include "../MiniFlow/Normalization.h"
+#include "../MiniFlow/Fold.h"
+#include "../MiniFlow/Pruning.h"
+#include "../MiniFlow/Pipeline.h"
+#include <sstream>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 constexpr double eps = 1e-10;
 
+// A matrix of smooth values in [-1, 1] that differ for every seed
+static dynamictensor::Tensor<double, 2> matrix(miniflow::Index rows, miniflow::Index cols, double seed)
+{
+	dynamictensor::Tensor<double, 2> m(dynamictensor::Shape<2>{ rows, cols });
+	for (miniflow::Index i = 0; i < rows; i++)
+	{
+		for (miniflow::Index j = 0; j < cols; j++) m[i][j] = std::sin(seed + 1.3 * i + 0.7 * j);
+	}
+	return m;
+}
+
+// Compares the gradient of the cost with respect to an input node with central differences
+static void check_gradient(miniflow::Graph& graph, miniflow::Node<dynamictensor::Tensor<double, 2>> const& cost, miniflow::Input<dynamictensor::Tensor<double, 2>>& input)
+{
+	dynamictensor::Tensor<double, 2> const gradient = input.getGradient()[0];
+	dynamictensor::Tensor<double, 2> value = input.getValue();
+	double const h = 1e-6;
+	for (miniflow::Index i = 0; i < value.shape()[0]; i++)
+	{
+		for (miniflow::Index j = 0; j < value.shape()[1]; j++)
+		{
+			double const x = value[i][j];
+			value[i][j] = x + h;
+			input.setValue(value);
+			graph.forward();
+			double const plus = cost.getValue()[0][0];
+			value[i][j] = x - h;
+			input.setValue(value);
+			graph.forward();
+			double const minus = cost.getValue()[0][0];
+			value[i][j] = x;
+			Assert::AreEqual(gradient[i][j], (plus - minus) / (2 * h), 1e-7);
+		}
+	}
+	input.setValue(value);
+}
+
 TEST_CLASS(TensorNodeTest)
 {
 	template<class T, unsigned rank>
@@ -117,6 +173,45 @@ public:
 		Assert::AreEqual(X.getGradient()[0].value_, 0.235, 1e-3);
 	}
 
+	TEST_METHOD(ActivationNodeTest)
+	{
+		miniflow::Input<Tensor> X(-0.5);
+		miniflow::ReLU<Tensor> R(X);
+		miniflow::LeakyReLU<Tensor> LR(X, false, { 0.1 });
+		miniflow::Tanh<Tensor> T(X);
+		miniflow::GELU<Tensor> G(X);
+		miniflow::DebugNode DR(R), DLR(LR), DT(T), DG(G);
+
+		for (miniflow::NodeInterface* node : std::vector<miniflow::NodeInterface*>{ &R, &LR, &T, &G })
+		{
+			node->forward();
+			node->backward();
+		}
+
+		Assert::AreEqual(R.getValue().value_, 0.);
+		Assert::AreEqual(R.getGradient()[0].value_, 0.);
+		Assert::AreEqual(LR.getValue().value_, -0.05, eps);
+		Assert::AreEqual(LR.getGradient()[0].value_, 0.1, eps);
+		Assert::AreEqual(T.getValue().value_, -0.4621, 1e-4);
+		Assert::AreEqual(T.getGradient()[0].value_, 0.7864, 1e-4);
+		Assert::AreEqual(G.getValue().value_, -0.1543, 1e-4);
+		Assert::AreEqual(G.getGradient()[0].value_, 0.1326, 1e-4);
+	}
+
+	TEST_METHOD(InPlaceActivationTest)
+	{
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b(0.3);
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Sigmoid<Tensor> S(L, true);
+		miniflow::MSE<Tensor> cost(Y, S);
+
+		miniflow::Graph neural_network(cost);
+		neural_network.SGD(1., 100);
+
+		Assert::AreEqual(cost.getValue().value_, 0., 1e-10);
+	}
+
 	TEST_METHOD(MSENodeTest)
 	{
 		miniflow::Input<Tensor> X(0.6224), Y(0.5);
@@ -154,6 +249,120 @@ public:
 		Assert::AreEqual(cost.getValue().value_, 0., 1e-10);
 	}
 
+	TEST_METHOD(IncrementalForwardTest)
+	{
+		// The bias of L is computed from the constant input C only
+		miniflow::Input<Tensor> X(0.2), C(0.5);
+		miniflow::Trainable<Tensor> W(2), W1(3), b1(0.1);
+		miniflow::Linear<Tensor> L1(C, W1, b1);
+		miniflow::Linear<Tensor> L(X, W, L1);
+		miniflow::Sigmoid<Tensor> S(L);
+
+		miniflow::Graph graph(S);
+		graph.forward();
+		Assert::IsFalse(L1.is_stale());
+
+		// A new value of X recomputes L and S only
+		miniflow::Profiler profiler;
+		graph.set_profiler(&profiler);
+		X.setValue(0.4);
+		Assert::IsTrue(L.is_stale() && S.is_stale() && !L1.is_stale());
+		graph.forward();
+		Assert::AreEqual(profiler.events().size(), size_t(2));
+		Assert::AreEqual(S.getValue().value_, 1 / (1 + std::exp(-(0.4 * 2 + 0.5 * 3 + 0.1))), 1e-10);
+
+		// Nothing changed
+		graph.forward();
+		Assert::AreEqual(profiler.events().size(), size_t(2));
+
+		// Training W1 makes the whole chain stale
+		W1.update(-1.);
+		graph.forward();
+		Assert::AreEqual(profiler.events().size(), size_t(5));
+	}
+
+	TEST_METHOD(EvaluateTest)
+	{
+		// The hidden layer S1 is a second output of the graph
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W1(1), b1(0.3), W2(2), b2(0.1);
+		miniflow::Linear<Tensor> L1(X, W1, b1);
+		miniflow::Sigmoid<Tensor> S1(L1);
+		miniflow::Linear<Tensor> L2(S1, W2, b2);
+		miniflow::Sigmoid<Tensor> S2(L2);
+		miniflow::MSE<Tensor> cost(Y, S2);
+
+		miniflow::Graph graph({ &cost, &S1 });
+		miniflow::Profiler profiler;
+		graph.set_profiler(&profiler);
+
+		// Only the ancestors of the targets run
+		graph.evaluate({ &S1 });
+		Assert::AreEqual(profiler.events().size(), size_t(2));
+		Assert::AreEqual(S1.getValue().value_, 1 / (1 + std::exp(-0.5)), 1e-10);
+		Assert::IsTrue(L2.is_stale());
+
+		// The prediction without the cost, then the rest of the graph
+		graph.evaluate({ &S2 });
+		Assert::AreEqual(profiler.events().size(), size_t(4));
+		graph.forward();
+		Assert::AreEqual(profiler.events().size(), size_t(5));
+	}
+
+	TEST_METHOD(SharedTrainableTest)
+	{
+		// W is used by both layers, it is listed and updated once
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b1(0.3), b2(0.1);
+		miniflow::Linear<Tensor> L1(X, W, b1);
+		miniflow::Sigmoid<Tensor> S1(L1);
+		miniflow::Linear<Tensor> L2(S1, W, b2);
+		miniflow::Sigmoid<Tensor> S2(L2);
+		miniflow::MSE<Tensor> cost(Y, S2);
+
+		miniflow::Graph graph(cost);
+		Assert::AreEqual(graph.nodes().size(), size_t(10));
+		Assert::AreEqual(graph.trainables().size(), size_t(3));
+
+		graph.forward();
+		graph.backward();
+		double gradient = W.getGradient()[0].value_;
+		graph.update(0.1);
+		Assert::AreEqual(W.getValue().value_, 1 - 0.1 * gradient, 1e-12);
+	}
+
+	TEST_METHOD(FanOutGradientTest)
+	{
+		// L feeds five heads, each with its own cost
+		miniflow::Input<Tensor> X(0.5), Y(1);
+		miniflow::Trainable<Tensor> W(2), b(0.1), c(0);
+		miniflow::Nodes<Tensor> nodes;
+		std::vector<double> weights{ 3, -1, 0.5, 2, -0.25 };
+		miniflow::Linear<Tensor> L(X, W, b);
+		std::vector<miniflow::NodeInterface*> costs;
+		for (double weight : weights)
+		{
+			auto& head = nodes.add<miniflow::Linear<Tensor>>(L, nodes.add<miniflow::Trainable<Tensor>>(weight), c);
+			costs.push_back(&nodes.add<miniflow::MSE<Tensor>>(Y, head));
+		}
+
+		miniflow::Graph graph(costs);
+		graph.forward();
+		graph.backward();
+
+		// Partial of the costs with respect to L, summed over the heads
+		double grad_L = 0;
+		for (double weight : weights) grad_L += -2 * (1 - weight * 1.1) * weight;
+		Assert::AreEqual(L.getGradient()[1].value_, 0.5 * grad_L, eps);
+		Assert::AreEqual(W.getGradient()[0].value_, 0.5 * grad_L, eps);
+		Assert::AreEqual(b.getGradient()[0].value_, grad_L, eps);
+
+		// The sum is reproducible
+		double gradient = W.getGradient()[0].value_;
+		graph.backward();
+		Assert::AreEqual(W.getGradient()[0].value_, gradient);
+	}
+
 	TEST_METHOD(DeepNetworkTest)
 	{
 		/*
@@ -245,6 +454,56 @@ public:
 		Assert::AreEqual(transposed[0][3][1], 7);
 	}
 
+	TEST_METHOD(TransposeKernelTest)
+	{
+		// Odd sizes leave partial tiles and blocks, 300 x 300 runs blocks in parallel
+		for (auto [rows, cols] : std::vector<std::pair<miniflow::Index, miniflow::Index>>{ { 37, 70 }, { 3, 2 }, { 300, 300 } })
+		{
+			dynamictensor::Tensor<double, 2> m({ rows, cols });
+			dynamictensor::Tensor<int, 2> n({ rows, cols });
+			for (miniflow::Index i = 0; i < rows; i++)
+			{
+				for (miniflow::Index j = 0; j < cols; j++)
+				{
+					m[i][j] = i * 1000. + j;
+					n[i][j] = int(i * 1000 + j);
+				}
+			}
+			dynamictensor::Tensor<double, 2> mt = transpose(m);
+			dynamictensor::Tensor<int, 2> nt = transpose(n);
+			Assert::IsTrue(mt.shape() == dynamictensor::Shape<2>{ cols, rows });
+			bool equal = true;
+			for (miniflow::Index i = 0; i < rows; i++)
+			{
+				for (miniflow::Index j = 0; j < cols; j++) equal = equal && mt[j][i] == m[i][j] && nt[j][i] == n[i][j];
+			}
+			Assert::IsTrue(equal);
+		}
+	}
+
+	TEST_METHOD(PermuteTest)
+	{
+		dynamictensor::Tensor<int, 3> t({ 2, 3, 4 });
+		for (miniflow::Index i = 0; i < 2; i++)
+			for (miniflow::Index j = 0; j < 3; j++)
+				for (miniflow::Index k = 0; k < 4; k++) t[i][j][k] = int(i * 100 + j * 10 + k);
+
+		// Axis i of the result is axis axes[i] of the input
+		dynamictensor::Tensor<int, 3> p = transpose(t, { 2, 0, 1 });
+		Assert::IsTrue(p.shape() == dynamictensor::Shape<3>{ 4, 2, 3 });
+		dynamictensor::Tensor<int, 3> q = transpose(t, { 1, 0, 2 });
+		Assert::IsTrue(q.shape() == dynamictensor::Shape<3>{ 3, 2, 4 });
+		bool equal = true;
+		for (miniflow::Index i = 0; i < 2; i++)
+			for (miniflow::Index j = 0; j < 3; j++)
+				for (miniflow::Index k = 0; k < 4; k++) equal = equal && p[k][i][j] == t[i][j][k] && q[j][i][k] == t[i][j][k];
+		Assert::IsTrue(equal);
+
+		// The last two axes and the identity
+		Assert::AreEqual(transpose(t, { 0, 2, 1 })[1][3][2], 123);
+		Assert::AreEqual(transpose(t, { 0, 1, 2 })[1][2][3], 123);
+	}
+
 	TEST_METHOD(DotTest)
 	{
 		dynamictensor::Shape<1> shape1{ 2 };
@@ -271,6 +530,141 @@ public:
 		Assert::AreEqual(dot3[1][0], 16);
 		Assert::AreEqual(dot3[1][1], 13);
 	}
+
+	TEST_METHOD(DotDispatchTest)
+	{
+		using Matrix = dynamictensor::Tensor<int, 2>;
+		auto matrix = [](miniflow::Index rows, miniflow::Index cols, int seed)
+		{
+			Matrix m({ rows, cols });
+			for (miniflow::Index i = 0; i < rows; i++)
+				for (miniflow::Index j = 0; j < cols; j++) m[i][j] = int((i * 7 + j * 3 + seed) % 11) - 5;
+			return m;
+		};
+		auto expected = [](Matrix const& a, Matrix const& b)
+		{
+			Matrix c({ a.shape()[0], b.shape()[1] });
+			for (miniflow::Index i = 0; i < a.shape()[0]; i++)
+				for (miniflow::Index j = 0; j < b.shape()[1]; j++)
+					for (miniflow::Index k = 0; k < a.shape()[1]; k++) c[i][j] += a[i][k] * b[k][j];
+			return c;
+		};
+		auto same = [](auto const& a, auto const& b)
+		{
+			auto x = to_data(a), y = to_data(b);
+			return x.shape_ == y.shape_ && x.values_ == y.values_;
+		};
+
+		// Every kernel: dot product, GEMV, GEMV transposed, outer product and GEMM
+		std::vector<std::array<miniflow::Index, 3>> shapes = { { 1, 9, 1 }, { 6, 9, 1 }, { 1, 9, 6 }, { 6, 1, 5 }, { 6, 9, 5 } };
+		for (auto const& [m, k, n] : shapes)
+		{
+			Matrix a = matrix(m, k, 1), b = matrix(k, n, 2);
+			Assert::IsTrue(same(dot(a, b), expected(a, b)));
+			Assert::IsTrue(same(dot_nt(a, transpose(b)), expected(a, b)));
+			Assert::IsTrue(same(dot_tn(transpose(a), b), expected(a, b)));
+		}
+
+		// Vector by matrix
+		Matrix m = matrix(9, 6, 3);
+		Matrix row = matrix(1, 9, 4);
+		Assert::IsTrue(same(dot(row[0], m), expected(row, m)[0]));
+
+		// Batched matrix product of rank 3 tensors
+		dynamictensor::Tensor<int, 3> t1({ 3, 4, 5 }), t2({ 3, 5, 2 });
+		for (miniflow::Index i = 0; i < 3; i++)
+		{
+			t1[i] = matrix(4, 5, i);
+			t2[i] = matrix(5, 2, i + 5);
+		}
+		dynamictensor::Tensor<int, 3> t3 = dot(t1, t2);
+		for (miniflow::Index i = 0; i < 3; i++) Assert::IsTrue(same(t3[i], expected(t1[i], t2[i])));
+	}
+
+	TEST_METHOD(SideOutputGradientTest)
+	{
+		// E and S are outputs of the graph that the cost does not depend on, their partials are empty.
+		// The Linear node F under S receives only empty partials.
+		using Tensor = dynamictensor::Tensor<double, 2>;
+		auto network = [&](bool side_output)
+		{
+			miniflow::Input<Tensor> X(matrix(3, 4, 1)), Y(matrix(3, 2, 2));
+			miniflow::Trainable<Tensor> W1(matrix(4, 5, 3)), b1(matrix(1, 5, 4)), W2(matrix(5, 2, 5)), b2(matrix(1, 2, 6));
+			miniflow::Trainable<Tensor> W3(matrix(5, 3, 7)), b3(matrix(1, 3, 8));
+			miniflow::Linear<Tensor> L1(X, W1, b1);
+			miniflow::Nodes<Tensor> nodes;
+			std::vector<miniflow::NodeInterface*> outputs;
+			if (side_output)
+			{
+				outputs.push_back(&nodes.add<miniflow::Sigmoid<Tensor>>(L1));
+				outputs.push_back(&nodes.add<miniflow::Sigmoid<Tensor>>(nodes.add<miniflow::Linear<Tensor>>(L1, W3, b3)));
+			}
+			miniflow::Linear<Tensor> L2(L1, W2, b2);
+			miniflow::MSE<Tensor> cost(Y, L2);
+			outputs.push_back(&cost);
+			miniflow::Graph graph(outputs);
+			graph.forward();
+			graph.backward();
+			Assert::AreEqual(size(W3.getGradient()[0]), std::size_t(0));
+			return to_data(W1.getGradient()[0]);
+		};
+
+		auto gradient = network(true), expected = network(false);
+		Assert::IsTrue(gradient.shape_ == expected.shape_);
+		for (std::size_t i = 0; i < expected.values_.size(); i++) Assert::AreEqual(gradient.values_[i], expected.values_[i], 1e-12);
+	}
+
+	TEST_METHOD(SideHeadTrainingTest)
+	{
+		// E is a trainable side head the cost does not depend on, its weights get empty gradients and are kept
+		using Tensor = dynamictensor::Tensor<double, 2>;
+		auto network = [&](bool side_head)
+		{
+			miniflow::Input<Tensor> X(matrix(3, 4, 1)), Y(matrix(3, 2, 2));
+			miniflow::Trainable<Tensor> W1(matrix(4, 5, 3)), b1(matrix(1, 5, 4)), W2(matrix(5, 2, 5)), b2(matrix(1, 2, 6));
+			miniflow::Trainable<Tensor> W3(matrix(5, 3, 7)), b3(matrix(1, 3, 8));
+			miniflow::Linear<Tensor> L1(X, W1, b1);
+			miniflow::Nodes<Tensor> nodes;
+			std::vector<miniflow::NodeInterface*> outputs;
+			if (side_head) outputs.push_back(&nodes.add<miniflow::Linear<Tensor>>(L1, W3, b3));
+			miniflow::Linear<Tensor> L2(L1, W2, b2);
+			miniflow::MSE<Tensor> cost(Y, L2);
+			outputs.push_back(&cost);
+			miniflow::Graph graph(outputs);
+			graph.SGD(0.1, 3);
+			Assert::IsTrue(to_data(W3.getValue()).values_ == to_data(matrix(5, 3, 7)).values_);
+			return to_data(W1.getValue());
+		};
+
+		auto trained = network(true), expected = network(false);
+		for (std::size_t i = 0; i < expected.values_.size(); i++) Assert::AreEqual(trained.values_[i], expected.values_[i], 1e-12);
+	}
+
+	TEST_METHOD(InPlaceBufferTest)
+	{
+		// S takes over the value of L, L writes the next product into the buffer it gets back
+		using Tensor = dynamictensor::Tensor<double, 2>;
+		miniflow::Input<Tensor> X(matrix(3, 4, 1)), Y(matrix(3, 2, 2));
+		miniflow::Trainable<Tensor> W(matrix(4, 2, 3)), b(matrix(1, 2, 4));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Sigmoid<Tensor> S(L, true);
+		miniflow::MSE<Tensor> cost(Y, S);
+		miniflow::Graph graph(cost);
+
+		auto buffers = [&] { return std::set<double const*>{ L.getValue().data_[0].data_.data(), S.getValue().data_[0].data_.data() }; };
+		graph.SGD(0.1, 2);
+		auto const before = buffers();
+		graph.SGD(0.1, 3);
+		graph.forward();
+		Assert::IsTrue(buffers() == before);
+
+		Tensor const expected = dot(X.getValue(), W.getValue());
+		for (miniflow::Index j = 0; j < 2; j++)
+		{
+			double const z = expected[1][j] + b.getValue()[0][j];
+			Assert::AreEqual(S.getValue()[1][j], 1 / (1 + std::exp(-z)), 1e-12);
+		}
+	}
 };
 
 TEST_CLASS(StaticTensorTest)
@@ -301,4 +695,1582 @@ public:
 		Assert::AreEqual(shape[2], unsigned(4));
 	}
 
+	TEST_METHOD(MatrixTest)
+	{
+		statictensor::Tensor<double, 2, 3> t1 = { { 1, 2, 3 }, { 4, 5, 6 } };
+		statictensor::Tensor<double, 3, 2> t2 = { { 1, 0 }, { 0, 1 }, { 2, -1 } };
+		statictensor::Tensor<double, 1, 2> b = { { 0.5, -0.5 } };
+
+		auto result = dot(t1, t2);
+		add_bias(result, b);
+		Assert::AreEqual(result[1][0], 16.5, 1e-10);
+		Assert::AreEqual(result[1][1], -1.5, 1e-10);
+		Assert::AreEqual(transpose(t1)[2][1], 6., 1e-10);
+		Assert::AreEqual(sum_all(t1 - 2. * t1), -21., 1e-10);
+		Assert::AreEqual(bias_gradient(result, b)[0][0], 24., 1e-10);
+	}
+};
+
+TEST_CLASS(CheckpointTest)
+{
+	using Tensor = miniflow::TensorScalar;
+
+public:
+
+	TEST_METHOD(SaveLoadTest)
+	{
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b(0.3);
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Sigmoid<Tensor> S(L);
+		miniflow::MSE<Tensor> cost(Y, S);
+		W.set_name("W");
+
+		miniflow::Graph neural_network(cost);
+		neural_network.SGD(1., 10);
+		double trained_W = W.getValue().value_;
+		double trained_b = b.getValue().value_;
+		miniflow::save_checkpoint(neural_network, "checkpoint_test.bin");
+
+		neural_network.SGD(1., 10);
+		miniflow::load_checkpoint(neural_network, "checkpoint_test.bin");
+
+		Assert::AreEqual(W.getValue().value_, trained_W);
+		Assert::AreEqual(b.getValue().value_, trained_b);
+
+		miniflow::CheckpointReader reader("checkpoint_test.bin");
+		Assert::IsNotNull(reader.find("W"));
+		Assert::IsNotNull(reader.find("trainable_1"));
+		Assert::AreEqual(reinterpret_cast<std::uintptr_t>(reader.find("W")->values_) % 64, std::uintptr_t(0));
+	}
+
+	TEST_METHOD(TensorDataTest)
+	{
+		dynamictensor::Tensor<double, 2> weights(dynamictensor::Shape<2>{ 2, 3 }, 0.5);
+		weights[1][2] = -4.;
+		miniflow::Trainable<dynamictensor::Tensor<double, 2>> W(weights), V(weights);
+
+		V.set_data(miniflow::TensorData{ { 1, 1 }, { 0. } });
+		V.set_data(W.data());
+
+		Assert::AreEqual(V.getValue().shape()[0], 2u);
+		Assert::AreEqual(V.getValue().shape()[1], 3u);
+		Assert::AreEqual(V.getValue()[1][2], -4.);
+	}
+
+	TEST_METHOD(ShapeMismatchTest)
+	{
+		using Matrix = dynamictensor::Tensor<double, 2>;
+		auto network = [](miniflow::Index rows, miniflow::Index cols)
+		{
+			auto X = std::make_unique<miniflow::Input<Matrix>>(Matrix(dynamictensor::Shape<2>{ 1, rows }, 1.));
+			auto W = std::make_unique<miniflow::Trainable<Matrix>>(Matrix(dynamictensor::Shape<2>{ rows, cols }, 0.5));
+			auto b = std::make_unique<miniflow::Trainable<Matrix>>(Matrix(dynamictensor::Shape<2>{ 1, cols }, 0.));
+			auto L = std::make_unique<miniflow::Linear<Matrix>>(*X, *W, *b);
+			W->set_name("W");
+			b->set_name("b");
+			return std::make_tuple(std::move(X), std::move(W), std::move(b), std::move(L));
+		};
+
+		// W of the same rank and number of values, transposed
+		auto saved = network(2, 3);
+		miniflow::save_checkpoint(miniflow::Graph(*std::get<3>(saved)), "checkpoint_test.bin");
+		auto loaded = network(3, 2);
+		miniflow::Graph graph(*std::get<3>(loaded));
+		Assert::ExpectException<std::runtime_error>([&] { miniflow::load_checkpoint(graph, "checkpoint_test.bin"); });
+		Assert::AreEqual(std::get<1>(loaded)->getValue().shape()[0], 3u);
+
+		// An entry whose number of values does not match its shape
+		miniflow::checkpoint_format::write({ { "W", miniflow::TensorData{ { 2, 3 }, { 1., 2. } } } }, "checkpoint_test.bin");
+		Assert::ExpectException<std::runtime_error>([&] { miniflow::CheckpointReader reader("checkpoint_test.bin"); });
+	}
+};
+
+TEST_CLASS(ProfilerTest)
+{
+	using Tensor = miniflow::TensorScalar;
+
+public:
+
+	TEST_METHOD(RecordTest)
+	{
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b(0.3);
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Sigmoid<Tensor> S(L);
+		miniflow::MSE<Tensor> cost(Y, S);
+		L.set_name("L");
+
+		miniflow::Graph neural_network(cost);
+		miniflow::Profiler profiler;
+		neural_network.set_profiler(&profiler);
+		neural_network.SGD(1., 2);
+
+		// 7 nodes, 3 passes, 2 steps. Inputs are never stale, so forward() runs the 3 computed nodes only.
+		Assert::AreEqual(profiler.events().size(), size_t(34));
+		Assert::AreEqual(profiler.label(&L), std::string("L"));
+
+		std::ostringstream trace, summary;
+		profiler.write_chrome_trace(trace);
+		profiler.write_summary(summary);
+		Assert::AreEqual(trace.str().find("{\"traceEvents\":["), size_t(0));
+		Assert::AreNotEqual(summary.str().find("Sigmoid#"), std::string::npos);
+
+		neural_network.set_profiler(nullptr);
+		neural_network.SGD(1., 1);
+		Assert::AreEqual(profiler.events().size(), size_t(34));
+	}
+
+	TEST_METHOD(AllocationCountTest)
+	{
+		using Matrix = dynamictensor::Tensor<double, 2>;
+
+		// Every buffer counts, whether built from a shape, copied or resized: one per row of a matrix
+		std::size_t const start = miniflow::allocation_count;
+		Matrix A(dynamictensor::Shape<2>{ 3, 4 }, 1.);
+		Assert::AreEqual(miniflow::allocation_count - start, size_t(3));
+		Matrix B = A;
+		Assert::AreEqual(miniflow::allocation_count - start, size_t(6));
+		B.data_[0].data_.resize(8);
+		Assert::AreEqual(miniflow::allocation_count - start, size_t(7));
+
+		// Writing into existing buffers allocates nothing
+		B = A;
+		Assert::AreEqual(miniflow::allocation_count - start, size_t(7));
+	}
+};
+
+TEST_CLASS(Conv2DTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 4>;
+	using Shape = dynamictensor::Shape<4>;
+
+public:
+
+	TEST_METHOD(ForwardBackwardTest)
+	{
+		// 3x3 image with values 0..8 convolved with a 2x2 kernel of ones
+		Tensor image(Shape{ 1, 1, 3, 3 });
+		for (unsigned i = 0; i < 9; i++) image[0][0][i / 3][i % 3] = i;
+
+		miniflow::Input<Tensor> X(image);
+		miniflow::Trainable<Tensor> W(Tensor(Shape{ 1, 1, 2, 2 }, 1.)), b(Tensor(Shape{ 1, 1, 1, 1 }, 0.5));
+		miniflow::Conv2D<Tensor> C(X, W, b);
+		miniflow::Input<Tensor> Y(Tensor(Shape{ 1, 1, 2, 2 }, 0.));
+		miniflow::MSE<Tensor> cost(Y, C);
+
+		miniflow::Graph neural_network(cost);
+		neural_network.forward();
+		neural_network.backward();
+
+		Assert::AreEqual(C.getValue()[0][0][0][0], 8.5, eps);
+		Assert::AreEqual(C.getValue()[0][0][1][1], 24.5, eps);
+		// d(cost)/d(output) = 2 / 4 * output, the bias gradient is its sum
+		Assert::AreEqual(b.getGradient()[0][0][0][0][0], 0.5 * (8.5 + 12.5 + 20.5 + 24.5), eps);
+		// The center pixel is read by every output
+		Assert::AreEqual(X.getGradient()[0][0][0][1][1], 0.5 * (8.5 + 12.5 + 20.5 + 24.5), eps);
+	}
+
+	TEST_METHOD(StridePaddingTest)
+	{
+		miniflow::Input<Tensor> X(Tensor(Shape{ 2, 3, 5, 5 }, 1.));
+		miniflow::Trainable<Tensor> W(Tensor(Shape{ 4, 3, 3, 3 }, 1.)), b(Tensor(Shape{ 1, 4, 1, 1 }, 0.));
+		miniflow::Conv2D<Tensor> C(X, W, b, 2, 1);
+		C.forward();
+
+		Assert::AreEqual(C.getValue().shape()[2], 3u);
+		Assert::AreEqual(C.getValue().shape()[3], 3u);
+		// A corner output reads a 2x2 patch of every channel, the center one a full 3x3 patch
+		Assert::AreEqual(C.getValue()[1][3][0][0], 12., eps);
+		Assert::AreEqual(C.getValue()[1][3][1][1], 27., eps);
+
+		// As an output of the graph nothing depends on it, its partials are empty
+		miniflow::Graph graph(C);
+		graph.backward();
+		Assert::AreEqual(size(X.getGradient()[0]), std::size_t(0));
+	}
+};
+
+TEST_CLASS(SoftmaxCrossEntropyTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+
+public:
+
+	TEST_METHOD(ForwardBackwardTest)
+	{
+		Tensor logits(dynamictensor::Shape<2>{ 2, 3 }), labels(dynamictensor::Shape<2>{ 2, 3 });
+		logits[0][0] = 1.; logits[0][1] = 2.; logits[0][2] = 3.;
+		logits[1][0] = 1000.; logits[1][1] = -1000.; logits[1][2] = 1000.;
+		labels[0][2] = 1.;
+		labels[1][0] = 1.;
+
+		miniflow::Input<Tensor> Y(labels), X(logits);
+		miniflow::SoftmaxCrossEntropy<Tensor> cost(Y, X, true);
+		cost.forward();
+		cost.backward();
+		X.backward();
+
+		// Row losses are log(e + e^2 + e^3) - 3 and log(2), large logits must not overflow
+		Assert::AreEqual(cost.getValue()[0][0], (0.4076059644 + 0.6931471806) / 2, 1e-9);
+		Assert::AreEqual(cost.probabilities()[1][0], 0.5, eps);
+		Assert::AreEqual(X.getGradient()[0][0][2], (0.6652409558 - 1) / 2, 1e-9);
+		Assert::AreEqual(X.getGradient()[0][1][0], (0.5 - 1) / 2, eps);
+		Assert::AreEqual(X.getGradient()[0][1][1], 0., eps);
+	}
+};
+
+TEST_CLASS(SparseTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using SparseTensor = sparsetensor::CsrMatrix<double>;
+
+	double eps = 1e-10;
+
+public:
+
+	TEST_METHOD(CsrMatrixTest)
+	{
+		// Duplicated triplets are summed
+		SparseTensor X = SparseTensor::from_triplets(2, 3, { { 1, 2, 4. }, { 0, 1, 1. }, { 1, 0, 2. }, { 1, 2, 1. } });
+		Tensor dense = X.to_dense();
+		Assert::AreEqual(X.nonzeros(), std::size_t(3));
+		Assert::AreEqual(dense[0][1], 1.);
+		Assert::AreEqual(dense[1][2], 5.);
+		Assert::AreEqual(transpose(X).to_dense()[2][1], 5.);
+		Assert::AreEqual(SparseTensor::from_dense(dense).nonzeros(), std::size_t(3));
+	}
+
+	TEST_METHOD(SparseLinearTest)
+	{
+		Tensor X(dynamictensor::Shape<2>{ 2, 3 }), W(dynamictensor::Shape<2>{ 3, 2 }, 0.5), b(dynamictensor::Shape<2>{ 2, 2 }, 0.1);
+		X[0][1] = 2.; X[1][0] = -1.; X[1][2] = 3.;
+		W[2][1] = -1.;
+
+		miniflow::SparseInput<Tensor> sparse_input(SparseTensor::from_dense(X));
+		miniflow::Input<Tensor> dense_input(X), Y1(Tensor(dynamictensor::Shape<2>{ 2, 2 }, 1.)), Y2(Tensor(dynamictensor::Shape<2>{ 2, 2 }, 1.));
+		miniflow::Trainable<Tensor> W1(W), b1(b), W2(W), b2(b);
+		miniflow::SparseLinear<Tensor> sparse_linear(sparse_input, W1, b1);
+		miniflow::Linear<Tensor> dense_linear(dense_input, W2, b2);
+		miniflow::MSE<Tensor> sparse_cost(Y1, sparse_linear), dense_cost(Y2, dense_linear);
+
+		miniflow::Graph sparse_graph(sparse_cost), dense_graph(dense_cost);
+		sparse_graph.forward();
+		sparse_graph.backward();
+		dense_graph.forward();
+		dense_graph.backward();
+
+		Assert::AreEqual(sparse_linear.getValue()[1][1], -3.4, eps);
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 2; j++)
+			{
+				Assert::AreEqual(sparse_linear.getGradient()[1][i][j], dense_linear.getGradient()[1][i][j], eps);
+			}
+		}
+		Assert::AreEqual(sparse_linear.getGradient()[2][1][1], dense_linear.getGradient()[2][1][1], eps);
+	}
+};
+
+TEST_CLASS(QuantizationTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+
+public:
+
+	TEST_METHOD(QuantizedWeightsTest)
+	{
+		Tensor W(dynamictensor::Shape<2>{ 2, 2 });
+		W[0][0] = 0.5; W[1][0] = -0.25;
+		W[0][1] = 0.01; W[1][1] = 0.02;
+
+		// Every output channel has its own scale
+		quantization::QuantizedWeights weights(W);
+		Assert::AreEqual(int(weights.values_[0]), 127);
+		Assert::AreEqual(int(weights.values_[1]), -64);
+		Assert::AreEqual(int(weights.values_[weights.stride_ + 1]), 127);
+		Assert::AreEqual(weights.scales_[1], 0.02 / 127, 1e-15);
+		Assert::AreEqual(weights.sums_[0], 63);
+	}
+
+	TEST_METHOD(QuantizedLinearTest)
+	{
+		Tensor X(dynamictensor::Shape<2>{ 3, 40 }), W(dynamictensor::Shape<2>{ 40, 5 }), b(dynamictensor::Shape<2>{ 3, 5 }, 0.5);
+		for (int i = 0; i < 3; i++) for (int k = 0; k < 40; k++) X[i][k] = std::sin(i + 0.3 * k);
+		for (int k = 0; k < 40; k++) for (int j = 0; j < 5; j++) W[k][j] = std::cos(k * j + 0.1 * k) / 8;
+
+		miniflow::Input<Tensor> input(X);
+		miniflow::Trainable<Tensor> weights(W), bias(b);
+		miniflow::Linear<Tensor> linear(input, weights, bias);
+		miniflow::Graph graph(linear);
+
+		quantization::Calibration calibration;
+		calibration.observe(graph);
+		Assert::AreEqual(calibration.range(linear).max_, 1., 1e-3);
+
+		miniflow::QuantizedLinear<Tensor> quantized(input, weights, bias, calibration.range(linear));
+		quantized.forward();
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 5; j++)
+			{
+				Assert::AreEqual(quantized.getValue()[i][j], linear.getValue()[i][j], 0.02);
+			}
+		}
+	}
+};
+
+TEST_CLASS(PredictorTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Predictor = miniflow::Predictor<Tensor>;
+
+	double eps = 1e-10;
+
+public:
+
+	TEST_METHOD(RowBiasTest)
+	{
+		// A single row b is shared by every example
+		Tensor X(dynamictensor::Shape<2>{ 3, 2 }, 1.), W(dynamictensor::Shape<2>{ 2, 2 }, 0.5), b(dynamictensor::Shape<2>{ 1, 2 });
+		b[0][1] = 2.;
+
+		miniflow::Input<Tensor> input(X), Y(Tensor(dynamictensor::Shape<2>{ 3, 2 }));
+		miniflow::Trainable<Tensor> weights(W), bias(b);
+		miniflow::Linear<Tensor> linear(input, weights, bias);
+		miniflow::MSE<Tensor> cost(Y, linear);
+		miniflow::Graph graph(cost);
+		graph.forward();
+		graph.backward();
+
+		Assert::AreEqual(linear.getValue()[2][1], 3., eps);
+		Assert::AreEqual(bias.getGradient()[0].shape()[0], miniflow::Index(1));
+		Assert::AreEqual(bias.getGradient()[0][0][1], 3 * 2 * 3. / 6, eps);
+	}
+
+	TEST_METHOD(PredictTest)
+	{
+		Tensor W(dynamictensor::Shape<2>{ 3, 2 }), b(dynamictensor::Shape<2>{ 1, 2 }, 0.1);
+		W[0][0] = 1.; W[1][1] = -1.; W[2][0] = 0.5;
+		miniflow::Trainable<Tensor> weights(W), bias(b);
+		Predictor::Builder build = [&](miniflow::Node<Tensor>& input, Predictor::Nodes& nodes) -> miniflow::Node<Tensor>&
+		{
+			return nodes.add<miniflow::Linear<Tensor>>(input, weights, bias);
+		};
+
+		miniflow::PredictorOptions options;
+		options.workers_ = 2;
+		options.max_batch_ = 4;
+		Predictor predictor(build, 3, options);
+
+		// Requests of several rows from several threads are answered with their own rows
+		std::vector<std::future<Tensor>> results(6);
+		std::vector<std::thread> clients;
+		for (int c = 0; c < 2; c++)
+		{
+			clients.emplace_back([&, c]
+			{
+				for (int r = c; r < 6; r += 2)
+				{
+					Tensor input(dynamictensor::Shape<2>{ miniflow::Index(1 + r % 2), 3 }, double(r));
+					results[r] = predictor.predict(input);
+				}
+			});
+		}
+		for (std::thread& client : clients) client.join();
+
+		for (int r = 0; r < 6; r++)
+		{
+			Tensor result = results[r].get();
+			Assert::AreEqual(result.shape()[0], miniflow::Index(1 + r % 2));
+			Assert::AreEqual(result[0][0], 1.5 * r + 0.1, eps);
+			Assert::AreEqual(result[0][1], -1. * r + 0.1, eps);
+		}
+	}
+};
+
+TEST_CLASS(CodegenTest)
+{
+	using Tensor = miniflow::TensorScalar;
+
+public:
+
+	TEST_METHOD(GenerateHeaderTest)
+	{
+		miniflow::Input<Tensor> X(0.2), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b(0.25);
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Sigmoid<Tensor> S(L);
+		miniflow::MSE<Tensor> cost(Y, S);
+		X.set_name("x");
+		b.set_name("bias");
+
+		std::ostringstream header;
+		miniflow::generate_header(S, header, "nn");
+		std::string code = header.str();
+
+		// Weights are embedded exactly, the shapes are constants
+		Assert::IsTrue(code.find("namespace nn") != std::string::npos);
+		Assert::IsTrue(code.find("inline constexpr double w_bias[1][1] =\n\t{\n\t\t{ 0x1p-2 },") != std::string::npos);
+		Assert::IsTrue(code.find("inline void forward(double const (&in_x)[1][1], double (&output)[1][1])") != std::string::npos);
+		Assert::IsTrue(code.find("double const x = in_x[i][k];") != std::string::npos);
+		Assert::IsTrue(code.find("y = 1 / (1 + std::exp(-x));") != std::string::npos);
+
+		// Cost nodes have no generated code
+		std::ostringstream unsupported;
+		Assert::ExpectException<std::runtime_error>([&] { miniflow::generate_header(cost, unsupported, "nn"); });
+	}
+
+	TEST_METHOD(ReservedNameTest)
+	{
+		// Names of the generated code, keywords and repeated names
+		miniflow::Input<Tensor> X(0.2);
+		miniflow::Trainable<Tensor> W1(1), b1(0.25), W2(-1), b2(0.5);
+		miniflow::Linear<Tensor> L1(X, W1, b1);
+		miniflow::Linear<Tensor> L2(L1, W2, b2);
+		X.set_name("x");
+		W1.set_name("output");
+		b1.set_name("int");
+		W2.set_name("output");
+		b2.set_name("v0");
+
+		std::ostringstream header;
+		miniflow::generate_header(L2, header, "nn");
+		std::string code = header.str();
+		Assert::IsTrue(code.find("inline constexpr double w_output[1][1]") != std::string::npos);
+		Assert::IsTrue(code.find("inline constexpr double w_output_2[1][1]") != std::string::npos);
+		Assert::IsTrue(code.find("inline constexpr double w_int[1][1]") != std::string::npos);
+		Assert::IsTrue(code.find("inline constexpr double w_v0[1][1]") != std::string::npos);
+		Assert::IsTrue(code.find("output[i][j] += x * w_output_2[k][j];") != std::string::npos);
+		Assert::IsTrue(code.find("double const x = in_x[i][k];") != std::string::npos);
+
+		std::ostringstream keyword;
+		Assert::ExpectException<std::runtime_error>([&] { miniflow::generate_header(L2, keyword, "int"); });
+	}
+
+	TEST_METHOD(InPlaceActivationShapeTest)
+	{
+		// S takes over the value of L1, whose shape follows from X and W1
+		using Matrix = dynamictensor::Tensor<double, 2>;
+		miniflow::Input<Matrix> X(matrix(2, 3, 0));
+		miniflow::Trainable<Matrix> W1(matrix(3, 4, 1)), b1(matrix(1, 4, 2)), W2(matrix(4, 5, 3)), b2(matrix(1, 5, 4));
+		miniflow::Linear<Matrix> L1(X, W1, b1);
+		miniflow::Sigmoid<Matrix> S(L1, true);
+		miniflow::Linear<Matrix> L2(S, W2, b2);
+
+		std::ostringstream header;
+		miniflow::generate_header(L2, header, "nn");
+		std::string code = header.str();
+		Assert::IsTrue(code.find("[2][4];\n") != std::string::npos);
+		Assert::IsTrue(code.find("[0][0]") == std::string::npos);
+		Assert::IsTrue(code.find("double (&output)[2][5]") != std::string::npos);
+	}
+};
+
+TEST_CLASS(StaticGraphTest)
+{
+	using Tensor = miniflow::TensorScalar;
+
+	template<typename Id> using Input = miniflow::staticgraph::Input<Tensor, Id>;
+	template<typename Id> using Trainable = miniflow::staticgraph::Trainable<Tensor, Id>;
+
+	double eps = 1e-10;
+
+public:
+
+	TEST_METHOD(SGDTest)
+	{
+		// The network of BasicNodeTest::SGDTest, trained step by step along the same Graph
+		using namespace miniflow::staticgraph;
+		using X = Input<struct XTag>;
+		using Y = Input<struct YTag>;
+		using W = Trainable<struct WTag>;
+		using b = Trainable<struct bTag>;
+
+		miniflow::StaticGraph<MSE<Y, Sigmoid<Linear<X, W, b>>>> network;
+		network.get<X>().setValue(0.2);
+		network.get<Y>().setValue(0.5);
+		network.get<W>().setValue(1);
+		network.get<b>().setValue(0.3);
+
+		miniflow::Input<Tensor> X_node(0.2), Y_node(0.5);
+		miniflow::Trainable<Tensor> W_node(1), b_node(0.3);
+		miniflow::Linear<Tensor> L(X_node, W_node, b_node);
+		miniflow::Sigmoid<Tensor> S(L);
+		miniflow::MSE<Tensor> cost(Y_node, S);
+		miniflow::Graph graph(cost);
+
+		for (int i = 0; i < 10; i++)
+		{
+			network.SGD_step(1.);
+			graph.SGD_step(1.);
+			Assert::AreEqual(network.get<W>().getValue().value_, W_node.getValue().value_, eps);
+			Assert::AreEqual(network.get<b>().getValue().value_, b_node.getValue().value_, eps);
+		}
+
+		network.SGD(1., 100);
+		Assert::AreEqual(network.forward(), 0., 1e-10);
+	}
+
+	TEST_METHOD(StaticTensorTest)
+	{
+		using namespace miniflow::staticgraph;
+		using X = miniflow::staticgraph::Input<statictensor::Tensor<double, 2, 2>, struct XTag>;
+		using Y = miniflow::staticgraph::Input<statictensor::Tensor<double, 2, 1>, struct YTag>;
+		using W = miniflow::staticgraph::Trainable<statictensor::Tensor<double, 2, 1>, struct WTag>;
+		using b = miniflow::staticgraph::Trainable<statictensor::Tensor<double, 1, 1>, struct bTag>;
+
+		miniflow::StaticGraph<MSE<Y, Tanh<Linear<X, W, b>>>> network;
+		network.get<X>().setValue({ { 1, 0 }, { 0, 1 } });
+		network.get<Y>().setValue({ { 0.5 }, { -0.5 } });
+		network.get<W>().setValue({ { 0 }, { 0 } });
+		network.get<b>().setValue({ { 0 } });
+
+		// tanh(0) = 0 with the derivative 1: the gradient of W is -(y_i) and the one of the shared b is their sum
+		network.forward();
+		network.backward();
+		Assert::AreEqual(network.get<W>().getGradient()[0][0], -0.5, eps);
+		Assert::AreEqual(network.get<W>().getGradient()[1][0], 0.5, eps);
+		Assert::AreEqual(network.get<b>().getGradient()[0][0], 0., eps);
+
+		network.SGD(0.5, 200);
+		Assert::AreEqual(network.forward(), 0., 1e-6);
+	}
+};
+
+TEST_CLASS(SweepTest)
+{
+	static constexpr std::size_t lanes = 4;
+	using Tensor = miniflow::TensorLanes<lanes>;
+
+	double eps = 1e-10;
+
+	// The network of BasicNodeTest::SGDTest with the input of a model
+	static double input(std::size_t model) { return 0.1 * (model + 1); }
+	static double learning_rate(std::size_t model) { return 0.5 + 0.25 * model; }
+
+	// Trains a single model on TensorScalar and returns {W, b, cost}
+	static std::vector<double> train_scalar(std::size_t model, int repeats)
+	{
+		using Scalar = miniflow::TensorScalar;
+		miniflow::Input<Scalar> X(input(model)), Y(0.5);
+		miniflow::Trainable<Scalar> W(1), b(0.3);
+		miniflow::Linear<Scalar> L(X, W, b);
+		miniflow::Sigmoid<Scalar> S(L);
+		miniflow::MSE<Scalar> cost(Y, S);
+		miniflow::Graph graph(cost);
+		graph.SGD(learning_rate(model), repeats);
+		return { W.getValue().value_, b.getValue().value_, cost.getValue().value_ };
+	}
+
+public:
+
+	TEST_METHOD(LanesTest)
+	{
+		// Every lane is an independent model with its own learning rate
+		Tensor X({ input(0), input(1), input(2), input(3) });
+		miniflow::Input<Tensor> X_node(X), Y(0.5);
+		miniflow::Trainable<Tensor> W(1), b(0.3);
+		miniflow::Linear<Tensor> L(X_node, W, b);
+		miniflow::Sigmoid<Tensor> S(L);
+		miniflow::MSE<Tensor> cost(Y, S);
+		miniflow::Graph graph(cost);
+
+		Tensor learning_rates({ learning_rate(0), learning_rate(1), learning_rate(2), learning_rate(3) });
+		for (int i = 0; i < 20; i++)
+		{
+			graph.forward();
+			graph.backward();
+			W.update(learning_rates);
+			b.update(learning_rates);
+		}
+
+		for (std::size_t model = 0; model < lanes; model++)
+		{
+			std::vector<double> expected = train_scalar(model, 20);
+			Assert::AreEqual(W.getValue()[int(model)], expected[0], eps);
+			Assert::AreEqual(b.getValue()[int(model)], expected[1], eps);
+			Assert::AreEqual(cost.getValue()[int(model)], expected[2], eps);
+		}
+	}
+
+	TEST_METHOD(TrainTest)
+	{
+		// 6 models fill two groups, the second one partly
+		miniflow::Sweep<lanes>::Builder build = [](std::size_t first, miniflow::Nodes<Tensor>& nodes) -> miniflow::Node<Tensor>&
+		{
+			Tensor X;
+			for (std::size_t lane = 0; lane < lanes; lane++) X[int(lane)] = input(first + lane);
+			auto& L = nodes.add<miniflow::Linear<Tensor>>(nodes.add<miniflow::Input<Tensor>>(X), nodes.add<miniflow::Trainable<Tensor>>(1.), nodes.add<miniflow::Trainable<Tensor>>(0.3));
+			return nodes.add<miniflow::MSE<Tensor>>(nodes.add<miniflow::Input<Tensor>>(0.5), nodes.add<miniflow::Sigmoid<Tensor>>(L));
+		};
+		miniflow::Sweep<lanes> sweep(6, build, learning_rate);
+		sweep.train(20);
+
+		std::vector<double> costs = sweep.costs();
+		Assert::AreEqual(costs.size(), std::size_t(6));
+		for (std::size_t model = 0; model < 6; model++)
+		{
+			std::vector<double> expected = train_scalar(model, 20);
+			std::vector<double> parameters = sweep.parameters(model);
+			Assert::AreEqual(parameters[0], expected[0], eps);
+			Assert::AreEqual(parameters[1], expected[1], eps);
+		}
+	}
+};
+
+TEST_CLASS(RecurrentTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Index = miniflow::Index;
+
+	template<typename Cell>
+	static void check_cell(miniflow::RecurrentOptions const& options)
+	{
+		Index const steps = 3, examples = 2, features = 2, hidden = 2;
+		Index const width = Cell::gates * hidden;
+		miniflow::Input<Tensor> X(matrix(steps * examples, features, 0));
+		miniflow::Input<Tensor> Y(matrix(options.all_steps_ ? steps * examples : examples, hidden, 1));
+		miniflow::Trainable<Tensor> W(matrix(features, width, 2)), U(matrix(hidden, width, 3)), b(matrix(1, width, 4));
+		miniflow::Recurrent<Tensor, Cell> R(X, W, U, b, steps, options);
+		miniflow::MSE<Tensor> cost(Y, R);
+
+		miniflow::Graph graph(cost);
+		graph.forward();
+		graph.backward();
+		for (miniflow::Input<Tensor>* input : std::vector<miniflow::Input<Tensor>*>{ &X, &W, &U, &b }) check_gradient(graph, cost, *input);
+	}
+
+public:
+
+	TEST_METHOD(UnrolledTest)
+	{
+		// An RNN node matches the network unrolled into a Linear and a Tanh node per step
+		Index const steps = 3, examples = 2, features = 2, hidden = 3;
+		Tensor const X = matrix(steps * examples, features, 0), Y = matrix(examples, hidden, 1);
+		Tensor const W = matrix(features, hidden, 2), U = matrix(hidden, hidden, 3), b = matrix(1, hidden, 4);
+
+		miniflow::Input<Tensor> X_node(X), Y_node(Y);
+		miniflow::Trainable<Tensor> W_node(W), U_node(U), b_node(b);
+		miniflow::RNN<Tensor> R(X_node, W_node, U_node, b_node, steps, { false });
+		miniflow::MSE<Tensor> cost(Y_node, R);
+		miniflow::Graph graph(cost);
+		graph.SGD_step(0.1);
+
+		miniflow::Nodes<Tensor> nodes;
+		miniflow::Trainable<Tensor> W_unrolled(W), U_unrolled(U), b_unrolled(b);
+		miniflow::Node<Tensor>* state = nullptr;
+		std::vector<miniflow::Input<Tensor>*> inputs;
+		for (Index t = 0; t < steps; t++)
+		{
+			Tensor x(dynamictensor::Shape<2>{ examples, features });
+			for (Index n = 0; n < examples; n++) x[n] = X[t * examples + n];
+			inputs.push_back(&nodes.add<miniflow::Input<Tensor>>(x));
+			miniflow::Node<Tensor>* a = &nodes.add<miniflow::Linear<Tensor>>(*inputs.back(), W_unrolled, b_unrolled);
+			if (state) a = &nodes.add<miniflow::Linear<Tensor>>(*state, U_unrolled, *a);
+			state = &nodes.add<miniflow::Tanh<Tensor>>(*a);
+		}
+		miniflow::MSE<Tensor> unrolled_cost(Y_node, *state);
+		miniflow::Graph unrolled(unrolled_cost);
+		unrolled.SGD_step(0.1);
+
+		Assert::AreEqual(cost.getValue()[0][0], unrolled_cost.getValue()[0][0], eps);
+		for (Index i = 0; i < hidden; i++)
+		{
+			for (Index j = 0; j < hidden; j++) Assert::AreEqual(U_node.getValue()[i][j], U_unrolled.getValue()[i][j], eps);
+			Assert::AreEqual(W_node.getValue()[0][i], W_unrolled.getValue()[0][i], eps);
+			Assert::AreEqual(b_node.getValue()[0][i], b_unrolled.getValue()[0][i], eps);
+		}
+		for (Index t = 0; t < steps; t++)
+		{
+			Assert::AreEqual(R.getGradient()[0][t * examples + 1][1], inputs[t]->getGradient()[0][1][1], eps);
+		}
+	}
+
+	TEST_METHOD(GradientTest)
+	{
+		check_cell<miniflow::RNNCell>({});
+		check_cell<miniflow::GRUCell>({});
+		check_cell<miniflow::LSTMCell>({});
+		check_cell<miniflow::LSTMCell>({ false });
+	}
+
+	TEST_METHOD(TruncationTest)
+	{
+		// With windows of two steps, the cost of the last step reaches the last two steps only
+		Index const steps = 4, examples = 2, features = 2, hidden = 2;
+		miniflow::Input<Tensor> X(matrix(steps * examples, features, 0)), Y(matrix(examples, hidden, 1));
+		miniflow::Trainable<Tensor> W(matrix(features, 4 * hidden, 2)), U(matrix(hidden, 4 * hidden, 3)), b(matrix(1, 4 * hidden, 4));
+		miniflow::LSTM<Tensor> R(X, W, U, b, steps, { false, 2 });
+		miniflow::MSE<Tensor> cost(Y, R);
+		miniflow::Graph graph(cost);
+		graph.forward();
+		graph.backward();
+
+		Tensor const& gradient = R.getGradient()[0];
+		for (Index row = 0; row < steps * examples; row++)
+		{
+			bool const reached = row >= 2 * examples;
+			Assert::AreEqual(gradient[row][0] != 0, reached);
+		}
+	}
+};
+
+TEST_CLASS(EmbeddingTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+
+	static Tensor table()
+	{
+		Tensor t(Shape{ 5, 2 });
+		for (miniflow::Index i = 0; i < 5; i++)
+		{
+			t[i][0] = 0.1 * i;
+			t[i][1] = -0.2 * i;
+		}
+		return t;
+	}
+
+public:
+
+	TEST_METHOD(LookupTest)
+	{
+		// Two fields per example, row 3 is read twice
+		Tensor indices(Shape{ 2, 2 });
+		indices[0][0] = 3; indices[0][1] = 1;
+		indices[1][0] = 4; indices[1][1] = 3;
+		miniflow::Input<Tensor> I(indices), Y(Tensor(Shape{ 2, 4 }, 1.));
+		miniflow::EmbeddingTable<Tensor> E(table());
+		miniflow::Embedding<Tensor> lookup(I, E);
+		miniflow::MSE<Tensor> cost(Y, lookup);
+
+		miniflow::Graph graph(cost);
+		graph.forward();
+		Assert::AreEqual(lookup.getValue()[1][1], -0.8, eps);
+		Assert::AreEqual(lookup.getValue()[1][2], 0.3, eps);
+
+		graph.backward();
+		auto const& gradient = E.getRowGradient();
+		Assert::AreEqual(gradient.size(), std::size_t(3));
+		Assert::AreEqual(gradient.rows_[1], miniflow::Index(3));
+		// Partials of the two reads of row 3 are summed
+		double const grad_3 = -2. / 8 * ((1 - 0.3) + (1 - 0.3));
+		Assert::AreEqual(gradient.values_[1][0], grad_3, eps);
+
+		// Rows that were not read are not updated
+		graph.update(0.5);
+		Assert::AreEqual(E.getValue()[3][0], 0.3 - 0.5 * grad_3, eps);
+		Assert::AreEqual(E.getValue()[2][0], 0.2);
+		Assert::AreEqual(graph.trainables().size(), std::size_t(1));
+	}
+
+	TEST_METHOD(OneHotTest)
+	{
+		// Training an embedding matches a Linear node on one-hot inputs
+		std::vector<miniflow::Index> rows{ 2, 0, 2 };
+		Tensor indices(Shape{ 3, 1 }), one_hot(Shape{ 3, 5 });
+		for (miniflow::Index n = 0; n < 3; n++)
+		{
+			indices[n][0] = rows[n];
+			one_hot[n][rows[n]] = 1;
+		}
+		Tensor labels(Shape{ 3, 2 }, 0.5);
+		labels[1][1] = -1;
+
+		miniflow::Input<Tensor> I(indices), Y(labels);
+		miniflow::EmbeddingTable<Tensor> E(table());
+		miniflow::Embedding<Tensor> lookup(I, E);
+		miniflow::MSE<Tensor> cost(Y, lookup);
+		miniflow::Graph graph(cost);
+
+		miniflow::Input<Tensor> X(one_hot), Y_dense(labels);
+		miniflow::Trainable<Tensor> W(table()), b(Tensor(Shape{ 1, 2 }));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::MSE<Tensor> dense_cost(Y_dense, L);
+		miniflow::Graph dense_graph(dense_cost);
+
+		for (int step = 0; step < 3; step++)
+		{
+			graph.SGD_step(0.1);
+			dense_graph.forward();
+			dense_graph.backward();
+			W.update(0.1);
+			Assert::AreEqual(cost.getValue()[0][0], dense_cost.getValue()[0][0], eps);
+		}
+		for (miniflow::Index i = 0; i < 5; i++)
+		{
+			for (miniflow::Index j = 0; j < 2; j++) Assert::AreEqual(E.getValue()[i][j], W.getValue()[i][j], eps);
+		}
+	}
+
+	TEST_METHOD(SharedTableTest)
+	{
+		// Two lookups into one table add their partials of the rows both read
+		Tensor indices1(Shape{ 1, 1 }), indices2(Shape{ 2, 1 });
+		indices1[0][0] = 1;
+		indices2[0][0] = 4; indices2[1][0] = 1;
+		miniflow::Input<Tensor> I1(indices1), I2(indices2), Y1(Tensor(Shape{ 1, 2 })), Y2(Tensor(Shape{ 2, 2 }));
+		miniflow::EmbeddingTable<Tensor> E(table());
+		miniflow::Embedding<Tensor> lookup1(I1, E), lookup2(I2, E);
+		miniflow::MSE<Tensor> cost1(Y1, lookup1), cost2(Y2, lookup2);
+
+		miniflow::Graph graph({ &cost1, &cost2 });
+		graph.forward();
+		graph.backward();
+		auto const& gradient = E.getRowGradient();
+		Assert::AreEqual(gradient.size(), std::size_t(2));
+		Assert::AreEqual(gradient.rows_[0], miniflow::Index(1));
+		Assert::AreEqual(gradient.values_[0][0], 2. / 2 * 0.1 + 2. / 4 * 0.1, eps);
+	}
+};
+
+TEST_CLASS(AutotuneTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+
+	static Tensor matrix(miniflow::Index rows, miniflow::Index cols)
+	{
+		Tensor t(Shape{ rows, cols });
+		for (miniflow::Index i = 0; i < rows; i++)
+			for (miniflow::Index j = 0; j < cols; j++) t[i][j] = 0.01 * ((i * 13 + j * 7) % 17) - 0.08;
+		return t;
+	}
+
+public:
+
+	TEST_METHOD(HeuristicTest)
+	{
+		dynamictensor::GemmBlocking small = miniflow::heuristic_gemm_blocking({ 1, 32 << 10, 1 << 20 });
+		Assert::AreEqual(small.cols_, miniflow::Index(512));
+		Assert::AreEqual(small.depth_, miniflow::Index(128));
+		dynamictensor::GemmBlocking large = miniflow::heuristic_gemm_blocking({ 8, 48 << 10, 2 << 20 });
+		Assert::AreEqual(large.cols_, miniflow::Index(1024));
+		Assert::AreEqual(large.depth_, miniflow::Index(128));
+		Assert::AreEqual(large.threads_, miniflow::Index(1));
+
+		// Without a profile loaded the products run with the heuristic blocking of the machine
+		Assert::AreEqual(dynamictensor::gemm_blocking.cols_, miniflow::heuristic_gemm_blocking().cols_);
+		Assert::AreEqual(dynamictensor::gemm_blocking.depth_, miniflow::heuristic_gemm_blocking().depth_);
+	}
+
+	TEST_METHOD(ProfileTest)
+	{
+		dynamictensor::GemmBlocking const saved = dynamictensor::gemm_blocking;
+		dynamictensor::GemmBlocking blocking;
+		blocking.depth_ = 64;
+		blocking.cols_ = 256;
+		blocking.threads_ = 2;
+		miniflow::save_gemm_profile("gemm_profile_test.txt", blocking);
+
+		Assert::IsTrue(miniflow::load_gemm_profile("gemm_profile_test.txt"));
+		Assert::AreEqual(dynamictensor::gemm_blocking.depth_, miniflow::Index(64));
+		Assert::AreEqual(dynamictensor::gemm_blocking.cols_, miniflow::Index(256));
+		Assert::AreEqual(dynamictensor::gemm_blocking.threads_, miniflow::Index(2));
+
+		// A profile of another machine falls back to the heuristic
+		{
+			std::ofstream file("gemm_profile_test.txt");
+			file << "miniflow_gemm_profile 1\nmachine_threads 0\ndepth 64\n";
+		}
+		Assert::IsFalse(miniflow::load_gemm_profile("gemm_profile_test.txt"));
+		Assert::AreEqual(dynamictensor::gemm_blocking.depth_, miniflow::heuristic_gemm_blocking().depth_);
+		Assert::IsFalse(miniflow::load_gemm_profile("missing_gemm_profile.txt"));
+		std::remove("gemm_profile_test.txt");
+		dynamictensor::gemm_blocking = saved;
+	}
+
+	TEST_METHOD(TuneTest)
+	{
+		dynamictensor::GemmBlocking const saved = dynamictensor::gemm_blocking;
+		miniflow::Input<Tensor> X(matrix(64, 40));
+		miniflow::Trainable<Tensor> W(matrix(40, 24)), b(matrix(1, 24));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Graph graph(L);
+		graph.forward();
+
+		std::vector<miniflow::GemmShape> shapes = miniflow::gemm_shapes(graph);
+		Assert::AreEqual(shapes.size(), size_t(1));
+		Assert::IsTrue(shapes[0] == miniflow::GemmShape{ 64, 40, 24 });
+
+		miniflow::AutotuneOptions options;
+		options.depths_ = { 16, 32 };
+		options.cols_ = { 8 };
+		options.threads_ = { 1, 4 };
+		dynamictensor::GemmBlocking tuned = miniflow::autotune_gemm(graph, options);
+		Assert::IsTrue(tuned.depth_ == 16 || tuned.depth_ == 32);
+		Assert::AreEqual(tuned.cols_, miniflow::Index(8));
+		Assert::AreEqual(dynamictensor::gemm_blocking.threads_, tuned.threads_);
+
+		// Products split between threads compute every value as a single thread does
+		Tensor const G = matrix(64, 24);
+		dynamictensor::gemm_blocking.threads_ = 1;
+		Tensor Y1 = dot(X.getValue(), W.getValue()), dX1 = dot_nt(G, W.getValue()), dW1 = dot_tn(X.getValue(), G);
+		dynamictensor::gemm_blocking.threads_ = 4;
+		Tensor Y4 = dot(X.getValue(), W.getValue()), dX4 = dot_nt(G, W.getValue()), dW4 = dot_tn(X.getValue(), G);
+		Assert::IsTrue(to_data(Y1).values_ == to_data(Y4).values_);
+		Assert::IsTrue(to_data(dX1).values_ == to_data(dX4).values_);
+		Assert::IsTrue(to_data(dW1).values_ == to_data(dW4).values_);
+		dynamictensor::gemm_blocking = saved;
+	}
+
+	TEST_METHOD(NodeShapesTest)
+	{
+		// Conv2D multiplies the weights by the im2col matrix of every image
+		using Image = dynamictensor::Tensor<double, 4>;
+		using ImageShape = dynamictensor::Shape<4>;
+		miniflow::Input<Image> images(Image(ImageShape{ 2, 3, 6, 6 }, 1.));
+		miniflow::Trainable<Image> kernels(Image(ImageShape{ 4, 3, 3, 3 }, 0.1)), bias(Image(ImageShape{ 1, 4, 1, 1 }, 0.));
+		miniflow::Conv2D<Image> C(images, kernels, bias);
+		miniflow::Graph conv_graph(C);
+		conv_graph.forward();
+		std::vector<miniflow::GemmShape> shapes = miniflow::gemm_shapes(conv_graph);
+		Assert::AreEqual(shapes.size(), size_t(1));
+		Assert::IsTrue(shapes[0] == miniflow::GemmShape{ 4, 27, 16 });
+
+		// A GRU multiplies the inputs of all the steps by W, then the state of every step by U
+		miniflow::Input<Tensor> X(matrix(3 * 5, 8));
+		miniflow::Trainable<Tensor> W(matrix(8, 3 * 6)), U(matrix(6, 3 * 6)), b(matrix(1, 3 * 6));
+		miniflow::Recurrent<Tensor, miniflow::GRUCell> R(X, W, U, b, 3);
+		miniflow::Graph recurrent_graph(R);
+		recurrent_graph.forward();
+		shapes = miniflow::gemm_shapes(recurrent_graph);
+		Assert::AreEqual(shapes.size(), size_t(2));
+		Assert::IsTrue(shapes[0] == miniflow::GemmShape{ 15, 8, 18 });
+		Assert::IsTrue(shapes[1] == miniflow::GemmShape{ 5, 6, 18 });
+	}
+};
+
+TEST_CLASS(MemoryTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+
+public:
+
+	TEST_METHOD(TrackerTest)
+	{
+		miniflow::MemoryTracker& tracker = miniflow::memory_tracker;
+		tracker.set_enabled(true);
+		std::size_t const live = tracker.live();
+		{
+			Tensor t(Shape{ 100, 50 });
+			Assert::AreEqual(tracker.live(), live + 100 * 50 * sizeof(double));
+			Assert::IsTrue(tracker.peak() >= tracker.live());
+			Tensor copy = t;
+			Assert::AreEqual(tracker.live(), live + 2 * 100 * 50 * sizeof(double));
+		}
+		Assert::AreEqual(tracker.live(), live);
+
+		// Off, allocations are not accounted
+		tracker.set_enabled(false);
+		{
+			Tensor t(Shape{ 100, 50 });
+			Assert::AreEqual(tracker.live(), live);
+		}
+		Assert::AreEqual(tracker.live(), live);
+	}
+
+	TEST_METHOD(HighWaterTest)
+	{
+		miniflow::MemoryTracker& tracker = miniflow::memory_tracker;
+		tracker.set_enabled(true);
+		tracker.reset_peak();
+		std::size_t const threshold = tracker.live() + (1 << 20);
+		std::vector<std::size_t> calls;
+		tracker.on_high_water(threshold, [&](std::size_t live) { calls.push_back(live); });
+
+		{
+			Tensor small(Shape{ 16, 16 });
+		}
+		Assert::AreEqual(calls.size(), size_t(0));
+		{
+			Tensor large(Shape{ 512, 512 });
+			Assert::AreEqual(calls.size(), size_t(1));
+			Assert::IsTrue(calls[0] >= threshold);
+		}
+		// Once until the peak is reset
+		{
+			Tensor large(Shape{ 512, 512 });
+		}
+		Assert::AreEqual(calls.size(), size_t(1));
+		tracker.reset_peak();
+		{
+			Tensor large(Shape{ 512, 512 });
+		}
+		Assert::AreEqual(calls.size(), size_t(2));
+		tracker.clear_callbacks();
+		tracker.set_enabled(false);
+	}
+
+	TEST_METHOD(ReportTest)
+	{
+		miniflow::memory_tracker.set_enabled(true);
+		miniflow::Input<Tensor> X(Tensor(Shape{ 8, 4 }, 1.)), Y(Tensor(Shape{ 8, 3 }, 0.5));
+		miniflow::Trainable<Tensor> W(Tensor(Shape{ 4, 3 }, 0.1)), b(Tensor(Shape{ 1, 3 }, 0.));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::MSE<Tensor> cost(Y, L);
+		miniflow::Graph graph(cost);
+		graph.SGD(0.1, 2);
+
+		miniflow::MemoryReport report = graph.memory_report();
+		Assert::AreEqual(report.nodes_.size(), size_t(6));
+		miniflow::MemoryUsage linear, mse;
+		for (auto const& entry : report.nodes_)
+		{
+			if (entry.node_ == &L) linear = entry.usage_;
+			if (entry.node_ == &cost) mse = entry.usage_;
+		}
+		// Value 8 x 3, partials with respect to X, W and b
+		Assert::AreEqual(linear.values_, 8 * 3 * sizeof(double));
+		Assert::AreEqual(linear.gradients_, (8 * 4 + 4 * 3 + 1 * 3) * sizeof(double));
+		// MSE keeps the differences for backward()
+		Assert::AreEqual(mse.state_, 8 * 3 * sizeof(double));
+		// The second step computes the partials while those of the first are held
+		Assert::IsTrue(linear.temporaries_ >= 8 * 4 * sizeof(double));
+
+		std::size_t held = 0;
+		for (auto const& entry : report.nodes_) held += entry.usage_.held();
+		Assert::AreEqual(report.total_.held(), held);
+		Assert::IsTrue(report.peak_ >= report.live_);
+
+		std::ostringstream out;
+		report.write(out);
+		Assert::IsTrue(out.str().find("Linear") != std::string::npos);
+		miniflow::memory_tracker.set_enabled(false);
+	}
+
+	TEST_METHOD(StorageBytesTest)
+	{
+		// Bytes of the value type, and of every lane of a TensorLanes
+		Assert::AreEqual(miniflow::storage_bytes(dynamictensor::Tensor<float, 2>(Shape{ 2, 3 })), 2 * 3 * sizeof(float));
+		Assert::AreEqual(miniflow::storage_bytes(miniflow::TensorLanes<4>(1.)), 4 * sizeof(double));
+		miniflow::Input<miniflow::TensorLanes<4>> X(1.);
+		Assert::AreEqual(X.memory().values_, 4 * sizeof(double));
+	}
+};
+
+TEST_CLASS(HalfPrecisionTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+	using Index = miniflow::Index;
+	using bfloat16 = halfprecision::bfloat16;
+	using float16 = halfprecision::float16;
+
+	static Tensor random_matrix(Index rows, Index cols, unsigned seed)
+	{
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<double> distribution(-1., 1.);
+		Tensor m(Shape{ rows, cols });
+		for (Index i = 0; i < rows; i++) for (Index j = 0; j < cols; j++) m[i][j] = distribution(generator);
+		return m;
+	}
+
+	// Product of the half precision values in double
+	template<class H>
+	static Tensor reference(halfprecision::Matrix<H> const& A, halfprecision::Matrix<H> const& B)
+	{
+		return dot(halfprecision::convert<double>(A), halfprecision::convert<double>(B));
+	}
+
+public:
+
+	TEST_METHOD(ConversionTest)
+	{
+		// Rounding to nearest even
+		Assert::AreEqual(float(float16(1.f + 1.f / 2048)), 1.f);
+		Assert::AreEqual(float(float16(1.f + 3.f / 2048)), 1.f + 1.f / 512);
+		Assert::AreEqual(float(bfloat16(1.f + 1.f / 256)), 1.f);
+		Assert::AreEqual(float(bfloat16(1.f + 3.f / 256)), 1.f + 1.f / 64);
+		Assert::AreEqual(float(bfloat16(-3.140625f)), -3.140625f);
+
+		// Range of float16
+		Assert::AreEqual(float(float16(65504.f)), 65504.f);
+		Assert::IsFalse(float16(65520.f).finite());
+		Assert::AreEqual(float(float16(-std::ldexp(1.f, -24))), -std::ldexp(1.f, -24));
+		Assert::AreEqual(float(float16(std::ldexp(1.f, -26))), 0.f);
+		Assert::IsTrue(std::isnan(float(float16(std::nanf("")))));
+		Assert::IsTrue(bfloat16(1e38f).finite());
+		Assert::IsTrue(std::isnan(float(bfloat16(std::nanf("")))));
+
+		// The vector kernels round as the conversion of a single value
+		std::vector<float> values(37);
+		for (std::size_t i = 0; i < values.size(); i++) values[i] = std::sin(float(i)) * std::ldexp(1.f, int(i % 20) - 10);
+		values[5] = 70000.f;
+		std::vector<float16> halves(values.size());
+		std::vector<bfloat16> brains(values.size());
+		halfprecision::convert(values.data(), halves.data(), Index(values.size()));
+		halfprecision::convert(values.data(), brains.data(), Index(values.size()));
+		std::vector<float> back(values.size());
+		halfprecision::convert(halves.data(), back.data(), Index(values.size()));
+		for (std::size_t i = 0; i < values.size(); i++)
+		{
+			Assert::AreEqual(halves[i].bits_, float16(values[i]).bits_);
+			Assert::AreEqual(brains[i].bits_, bfloat16(values[i]).bits_);
+			Assert::AreEqual(back[i], float(halves[i]));
+		}
+
+		// A quarter of the bytes of double values
+		miniflow::memory_tracker.set_enabled(true);
+		{
+			std::size_t const live = miniflow::memory_tracker.live();
+			halfprecision::Matrix<bfloat16> W = halfprecision::convert<bfloat16>(random_matrix(10, 20, 1));
+			Assert::AreEqual(miniflow::memory_tracker.live(), live + 10 * 20 * sizeof(bfloat16));
+		}
+		miniflow::memory_tracker.set_enabled(false);
+	}
+
+	TEST_METHOD(TransformTest)
+	{
+		Tensor A = random_matrix(3, 300, 2), B = random_matrix(3, 300, 3);
+		halfprecision::Matrix<float16> C;
+		halfprecision::transform(C, [](float a, float b) { return a + 2 * b; }, A, B);
+		Assert::IsTrue(C.shape() == A.shape());
+		for (Index i = 0; i < 3; i++)
+		{
+			for (Index j = 0; j < 300; j++) Assert::AreEqual(double(C[i][j]), A[i][j] + 2 * B[i][j], 2e-3);
+		}
+		Assert::IsTrue(halfprecision::all_finite(C));
+		C[1][7] = float16(1e6f);
+		Assert::IsFalse(halfprecision::all_finite(C));
+	}
+
+	TEST_METHOD(GemmTest)
+	{
+		// Small blocks, so that the products run over several panels
+		dynamictensor::GemmBlocking const blocking = dynamictensor::gemm_blocking;
+		dynamictensor::gemm_blocking.depth_ = 16;
+		dynamictensor::gemm_blocking.cols_ = 24;
+
+		auto A = halfprecision::convert<bfloat16>(random_matrix(37, 70, 4));
+		auto B = halfprecision::convert<bfloat16>(random_matrix(70, 45, 5));
+		auto G = halfprecision::convert<bfloat16>(random_matrix(37, 45, 6));
+		halfprecision::Matrix<float> C({ 37, 45 }), D({ 37, 70 }), E({ 70, 45 });
+		halfprecision::gemm(A, B, C);
+		halfprecision::gemm_nt(G, B, D);
+		halfprecision::gemm_tn(A, G, E);
+		Tensor const expected_C = reference(A, B);
+		Tensor const expected_D = reference(G, transpose(B));
+		Tensor const expected_E = reference(transpose(A), G);
+		for (Index i = 0; i < 37; i++)
+		{
+			for (Index j = 0; j < 45; j++) Assert::AreEqual(double(C[i][j]), expected_C[i][j], 1e-4);
+			for (Index j = 0; j < 70; j++) Assert::AreEqual(double(D[i][j]), expected_D[i][j], 1e-4);
+		}
+		for (Index i = 0; i < 70; i++)
+		{
+			for (Index j = 0; j < 45; j++) Assert::AreEqual(double(E[i][j]), expected_E[i][j], 1e-4);
+		}
+
+		auto F = halfprecision::convert<float16>(random_matrix(5, 33, 7));
+		auto H = halfprecision::convert<float16>(random_matrix(33, 9, 8));
+		halfprecision::Matrix<float> product = halfprecision::dot(F, H);
+		Tensor const expected = reference(F, H);
+		for (Index i = 0; i < 5; i++)
+		{
+			for (Index j = 0; j < 9; j++) Assert::AreEqual(double(product[i][j]), expected[i][j], 1e-4);
+		}
+		dynamictensor::gemm_blocking = blocking;
+	}
+
+	TEST_METHOD(MixedTrainingTest)
+	{
+		Tensor const X_value = random_matrix(16, 8, 9), W_value = random_matrix(8, 4, 10);
+		Tensor const Y_value = dot(X_value, random_matrix(8, 4, 11));
+
+		miniflow::Input<Tensor> X(X_value), Y(Y_value);
+		miniflow::Trainable<Tensor> W(W_value), b(Tensor(Shape{ 1, 4 }, 0.));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::MSE<Tensor> cost(Y, L);
+		miniflow::Graph graph(cost);
+
+		miniflow::Input<Tensor> X_half(X_value), Y_half(Y_value);
+		miniflow::MixedTrainable<Tensor, float16> W_half(W_value);
+		miniflow::Trainable<Tensor> b_half(Tensor(Shape{ 1, 4 }, 0.));
+		halfprecision::LossScale loss_scale;
+		miniflow::HalfLinear<Tensor, float16> L_half(X_half, W_half, b_half, &loss_scale);
+		miniflow::MSE<Tensor> cost_half(Y_half, L_half);
+		miniflow::Graph graph_half(cost_half);
+
+		// The first scale overflows float16, the step is skipped and the scale halved
+		loss_scale.scale_ = 1 << 20;
+		Assert::IsFalse(miniflow::mixed_SGD_step(graph_half, 0.1, loss_scale));
+		Assert::AreEqual(loss_scale.scale_, double(1 << 19));
+		Assert::AreEqual(W_half.getValue()[0][0], W_value[0][0]);
+
+		int skipped = 0;
+		for (int step = 0; step < 200; step++)
+		{
+			graph.SGD_step(0.1);
+			if (!miniflow::mixed_SGD_step(graph_half, 0.1, loss_scale)) skipped++;
+		}
+		Assert::IsTrue(skipped < 10);
+		Assert::IsTrue(cost_half.getValue()[0][0] < 0.05);
+		Assert::AreEqual(cost_half.getValue()[0][0], cost.getValue()[0][0], 1e-3);
+		// The master copy is updated in double, the half copy follows it
+		for (Index k = 0; k < 8; k++)
+		{
+			for (Index j = 0; j < 4; j++)
+			{
+				Assert::AreEqual(W_half.getValue()[k][j], W.getValue()[k][j], 1e-2);
+				Assert::AreEqual(double(W_half.getHalfValue()[k][j]), double(float16(float(W_half.getValue()[k][j]))));
+			}
+		}
+	}
+
+	TEST_METHOD(LossScaleTest)
+	{
+		// Gradients below the smallest float16 are lost without a scale
+		Tensor const X_value(Shape{ 2, 3 }, 1.), Y_value(Shape{ 2, 2 }, 1e-8);
+		miniflow::Input<Tensor> X(X_value), Y(Y_value), X_unscaled(X_value), Y_unscaled(Y_value);
+		miniflow::MixedTrainable<Tensor, float16> W(Tensor(Shape{ 3, 2 }, 0.)), W_unscaled(Tensor(Shape{ 3, 2 }, 0.));
+		miniflow::Trainable<Tensor> b(Tensor(Shape{ 1, 2 }, 0.)), b_unscaled(Tensor(Shape{ 1, 2 }, 0.));
+		halfprecision::LossScale loss_scale;
+		miniflow::HalfLinear<Tensor, float16> L(X, W, b, &loss_scale), unscaled(X_unscaled, W_unscaled, b_unscaled);
+		miniflow::MSE<Tensor> cost(Y, L), unscaled_cost(Y_unscaled, unscaled);
+		miniflow::Graph graph(cost), unscaled_graph(unscaled_cost);
+
+		graph.forward();
+		graph.backward();
+		unscaled_graph.forward();
+		unscaled_graph.backward();
+		// dcost/dL = -2 / 4 * 1e-8 per value, dW sums the 2 rows
+		Assert::AreEqual(L.getGradient()[1][0][0], -1e-8, 1e-10);
+		Assert::AreEqual(unscaled.getGradient()[1][0][0], 0.);
+		Assert::IsTrue(loss_scale.end_step());
+
+		loss_scale.growth_interval_ = 1;
+		loss_scale.end_step();
+		Assert::AreEqual(loss_scale.scale_, 65536. * 2);
+	}
+};
+
+TEST_CLASS(NormalizationTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Index = miniflow::Index;
+
+public:
+
+	TEST_METHOD(AffineTest)
+	{
+		miniflow::Input<Tensor> X(matrix(4, 3, 0)), Y(matrix(4, 3, 1));
+		miniflow::Trainable<Tensor> gamma(matrix(1, 3, 2)), beta(matrix(1, 3, 3));
+		miniflow::Affine<Tensor> A(X, gamma, beta);
+		miniflow::MSE<Tensor> cost(Y, A);
+		miniflow::Graph graph(cost);
+		graph.forward();
+		Assert::AreEqual(A.getValue()[2][1], X.getValue()[2][1] * gamma.getValue()[0][1] + beta.getValue()[0][1], 1e-15);
+
+		graph.backward();
+		for (miniflow::Input<Tensor>* input : std::vector<miniflow::Input<Tensor>*>{ &X, &gamma, &beta }) check_gradient(graph, cost, *input);
+	}
+
+	TEST_METHOD(BatchNormTest)
+	{
+		miniflow::Input<Tensor> X(matrix(5, 3, 0)), Y(matrix(5, 3, 1));
+		miniflow::Trainable<Tensor> gamma(Tensor(dynamictensor::Shape<2>{ 1, 3 }, 1.)), beta(Tensor(dynamictensor::Shape<2>{ 1, 3 }, 0.));
+		miniflow::BatchNorm<Tensor> N(X, gamma, beta, 0.5);
+		miniflow::MSE<Tensor> cost(Y, N);
+		miniflow::Graph graph(cost);
+
+		// Every feature of the batch has mean 0 and variance 1
+		graph.forward();
+		for (Index j = 0; j < 3; j++)
+		{
+			double sum = 0, squares = 0;
+			for (Index i = 0; i < 5; i++)
+			{
+				sum += N.getValue()[i][j];
+				squares += N.getValue()[i][j] * N.getValue()[i][j];
+			}
+			Assert::AreEqual(sum, 0., 1e-12);
+			Assert::AreEqual(squares / 5, 1., 1e-4);
+		}
+		// Running averages move halfway to the batch statistics, with an unbiased variance
+		double mean = 0, variance = 0;
+		for (Index i = 0; i < 5; i++) mean += X.getValue()[i][0] / 5;
+		for (Index i = 0; i < 5; i++) variance += (X.getValue()[i][0] - mean) * (X.getValue()[i][0] - mean) / 4;
+		Assert::AreEqual(N.running_mean()[0][0], mean / 2, 1e-15);
+		Assert::AreEqual(N.running_variance()[0][0], (1 + variance) / 2, 1e-15);
+
+		gamma.setValue(matrix(1, 3, 2));
+		beta.setValue(matrix(1, 3, 3));
+		graph.forward();
+		graph.backward();
+		for (miniflow::Input<Tensor>* input : std::vector<miniflow::Input<Tensor>*>{ &X, &gamma, &beta }) check_gradient(graph, cost, *input);
+
+		// In inference mode the node is the affine transform of its running averages
+		N.set_training(false);
+		graph.forward();
+		auto const [scale, shift] = N.inference_affine();
+		Assert::AreEqual(N.getValue()[3][2], X.getValue()[3][2] * scale[0][2] + shift[0][2], 1e-12);
+		graph.backward();
+		for (miniflow::Input<Tensor>* input : std::vector<miniflow::Input<Tensor>*>{ &X, &gamma, &beta }) check_gradient(graph, cost, *input);
+	}
+};
+
+TEST_CLASS(FoldTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+	using Index = miniflow::Index;
+
+public:
+
+	TEST_METHOD(FoldingTest)
+	{
+		miniflow::Input<Tensor> X(matrix(6, 4, 0)), C(matrix(1, 3, 1));
+		miniflow::Trainable<Tensor> W1(matrix(4, 5, 2)), b1(matrix(1, 5, 3)), gamma(matrix(1, 5, 4)), beta(matrix(1, 5, 5));
+		miniflow::Trainable<Tensor> W2(matrix(5, 3, 6)), scale(matrix(1, 3, 7)), shift(matrix(1, 3, 8));
+		miniflow::Linear<Tensor> L1(X, W1, b1);
+		miniflow::BatchNorm<Tensor> N(L1, gamma, beta);
+		miniflow::ReLU<Tensor> R(N);
+		miniflow::Identity<Tensor> I(R);
+		// The bias of L2 depends on constants only
+		miniflow::Sigmoid<Tensor> b2(C);
+		miniflow::Linear<Tensor> L2(I, W2, b2);
+		miniflow::Affine<Tensor> A(L2, scale, shift);
+		miniflow::Graph graph(A);
+
+		// Running averages of a few batches
+		for (int batch = 0; batch < 4; batch++)
+		{
+			X.setValue(matrix(6, 4, batch));
+			graph.forward();
+		}
+		N.set_training(false);
+
+		miniflow::FoldedNetwork<Tensor> folded(A, { &X });
+		miniflow::FoldReport const& report = folded.report();
+		Assert::AreEqual(report.constants_, size_t(1));
+		Assert::AreEqual(report.affines_, size_t(2));
+		Assert::AreEqual(report.identities_, size_t(1));
+		Assert::AreEqual(report.nodes_before_, size_t(16));
+		// X, W and b of both Linear nodes, and the Linear nodes and the ReLU
+		Assert::AreEqual(report.nodes_after_, size_t(8));
+		Assert::AreEqual(folded.validate(), 0., 1e-12);
+
+		// Inputs are set on the original input nodes
+		X.setValue(matrix(3, 4, 10));
+		Assert::AreEqual(folded.validate(), 0., 1e-12);
+		Assert::AreEqual(folded.evaluate().shape()[0], Index(3));
+	}
+
+	TEST_METHOD(SharedValueTest)
+	{
+		// L is read by A and by L2, so A cannot change it
+		miniflow::Input<Tensor> X(matrix(3, 4, 0));
+		miniflow::Trainable<Tensor> W(matrix(4, 4, 1)), b(matrix(1, 4, 2)), scale(matrix(1, 4, 3)), shift(matrix(1, 4, 4));
+		miniflow::Trainable<Tensor> W2(matrix(4, 4, 5)), one(Tensor(Shape{ 1, 4 }, 1.)), zero(Tensor(Shape{ 1, 4 }, 0.));
+		miniflow::Linear<Tensor> L(X, W, b);
+		miniflow::Identity<Tensor> I(L);
+		miniflow::Affine<Tensor> A(I, scale, shift);
+		miniflow::Linear<Tensor> L2(L, W2, A);
+		miniflow::Tanh<Tensor> T(L2);
+		miniflow::Affine<Tensor> unit(T, one, zero);
+
+		miniflow::FoldedNetwork<Tensor> folded(unit, { &X });
+		Assert::AreEqual(folded.report().affines_, size_t(0));
+		Assert::AreEqual(folded.report().identities_, size_t(2));
+		Assert::AreEqual(folded.validate(), 0., 1e-12);
+
+		miniflow::BatchNorm<Tensor> N(X, scale, shift);
+		Assert::ExpectException<std::runtime_error>([&] { miniflow::FoldedNetwork<Tensor> training(N, { &X }); });
+	}
+};
+
+TEST_CLASS(PruningTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+	using Index = miniflow::Index;
+
+	static double block_rms(Tensor const& W, miniflow::BlockMask const& mask, Index kb, Index jb)
+	{
+		double squares = 0;
+		for (Index k = mask.row_begin(kb); k < mask.row_end(kb); k++)
+		{
+			for (Index j = mask.col_begin(jb); j < mask.col_end(jb); j++) squares += W[k][j] * W[k][j];
+		}
+		return std::sqrt(squares / ((mask.row_end(kb) - mask.row_begin(kb)) * (mask.col_end(jb) - mask.col_begin(jb))));
+	}
+
+public:
+
+	TEST_METHOD(MagnitudeTest)
+	{
+		// 3 x 3 blocks, the last block column a single column wide
+		Tensor const original = matrix(6, 5, 0);
+		miniflow::Trainable<Tensor> W(original);
+		miniflow::BlockMask const mask = miniflow::prune(W, { 2, 2, 0.5 });
+		Assert::AreEqual(mask.block_row_count(), Index(3));
+		Assert::AreEqual(mask.block_col_count(), Index(3));
+
+		double largest_pruned = 0, smallest_kept = 1e300;
+		std::size_t kept_blocks = 0, zeros = 0;
+		for (Index kb = 0; kb < 3; kb++)
+		{
+			for (Index jb = 0; jb < 3; jb++)
+			{
+				double const rms = block_rms(original, mask, kb, jb);
+				if (mask.kept(kb, jb))
+				{
+					kept_blocks++;
+					smallest_kept = std::min(smallest_kept, rms);
+				}
+				else largest_pruned = std::max(largest_pruned, rms);
+			}
+		}
+		for (Index k = 0; k < 6; k++)
+		{
+			for (Index j = 0; j < 5; j++)
+			{
+				bool const kept = mask.kept(k / 2, j / 2);
+				Assert::AreEqual(W.getValue()[k][j], kept ? original[k][j] : 0.);
+				zeros += !kept;
+			}
+		}
+		// Half of the 9 blocks, rounded up
+		Assert::AreEqual(kept_blocks, std::size_t(4));
+		Assert::IsTrue(largest_pruned <= smallest_kept);
+		Assert::AreEqual(mask.sparsity(), zeros / 30., 1e-15);
+		Assert::AreEqual(mask.kept_values() + zeros, std::size_t(30));
+
+		// Empty blocks are rejected, an empty matrix has no sparsity
+		Assert::ExpectException<std::runtime_error>([] { miniflow::BlockMask(6, 5, 0, 2); });
+		Assert::AreEqual(miniflow::BlockMask(0, 5, 2, 2).sparsity(), 0.);
+	}
+
+	TEST_METHOD(SparseLinearTest)
+	{
+		// 40 rows on 2 threads, blocks of 3 x 4 with partial last blocks
+		dynamictensor::GemmBlocking const blocking = dynamictensor::gemm_blocking;
+		dynamictensor::gemm_blocking.threads_ = 2;
+		miniflow::Input<Tensor> X(matrix(40, 10, 0));
+		miniflow::Trainable<Tensor> W(matrix(10, 9, 1)), b(matrix(1, 9, 2));
+		miniflow::BlockMask const mask = miniflow::prune(W, { 3, 4, 0.6 });
+		miniflow::BlockSparseLinear<Tensor> S(X, W, b, mask);
+		// The dense graph has its own nodes, an input sums the gradients of all its consumers
+		miniflow::Input<Tensor> dense_X(X.getValue());
+		miniflow::Trainable<Tensor> dense_W(W.getValue()), dense_b(b.getValue());
+		miniflow::Linear<Tensor> L(dense_X, dense_W, dense_b);
+		miniflow::Sigmoid<Tensor> sparse_output(S), dense_output(L);
+		miniflow::Input<Tensor> Y(matrix(40, 9, 3)), dense_Y(Y.getValue());
+		miniflow::MSE<Tensor> sparse_cost(Y, sparse_output), dense_cost(dense_Y, dense_output);
+		miniflow::Graph sparse(sparse_cost), dense(dense_cost);
+
+		// Same values and gradients as the dense Linear node on the pruned W
+		sparse.forward();
+		dense.forward();
+		sparse.backward();
+		dense.backward();
+		for (Index i = 0; i < 40; i++)
+		{
+			for (Index j = 0; j < 9; j++) Assert::AreEqual(S.getValue()[i][j], L.getValue()[i][j], 1e-12);
+		}
+		for (Index k = 0; k < 10; k++)
+		{
+			for (Index j = 0; j < 9; j++)
+			{
+				double const expected = mask.kept(k / 3, j / 4) ? L.getGradient()[1][k][j] : 0.;
+				Assert::AreEqual(S.getGradient()[1][k][j], expected, 1e-12);
+			}
+		}
+		for (Index i = 0; i < 40; i++)
+		{
+			for (Index k = 0; k < 10; k++) Assert::AreEqual(S.getGradient()[0][i][k], L.getGradient()[0][i][k], 1e-12);
+		}
+		Assert::AreEqual(S.getGradient()[2][0][5], L.getGradient()[2][0][5], 1e-12);
+		Assert::AreEqual(S.flops(), 2 * 40 * mask.kept_values() + 40 * 9);
+		dynamictensor::gemm_blocking = blocking;
+
+		// Fine-tuning keeps the pruned blocks at zero and lowers the cost
+		miniflow::Input<Tensor> tuned_X(X.getValue()), tuned_Y(Y.getValue());
+		miniflow::Trainable<Tensor> tuned_W(W.getValue()), tuned_b(b.getValue());
+		miniflow::BlockSparseLinear<Tensor> tuned(tuned_X, tuned_W, tuned_b, mask);
+		miniflow::Sigmoid<Tensor> tuned_output(tuned);
+		miniflow::MSE<Tensor> tuned_cost(tuned_Y, tuned_output);
+		miniflow::Graph graph(tuned_cost);
+		graph.forward();
+		double const initial = tuned_cost.getValue()[0][0];
+		graph.SGD(0.5, 20);
+		graph.forward();
+		Assert::IsTrue(tuned_cost.getValue()[0][0] < initial);
+		for (Index k = 0; k < 10; k++)
+		{
+			for (Index j = 0; j < 9; j++)
+			{
+				if (!mask.kept(k / 3, j / 4)) Assert::AreEqual(tuned_W.getValue()[k][j], 0.);
+			}
+		}
+	}
+};
+
+TEST_CLASS(PipelineTest)
+{
+	using Tensor = dynamictensor::Tensor<double, 2>;
+	using Shape = dynamictensor::Shape<2>;
+	using Index = miniflow::Index;
+	using Pipeline = miniflow::Pipeline<Tensor>;
+
+public:
+
+	TEST_METHOD(MicroBatchTest)
+	{
+		// A step of 4 micro-batches on 3 stages is a step on the whole mini-batch
+		Tensor const X = matrix(8, 4, 0), Y = matrix(8, 2, 1);
+		miniflow::Trainable<Tensor> W1(matrix(4, 5, 2)), b1(matrix(1, 5, 3)), W2(matrix(5, 2, 4)), b2(matrix(1, 2, 5));
+		Pipeline::Builder build = [&](miniflow::Node<Tensor>& input, miniflow::Node<Tensor>& labels, Pipeline::Nodes& nodes) -> miniflow::Node<Tensor>&
+		{
+			auto& L1 = nodes.add<miniflow::Linear<Tensor>>(input, W1, b1);
+			auto& S1 = nodes.add<miniflow::Sigmoid<Tensor>>(L1);
+			auto& L2 = nodes.add<miniflow::Linear<Tensor>>(S1, W2, b2);
+			return nodes.add<miniflow::MSE<Tensor>>(labels, L2);
+		};
+		miniflow::PipelineOptions options;
+		options.stages_ = 3;
+		options.micro_batches_ = 4;
+
+		miniflow::Input<Tensor> input(X), labels(Y);
+		miniflow::Trainable<Tensor> V1(W1.getValue()), c1(b1.getValue()), V2(W2.getValue()), c2(b2.getValue());
+		miniflow::Linear<Tensor> L1(input, V1, c1);
+		miniflow::Sigmoid<Tensor> S1(L1);
+		miniflow::Linear<Tensor> L2(S1, V2, c2);
+		miniflow::MSE<Tensor> cost(labels, L2);
+		miniflow::Graph graph(cost);
+
+		{
+			Pipeline pipeline(build, options);
+			for (int step = 0; step < 3; step++)
+			{
+				graph.forward();
+				double const expected = cost.getValue()[0][0];
+				Assert::AreEqual(pipeline.step(X, Y, 0.5), expected, 1e-12);
+				graph.SGD_step(0.5);
+			}
+
+			// Linear, Sigmoid, Linear and MSE in 3 stages
+			miniflow::PipelineReport const& report = pipeline.report();
+			Assert::AreEqual(report.steps_, std::size_t(3));
+			Assert::AreEqual(report.stage_nodes_.size(), std::size_t(3));
+			Assert::AreEqual(report.stage_nodes_[0] + report.stage_nodes_[1] + report.stage_nodes_[2], std::size_t(4));
+			Assert::AreEqual(std::string(pipeline.stages(3)[2].back()->type()), std::string("MSE"));
+			Assert::IsTrue(report.bubble() >= 0 && report.bubble() < 1);
+			for (std::size_t s = 0; s < 3; s++) Assert::IsTrue(report.idle_seconds(s) >= 0);
+
+			Assert::ExpectException<std::runtime_error>([&] { pipeline.step(matrix(3, 4, 0), matrix(3, 2, 1), 0.5); });
+		}
+		for (Index k = 0; k < 4; k++)
+		{
+			for (Index j = 0; j < 5; j++) Assert::AreEqual(W1.getValue()[k][j], V1.getValue()[k][j], 1e-12);
+		}
+		for (Index k = 0; k < 5; k++)
+		{
+			for (Index j = 0; j < 2; j++) Assert::AreEqual(W2.getValue()[k][j], V2.getValue()[k][j], 1e-12);
+		}
+		Assert::AreEqual(b1.getValue()[0][3], c1.getValue()[0][3], 1e-12);
+	}
 };